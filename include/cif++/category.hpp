@@ -35,6 +35,8 @@
 #include "cif++/validate.hpp"
 
 #include <array>
+#include <atomic>
+#include <mutex>
 
 /** \file category.hpp
  * Documentation for the cif::category class
@@ -90,6 +92,28 @@ class missing_key_error : public std::runtime_error
 	std::string m_key;
 };
 
+/// @brief A bulk_insert_error is thrown by category::bulk_insert when
+/// one or more of the rows could not be inserted. It contains a description
+/// of each of the problems found.
+class bulk_insert_error : public std::runtime_error
+{
+  public:
+	/**
+	 * @brief Construct a new bulk insert error object for category @a cat
+	 */
+	bulk_insert_error(const std::string &cat, std::vector<std::string> errors)
+		: std::runtime_error("Could not insert rows in category " + cat + ", " + std::to_string(errors.size()) + " errors, first: " + errors.front())
+		, m_errors(std::move(errors))
+	{
+	}
+
+	/// @brief The descriptions of all errors
+	const std::vector<std::string> &errors() const noexcept { return m_errors; }
+
+  private:
+	std::vector<std::string> m_errors;
+};
+
 /// @brief A multiple_results_error is throw when you request a single
 /// row using a query but the query contains more than exactly one row.
 class multiple_results_error : public std::runtime_error
@@ -116,12 +140,106 @@ inline constexpr bool is_optional_v<std::optional<_Tp>> = true;
 
 // --------------------------------------------------------------------
 
+/// The type of index a category uses to look up rows by key and to
+/// keep the key values unique.
+
+enum class index_type
+{
+	tree, ///< A balanced tree, keeping the rows ordered by key
+	hash  ///< A hash table, faster for large categories but not ordered
+};
+
+// --------------------------------------------------------------------
+
+namespace detail
+{
+	/// The change journal of a datablock, see datablock::begin_transaction.
+	/// While a transaction is active, the categories of the datablock record
+	/// the rows they insert and erase and the values they update, so that
+	/// these changes can be undone. Erased rows are kept until the outermost
+	/// transaction is committed.
+	class journal
+	{
+	  public:
+		/** @cond */
+		journal() = default;
+		journal(const journal &) = delete;
+		journal &operator=(const journal &) = delete;
+		/** @endcond */
+
+		bool active() const { return not m_marks.empty(); }
+
+		void begin(datablock &db);
+		void commit(datablock &db);
+		void rollback(datablock &db);
+
+		// Recording changes, called by category. The record functions
+		// do nothing while changes are being undone.
+
+		void record_create(category &cat);
+
+		void record_insert(category *cat, row *r, row *prev);
+
+		// Returns true if the journal keeps row @a r
+		bool record_erase(category *cat, row *r, row *prev);
+
+		void record_update(category *cat, row *r, uint16_t item_ix, std::string_view old_value);
+		void record_swap(category *cat, uint16_t item_ix, row *a, row *b);
+		void record_reorder(category *cat, std::vector<row *> &&order);
+
+		// Drop the changes recorded for @a cat, which is about to be destroyed
+		void forget(category *cat);
+
+	  private:
+		enum class change_kind
+		{
+			create,
+			insert,
+			erase,
+			update,
+			swap,
+			reorder
+		};
+
+		struct change
+		{
+			change_kind m_kind;
+			category *m_category;
+			row *m_row = nullptr;
+			row *m_other = nullptr; // the previous row for insert and erase, the other row for swap
+			uint16_t m_item_ix = 0;
+			std::string m_value;
+			std::vector<row *> m_order;
+		};
+
+		// Detach the categories of @a db from this journal
+		void detach(datablock &db);
+
+		std::vector<change> m_changes;
+		std::vector<std::size_t> m_marks; // the number of changes at the start of each transaction
+		bool m_undoing = false;
+	};
+} // namespace detail
+
+// --------------------------------------------------------------------
+
 /// The class category is a sequence container for rows of data values.
 /// You could think of it as a std::vector<cif::row_handle> like class.
 ///
 /// A @ref category_validator can be assigned to an object of category
 /// after which this class can validate contained data and use an
 /// index to keep key values unique.
+///
+/// Copying a category does not copy the rows, the copy shares them with
+/// the original. The original keeps its rows, row handles and iterators
+/// obtained from it remain valid. When the original is modified, it
+/// first gives the copies a clone of the rows. A copy clones the rows
+/// when they are accessed for the first time, reading the size of a copy
+/// or destroying it does not clone anything.
+///
+/// Different categories may be used by different threads, even when
+/// they share rows, and a category may be read and copied by several
+/// threads at the same time.
 
 class category
 {
@@ -129,6 +247,8 @@ class category
 	/// \cond
 
 	friend class row_handle;
+	friend class condition;
+	friend class detail::journal;
 
 	template <typename, typename...>
 	friend class iterator_impl;
@@ -143,7 +263,7 @@ class category
 
 	category() = default;            ///< Default constructor
 	category(std::string_view name); ///< Constructor taking a \a name
-	category(const category &rhs);   ///< Copy constructor
+	category(const category &rhs);   ///< Copy constructor, the rows are shared with @a rhs until either is modified
 
 	category(category &&rhs) noexcept ///< Move constructor
 	{
@@ -166,6 +286,7 @@ class category
 	// --------------------------------------------------------------------
 
 	const std::string &name() const { return m_name; } ///< Returns the name of the category
+	std::size_t name_hash() const { return m_name_hash; } ///< Returns the case insensitive hash of name()
 
 	[[deprecated("use key_items instead")]] iset key_fields() const; ///< Returns the cif::iset of key item names. Retrieved from the @ref category_validator for this category
 
@@ -192,6 +313,28 @@ class category
 	/// @return The @ref category_validator or nullptr if not assigned
 	const category_validator *get_cat_validator() const { return m_cat_validator; }
 
+	/// @brief Set the type of index used for the key items to @a type,
+	/// an existing index is rebuilt using the new type
+	void set_index_type(index_type type);
+
+	/// @brief Return the type of index used for the key items
+	index_type get_index_type() const { return m_index_type; }
+
+	/// @brief Create a secondary index on the items named @a items
+	///
+	/// Conditions testing for equality on each of these items, e.g.
+	/// key("label_asym_id") == "A" and key("label_seq_id") == 1 for an
+	/// index on label_asym_id and label_seq_id, use the index to find the
+	/// matching rows instead of testing each row in the category.
+	/// @param items The names of the items in the index
+	void create_index(const std::vector<std::string> &items);
+
+	/// @brief Return the estimated fraction of the rows that share a value
+	/// for the item with index @a item_ix. This is 1/n for a key consisting
+	/// of only this item, otherwise it is derived from the number of distinct
+	/// values in a secondary index on this item, if there is one.
+	double equality_selectivity(uint16_t item_ix) const;
+
 	/// @brief Validate the data stored using the assigned @ref category_validator
 	/// @return Returns true is all validations pass
 	bool is_valid() const;
@@ -229,6 +372,7 @@ class category
 	/// the category is empty.
 	reference front()
 	{
+		acquire_rows();
 		return { *this, *m_head };
 	}
 
@@ -237,6 +381,7 @@ class category
 	/// the category is empty.
 	const_reference front() const
 	{
+		acquire_rows();
 		return { const_cast<category &>(*this), const_cast<row &>(*m_head) };
 	}
 
@@ -245,6 +390,7 @@ class category
 	/// the category is empty.
 	reference back()
 	{
+		acquire_rows();
 		return { *this, *m_tail };
 	}
 
@@ -253,12 +399,14 @@ class category
 	/// the category is empty.
 	const_reference back() const
 	{
+		acquire_rows();
 		return { const_cast<category &>(*this), const_cast<row &>(*m_tail) };
 	}
 
 	/// Return an iterator to the first row
 	iterator begin()
 	{
+		acquire_rows();
 		return { *this, m_head };
 	}
 
@@ -271,6 +419,7 @@ class category
 	/// Return a const iterator to the first row
 	const_iterator begin() const
 	{
+		acquire_rows();
 		return { *this, m_head };
 	}
 
@@ -283,6 +432,7 @@ class category
 	/// Return a const iterator to the first row
 	const_iterator cbegin() const
 	{
+		acquire_rows();
 		return { *this, m_head };
 	}
 
@@ -295,7 +445,7 @@ class category
 	/// Return a count of the rows in this container
 	std::size_t size() const
 	{
-		return std::distance(cbegin(), cend());
+		return m_row_count;
 	}
 
 	/// Return the theoretical maximum number or rows that can be stored
@@ -307,7 +457,7 @@ class category
 	/// Return true if the category is empty
 	bool empty() const
 	{
-		return m_head == nullptr;
+		return m_row_count == 0;
 	}
 
 	// --------------------------------------------------------------------
@@ -324,11 +474,33 @@ class category
 	/// @brief Return a const row_handle for the row specified by \a key
 	/// @param key The value for the key, items specified in the dictionary should have a value
 	/// @return The row found in the index, or an undefined row_handle
-	const row_handle operator[](const key_type &key) const
+	const row_handle operator[](const key_type &key) const;
+
+	/// @brief Return a row_handle for the row at position \a ix
+	///
+	/// The first call after rows were added, removed or reordered builds
+	/// a directory of the rows, subsequent calls take constant time.
+	/// The const version may be called by several threads at the same time.
+	/// @param ix The position of the row, should be less than size()
+	/// @return The row at position \a ix
+	row_handle operator[](std::size_t ix)
 	{
-		return const_cast<category *>(this)->operator[](key);
+		build_directory();
+		return { *this, *m_directory.at(ix) };
 	}
 
+	/// @brief Return a const row_handle for the row at position \a ix
+	/// @param ix The position of the row, should be less than size()
+	/// @return The row at position \a ix
+	const row_handle operator[](std::size_t ix) const
+	{
+		build_directory();
+		return { *this, *m_directory.at(ix) };
+	}
+
+	/// @brief Make sure the directory of rows used by operator[](std::size_t) is up to date
+	void build_directory() const;
+
 	// --------------------------------------------------------------------
 
 	/// @brief Return a special const iterator for all rows in this category.
@@ -812,16 +984,16 @@ class category
 
 			if (sh.has_value() and *sh)
 				result = true;
+			else if (auto candidates = cond.candidates(); candidates != nullptr)
+			{
+				std::vector<row *> rows(*candidates);
+				result = cond.filter(rows.data(), rows.size()) > 0;
+			}
 			else
 			{
-				for (auto r : *this)
-				{
-					if (cond(r))
-					{
-						result = true;
-						break;
-					}
-				}
+				row *batch[condition::kBatchSize];
+				for (auto r = m_head; r != nullptr and not result;)
+					result = cond.filter(batch, fill_batch(r, batch)) > 0;
 			}
 		}
 
@@ -843,19 +1015,59 @@ class category
 
 			if (sh.has_value() and *sh)
 				result = 1;
+			else if (auto candidates = cond.candidates(); candidates != nullptr)
+			{
+				std::vector<row *> rows(*candidates);
+				result = cond.filter(rows.data(), rows.size());
+			}
 			else
 			{
-				for (auto r : *this)
-				{
-					if (cond(r))
-						++result;
-				}
+				row *batch[condition::kBatchSize];
+				for (auto r = m_head; r != nullptr;)
+					result += cond.filter(batch, fill_batch(r, batch));
 			}
 		}
 
 		return result;
 	}
 
+	// --------------------------------------------------------------------
+	// Parallel versions of find, count, contains and erase. The rows are
+	// divided into ranges that are tested concurrently using @a n_threads
+	// threads, or the number of hardware threads if @a n_threads is zero.
+	// The condition must be safe to evaluate concurrently, which all the
+	// conditions in condition.hpp are. The category should not be modified
+	// while these are running. The const versions may be called by several
+	// threads at the same time, building the directory and the secondary
+	// indices they use is synchronized.
+
+	/// @brief Return the rows that match condition @a cond, in the order
+	/// of the category
+	/// @param cond The condition to match
+	/// @param n_threads The number of threads to use
+	/// @return The rows found
+	std::vector<row_handle> find_parallel(condition &&cond, std::size_t n_threads = 0);
+
+	/// @brief Return the total number of rows that match condition @a cond
+	/// @param cond The condition to match
+	/// @param n_threads The number of threads to use
+	/// @return The count
+	std::size_t count_parallel(condition &&cond, std::size_t n_threads = 0) const;
+
+	/// @brief Return whether a row exists that matches condition @a cond
+	/// @param cond The condition to match
+	/// @param n_threads The number of threads to use
+	/// @return True if a row matches
+	bool contains_parallel(condition &&cond, std::size_t n_threads = 0) const;
+
+	/// @brief Erase all rows that match condition @a cond. The rows to erase
+	/// are found in parallel, erasing them including cascading deletes and
+	/// removing orphans is done on the calling thread.
+	/// @param cond The condition
+	/// @param n_threads The number of threads to use
+	/// @return The number of rows that have been erased
+	std::size_t erase_parallel(condition &&cond, std::size_t n_threads = 0);
+
 	// --------------------------------------------------------------------
 
 	/// Using the relations defined in the validator, return whether the row
@@ -934,7 +1146,7 @@ class category
 			for (auto i = b; i != e; ++i)
 			{
 				// item_value *new_item = this->create_item(*i);
-				r->append(add_item(i->name()), { i->value() });
+				r->append(add_item(i->name()), { i->value(), m_strings });
 			}
 		}
 		catch (...)
@@ -947,6 +1159,45 @@ class category
 		return insert_impl(cend(), r);
 	}
 
+	/// @brief Append the rows in @a rows, a range of row_initializer objects,
+	/// at the end of this category.
+	///
+	/// Unlike calling emplace for each row, validation is deferred until all
+	/// rows have been created. The values are then validated using @a n_threads
+	/// threads, or the number of hardware threads if @a n_threads is zero. The
+	/// new rows are added to the key index at once, after sorting them by key.
+	///
+	/// All problems found, invalid values, missing mandatory items and duplicate
+	/// keys, are reported together in a bulk_insert_error. In that case none of
+	/// the rows is inserted.
+	///
+	/// @param rows The rows to insert
+	/// @param n_threads The number of threads to use for validation
+	template <typename Range>
+	void bulk_insert(Range &&rows, std::size_t n_threads = 0)
+	{
+		std::vector<row *> new_rows;
+
+		try
+		{
+			for (const row_initializer &ri : rows)
+			{
+				new_rows.push_back(this->create_row());
+
+				for (auto &i : ri)
+					new_rows.back()->append(add_item(i.name()), { i.value(), m_strings });
+			}
+		}
+		catch (...)
+		{
+			for (auto r : new_rows)
+				this->delete_row(r);
+			throw;
+		}
+
+		bulk_insert_rows(std::move(new_rows), n_threads);
+	}
+
 	/// @brief Completely erase all rows contained in this category
 	void clear();
 
@@ -1081,13 +1332,7 @@ class category
 
 	uint16_t get_item_ix(std::string_view item_name) const
 	{
-		uint16_t result;
-
-		for (result = 0; result < m_items.size(); ++result)
-		{
-			if (iequals(item_name, m_items[result].m_name))
-				break;
-		}
+		uint16_t result = find_item_ix(item_name, ihash(item_name));
 
 		if (VERBOSE > 0 and result == m_items.size() and m_cat_validator != nullptr) // validate the name, if it is known at all (since it was not found)
 		{
@@ -1099,6 +1344,12 @@ class category
 		return result;
 	}
 
+	/// \brief Return the index number for the item with precomputed key \a key
+	uint16_t get_item_ix(const item_key &key) const
+	{
+		return find_item_ix(key.name(), key.hash());
+	}
+
 	/// @brief Return the name for item with index @a ix
 	/// @param ix The index number
 	/// @return The name of the item
@@ -1115,25 +1366,13 @@ class category
 	/// @return The index number of the item
 	uint16_t add_item(std::string_view item_name)
 	{
-		using namespace std::literals;
-
-		uint16_t result = get_item_ix(item_name);
-
-		if (result == m_items.size())
-		{
-			const item_validator *item_validator = nullptr;
-
-			if (m_cat_validator != nullptr)
-			{
-				item_validator = m_cat_validator->get_validator_for_item(item_name);
-				if (item_validator == nullptr)
-					m_validator->report_error(validation_error::item_not_allowed_in_category, m_name, item_name, false);
-			}
-
-			m_items.emplace_back(item_name, item_validator);
-		}
+		return add_item(item_name, ihash(item_name));
+	}
 
-		return result;
+	/// @brief Make sure the item with precomputed key @a key is known and return its index number
+	uint16_t add_item(const item_key &key)
+	{
+		return add_item(key.name(), key.hash());
 	}
 
 	/** @brief Remove item name @a colum_name
@@ -1152,6 +1391,12 @@ class category
 		return get_item_ix(name) < m_items.size();
 	}
 
+	/// @brief Return whether the item with precomputed key @a key exists in this category
+	bool has_item(const item_key &key) const
+	{
+		return get_item_ix(key) < m_items.size();
+	}
+
 	/// @brief Return the cif::iset of items in this category
 	iset get_items() const;
 
@@ -1164,7 +1409,7 @@ class category
 	void sort(std::function<int(row_handle, row_handle)> f);
 
 	/// @brief Reorder the rows in the category using the index defined by
-	/// the @ref category_validator
+	/// the @ref category_validator, i.e. sort the rows by key
 	void reorder_by_index();
 
 	// --------------------------------------------------------------------
@@ -1191,6 +1436,14 @@ class category
 	/// @param addMissingItems When false, empty items are suppressed from the output
 	void write(std::ostream &os, const std::vector<std::string> &order, bool addMissingItems = true);
 
+	/// @brief Write the contents of the category to @a os in the native binary format
+	void save_binary(std::ostream &os) const;
+
+	/// @brief Replace the contents of the category, including its name, with the
+	/// data written by save_binary read from @a is. The resulting category has no
+	/// validator and no links, use set_validator to attach one and rebuild them.
+	void load_binary(std::istream &is);
+
   private:
 	void write(std::ostream &os, const std::vector<uint16_t> &order, bool includeEmptyItems) const;
 
@@ -1223,38 +1476,137 @@ class category
 	using row_allocator_type = typename std::allocator_traits<allocator_type>::template rebind_alloc<row>;
 	using row_allocator_traits = std::allocator_traits<row_allocator_type>;
 
-	row_allocator_traits::pointer get_row()
+	// Rows are not allocated one by one, they are taken from blocks
+	// of storage owned by the category. This keeps the rows of a
+	// category close together in memory and saves an allocation
+	// for each row.
+	class row_pool
 	{
-		row_allocator_type ra(get_allocator());
-		return row_allocator_traits::allocate(ra, 1);
+	  public:
+		row_pool() = default;
+		row_pool(const row_pool &) = delete;
+		row_pool &operator=(const row_pool &) = delete;
+
+		~row_pool()
+		{
+			release();
+		}
+
+		void swap(row_pool &rhs) noexcept
+		{
+			std::swap(m_blocks, rhs.m_blocks);
+			std::swap(m_free, rhs.m_free);
+			std::swap(m_used, rhs.m_used);
+		}
+
+		bool empty() const
+		{
+			return m_blocks.empty();
+		}
+
+		// Take over the storage of @a rhs, which will be empty afterwards
+		void splice(row_pool &rhs);
+
+		// Return storage for @a n consecutive rows
+		row *allocate(std::size_t n);
+
+		// Return the storage for row @a r for reuse
+		void deallocate(row *r)
+		{
+			m_free.push_back(r);
+		}
+
+		// Release all storage, rows should have been destroyed before
+		void release();
+
+	  private:
+		static constexpr std::size_t kMaxBlockSize = 4096;
+
+		struct block
+		{
+			row *data;
+			std::size_t size;
+		};
+
+		std::vector<block> m_blocks;
+		std::vector<row *> m_free;
+		std::size_t m_used = 0; // The number of rows used in the last block
+	};
+
+	row_allocator_traits::pointer get_row(std::size_t n = 1)
+	{
+		detach_rows();
+		return m_rows.allocate(n);
 	}
 
-	row *create_row()
+	// Construct a new row in the storage at @a p, obtained from get_row
+	row *construct_row(row *p)
 	{
-		auto p = this->get_row();
 		row_allocator_type ra(get_allocator());
 		row_allocator_traits::construct(ra, p);
 		return p;
 	}
 
+	row *create_row()
+	{
+		return construct_row(this->get_row());
+	}
+
 	row *clone_row(const row &r);
 
 	void delete_row(row *r);
 
+	// The parser creates rows in bulk, without validation
+	friend class parser;
+
+	// Reading and writing the native binary format, see binary.cpp,
+	// and BinaryCIF, see bcif.cpp
+	friend class binary_io;
+	friend class bcif_io;
+
+	// Link the rows starting at @a head and ending at @a tail
+	// at the end of this category. No validation takes place and
+	// the index is not updated.
+	void append_rows(row *head, row *tail);
+
 	row_handle create_copy(row_handle r);
 
 	struct item_entry
 	{
 		std::string m_name;
+		std::size_t m_hash;
 		const item_validator *m_validator;
 
-		item_entry(std::string_view name, const item_validator *validator)
+		item_entry(std::string_view name, std::size_t hash, const item_validator *validator)
 			: m_name(name)
+			, m_hash(hash)
 			, m_validator(validator)
 		{
 		}
 	};
 
+	// Item names are looked up in an open addressing hash table, each
+	// slot contains the item index plus one, zero marks an empty slot.
+
+	uint16_t find_item_ix(std::string_view name, std::size_t hash) const
+	{
+		if (not m_item_table.empty())
+		{
+			const std::size_t mask = m_item_table.size() - 1;
+			for (std::size_t i = hash & mask; m_item_table[i] != 0; i = (i + 1) & mask)
+			{
+				auto &item = m_items[m_item_table[i] - 1];
+				if (item.m_hash == hash and iequals(item.m_name, name))
+					return m_item_table[i] - 1;
+			}
+		}
+
+		return static_cast<uint16_t>(m_items.size());
+	}
+
+	uint16_t add_item(std::string_view item_name, std::size_t hash);
+	void rebuild_item_table();
+
 	struct link
 	{
 		link(category *linked, const link_validator *v)
@@ -1281,17 +1633,112 @@ class category
 
 	void swap_item(uint16_t item_ix, row_handle &a, row_handle &b);
 
+	void create_key_index();
+
+	// Return the rows that match @a cond, found using @a n_threads threads.
+	std::vector<row *> find_rows_parallel(condition &cond, std::size_t n_threads) const;
+
+	// Validate the rows in @a rows, add them to the index and append them
+	void bulk_insert_rows(std::vector<row *> &&rows, std::size_t n_threads);
+
+	// Erase the rows for which @a pred returns true
+	template <typename Pred>
+	std::size_t erase_if(Pred &&pred, std::function<void(row_handle)> &&visit);
+
+	// Store up to condition::kBatchSize rows starting at @a r in @a batch,
+	// @a r is advanced to the next row. Returns the number of rows stored.
+	static std::size_t fill_batch(row *&r, row **batch)
+	{
+		std::size_t n = 0;
+		for (; r != nullptr and n < condition::kBatchSize; r = r->m_next)
+			batch[n++] = r;
+		return n;
+	}
+
+	// Return the rows that may match all of the item equalities in @a
+	// equalities, using a secondary index. Returns an empty optional when
+	// there is no secondary index on these items. A description of the
+	// index used is stored in @a plan.
+	std::optional<std::vector<row *>> find_in_secondary_index(const std::vector<detail::item_equality> &equalities, std::string &plan) const;
+
+	// Keep the secondary indices up to date
+	void secondary_index_insert(row *r, bool at_end);
+	void secondary_index_erase(row *r);
+	void secondary_index_invalidate();
+
+	// Undo changes recorded in the journal, in reverse order
+	void undo_insert(row *r, row *prev);
+	void undo_erase(row *r, row *prev);
+	void undo_reorder(const std::vector<row *> &order);
+
+	// The rows of a category are shared with its copies, see shared_rows
+	// in category.cpp. A copy calls acquire_rows before accessing the rows
+	// and the original calls detach_rows before modifying them.
+	struct shared_rows;
+
+	void acquire_rows() const
+	{
+		if (m_source != nullptr)
+			acquire_shared_rows();
+	}
+
+	void detach_rows()
+	{
+		acquire_rows();
+
+		if (m_shared != nullptr)
+			detach_shared_rows();
+	}
+
+	// Replace the shared rows of this copy by a clone of them
+	void acquire_shared_rows() const;
+
+	// Give the copies sharing the rows of this category a clone
+	void detach_shared_rows();
+
+	// Return the shared rows of this category, for a new copy
+	shared_rows *share_rows() const;
+
+	// Stop sharing rows, this category is empty afterwards
+	void release_shared_rows();
+
+	// Fill this empty category with clones of the rows starting at @a head,
+	// create the key index and secondary indices on the same items as in
+	// @a indices.
+	void clone_rows(const row *head, const std::vector<class secondary_index *> &indices);
+
 	// --------------------------------------------------------------------
 
 	std::string m_name;
+	std::size_t m_name_hash = ihash({});
 	std::vector<item_entry> m_items;
+	std::vector<uint16_t> m_item_table;
 	const validator *m_validator = nullptr;
 	const category_validator *m_cat_validator = nullptr;
 	std::vector<link> m_parent_links, m_child_links;
 	bool m_cascade = true;
 	uint32_t m_last_unique_num = 0;
 	class category_index *m_index = nullptr;
+	index_type m_index_type = index_type::tree;
+	std::vector<class secondary_index *> m_secondary_indices;
 	row *m_head = nullptr, *m_tail = nullptr;
+	std::size_t m_row_count = 0;
+	mutable std::atomic<shared_rows *> m_shared{ nullptr };
+
+	// The rows shared with the category this is a copy of, until they are
+	// acquired while holding m_source_mutex
+	mutable std::atomic<shared_rows *> m_source{ nullptr };
+	mutable std::mutex m_source_mutex;
+	detail::journal *m_journal = nullptr;
+
+	// The rows in order, for random access. Valid only when m_directory_valid
+	// is true, it is built while holding m_directory_mutex
+	mutable std::vector<row *> m_directory;
+	mutable std::atomic<bool> m_directory_valid = false;
+	mutable std::mutex m_directory_mutex;
+
+	row_pool m_rows;
+	string_pool m_strings;
 };
 
 } // namespace cif
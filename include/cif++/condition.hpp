@@ -28,12 +28,16 @@
 
 #include "cif++/row.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <concepts>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <regex>
 #include <utility>
+#include <variant>
 
 /** \file condition.hpp
  * This file contains code to create conditions: object encapsulating a
@@ -140,11 +144,158 @@ uint16_t get_item_ix(const category &cat, std::string_view col);
  */
 bool is_item_type_uchar(const category &cat, std::string_view col);
 
+/**
+ * @brief Return the estimated fraction of rows in category @a cat that
+ * have the same value for the item with index @a ix
+ * 
+ * @param cat The category
+ * @param ix The item index
+ * @return double The estimated selectivity of an equality test on this item
+ */
+double get_equality_selectivity(const category &cat, uint16_t ix);
+
 // --------------------------------------------------------------------
 // some more templates to be able to do querying
 
 namespace detail
 {
+	/// An equality test on the item with index m_item_ix that must hold for
+	/// a row to match a condition. Used to look up rows in a secondary index.
+	struct item_equality
+	{
+		uint16_t m_item_ix;
+		std::variant<std::string_view, double> m_value;
+	};
+
+	/// The operator in a comparison of an item with a constant
+	enum class comparison_op : uint8_t
+	{
+		equal,
+		less,
+		less_equal,
+		greater,
+		greater_equal
+	};
+
+	/// A comparison of an item with a constant in a form that can be compiled.
+	/// The type of the constant determines how the item values are converted,
+	/// for integral constants m_min and m_max contain the range of the type.
+	struct comparison
+	{
+		comparison_op m_op;
+		std::variant<std::string, int64_t, float, double> m_value;
+		int64_t m_min = 0, m_max = 0;
+	};
+
+	/// Return the comparison of an item with the number @a v using @a op,
+	/// or nothing if numbers of type T cannot be compiled
+	template <typename T>
+	std::optional<comparison> make_comparison(comparison_op op, T v)
+	{
+		if constexpr (std::is_same_v<T, float> or std::is_same_v<T, double>)
+			return comparison{ op, v };
+		else if constexpr (std::is_integral_v<T> and std::numeric_limits<T>::max() <= std::numeric_limits<int64_t>::max())
+			return comparison{ op, static_cast<int64_t>(v), std::numeric_limits<T>::min(), std::numeric_limits<T>::max() };
+		else
+			return {};
+	}
+
+	struct condition_impl;
+
+	/// A condition compiled into a flat list of instructions, with item
+	/// indices resolved and constants converted. The instructions for AND,
+	/// OR and NOT are followed by those of their operands.
+	///
+	/// Rows are tested one at a time using test or in batches using filter.
+	/// The latter evaluates each instruction for all rows in a batch that
+	/// are still undecided, keeping the loops free of dispatching.
+	class condition_program
+	{
+	  public:
+		/// The maximum number of rows evaluated at once
+		static constexpr std::size_t kBatchSize = 256;
+
+		enum class opcode : uint8_t
+		{
+			always,
+			is_empty,
+			is_not_empty,
+			equals_row,
+			equals_short,
+			compare_text,
+			compare_integer,
+			compare_float,
+			compare_double,
+			call,
+			and_op,
+			or_op,
+			not_op
+		};
+
+		struct instruction
+		{
+			opcode m_op;
+			comparison_op m_cmp = comparison_op::equal;
+			bool m_icase = false;
+			uint16_t m_item_ix = 0;
+			std::size_t m_end = 0;           // and_op, or_op and not_op: index past the operands
+			std::size_t m_length = 0;        // equals_short: the length of the value
+			uint64_t m_word = 0, m_mask = 0; // equals_short: the value and the bits to ignore
+			int64_t m_integer = 0, m_min = 0, m_max = 0;
+			double m_number = 0;
+			std::string m_text;
+			row_handle m_row;                        // equals_row
+			const condition_impl *m_impl = nullptr; // call
+		};
+
+		/// Start a new program for category @a cat
+		void reset(const category &cat)
+		{
+			m_code.clear();
+			m_category = &cat;
+		}
+
+		bool empty() const { return m_code.empty(); }
+
+		/// Append instruction @a i, returns its index
+		std::size_t add(instruction &&i)
+		{
+			m_code.emplace_back(std::move(i));
+			return m_code.size() - 1;
+		}
+
+		/// Append the instruction for comparison @a cmp of item @a item_ix
+		void add(const comparison &cmp, uint16_t item_ix, bool icase);
+
+		/// Mark the end of the operands of the instruction at index @a ix
+		void close(std::size_t ix)
+		{
+			m_code[ix].m_end = m_code.size();
+		}
+
+		/// Return true if row @a r matches
+		bool test(const row *r) const
+		{
+			return test(0, r);
+		}
+
+		/// Move the rows in @a rows that match to the front, keeping
+		/// their order, and return their number
+		std::size_t filter(row **rows, std::size_t count) const;
+
+	  private:
+		bool test(std::size_t pc, const row *r) const;
+		std::size_t filter(std::size_t pc, const row *const *rows, uint16_t *sel, std::size_t count) const;
+
+		std::size_t next(std::size_t pc) const
+		{
+			return m_code[pc].m_op >= opcode::and_op ? m_code[pc].m_end : pc + 1;
+		}
+
+		std::vector<instruction> m_code;
+		const category *m_category = nullptr;
+	};
+
 	struct condition_impl
 	{
 		virtual ~condition_impl() {}
@@ -155,12 +306,36 @@ namespace detail
 		virtual std::optional<row_handle> single() const { return {}; };
 
 		virtual bool equals([[maybe_unused]] const condition_impl *rhs) const { return false; }
+
+		// Add the item equalities that must hold for this condition to be true
+		virtual void get_equalities([[maybe_unused]] std::vector<item_equality> &equalities) const {}
+
+		// Estimates used to plan the evaluation, valid after prepare: the
+		// relative cost of testing a single row and the expected fraction
+		// of rows that pass the test
+		virtual double cost() const { return 1; }
+		virtual double selectivity() const { return 0.5; }
+
+		// Add the instructions for this condition to @a program, by
+		// default a call to test
+		virtual void compile(condition_program &program) const
+		{
+			program.add({ .m_op = condition_program::opcode::call, .m_impl = this });
+		}
 	};
 
 	struct all_condition_impl : public condition_impl
 	{
 		bool test(row_handle) const override { return true; }
 		void str(std::ostream &os) const override { os << "*"; }
+
+		double cost() const override { return 0; }
+		double selectivity() const override { return 1; }
+
+		void compile(condition_program &program) const override
+		{
+			program.add({ .m_op = condition_program::opcode::always });
+		}
 	};
 
 	struct or_condition_impl;
@@ -208,6 +383,9 @@ class condition
 		: m_impl(nullptr)
 	{
 		std::swap(m_impl, rhs.m_impl);
+		std::swap(m_candidates, rhs.m_candidates);
+		std::swap(m_plan, rhs.m_plan);
+		std::swap(m_program, rhs.m_program);
 	}
 
 	condition &operator=(const condition &) = delete;
@@ -218,6 +396,9 @@ class condition
 	condition &operator=(condition &&rhs) noexcept
 	{
 		std::swap(m_impl, rhs.m_impl);
+		std::swap(m_candidates, rhs.m_candidates);
+		std::swap(m_plan, rhs.m_plan);
+		std::swap(m_program, rhs.m_program);
 		return *this;
 	}
 
@@ -247,9 +428,27 @@ class condition
 	{
 		assert(this->m_impl != nullptr);
 		assert(this->m_prepared);
+
+		if (not m_program.empty() and not r.empty())
+			return m_program.test(r.get_row());
+
 		return m_impl ? m_impl->test(r) : false;
 	}
 
+	/// The number of rows tested at once by filter
+	static constexpr std::size_t kBatchSize = detail::condition_program::kBatchSize;
+
+	/**
+	 * @brief Move the rows in @a rows that match this condition to
+	 * the front, keeping their order. The rows are tested in batches
+	 * of kBatchSize rows.
+	 * 
+	 * @param rows The rows to test
+	 * @param count The number of rows in @a rows
+	 * @return std::size_t The number of rows that match
+	 */
+	std::size_t filter(row **rows, std::size_t count) const;
+
 	/**
 	 * @brief Return true if the condition is not empty
 	 */
@@ -272,6 +471,29 @@ class condition
 		return m_impl ? m_impl->single() : std::optional<row_handle>();
 	}
 
+	/**
+	 * @brief If the prepare step could use the primary index or a secondary
+	 * index of the category, this method returns the rows that may match, in
+	 * the order of the category. Each of these rows still has to be tested
+	 * using operator().
+	 *
+	 * @return const std::vector<row *>* The candidate rows or nullptr if no
+	 * index was used
+	 */
+	const std::vector<row *> *candidates() const
+	{
+		return m_candidates.has_value() ? &*m_candidates : nullptr;
+	}
+
+	/**
+	 * @brief Return a description of the plan chosen by the prepare step:
+	 * the access path used to find the rows, followed by the tests that
+	 * are applied to them in the order in which they are evaluated.
+	 * 
+	 * @return std::string The description of the plan
+	 */
+	std::string explain() const;
+
 	friend condition operator||(condition &&a, condition &&b); /**< Return a condition which is the logical OR or condition @a and @b */
 	friend condition operator&&(condition &&a, condition &&b); /**< Return a condition which is the logical AND or condition @a and @b */
 
@@ -288,6 +510,9 @@ class condition
 	{
 		std::swap(m_impl, rhs.m_impl);
 		std::swap(m_prepared, rhs.m_prepared);
+		std::swap(m_candidates, rhs.m_candidates);
+		std::swap(m_plan, rhs.m_plan);
+		std::swap(m_program, rhs.m_program);
 	}
 
 	/**
@@ -309,6 +534,9 @@ class condition
 
 	condition_impl *m_impl;
 	bool m_prepared = false;
+	std::optional<std::vector<row *>> m_candidates;
+	std::string m_plan;
+	detail::condition_program m_program;
 };
 
 namespace detail
@@ -336,6 +564,13 @@ namespace detail
 			os << m_item_name << " IS NULL";
 		}
 
+		double selectivity() const override { return 0.1; }
+
+		void compile(condition_program &program) const override
+		{
+			program.add({ .m_op = condition_program::opcode::is_empty, .m_item_ix = m_item_ix });
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 	};
@@ -363,10 +598,65 @@ namespace detail
 			os << m_item_name << " IS NOT NULL";
 		}
 
+		double selectivity() const override { return 0.9; }
+
+		void compile(condition_program &program) const override
+		{
+			program.add({ .m_op = condition_program::opcode::is_not_empty, .m_item_ix = m_item_ix });
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 	};
 
+	// Values shorter than item_value::kBufferSize are compared as a single
+	// word, see item_handle::equals_short. For case insensitive comparison
+	// the 0x20 bit is ignored for all characters that are letters.
+	struct short_value_matcher
+	{
+		void init(std::string_view value, bool icase)
+		{
+			m_valid = not value.empty() and value.length() < item_value::kBufferSize;
+
+			if (m_valid)
+			{
+				m_value = item_value(value);
+
+				char mask[sizeof(uint64_t)] = {};
+				if (icase)
+				{
+					for (std::size_t i = 0; i < value.length(); ++i)
+					{
+						if (std::isalpha(static_cast<unsigned char>(value[i])))
+							mask[i] = 0x20;
+					}
+				}
+
+				std::memcpy(&m_fold_mask, mask, sizeof(mask));
+			}
+		}
+
+		bool valid() const { return m_valid; }
+
+		bool matches(const item_handle &i) const
+		{
+			return i.equals_short(m_value, m_fold_mask);
+		}
+
+		void compile(condition_program &program, uint16_t item_ix) const
+		{
+			program.add({ .m_op = condition_program::opcode::equals_short,
+				.m_item_ix = item_ix,
+				.m_length = m_value.m_length,
+				.m_word = m_value.m_storage,
+				.m_mask = m_fold_mask });
+		}
+
+		item_value m_value;
+		uint64_t m_fold_mask = 0;
+		bool m_valid = false;
+	};
+
 	struct key_equals_condition_impl : public condition_impl
 	{
 		key_equals_condition_impl(item &&i)
@@ -379,7 +669,10 @@ namespace detail
 
 		bool test(row_handle r) const override
 		{
-			return m_single_hit.has_value() ? *m_single_hit == r : r[m_item_ix].compare(m_value, m_icase) == 0;
+			if (m_single_hit.has_value())
+				return *m_single_hit == r;
+
+			return m_short_value.valid() ? m_short_value.matches(r[m_item_ix]) : r[m_item_ix].compare(m_value, m_icase) == 0;
 		}
 
 		void str(std::ostream &os) const override
@@ -406,11 +699,35 @@ namespace detail
 			return this == rhs;
 		}
 
+		void get_equalities(std::vector<item_equality> &equalities) const override
+		{
+			equalities.push_back({ m_item_ix, std::string_view{ m_value } });
+		}
+
+		double cost() const override
+		{
+			return m_single_hit.has_value() or m_short_value.valid() ? 1 : 2;
+		}
+
+		double selectivity() const override { return m_selectivity; }
+
+		void compile(condition_program &program) const override
+		{
+			if (m_single_hit.has_value())
+				program.add({ .m_op = condition_program::opcode::equals_row, .m_row = *m_single_hit });
+			else if (m_short_value.valid())
+				m_short_value.compile(program, m_item_ix);
+			else
+				program.add({ comparison_op::equal, m_value }, m_item_ix, m_icase);
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 		bool m_icase = false;
 		std::string m_value;
+		short_value_matcher m_short_value;
 		std::optional<row_handle> m_single_hit;
+		double m_selectivity = 0.1;
 	};
 
 	struct key_equals_or_empty_condition_impl : public condition_impl
@@ -427,6 +744,8 @@ namespace detail
 		{
 			m_item_ix = get_item_ix(c, m_item_name);
 			m_icase = is_item_type_uchar(c, m_item_name);
+			m_short_value.init(m_value, m_icase);
+			m_selectivity = std::min(get_equality_selectivity(c, m_item_ix) + 0.1, 1.0);
 			return this;
 		}
 
@@ -435,8 +754,10 @@ namespace detail
 			bool result = false;
 			if (m_single_hit.has_value())
 				result = *m_single_hit == r;
+			else if (r[m_item_ix].empty())
+				result = true;
 			else
-				result = r[m_item_ix].empty() or r[m_item_ix].compare(m_value, m_icase) == 0;
+				result = m_short_value.valid() ? m_short_value.matches(r[m_item_ix]) : r[m_item_ix].compare(m_value, m_icase) == 0;
 			return result;
 		}
 
@@ -464,11 +785,32 @@ namespace detail
 			return this == rhs;
 		}
 
+		double cost() const override { return 2; }
+		double selectivity() const override { return m_selectivity; }
+
+		void compile(condition_program &program) const override
+		{
+			if (m_single_hit.has_value())
+				program.add({ .m_op = condition_program::opcode::equals_row, .m_row = *m_single_hit });
+			else
+			{
+				auto ix = program.add({ .m_op = condition_program::opcode::or_op });
+				program.add({ .m_op = condition_program::opcode::is_empty, .m_item_ix = m_item_ix });
+				if (m_short_value.valid())
+					m_short_value.compile(program, m_item_ix);
+				else
+					program.add({ comparison_op::equal, m_value }, m_item_ix, m_icase);
+				program.close(ix);
+			}
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 		std::string m_value;
 		bool m_icase = false;
+		short_value_matcher m_short_value;
 		std::optional<row_handle> m_single_hit;
+		double m_selectivity = 0.2;
 	};
 
 	struct key_equals_number_condition_impl : public condition_impl
@@ -510,10 +852,27 @@ namespace detail
 			return this == rhs;
 		}
 
+		void get_equalities(std::vector<item_equality> &equalities) const override
+		{
+			equalities.push_back({ m_item_ix, m_value });
+		}
+
+		double cost() const override { return m_single_hit.has_value() ? 1 : 2; }
+		double selectivity() const override { return m_selectivity; }
+
+		void compile(condition_program &program) const override
+		{
+			if (m_single_hit.has_value())
+				program.add({ .m_op = condition_program::opcode::equals_row, .m_row = *m_single_hit });
+			else
+				program.add({ comparison_op::equal, m_value }, m_item_ix, false);
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 		double m_value;
 		std::optional<row_handle> m_single_hit;
+		double m_selectivity = 0.1;
 	};
 
 	struct key_equals_number_or_empty_condition_impl : public condition_impl
@@ -528,6 +887,7 @@ namespace detail
 		condition_impl *prepare(const category &c) override
 		{
 			m_item_ix = get_item_ix(c, m_item_name);
+			m_selectivity = std::min(get_equality_selectivity(c, m_item_ix) + 0.1, 1.0);
 			return this;
 		}
 
@@ -565,19 +925,38 @@ namespace detail
 			return this == rhs;
 		}
 
+		double cost() const override { return 3; }
+		double selectivity() const override { return m_selectivity; }
+
+		void compile(condition_program &program) const override
+		{
+			if (m_single_hit.has_value())
+				program.add({ .m_op = condition_program::opcode::equals_row, .m_row = *m_single_hit });
+			else
+			{
+				auto ix = program.add({ .m_op = condition_program::opcode::or_op });
+				program.add({ .m_op = condition_program::opcode::is_empty, .m_item_ix = m_item_ix });
+				program.add({ comparison_op::equal, m_value }, m_item_ix, false);
+				program.close(ix);
+			}
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 		double m_value;
 		std::optional<row_handle> m_single_hit;
+		double m_selectivity = 0.2;
 	};
 
 	struct key_compare_condition_impl : public condition_impl
 	{
 		template <typename COMP>
-		key_compare_condition_impl(const std::string &item_name, COMP &&comp, const std::string &s)
+		key_compare_condition_impl(const std::string &item_name, COMP &&comp, const std::string &s,
+			std::optional<comparison> cmp = {})
 			: m_item_name(item_name)
 			, m_compare(std::move(comp))
 			, m_str(s)
+			, m_comparison(std::move(cmp))
 		{
 		}
 
@@ -598,11 +977,24 @@ namespace detail
 			os << m_item_name << (m_icase ? "^ " : " ") << m_str;
 		}
 
+		// a range test, which is assumed to select a third of the rows
+		double cost() const override { return 4; }
+		double selectivity() const override { return 1.0 / 3; }
+
+		void compile(condition_program &program) const override
+		{
+			if (m_comparison.has_value())
+				program.add(*m_comparison, m_item_ix, m_icase);
+			else
+				condition_impl::compile(program);
+		}
+
 		std::string m_item_name;
 		uint16_t m_item_ix = 0;
 		bool m_icase = false;
 		std::function<bool(row_handle, bool)> m_compare;
 		std::string m_str;
+		std::optional<comparison> m_comparison;
 	};
 
 	struct key_matches_condition_impl : public condition_impl
@@ -631,6 +1023,9 @@ namespace detail
 			os << m_item_name << " =~ expression";
 		}
 
+		double cost() const override { return 20; }
+		double selectivity() const override { return 0.1; }
+
 		std::string m_item_name;
 		uint16_t m_item_ix;
 		std::regex mRx;
@@ -674,6 +1069,9 @@ namespace detail
 			os << "<any> == " << mValue;
 		}
 
+		double cost() const override { return 10; }
+		double selectivity() const override { return 0.1; }
+
 		valueType mValue;
 	};
 
@@ -713,6 +1111,9 @@ namespace detail
 			os << "<any> =~ expression";
 		}
 
+		double cost() const override { return 50; }
+		double selectivity() const override { return 0.1; }
+
 		std::regex mRx;
 	};
 
@@ -756,9 +1157,25 @@ namespace detail
 		{
 			for (auto &sub : m_sub)
 				sub = sub->prepare(c);
+
+			order_by_rank();
+
 			return this;
 		}
 
+		// Test the sub conditions that are cheap and reject many rows first
+		void order_by_rank()
+		{
+			auto rank = [](const condition_impl *c)
+			{
+				double reject = 1 - c->selectivity();
+				return reject > 0 ? c->cost() / reject : std::numeric_limits<double>::max();
+			};
+
+			std::stable_sort(m_sub.begin(), m_sub.end(), [rank](const condition_impl *a, const condition_impl *b)
+				{ return rank(a) < rank(b); });
+		}
+
 		bool test(row_handle r) const override
 		{
 			bool result = true;
@@ -797,17 +1214,18 @@ namespace detail
 		{
 			std::optional<row_handle> result;
 
-			for (auto sub : m_sub)
+			// only a single hit if all sub conditions agree
+			for (bool first = true; auto sub : m_sub)
 			{
 				auto s = sub->single();
 
-				if (not result.has_value())
+				if (std::exchange(first, false))
 				{
 					result = s;
 					continue;
 				}
 
-				if (s == result)
+				if (s.has_value() and s == result)
 					continue;
 
 				result.reset();
@@ -817,6 +1235,39 @@ namespace detail
 			return result;
 		}
 
+		void get_equalities(std::vector<item_equality> &equalities) const override
+		{
+			for (auto sub : m_sub)
+				sub->get_equalities(equalities);
+		}
+
+		double cost() const override
+		{
+			double result = 0, passed = 1;
+			for (auto sub : m_sub)
+			{
+				result += passed * sub->cost();
+				passed *= sub->selectivity();
+			}
+			return result;
+		}
+
+		double selectivity() const override
+		{
+			double result = 1;
+			for (auto sub : m_sub)
+				result *= sub->selectivity();
+			return result;
+		}
+
+		void compile(condition_program &program) const override
+		{
+			auto ix = program.add({ .m_op = condition_program::opcode::and_op });
+			for (auto sub : m_sub)
+				sub->compile(program);
+			program.close(ix);
+		}
+
 		static condition_impl *combine_equal(std::vector<and_condition_impl *> &subs, or_condition_impl *oc);
 
 		std::vector<condition_impl *> m_sub;
@@ -886,21 +1337,49 @@ namespace detail
 			os << ')';
 		}
 
+		double cost() const override
+		{
+			double result = 0, failed = 1;
+			for (auto sub : m_sub)
+			{
+				result += failed * sub->cost();
+				failed *= 1 - sub->selectivity();
+			}
+			return result;
+		}
+
+		double selectivity() const override
+		{
+			double failed = 1;
+			for (auto sub : m_sub)
+				failed *= 1 - sub->selectivity();
+			return 1 - failed;
+		}
+
+		void compile(condition_program &program) const override
+		{
+			auto ix = program.add({ .m_op = condition_program::opcode::or_op });
+			for (auto sub : m_sub)
+				sub->compile(program);
+			program.close(ix);
+		}
+
 		virtual std::optional<row_handle> single() const override
 		{
 			std::optional<row_handle> result;
 
-			for (auto sub : m_sub)
+			// only a single hit if all sub conditions agree
+			for (bool first = true; auto sub : m_sub)
 			{
 				auto s = sub->single();
 
-				if (not result.has_value())
+				if (std::exchange(first, false))
 				{
 					result = s;
 					continue;
 				}
 
-				if (s == result)
+				if (s.has_value() and s == result)
 					continue;
 
 				result.reset();
@@ -944,6 +1423,16 @@ namespace detail
 			os << ')';
 		}
 
+		double cost() const override { return mA->cost(); }
+		double selectivity() const override { return 1 - mA->selectivity(); }
+
+		void compile(condition_program &program) const override
+		{
+			auto ix = program.add({ .m_op = condition_program::opcode::not_op });
+			mA->compile(program);
+			program.close(ix);
+		}
+
 		condition_impl *mA;
 	};
 
@@ -1143,7 +1632,7 @@ condition operator>(const key &key, const T &v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v) > 0; },
-		s.str()));
+		s.str(), detail::make_comparison(detail::comparison_op::greater, v)));
 }
 
 /**
@@ -1158,7 +1647,7 @@ condition operator>=(const key &key, const T &v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v) >= 0; },
-		s.str()));
+		s.str(), detail::make_comparison(detail::comparison_op::greater_equal, v)));
 }
 
 /**
@@ -1173,7 +1662,7 @@ condition operator<(const key &key, const T &v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v) < 0; },
-		s.str()));
+		s.str(), detail::make_comparison(detail::comparison_op::less, v)));
 }
 
 /**
@@ -1188,7 +1677,7 @@ condition operator<=(const key &key, const T &v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v) <= 0; },
-		s.str()));
+		s.str(), detail::make_comparison(detail::comparison_op::less_equal, v)));
 }
 
 /**
@@ -1202,7 +1691,7 @@ inline condition operator>(const key &key, std::string_view v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v, icase) > 0; },
-		s.str()));
+		s.str(), detail::comparison{ detail::comparison_op::greater, std::string{ v } }));
 }
 
 /**
@@ -1216,7 +1705,7 @@ inline condition operator>=(const key &key, std::string_view v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v, icase) >= 0; },
-		s.str()));
+		s.str(), detail::comparison{ detail::comparison_op::greater_equal, std::string{ v } }));
 }
 
 /**
@@ -1230,7 +1719,7 @@ inline condition operator<(const key &key, std::string_view v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v, icase) < 0; },
-		s.str()));
+		s.str(), detail::comparison{ detail::comparison_op::less, std::string{ v } }));
 }
 
 /**
@@ -1244,7 +1733,7 @@ inline condition operator<=(const key &key, std::string_view v)
 	return condition(new detail::key_compare_condition_impl(
 		key.m_item_name, [item_name = key.m_item_name, v](row_handle r, bool icase)
 		{ return r[item_name].compare(v, icase) <= 0; },
-		s.str()));
+		s.str(), detail::comparison{ detail::comparison_op::less_equal, std::string{ v } }));
 }
 
 /**
@@ -56,6 +56,7 @@ class datablock : public std::list<category>
 	 */
 	datablock(std::string_view name)
 		: m_name(name)
+		, m_name_hash(ihash(name))
 	{
 	}
 
@@ -72,12 +73,16 @@ class datablock : public std::list<category>
 		swap_(*this, db);
 		return *this;
 	}
+
+	~datablock();
 	/** @endcond */
 
 	friend void swap_(datablock &a, datablock &b) noexcept
 	{
 		std::swap(a.m_name, b.m_name);
+		std::swap(a.m_name_hash, b.m_name_hash);
 		std::swap(a.m_validator, b.m_validator);
+		std::swap(a.m_journal, b.m_journal);
 		std::swap(static_cast<std::list<category>&>(a), static_cast<std::list<category>&>(b));
 	}
 
@@ -88,6 +93,11 @@ class datablock : public std::list<category>
 	 */
 	const std::string &name() const { return m_name; }
 
+	/**
+	 * @brief Return the case insensitive hash of name()
+	 */
+	std::size_t name_hash() const { return m_name_hash; }
+
 	/**
 	 * @brief Set the name of this datablock to @a name
 	 * 
@@ -96,6 +106,7 @@ class datablock : public std::list<category>
 	void set_name(std::string_view name)
 	{
 		m_name = name;
+		m_name_hash = ihash(name);
 	}
 
 	/**
@@ -213,6 +224,17 @@ class datablock : public std::list<category>
 	 */
 	void write(std::ostream &os, const std::vector<std::string> &item_name_order);
 
+	/**
+	 * @brief Write out the contents to @a os in the native binary format
+	 */
+	void save_binary(std::ostream &os) const;
+
+	/**
+	 * @brief Replace the contents, including the name, with the data
+	 * written by save_binary read from @a is
+	 */
+	void load_binary(std::istream &is);
+
 	/**
 	 * @brief Friend operator<< to write datablock @a db to std::ostream @a os
 	 */
@@ -229,9 +251,52 @@ class datablock : public std::list<category>
 	 */
 	bool operator==(const datablock &rhs) const;
 
+	// --------------------------------------------------------------------
+
+	/**
+	 * @brief Start a transaction. Until the transaction is committed or
+	 * rolled back, the rows inserted and erased and the values updated in
+	 * the categories of this datablock are recorded, including the changes
+	 * made to linked categories. Categories created in the meantime are
+	 * recorded as well.
+	 *
+	 * The cost of recording and of rolling back is proportional to the
+	 * number of changes. Erased rows are kept until the outermost transaction
+	 * is committed, row handles to them become valid again after a rollback.
+	 *
+	 * Transactions can be nested, committing a nested transaction makes its
+	 * changes part of the enclosing transaction.
+	 *
+	 * Adding or removing items, e.g. using category::remove_item, and
+	 * removing categories are not recorded. Changes recorded for a category
+	 * that is removed or replaced can no longer be rolled back.
+	 */
+	void begin_transaction();
+
+	/**
+	 * @brief Accept the changes made since the matching begin_transaction
+	 */
+	void commit();
+
+	/**
+	 * @brief Undo the changes made since the matching begin_transaction
+	 */
+	void rollback();
+
+	/**
+	 * @brief Return true if a transaction was started and is not yet
+	 * committed or rolled back
+	 */
+	bool in_transaction() const
+	{
+		return m_journal and m_journal->active();
+	}
+
   private:
 	std::string m_name;
+	std::size_t m_name_hash = ihash({});
 	const validator *m_validator = nullptr;
+	std::unique_ptr<detail::journal> m_journal;
 };
 
 } // namespace cif
\ No newline at end of file
@@ -68,6 +68,18 @@ class file : public std::list<datablock>
 		load(p);
 	}
 
+	/**
+	 * @brief Construct a new file object using the data selected by @a options
+	 * in the file @a p as content
+	 *
+	 * @param p Path to a file containing the data to load
+	 * @param options The categories and items to load
+	 */
+	file(const std::filesystem::path &p, const load_options &options)
+	{
+		load(p, options);
+	}
+
 	/**
 	 * @brief Construct a new file object using the data in the std::istream @a is
 	 * 
@@ -87,16 +99,7 @@ class file : public std::list<datablock>
 	 */
 	explicit file(const char *data, std::size_t length)
 	{
-		struct membuf : public std::streambuf
-		{
-			membuf(char *text, std::size_t length)
-			{
-				this->setg(text, text, text + length);
-			}
-		} buffer(const_cast<char *>(data), length);
-
-		std::istream is(&buffer);
-		load(is);
+		load_text(std::string_view(data, length));
 	}
 
 	/** @cond */
@@ -171,6 +174,11 @@ class file : public std::list<datablock>
 	 */
 	void load_dictionary();
 
+	/**
+	 * @brief Return the name of the dictionary datablock @a db conforms to
+	 * according to its *audit_conform* category, empty if it has none.
+	 */
+	static std::string get_dictionary_name(const datablock &db);
 
 	/**
 	 * @brief Attempt to load the named dictionary @a name and
@@ -226,18 +234,107 @@ class file : public std::list<datablock>
 	 */
 	std::tuple<iterator, bool> emplace(std::string_view name);
 
-	/** Load the data from the file specified by @a p */
+	/** Load the data from the file specified by @a p
+	 *
+	 * Files that are not compressed are mapped into memory and parsed
+	 * in place, avoiding the overhead of reading through a stream.
+	 */
 	void load(const std::filesystem::path &p);
 
+	/**
+	 * @brief Load only the data selected by @a options from the file specified by @a p
+	 *
+	 * Categories and items that are not selected are skipped while parsing,
+	 * no rows or values are created for them. This saves a lot of time and
+	 * memory when only a few small categories are needed from a large file.
+	 */
+	void load(const std::filesystem::path &p, const load_options &options);
+
+	/**
+	 * @brief Load the data from the file specified by @a p using multiple threads
+	 *
+	 * The datablocks in the file are located first, after which they are
+	 * parsed in parallel using @a n_threads threads. When @a n_threads is
+	 * zero, the number of hardware threads is used. The resulting datablocks
+	 * are stored in the order in which they appear in the file.
+	 *
+	 * This is useful for large files containing many datablocks, like the
+	 * CCD file components.cif. Note that datablock names in the file should
+	 * be unique.
+	 *
+	 * @param p Path to the file to load, may be compressed with gzip
+	 * @param n_threads The number of threads to use
+	 */
+	void load_parallel(const std::filesystem::path &p, std::size_t n_threads = 0);
+
 	/** Load the data from @a is */
 	void load(std::istream &is);
 
+	/** Load only the data selected by @a options from @a is */
+	void load(std::istream &is, const load_options &options);
+
 	/** Save the data to the file specified by @a p */
 	void save(const std::filesystem::path &p) const;
 
 	/** Save the data to @a is */
 	void save(std::ostream &os) const;
 
+	/**
+	 * @brief Load the data from the file specified by @a p in the native binary format
+	 *
+	 * The binary format stores the item names once per category and the
+	 * values column by column. It preserves the order of categories, items
+	 * and rows, as well as the difference between unknown ('?') and
+	 * inapplicable ('.') values. Reading it is a lot faster than parsing
+	 * text. The file is mapped into memory when possible.
+	 */
+	void load_binary(const std::filesystem::path &p);
+
+	/**
+	 * @brief Load only the data selected by @a options from the file specified
+	 * by @a p in the native binary format
+	 *
+	 * The categories that are not selected are skipped using the directory
+	 * stored with each datablock, their data is not decoded at all.
+	 */
+	void load_binary(const std::filesystem::path &p, const load_options &options);
+
+	/** Load the data in native binary format from @a is */
+	void load_binary(std::istream &is);
+
+	/** Load only the data selected by @a options in native binary format from @a is */
+	void load_binary(std::istream &is, const load_options &options);
+
+	/** Save the data in native binary format to the file specified by @a p */
+	void save_binary(const std::filesystem::path &p) const;
+
+	/** Save the data in native binary format to @a os */
+	void save_binary(std::ostream &os) const;
+
+	/**
+	 * @brief Load the data from the BinaryCIF file specified by @a p, the file
+	 * may be compressed with gzip
+	 *
+	 * BinaryCIF is the MessagePack based format distributed by the wwPDB and
+	 * RCSB. Note that load() recognises BinaryCIF data as well.
+	 */
+	void load_bcif(const std::filesystem::path &p);
+
+	/** Load the data in BinaryCIF format from @a is */
+	void load_bcif(std::istream &is);
+
+	/**
+	 * @brief Save the data as BinaryCIF to the file specified by @a p
+	 *
+	 * Columns containing integers or decimal numbers with a fixed number of
+	 * decimals are stored as numbers, in a way that reproduces the text exactly.
+	 * Other columns are stored as strings.
+	 */
+	void save_bcif(const std::filesystem::path &p) const;
+
+	/** Save the data as BinaryCIF to @a os */
+	void save_bcif(std::ostream &os) const;
+
 	/**
 	 * @brief Friend operator<< to write file @a f to std::ostream @a os
 	 */
@@ -248,6 +345,18 @@ class file : public std::list<datablock>
 	}
 
   private:
+	// Load the text in @a data, the parser reads directly from this memory
+	void load_text(std::string_view data, const load_options &options = {});
+
+	// Remove the data not selected by @a options from the datablocks starting at @a db
+	void select(iterator db, const load_options &options);
+
+	// Load the data selected by @a options in native binary format in @a data
+	void load_binary_data(std::string_view data, const load_options &options = {});
+
+	// Load the BinaryCIF data in @a data
+	void load_bcif_data(std::string_view data);
+
 	const validator *m_validator = nullptr;
 };
 
@@ -50,4 +50,6 @@ class row_handle;
 class item;
 struct item_handle;
 
+class validator;
+
 } // namespace cif
\ No newline at end of file
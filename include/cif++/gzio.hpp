@@ -5,11 +5,18 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <zlib.h>
 
@@ -309,6 +316,549 @@ class basic_igzip_streambuf : public basic_streambuf<CharT, Traits>
 
 // --------------------------------------------------------------------
 
+/// \brief A streambuf class that decompresses gzipped data using background threads
+///
+/// \tparam CharT		Type of the character stream.
+/// \tparam Traits		Traits for character type, defaults to char_traits<_CharT>.
+///
+/// This implementation of streambuf reads the compressed data from upstream
+/// in large blocks and hands these to worker threads to be inflated. While
+/// the consumer processes a block of decompressed data, the next blocks are
+/// being inflated.
+///
+/// Regular gzip data can only be inflated sequentially, in that case a single
+/// worker thread is used to read ahead. If the data is BGZF, that is a series
+/// of gzip members each of at most 64 KiB with the size of the member stored
+/// in the header, the members are inflated in parallel by multiple threads.
+/// Data following the BGZF members that is not BGZF itself, e.g. a regular
+/// gzip file appended to a BGZF file, is inflated sequentially.
+///
+/// Corrupt or truncated data results in a std::runtime_error being thrown
+/// from underflow after all data that could be inflated has been delivered,
+/// std::istream turns this into a badbit.
+///
+/// Upstream is only ever accessed from the thread calling underflow.
+
+template <typename CharT, typename Traits>
+class basic_igzip_mt_streambuf : public basic_streambuf<CharT, Traits>
+{
+  public:
+	/** @cond */
+
+	static_assert(sizeof(CharT) == 1, "Unfortunately, support for wide characters is not implemented yet.");
+
+	using char_type = CharT;
+	using traits_type = Traits;
+
+	using streambuf_type = std::basic_streambuf<char_type, traits_type>;
+	using base_type = basic_streambuf<CharT, Traits>;
+
+	using int_type = typename traits_type::int_type;
+	using pos_type = typename traits_type::pos_type;
+	using off_type = typename traits_type::off_type;
+
+	/** @endcond */
+
+	/// \brief Constructor, @a max_threads is the maximum number of threads
+	/// to use for BGZF data. If zero, the number of hardware threads is used.
+	basic_igzip_mt_streambuf(std::size_t max_threads = 0)
+		: m_max_threads(max_threads)
+	{
+		if (m_max_threads == 0)
+			m_max_threads = std::thread::hardware_concurrency();
+		if (m_max_threads == 0)
+			m_max_threads = 1;
+	}
+
+	/** @cond */
+
+	// The worker threads refer to this object, so it cannot be moved
+	basic_igzip_mt_streambuf(const basic_igzip_mt_streambuf &) = delete;
+	basic_igzip_mt_streambuf &operator=(const basic_igzip_mt_streambuf &) = delete;
+
+	~basic_igzip_mt_streambuf()
+	{
+		close();
+	}
+
+	/** @endcond */
+
+	/// \brief Stop the worker threads and release all buffers
+	base_type *close() override
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			m_stop = true;
+		}
+
+		m_work_cv.notify_all();
+
+		for (auto &t : m_threads)
+			t.join();
+
+		m_threads.clear();
+		m_jobs.clear();
+		m_todo.clear();
+		m_current.reset();
+		m_prefix.clear();
+		m_stop = false;
+		m_failed = false;
+
+		if (m_zstream_initialised)
+		{
+			::inflateEnd(&m_zstream);
+			m_zstream_initialised = false;
+		}
+
+		this->setg(nullptr, nullptr, nullptr);
+
+		return this;
+	}
+
+	/// \brief Return whether the data in @a upstream starts with a gzip header
+	///
+	/// The position of @a upstream is restored, which means it has to be seekable.
+	static bool is_gzip(streambuf_type &upstream)
+	{
+		char_type h[2];
+		auto n = upstream.sgetn(h, sizeof(h));
+		bool result = n == sizeof(h) and static_cast<unsigned char>(h[0]) == 0x1f and static_cast<unsigned char>(h[1]) == 0x8b;
+		upstream.pubseekoff(-n, std::ios_base::cur, std::ios_base::in);
+		return result;
+	}
+
+	/// \brief Return whether the data in @a upstream starts with a BGZF header
+	///
+	/// The position of @a upstream is restored, which means it has to be seekable.
+	static bool is_bgzf(streambuf_type &upstream)
+	{
+		char_type h[18];
+		auto n = upstream.sgetn(h, sizeof(h));
+		bool result = n == sizeof(h) and is_bgzf_header(reinterpret_cast<const unsigned char *>(h));
+		upstream.pubseekoff(-n, std::ios_base::cur, std::ios_base::in);
+		return result;
+	}
+
+	/// \brief Initialize the streambuf using @a upstream as source
+	///
+	/// The start of the data is read to see whether this is BGZF data.
+	/// Returns nullptr if the data is not gzip compressed.
+	base_type *init(streambuf_type *upstream) override
+	{
+		close();
+
+		this->set_upstream(upstream);
+
+		m_upstream_eof = false;
+		m_zstream_ended = false;
+
+		// Sniff the header, BGZF uses an extra field with subfield 'BC'
+		m_prefix.resize(18);
+		m_prefix.resize(std::max<std::streamsize>(0, upstream->sgetn(m_prefix.data(), m_prefix.size())));
+		m_prefix_offset = 0;
+
+		auto h = reinterpret_cast<const unsigned char *>(m_prefix.data());
+		if (m_prefix.size() < 2 or h[0] != 0x1f or h[1] != 0x8b)
+		{
+			close();
+			return nullptr;
+		}
+
+		m_bgzf = m_prefix.size() == 18 and is_bgzf_header(h);
+
+		// Regular gzip data is inflated using this zstream, one job at a time
+		m_zstream = z_stream_s{};
+		if (::inflateInit2(&m_zstream, 47) != Z_OK)
+		{
+			close();
+			return nullptr;
+		}
+		m_zstream_initialised = true;
+
+		try
+		{
+			std::size_t n = m_bgzf ? m_max_threads : 1;
+			for (std::size_t i = 0; i < n; ++i)
+				m_threads.emplace_back([this]() { work(); });
+		}
+		catch (const std::system_error &)
+		{
+			close();
+			return nullptr;
+		}
+
+		return this;
+	}
+
+  private:
+	/// \brief A block of compressed data and the result of inflating it
+	struct job
+	{
+		std::vector<char_type> in, out;
+		bool bgzf = false;
+		bool last = false;
+		bool done = false;
+		bool failed = false;
+	};
+
+	/// \brief The size of the compressed blocks read from upstream
+	static constexpr std::size_t kBlockSize = 256 * 1024;
+
+	/// \brief Read @a n bytes from the sniffed prefix and then from upstream
+	std::streamsize read_upstream(char_type *p, std::streamsize n)
+	{
+		std::streamsize result = 0;
+
+		if (m_prefix_offset < m_prefix.size())
+		{
+			result = std::min<std::streamsize>(n, m_prefix.size() - m_prefix_offset);
+			std::copy(m_prefix.data() + m_prefix_offset, m_prefix.data() + m_prefix_offset + result, p);
+			m_prefix_offset += result;
+		}
+
+		if (result < n)
+			result += std::max<std::streamsize>(0, this->m_upstream->sgetn(p + result, n - result));
+
+		return result;
+	}
+
+	/// \brief Return whether @a h points to a gzip header with a BGZF extra field first
+	static bool is_bgzf_header(const unsigned char *h)
+	{
+		return h[0] == 0x1f and h[1] == 0x8b and h[2] == 8 and (h[3] & 4) != 0 and
+		       (h[10] | h[11] << 8) >= 6 and h[12] == 'B' and h[13] == 'C' and (h[14] | h[15] << 8) == 2;
+	}
+
+	/// \brief Push back the bytes in [@a b, @a e) so they are read again
+	void unread(const char_type *b, const char_type *e)
+	{
+		std::vector<char_type> prefix(b, e);
+		prefix.insert(prefix.end(), m_prefix.begin() + m_prefix_offset, m_prefix.end());
+		std::swap(m_prefix, prefix);
+		m_prefix_offset = 0;
+	}
+
+	/// \brief Append a complete BGZF member to @a buffer, returns false if there is none
+	///
+	/// If the data is not a complete BGZF member, nothing is appended and the
+	/// bytes that were read are pushed back.
+	bool read_bgzf_member(std::vector<char_type> &buffer)
+	{
+		auto start = buffer.size();
+
+		auto fail = [&]()
+		{
+			unread(buffer.data() + start, buffer.data() + buffer.size());
+			buffer.resize(start);
+			return false;
+		};
+
+		// fixed part of the header and the extra field length
+		buffer.resize(start + 12);
+		buffer.resize(start + read_upstream(buffer.data() + start, 12));
+
+		auto h = reinterpret_cast<const unsigned char *>(buffer.data() + start);
+		if (buffer.size() - start != 12 or h[0] != 0x1f or h[1] != 0x8b or h[2] != 8 or (h[3] & 4) == 0)
+			return fail();
+
+		std::size_t xlen = h[10] | h[11] << 8;
+
+		buffer.resize(start + 12 + xlen);
+		buffer.resize(start + 12 + read_upstream(buffer.data() + start + 12, xlen));
+		if (buffer.size() - start != 12 + xlen)
+			return fail();
+
+		std::size_t bsize = member_size(reinterpret_cast<const unsigned char *>(buffer.data() + start));
+		if (bsize < 12 + xlen + 8)
+			return fail();
+
+		auto n = bsize - 12 - xlen;
+		buffer.resize(start + bsize);
+		buffer.resize(start + 12 + xlen + read_upstream(buffer.data() + start + 12 + xlen, n));
+		if (buffer.size() - start != bsize)
+			return fail();
+
+		return true;
+	}
+
+	/// \brief Read compressed data from upstream and queue it, called with @a lock held
+	void fill_queue(std::unique_lock<std::mutex> &lock)
+	{
+		const std::size_t kMaxJobs = m_bgzf ? 2 * m_threads.size() + 1 : 4;
+
+		while (not m_upstream_eof and m_jobs.size() < kMaxJobs)
+		{
+			// Regular gzip data is inflated using the shared zstream. With
+			// multiple workers this is only safe one job at a time.
+			if (not m_bgzf and m_threads.size() > 1 and
+				std::find_if(m_jobs.begin(), m_jobs.end(), [](auto &j)
+					{ return not j->bgzf and not j->done; }) != m_jobs.end())
+				break;
+
+			auto j = std::make_unique<job>();
+			j->bgzf = m_bgzf;
+
+			lock.unlock();
+
+			if (j->bgzf)
+			{
+				while (j->in.size() < kBlockSize)
+				{
+					if (not read_bgzf_member(j->in))
+					{
+						// Not BGZF, inflate whatever follows sequentially
+						m_bgzf = false;
+						break;
+					}
+				}
+			}
+			else
+			{
+				j->in.resize(kBlockSize);
+				j->in.resize(read_upstream(j->in.data(), kBlockSize));
+				if (j->in.size() < kBlockSize)
+				{
+					m_upstream_eof = true;
+					j->last = true;
+				}
+			}
+
+			lock.lock();
+
+			// an empty last job is still needed to check the end of the stream
+			if (j->in.empty() and not j->last)
+				continue;
+
+			m_todo.push_back(j.get());
+			m_jobs.push_back(std::move(j));
+
+			m_work_cv.notify_one();
+		}
+	}
+
+	/// \brief The worker thread main loop
+	void work()
+	{
+		z_stream_s zstream{};
+		bool initialised = ::inflateInit2(&zstream, 47) == Z_OK;
+
+		for (;;)
+		{
+			job *j = nullptr;
+
+			{
+				std::unique_lock lock(m_mutex);
+				m_work_cv.wait(lock, [this]()
+					{ return m_stop or not m_todo.empty(); });
+
+				if (m_stop)
+					break;
+
+				j = m_todo.front();
+				m_todo.pop_front();
+			}
+
+			bool ok = false;
+
+			try
+			{
+				ok = j->bgzf ? initialised and inflate_members(zstream, *j) : inflate_stream(*j);
+			}
+			catch (...)
+			{
+				ok = false;
+			}
+
+			{
+				std::unique_lock lock(m_mutex);
+				j->done = true;
+				j->failed = not ok;
+			}
+
+			m_done_cv.notify_all();
+		}
+
+		if (initialised)
+			::inflateEnd(&zstream);
+	}
+
+	/// \brief Inflate the next part of a regular gzip stream
+	bool inflate_stream(job &j)
+	{
+		auto &zstream = m_zstream;
+
+		zstream.next_in = reinterpret_cast<unsigned char *>(j.in.data());
+		zstream.avail_in = static_cast<uInt>(j.in.size());
+
+		while (zstream.avail_in > 0)
+		{
+			// concatenated gzip members
+			if (m_zstream_ended)
+			{
+				if (::inflateReset2(&zstream, 47) != Z_OK)
+					return false;
+				m_zstream_ended = false;
+			}
+
+			auto size = j.out.size();
+			j.out.resize(size + 4 * j.in.size());
+
+			zstream.next_out = reinterpret_cast<unsigned char *>(j.out.data() + size);
+			zstream.avail_out = static_cast<uInt>(j.out.size() - size);
+
+			int err = ::inflate(&zstream, Z_SYNC_FLUSH);
+
+			j.out.resize(j.out.size() - zstream.avail_out);
+
+			if (err == Z_STREAM_END)
+				m_zstream_ended = true;
+			else if (err != Z_OK and err != Z_BUF_ERROR)
+				return false;
+		}
+
+		// at the end of the data the last member should be complete
+		return not j.last or m_zstream_ended or zstream.total_in == 0;
+	}
+
+	/// \brief Inflate a series of complete BGZF members
+	bool inflate_members(z_stream_s &zstream, job &j)
+	{
+		auto data = reinterpret_cast<unsigned char *>(j.in.data());
+		std::size_t offset = 0;
+
+		// The output size is known in advance, it is stored in the member trailers
+		std::size_t total = 0;
+		while (offset < j.in.size())
+		{
+			std::size_t bsize = member_size(data + offset);
+			if (bsize < 20 or bsize > j.in.size() - offset)
+				return false;
+
+			auto t = data + offset + bsize - 4;
+			total += t[0] | t[1] << 8 | t[2] << 16 | static_cast<std::size_t>(t[3]) << 24;
+			offset += bsize;
+		}
+
+		j.out.resize(total);
+
+		// Members may be empty, like the BGZF end-of-file marker, but inflate
+		// does not accept a null output buffer
+		unsigned char empty;
+		zstream.next_out = total > 0 ? reinterpret_cast<unsigned char *>(j.out.data()) : &empty;
+		zstream.avail_out = static_cast<uInt>(j.out.size());
+
+		for (offset = 0; offset < j.in.size();)
+		{
+			std::size_t bsize = member_size(data + offset);
+
+			if (::inflateReset2(&zstream, 47) != Z_OK)
+				return false;
+
+			zstream.next_in = data + offset;
+			zstream.avail_in = static_cast<uInt>(bsize);
+
+			if (::inflate(&zstream, Z_FINISH) != Z_STREAM_END)
+			{
+				// keep what was inflated successfully
+				j.out.resize(j.out.size() - zstream.avail_out);
+				return false;
+			}
+
+			offset += bsize;
+		}
+
+		return zstream.avail_out == 0;
+	}
+
+	/// \brief Return the size of the BGZF member starting at @a h, zero if there is no BC subfield
+	static std::size_t member_size(const unsigned char *h)
+	{
+		std::size_t xlen = h[10] | h[11] << 8;
+		for (std::size_t i = 12; i + 4 <= 12 + xlen;)
+		{
+			std::size_t slen = h[i + 2] | h[i + 3] << 8;
+			if (h[i] == 'B' and h[i + 1] == 'C' and slen == 2 and i + 6 <= 12 + xlen)
+				return (h[i + 4] | h[i + 5] << 8) + 1;
+			i += 4 + slen;
+		}
+		return 0;
+	}
+
+	/// \brief Hand over the next block of inflated data to the consumer
+	int_type underflow() override
+	{
+		while (this->gptr() == this->egptr())
+		{
+			if (m_failed)
+				throw std::runtime_error("Invalid or truncated gzip data");
+
+			std::unique_lock lock(m_mutex);
+
+			m_current.reset();
+
+			fill_queue(lock);
+
+			if (m_jobs.empty())
+				break;
+
+			m_done_cv.wait(lock, [this]()
+				{ return m_jobs.front()->done; });
+
+			m_current = std::move(m_jobs.front());
+			m_jobs.pop_front();
+
+			if (m_current->failed)
+			{
+				// deliver what was inflated, the error is reported in the next call
+				m_upstream_eof = true;
+				m_todo.clear();
+				m_failed = true;
+			}
+			else
+			{
+				// start reading the next block before handing this one over
+				fill_queue(lock);
+			}
+
+			this->setg(m_current->out.data(), m_current->out.data(), m_current->out.data() + m_current->out.size());
+		}
+
+		return this->gptr() != this->egptr() ? traits_type::to_int_type(*this->gptr()) : traits_type::eof();
+	}
+
+  private:
+	std::size_t m_max_threads;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv, m_done_cv;
+
+	/// \brief All pending jobs, in the order of the data
+	std::deque<std::unique_ptr<job>> m_jobs;
+
+	/// \brief The jobs that have not been picked up by a worker yet
+	std::deque<job *> m_todo;
+
+	/// \brief The job whose output is currently being consumed
+	std::unique_ptr<job> m_current;
+
+	/// \brief The bytes read while sniffing the header
+	std::vector<char_type> m_prefix;
+	std::size_t m_prefix_offset = 0;
+
+	bool m_bgzf = false;
+	bool m_stop = false;
+	bool m_upstream_eof = false;
+	bool m_failed = false;
+
+	/// \brief Used to inflate regular gzip data, by one worker at a time
+	z_stream_s m_zstream{};
+	bool m_zstream_initialised = false;
+	bool m_zstream_ended = false;
+};
+
+// --------------------------------------------------------------------
+
 /// \brief A streambuf class that can be used to compress data using zlib
 ///
 /// \tparam CharT		Type of the character stream.
@@ -497,6 +1047,459 @@ class basic_ogzip_streambuf : public basic_streambuf<CharT, Traits>
 
 // --------------------------------------------------------------------
 
+/// \brief A seekable streambuf class that decompresses BGZF data
+///
+/// \tparam CharT		Type of the character stream.
+/// \tparam Traits		Traits for character type, defaults to char_traits<_CharT>.
+///
+/// BGZF is a gzip compatible format that consists of a series of gzip
+/// members, each holding at most 64 KiB of data. The size of each member
+/// is stored in its header, which allows building a table of the members
+/// without inflating them.
+///
+/// This streambuf builds such a table in init and can then seek to any
+/// uncompressed position by inflating only the member that contains it.
+/// Positions are uncompressed offsets, as if the data was not compressed.
+/// The upstream streambuf must be seekable.
+
+template <typename CharT, typename Traits>
+class basic_ibgzf_streambuf : public basic_streambuf<CharT, Traits>
+{
+  public:
+	/** @cond */
+
+	static_assert(sizeof(CharT) == 1, "Unfortunately, support for wide characters is not implemented yet.");
+
+	using char_type = CharT;
+	using traits_type = Traits;
+
+	using streambuf_type = std::basic_streambuf<char_type, traits_type>;
+	using base_type = basic_streambuf<CharT, Traits>;
+
+	using int_type = typename traits_type::int_type;
+	using pos_type = typename traits_type::pos_type;
+	using off_type = typename traits_type::off_type;
+
+	basic_ibgzf_streambuf() = default;
+
+	basic_ibgzf_streambuf(const basic_ibgzf_streambuf &) = delete;
+	basic_ibgzf_streambuf &operator=(const basic_ibgzf_streambuf &) = delete;
+
+	~basic_ibgzf_streambuf()
+	{
+		close();
+	}
+
+	/** @endcond */
+
+	/// \brief Release the zlib structures and the block table
+	base_type *close() override
+	{
+		if (m_zstream)
+		{
+			::inflateEnd(m_zstream.get());
+			m_zstream.reset(nullptr);
+		}
+
+		m_blocks.clear();
+		m_current = kNoBlock;
+
+		this->setg(nullptr, nullptr, nullptr);
+
+		return this;
+	}
+
+	/// \brief Initialize the streambuf using @a upstream as source
+	///
+	/// Returns nullptr if the data in @a upstream is not BGZF or
+	/// if @a upstream cannot seek.
+	base_type *init(streambuf_type *upstream) override
+	{
+		close();
+
+		this->set_upstream(upstream);
+
+		m_zstream.reset(new z_stream_s);
+		*m_zstream = z_stream_s{};
+
+		if (::inflateInit2(m_zstream.get(), 47) != Z_OK)
+		{
+			m_zstream.reset(nullptr);
+			return nullptr;
+		}
+
+		if (not build_block_table())
+		{
+			close();
+			return nullptr;
+		}
+
+		return this;
+	}
+
+	/// \brief Return the total size of the uncompressed data
+	std::size_t size() const
+	{
+		return m_blocks.empty() ? 0 : m_blocks.back().uoffset;
+	}
+
+  private:
+	/// \brief The start of a member, both in the compressed and in the uncompressed data
+	struct block
+	{
+		std::size_t coffset, uoffset;
+	};
+
+	static constexpr std::size_t kNoBlock = ~std::size_t(0);
+
+	/// \brief Read the headers of all members, the last entry in
+	/// m_blocks marks the end of the data
+	bool build_block_table()
+	{
+		auto &upstream = *this->m_upstream;
+
+		if (upstream.pubseekpos(0, std::ios_base::in) != pos_type(0))
+			return false;
+
+		std::size_t coffset = 0, uoffset = 0;
+		std::vector<unsigned char> extra;
+
+		for (;;)
+		{
+			unsigned char h[12];
+			auto n = upstream.sgetn(reinterpret_cast<char_type *>(h), sizeof(h));
+
+			if (n == 0)
+				break;
+
+			if (n != sizeof(h) or h[0] != 0x1f or h[1] != 0x8b or h[2] != 8 or (h[3] & 4) == 0)
+				return false;
+
+			std::size_t xlen = h[10] | h[11] << 8;
+			extra.resize(xlen);
+			if (upstream.sgetn(reinterpret_cast<char_type *>(extra.data()), xlen) != static_cast<std::streamsize>(xlen))
+				return false;
+
+			std::size_t bsize = 0;
+			for (std::size_t i = 0; i + 4 <= xlen;)
+			{
+				std::size_t slen = extra[i + 2] | extra[i + 3] << 8;
+				if (extra[i] == 'B' and extra[i + 1] == 'C' and slen == 2 and i + 6 <= xlen)
+				{
+					bsize = (extra[i + 4] | extra[i + 5] << 8) + 1;
+					break;
+				}
+				i += 4 + slen;
+			}
+
+			if (bsize < 12 + xlen + 8)
+				return false;
+
+			// The uncompressed size is in the last four bytes of the member
+			unsigned char isize[4];
+			if (upstream.pubseekpos(coffset + bsize - 4, std::ios_base::in) != pos_type(coffset + bsize - 4) or
+				upstream.sgetn(reinterpret_cast<char_type *>(isize), 4) != 4)
+				return false;
+
+			m_blocks.push_back({ coffset, uoffset });
+
+			coffset += bsize;
+			uoffset += isize[0] | isize[1] << 8 | isize[2] << 16 | static_cast<std::size_t>(isize[3]) << 24;
+		}
+
+		m_blocks.push_back({ coffset, uoffset });
+
+		return m_blocks.size() > 1;
+	}
+
+	/// \brief Inflate block @a nr and make its data available
+	bool load_block(std::size_t nr)
+	{
+		auto &b = m_blocks[nr];
+		auto &e = m_blocks[nr + 1];
+
+		m_in_buffer.resize(e.coffset - b.coffset);
+		m_out_buffer.resize(e.uoffset - b.uoffset);
+
+		if (this->m_upstream->pubseekpos(b.coffset, std::ios_base::in) != pos_type(b.coffset) or
+			this->m_upstream->sgetn(m_in_buffer.data(), m_in_buffer.size()) != static_cast<std::streamsize>(m_in_buffer.size()))
+			return false;
+
+		auto &zstream = *m_zstream;
+
+		if (::inflateReset2(&zstream, 47) != Z_OK)
+			return false;
+
+		zstream.next_in = reinterpret_cast<unsigned char *>(m_in_buffer.data());
+		zstream.avail_in = static_cast<uInt>(m_in_buffer.size());
+		zstream.next_out = reinterpret_cast<unsigned char *>(m_out_buffer.data());
+		zstream.avail_out = static_cast<uInt>(m_out_buffer.size());
+
+		if (::inflate(&zstream, Z_FINISH) != Z_STREAM_END or zstream.avail_out != 0)
+			return false;
+
+		m_current = nr;
+		this->setg(m_out_buffer.data(), m_out_buffer.data(), m_out_buffer.data() + m_out_buffer.size());
+
+		return true;
+	}
+
+	int_type underflow() override
+	{
+		if (not m_zstream)
+			return traits_type::eof();
+
+		while (this->gptr() == this->egptr())
+		{
+			std::size_t next = m_current == kNoBlock ? 0 : m_current + 1;
+
+			if (next + 1 >= m_blocks.size())
+				return traits_type::eof();
+
+			// corrupt data, treat as end of file from now on
+			if (not load_block(next))
+			{
+				close();
+				return traits_type::eof();
+			}
+		}
+
+		return traits_type::to_int_type(*this->gptr());
+	}
+
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+	{
+		if (not m_zstream or (which & std::ios_base::in) == 0)
+			return pos_type(off_type(-1));
+
+		off_type pos = off;
+
+		if (dir == std::ios_base::cur)
+		{
+			if (m_current != kNoBlock)
+				pos += m_blocks[m_current].uoffset + (this->gptr() - this->eback());
+		}
+		else if (dir == std::ios_base::end)
+			pos += size();
+
+		return seekpos(pos, which);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+	{
+		if (not m_zstream or (which & std::ios_base::in) == 0 or pos < 0 or static_cast<std::size_t>(pos) > size())
+			return pos_type(off_type(-1));
+
+		std::size_t p = static_cast<std::size_t>(pos);
+
+		// The last member that starts at or before p, skipping empty members
+		auto i = std::upper_bound(m_blocks.begin(), m_blocks.end() - 1, p, [](std::size_t p, const block &b)
+			{ return p < b.uoffset; });
+		std::size_t nr = (i - m_blocks.begin()) - 1;
+
+		if (nr != m_current and not load_block(nr))
+		{
+			close();
+			return pos_type(off_type(-1));
+		}
+
+		this->setg(m_out_buffer.data(), m_out_buffer.data() + (p - m_blocks[nr].uoffset), m_out_buffer.data() + m_out_buffer.size());
+
+		return pos;
+	}
+
+  private:
+	/// \brief The zlib internal structures
+	std::unique_ptr<z_stream_s> m_zstream;
+
+	/// \brief The table of members
+	std::vector<block> m_blocks;
+
+	/// \brief The member whose data is currently in m_out_buffer
+	std::size_t m_current = kNoBlock;
+
+	std::vector<char_type> m_in_buffer, m_out_buffer;
+};
+
+// --------------------------------------------------------------------
+
+/// \brief A streambuf class that compresses data into BGZF format
+///
+/// \tparam CharT		Type of the character stream.
+/// \tparam Traits		Traits for character type, defaults to char_traits<_CharT>.
+///
+/// The data is written as a series of independent gzip members of
+/// at most 64 KiB each, followed by an empty end of file member.
+/// The result can be read by any gzip decompressor and allows random
+/// access using basic_ibgzf_streambuf.
+
+template <typename CharT, typename Traits>
+class basic_obgzf_streambuf : public basic_streambuf<CharT, Traits>
+{
+  public:
+	/** @cond */
+
+	static_assert(sizeof(CharT) == 1, "Unfortunately, support for wide characters is not implemented yet.");
+
+	using char_type = CharT;
+	using traits_type = Traits;
+
+	using streambuf_type = std::basic_streambuf<char_type, traits_type>;
+	using base_type = basic_streambuf<CharT, Traits>;
+
+	using int_type = typename traits_type::int_type;
+	using pos_type = typename traits_type::pos_type;
+	using off_type = typename traits_type::off_type;
+
+	basic_obgzf_streambuf() = default;
+
+	basic_obgzf_streambuf(const basic_obgzf_streambuf &) = delete;
+	basic_obgzf_streambuf &operator=(const basic_obgzf_streambuf &) = delete;
+
+	~basic_obgzf_streambuf()
+	{
+		close();
+	}
+
+	/** @endcond */
+
+	/// \brief Write out the pending data and the end of file marker
+	base_type *close() override
+	{
+		if (m_open)
+		{
+			m_open = false;
+
+			if (write_block() and this->pptr() == this->pbase())
+			{
+				static const unsigned char kEOFMarker[28] = {
+					0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+					0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+				};
+
+				this->m_upstream->sputn(reinterpret_cast<const char_type *>(kEOFMarker), sizeof(kEOFMarker));
+			}
+		}
+
+		this->setp(nullptr, nullptr);
+
+		return this;
+	}
+
+	/// \brief Initialize the streambuf using @a upstream as destination
+	base_type *init(streambuf_type *upstream) override
+	{
+		close();
+
+		this->set_upstream(upstream);
+
+		m_in_buffer.resize(kBlockSize);
+		m_out_buffer.resize(kMaxMemberSize);
+
+		this->setp(m_in_buffer.data(), m_in_buffer.data() + m_in_buffer.size());
+		m_open = true;
+
+		return this;
+	}
+
+  private:
+	/// \brief The amount of data stored in one member, this leaves enough room
+	/// for the case where the data does not compress.
+	static constexpr std::size_t kBlockSize = 0xff00;
+
+	/// \brief The maximum size of a BGZF member
+	static constexpr std::size_t kMaxMemberSize = 0x10000;
+
+	/// \brief Compress the data in the put area into a new member
+	bool write_block()
+	{
+		std::size_t size = this->pptr() - this->pbase();
+		if (size == 0)
+			return true;
+
+		const std::size_t kHeaderSize = 18, kTrailerSize = 8;
+
+		// Data that does not compress is stored instead
+		std::size_t clen = 0;
+		for (int level : { Z_DEFAULT_COMPRESSION, Z_NO_COMPRESSION })
+		{
+			z_stream_s zstream{};
+			if (::deflateInit2(&zstream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				return false;
+
+			zstream.next_in = reinterpret_cast<unsigned char *>(this->pbase());
+			zstream.avail_in = static_cast<uInt>(size);
+			zstream.next_out = reinterpret_cast<unsigned char *>(m_out_buffer.data() + kHeaderSize);
+			zstream.avail_out = static_cast<uInt>(kMaxMemberSize - kHeaderSize - kTrailerSize);
+
+			int err = ::deflate(&zstream, Z_FINISH);
+			clen = zstream.total_out;
+			::deflateEnd(&zstream);
+
+			if (err == Z_STREAM_END)
+				break;
+
+			clen = 0;
+		}
+
+		if (clen == 0)
+			return false;
+
+		auto bsize = kHeaderSize + clen + kTrailerSize;
+		auto crc = ::crc32(0, reinterpret_cast<const unsigned char *>(this->pbase()), static_cast<uInt>(size));
+
+		const unsigned char header[kHeaderSize] = {
+			0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+			static_cast<unsigned char>(bsize - 1), static_cast<unsigned char>((bsize - 1) >> 8)
+		};
+
+		auto out = reinterpret_cast<unsigned char *>(m_out_buffer.data());
+		std::copy(header, header + kHeaderSize, out);
+
+		auto t = out + kHeaderSize + clen;
+		for (int i = 0; i < 4; ++i)
+		{
+			t[i] = static_cast<unsigned char>(crc >> (8 * i));
+			t[i + 4] = static_cast<unsigned char>(size >> (8 * i));
+		}
+
+		if (this->m_upstream->sputn(m_out_buffer.data(), bsize) != static_cast<std::streamsize>(bsize))
+			return false;
+
+		this->setp(m_in_buffer.data(), m_in_buffer.data() + m_in_buffer.size());
+
+		return true;
+	}
+
+	int_type overflow(int_type ch) override
+	{
+		if (not m_open or not write_block())
+			return traits_type::eof();
+
+		if (not traits_type::eq_int_type(ch, traits_type::eof()))
+		{
+			*this->pptr() = traits_type::to_char_type(ch);
+			this->pbump(1);
+		}
+
+		return traits_type::not_eof(ch);
+	}
+
+	int sync() override
+	{
+		if (m_open and not write_block())
+			return -1;
+
+		return this->m_upstream ? this->m_upstream->pubsync() : 0;
+	}
+
+  private:
+	bool m_open = false;
+	std::vector<char_type> m_in_buffer, m_out_buffer;
+};
+
+// --------------------------------------------------------------------
+
 /// \brief An istream implementation that wraps a streambuf with a decompressing streambuf
 ///
 /// \tparam CharT		Type of the character stream.
@@ -628,6 +1631,7 @@ class basic_ifstream : public basic_istream<CharT, Traits>
 	using filebuf_type = std::basic_filebuf<char_type, traits_type>;
 
 	using gzip_streambuf_type = typename base_type::gzip_streambuf_type;
+	using mt_gzip_streambuf_type = basic_igzip_mt_streambuf<char_type, traits_type>;
 
 	/// \brief Default constructor, does not open a file since none is specified
 	basic_ifstream() = default;
@@ -710,7 +1714,14 @@ class basic_ifstream : public basic_istream<CharT, Traits>
 		else
 		{
 			if (filename.extension() == ".gz")
-				this->m_gziobuf.reset(new gzip_streambuf_type);
+			{
+				// Inflate on background threads when there are threads to spare, BGZF
+				// data in parallel and regular gzip data ahead of the reader
+				if (std::thread::hardware_concurrency() > 1 and mt_gzip_streambuf_type::is_gzip(m_filebuf))
+					this->m_gziobuf.reset(new mt_gzip_streambuf_type);
+				else
+					this->m_gziobuf.reset(new gzip_streambuf_type);
+			}
 
 			if (not this->m_gziobuf)
 			{
@@ -1087,4 +2098,28 @@ using ifstream = basic_ifstream<char, std::char_traits<char>>;
 /// \brief Convenience typedef for a file ofstream
 using ofstream = basic_ofstream<char, std::char_traits<char>>;
 
+// --------------------------------------------------------------------
+
+/// \brief Copy the data from @a in to @a out compressing it into the BGZF format
+///
+/// When @a in is a gzio::istream this can be used to convert a regular gzip
+/// file into a BGZF file that allows random access.
+/// \result Returns true if all data was written successfully
+
+inline bool convert_to_bgzf(std::istream &in, std::ostream &out)
+{
+	basic_obgzf_streambuf<char, std::char_traits<char>> buffer;
+	if (buffer.init(out.rdbuf()) == nullptr)
+		return false;
+
+	std::ostream os(&buffer);
+	os << in.rdbuf();
+
+	bool result = not os.bad();
+
+	buffer.close();
+
+	return result and out.good();
+}
+
 } // namespace gzio
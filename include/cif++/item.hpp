@@ -40,6 +40,7 @@
 #include <memory>
 #include <optional>
 #include <utility>
+#include <vector>
 
 /** \file item.hpp
  *
@@ -255,13 +256,77 @@ class item
 	std::string m_value;
 };
 
+// --------------------------------------------------------------------
+/// \brief Storage for the text of item_value objects
+///
+/// The text is allocated in large blocks which are released all at
+/// once. Individual strings are never freed, a category owns a
+/// string_pool and releases it when the category is cleared. Values
+/// updated after they were stored in a category therefore do not use
+/// the pool, they own their text.
+
+class string_pool
+{
+  public:
+	/** @cond */
+	string_pool() = default;
+	string_pool(const string_pool &) = delete;
+	string_pool &operator=(const string_pool &) = delete;
+
+	string_pool(string_pool &&rhs) noexcept
+	{
+		swap(rhs);
+	}
+
+	string_pool &operator=(string_pool &&rhs) noexcept
+	{
+		swap(rhs);
+		return *this;
+	}
+
+	~string_pool()
+	{
+		release();
+	}
+
+	void swap(string_pool &rhs) noexcept
+	{
+		std::swap(m_blocks, rhs.m_blocks);
+		std::swap(m_ptr, rhs.m_ptr);
+		std::swap(m_end, rhs.m_end);
+	}
+	/** @endcond */
+
+	/// \brief Return whether this pool holds no storage
+	bool empty() const
+	{
+		return m_blocks.empty();
+	}
+
+	/// \brief Return storage for @a n characters
+	char *allocate(std::size_t n);
+
+	/// \brief Take over the storage of @a rhs, which will be empty afterwards
+	void splice(string_pool &rhs);
+
+	/// \brief Release all storage
+	void release();
+
+  private:
+	static constexpr std::size_t kBlockSize = 64 * 1024;
+
+	std::vector<char *> m_blocks;
+	char *m_ptr = nullptr, *m_end = nullptr;
+};
+
 // --------------------------------------------------------------------
 /// \brief the internal storage for items in a category
 ///
 /// Internal storage, strictly forward linked list with minimal space
 /// requirements. Strings of size 7 or shorter are stored internally.
 /// Typically, more than 99% of the strings in an mmCIF file are less
-/// than 8 bytes in length.
+/// than 8 bytes in length. Longer strings are stored on the heap or,
+/// for values stored in a category, in the string_pool of the category.
 
 struct item_value
 {
@@ -287,6 +352,25 @@ struct item_value
 		}
 	}
 
+	/// \brief constructor, long strings are stored in @a pool
+	item_value(std::string_view text, string_pool &pool)
+		: m_length(text.length())
+		, m_storage(0)
+	{
+		if (m_length >= kBufferSize)
+		{
+			m_data = pool.allocate(m_length + 1);
+			std::copy(text.begin(), text.end(), m_data);
+			m_data[m_length] = 0;
+			m_length |= kPooled;
+		}
+		else
+		{
+			std::copy(text.begin(), text.end(), m_local_data);
+			m_local_data[m_length] = 0;
+		}
+	}
+
 	/** @cond */
 	item_value(item_value &&rhs) noexcept
 		: m_length(std::exchange(rhs.m_length, 0))
@@ -303,7 +387,7 @@ struct item_value
 
 	~item_value()
 	{
-		if (m_length >= kBufferSize)
+		if (m_length >= kBufferSize and (m_length & kPooled) == 0)
 			delete[] m_data;
 		m_storage = 0;
 		m_length = 0;
@@ -319,24 +403,33 @@ struct item_value
 		return m_length != 0;
 	}
 
-	std::size_t m_length = 0; ///< Length of the data
+	std::size_t m_length = 0; ///< Length of the data, the highest bit is set for data in a string_pool
 	union
 	{
 		char m_local_data[8]; ///< Storage area for small strings (strings smaller than kBufferSize)
-		char *m_data;         ///< Pointer to a string stored in the heap
+		char *m_data;         ///< Pointer to a string stored in the heap or in a string_pool
 		uint64_t m_storage;   ///< Alternative storage of the data, used in move operations
 	};
 
 	/** The maximum length of locally stored strings */
 	static constexpr std::size_t kBufferSize = sizeof(m_local_data);
 
+	/** The bit in m_length flagging data stored in a string_pool */
+	static constexpr std::size_t kPooled = std::size_t(1) << (8 * sizeof(std::size_t) - 1);
+
+	/** Return the length of the content */
+	constexpr std::size_t length() const
+	{
+		return m_length & ~kPooled;
+	}
+
 	// By using std::string_view instead of c_str we obain a
 	// nice performance gain since we avoid many calls to strlen.
 
 	/** Return the content of the item as a std::string_view */
 	constexpr inline std::string_view text() const
 	{
-		return { m_length >= kBufferSize ? m_data : m_local_data, m_length };
+		return { m_length >= kBufferSize ? m_data : m_local_data, length() };
 	}
 };
 
@@ -455,6 +548,18 @@ struct item_handle
 		return item_value_as<T>::compare(*this, value, icase);
 	}
 
+	/**
+	 * @brief Return true if the contents of this item equals the
+	 * short value @a value, a value shorter than item_value::kBufferSize.
+	 *
+	 * Short values are stored inside item_value, padded with zeros.
+	 * They are therefore compared as a single word instead of character
+	 * by character. Bits set in @a fold_mask are ignored, setting the
+	 * 0x20 bit for characters that are letters results in a case
+	 * insensitive comparison.
+	 */
+	bool equals_short(const item_value &value, uint64_t fold_mask = 0) const;
+
 	/**
 	 * @brief Compare the value contained with the value @a value and
 	 * return true if both are equal.
@@ -530,7 +530,7 @@ class conditional_iterator_proxy
 		using pointer = value_type *;
 		using reference = value_type;
 
-		conditional_iterator_impl(CategoryType &cat, row_iterator pos, const condition &cond, const std::array<uint16_t, N> &cix);
+		conditional_iterator_impl(CategoryType &cat, row_iterator pos, const condition &cond, const std::array<uint16_t, N> &cix, bool use_candidates);
 		conditional_iterator_impl(const conditional_iterator_impl &i) = default;
 		conditional_iterator_impl &operator=(const conditional_iterator_impl &i) = default;
 
@@ -549,6 +549,24 @@ class conditional_iterator_proxy
 
 		conditional_iterator_impl &operator++()
 		{
+			if (m_candidates != nullptr)
+			{
+				// only visit the rows found in the secondary index
+				while (m_begin != m_end)
+				{
+					if (++m_candidate_ix >= m_candidates->size())
+						m_begin = m_end;
+					else
+					{
+						m_begin = base_iterator(row_iterator(*m_cat, (*m_candidates)[m_candidate_ix]), m_cix);
+						if (m_condition->operator()(m_begin))
+							break;
+					}
+				}
+
+				return *this;
+			}
+
 			while (m_begin != m_end)
 			{
 				if (++m_begin == m_end)
@@ -585,6 +603,9 @@ class conditional_iterator_proxy
 		base_iterator m_begin, m_end;
 		value_type m_current;
 		const condition *m_condition;
+		std::array<uint16_t, N> m_cix;
+		const std::vector<row *> *m_candidates = nullptr;
+		std::size_t m_candidate_ix = 0;
 	};
 
 	using iterator = conditional_iterator_impl;
@@ -621,6 +642,7 @@ class conditional_iterator_proxy
 	condition m_condition;
 	row_iterator mCBegin, mCEnd;
 	std::array<uint16_t, N> mCix;
+	bool m_use_candidates = false;
 };
 
 // --------------------------------------------------------------------
@@ -653,14 +675,26 @@ iterator_proxy<Category, Ts...>::iterator_proxy(Category &cat, row_iterator pos,
 
 template <typename Category, typename... Ts>
 conditional_iterator_proxy<Category, Ts...>::conditional_iterator_impl::conditional_iterator_impl(
-	Category &cat, row_iterator pos, const condition &cond, const std::array<uint16_t, N> &cix)
+	Category &cat, row_iterator pos, const condition &cond, const std::array<uint16_t, N> &cix, bool use_candidates)
 	: m_cat(&cat)
 	, m_begin(pos, cix)
 	, m_end(cat.end(), cix)
 	, m_condition(&cond)
+	, m_cix(cix)
 {
 	if (m_condition == nullptr or m_condition->empty())
 		m_begin = m_end;
+	else if (use_candidates and (m_candidates = m_condition->candidates()) != nullptr)
+	{
+		// pos is either one of the candidates or the end
+		if (m_begin == m_end)
+			m_candidate_ix = m_candidates->size();
+		else
+		{
+			while (m_candidate_ix < m_candidates->size() and row_iterator(cat, (*m_candidates)[m_candidate_ix]) != pos)
+				++m_candidate_ix;
+		}
+	}
 }
 
 template <typename Category, typename... Ts>
@@ -669,6 +703,7 @@ conditional_iterator_proxy<Category, Ts...>::conditional_iterator_proxy(conditio
 	, mCBegin(p.mCBegin)
 	, mCEnd(p.mCEnd)
 	, mCix(p.mCix)
+	, m_use_candidates(p.m_use_candidates)
 {
 	std::swap(m_cat, p.m_cat);
 	std::swap(mCix, p.mCix);
@@ -689,8 +724,22 @@ conditional_iterator_proxy<Category, Ts...>::conditional_iterator_proxy(Category
 	{
 		m_condition.prepare(cat);
 
-		while (mCBegin != mCEnd and not m_condition(*mCBegin))
-			++mCBegin;
+		// The rows found using a secondary index can only be used when
+		// starting at the first row
+		auto candidates = m_condition.candidates();
+		m_use_candidates = candidates != nullptr and pos == cat.begin();
+
+		if (m_use_candidates)
+		{
+			auto ci = std::find_if(candidates->begin(), candidates->end(),
+				[this](row *r) { return m_condition(row_handle(*m_cat, *r)); });
+			mCBegin = ci == candidates->end() ? mCEnd : row_iterator(cat, *ci);
+		}
+		else
+		{
+			while (mCBegin != mCEnd and not m_condition(*mCBegin))
+				++mCBegin;
+		}
 	}
 	else
 		mCBegin = mCEnd;
@@ -709,13 +758,13 @@ conditional_iterator_proxy<Category, Ts...> &conditional_iterator_proxy<Category
 template <typename Category, typename... Ts>
 typename conditional_iterator_proxy<Category, Ts...>::iterator conditional_iterator_proxy<Category, Ts...>::begin() const
 {
-	return iterator(*m_cat, mCBegin, m_condition, mCix);
+	return iterator(*m_cat, mCBegin, m_condition, mCix, m_use_candidates);
 }
 
 template <typename Category, typename... Ts>
 typename conditional_iterator_proxy<Category, Ts...>::iterator conditional_iterator_proxy<Category, Ts...>::end() const
 {
-	return iterator(*m_cat, mCEnd, m_condition, mCix);
+	return iterator(*m_cat, mCEnd, m_condition, mCix, m_use_candidates);
 }
 
 template <typename Category, typename... Ts>
@@ -732,6 +781,7 @@ void conditional_iterator_proxy<Category, Ts...>::swap(conditional_iterator_prox
 	std::swap(mCBegin, rhs.mCBegin);
 	std::swap(mCEnd, rhs.mCEnd);
 	std::swap(mCix, rhs.mCix);
+	std::swap(m_use_candidates, rhs.m_use_candidates);
 }
 
 /** @endcond */
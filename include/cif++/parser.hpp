@@ -28,7 +28,12 @@
 
 #include "cif++/row.hpp"
 
+#include <functional>
+#include <limits>
 #include <map>
+#include <memory>
+#include <optional>
+#include <tuple>
 
 /**
  * @file parser.hpp
@@ -54,6 +59,50 @@ class parse_error : public std::runtime_error
 
 // --------------------------------------------------------------------
 
+/**
+ * @brief Options for loading only part of the data in a file
+ *
+ * Categories that are not accepted are skipped by the parser, their
+ * values are tokenised but no rows or item values are created for them.
+ * The same is true for items that are not accepted in a category.
+ * All names are compared ignoring character case.
+ */
+struct load_options
+{
+	/// \brief Only load the categories in this set, if not empty
+	iset categories;
+
+	/// \brief Do not load the categories in this set
+	iset skip_categories;
+
+	/// \brief Map containing the items to load, for the categories in this map
+	/// only the items listed are loaded. Other categories are loaded completely.
+	/// The key items of a category are always loaded when it has a validator.
+	std::map<std::string, iset, iless> items;
+
+	/// \brief Return true if all data is loaded
+	bool empty() const
+	{
+		return categories.empty() and skip_categories.empty() and items.empty();
+	}
+
+	/// \brief Return true if category @a name should be loaded
+	bool accept_category(std::string_view name) const
+	{
+		std::string n(name);
+		return (categories.empty() or categories.count(n)) and skip_categories.count(n) == 0;
+	}
+
+	/// \brief Return true if item @a item in category @a category should be loaded
+	bool accept_item(std::string_view category, std::string_view item) const
+	{
+		auto i = items.find(std::string{ category });
+		return i == items.end() or i->second.count(std::string{ item });
+	}
+};
+
+// --------------------------------------------------------------------
+
 /**
  * @brief The sac_parser is a similar to SAX parsers (Simple API for XML, 
  * in our case it is Simple API for CIF)
@@ -65,6 +114,11 @@ class parse_error : public std::runtime_error
  * 
  * This class is an abstract base class. Derived classes should
  * implement the produce_ methods.
+ *
+ * Data can be read from a std::istream or directly from a block
+ * of memory, e.g. a memory mapped file. In the latter case the
+ * token values passed to the produce_ methods point directly into
+ * this block of memory, no copying takes place.
  */
 
 // TODO: Need to implement support for transformed long lines
@@ -182,8 +236,23 @@ class sac_parser
 	// Put the last read character back into the istream
 	void retract();
 
+	// Start a new, empty token at the current location
+	void clear_token();
+
+	// The characters read for the current token
+	const char *token_data() const;
+	std::size_t token_size() const;
+
+	// Raw access to the source, bypassing the tokeniser. Used
+	// to quickly locate datablocks.
+	int bump_raw();
+	std::size_t tell_raw();
+	void seek_raw(std::size_t pos);
+
 	CIFToken get_next_token();
 
+	CIFToken get_next_simple_token();
+
 	void match(CIFToken token);
 
 	/** @endcond */
@@ -227,12 +296,25 @@ class sac_parser
 
 	sac_parser(std::istream &is, bool init = true);
 
+	// Parse the data in @a data. The memory should remain
+	// valid for the lifetime of the parser.
+	sac_parser(std::string_view data, bool init = true);
+
 	void parse_global();
 
 	void parse_datablock();
 
+	// Parse the values of a loop_ in @a category containing the
+	// items @a item_names. Derived classes may override this to
+	// read the values in a more efficient way. Values for items
+	// with an empty name should be skipped.
+	virtual void parse_loop_body(std::string_view category, const std::vector<std::string> &item_names);
+
 	virtual void parse_save_frame();
 
+	// Skip the values of a loop_ without producing anything
+	void skip_loop_body();
+
 	void error(const std::string &msg)
 	{
 		if (cif::VERBOSE > 0)
@@ -254,6 +336,11 @@ class sac_parser
 	virtual void produce_row() = 0;
 	virtual void produce_item(std::string_view category, std::string_view item, std::string_view value) = 0;
 
+	// selection methods, data that is not accepted is skipped
+
+	virtual bool accept_category(std::string_view /*name*/) { return true; }
+	virtual bool accept_item(std::string_view /*category*/, std::string_view /*item*/) { return true; }
+
   protected:
 
 	enum class State
@@ -274,7 +361,18 @@ class sac_parser
 		Value
 	};
 
-	std::streambuf &m_source;
+	std::streambuf *m_source = nullptr;
+
+	// When parsing from memory, the characters are taken directly from
+	// the range [m_data_begin, m_data_end). m_data_begin is nullptr otherwise.
+	const char *m_data_begin = nullptr;
+	const char *m_data_end = nullptr;
+	const char *m_data_ptr = nullptr;
+	const char *m_token_start = nullptr;
+	bool m_data_eof = false;
+
+	// Fall back buffer used when the data in memory contains carriage returns
+	std::unique_ptr<std::streambuf> m_data_buffer;
 
 	// Parser state
 	uint32_t m_line_nr;
@@ -306,6 +404,38 @@ class parser : public sac_parser
 	{
 	}
 
+	/// \brief constructor, generates data into @a file from the text in @a data
+	///
+	/// The memory pointed to by @a data should remain valid during parsing.
+	parser(std::string_view data, file &file)
+		: sac_parser(data)
+		, m_file(file)
+	{
+	}
+
+	/// \brief Set the maximum number of threads used to parse the values
+	/// of large loop_ categories. A value of zero means the number of
+	/// hardware threads is used, which is the default. Only data parsed
+	/// from memory is parsed in parallel.
+	void set_max_threads(std::size_t n)
+	{
+		m_max_threads = n;
+	}
+
+	/**
+	 * @brief Only load the data selected by @a options
+	 *
+	 * The key items of categories are always loaded, the validator @a v
+	 * is used to find them. Without one, the dictionary named in the
+	 * audit_conform category is used, if that was parsed already. Otherwise
+	 * all items are loaded for categories with a selection of items.
+	 */
+	void set_load_options(const load_options &options, const validator *v = nullptr)
+	{
+		m_options = options;
+		m_validator = v;
+	}
+
 	/** @cond */
 	void produce_datablock(std::string_view name) override;
 
@@ -315,11 +445,276 @@ class parser : public sac_parser
 
 	void produce_item(std::string_view category, std::string_view item, std::string_view value) override;
 
+	bool accept_category(std::string_view name) override;
+
+	bool accept_item(std::string_view category, std::string_view item) override;
+
   protected:
+	void parse_loop_body(std::string_view category, const std::vector<std::string> &item_names) override;
+
+	bool parse_loop_body_parallel(const std::vector<std::string> &item_names);
+
+	// Items with an empty name are not loaded, they get this index
+	static constexpr uint16_t kSkipItem = std::numeric_limits<uint16_t>::max();
+
+	// Return the indices in the current category for the items in @a item_names
+	std::vector<uint16_t> get_item_indices(const std::vector<std::string> &item_names);
+
+	// Add the linked list of rows [head, tail] to the current category
+	void append_rows(row *head, row *tail);
+
+	// Return the validator for the current datablock, if known
+	const validator *get_validator();
+
 	file &m_file;
 	datablock *m_datablock = nullptr;
 	category *m_category = nullptr;
 	row_handle m_row;
+	std::size_t m_max_threads = 0;
+	load_options m_options;
+	const validator *m_validator = nullptr;
+
+	// The validator found using audit_conform and the datablock it is for
+	const validator *m_db_validator = nullptr;
+	const datablock *m_db_validator_for = nullptr;
+
+	/** @endcond */
+};
+
+// --------------------------------------------------------------------
+
+/** @cond */
+namespace detail
+{
+
+	// Convert the text of a value as found in a file into a value of type T,
+	// using the same rules as item_handle::as<T>().
+
+	inline bool is_empty_text(std::string_view txt)
+	{
+		return txt.empty() or (txt.length() == 1 and (txt.front() == '.' or txt.front() == '?'));
+	}
+
+	template <typename T, typename = void>
+	struct stream_value_as;
+
+	template <typename T>
+	struct stream_value_as<T, std::enable_if_t<std::is_arithmetic_v<T> and not std::is_same_v<T, bool>>>
+	{
+		static T convert(std::string_view txt)
+		{
+			T result = {};
+
+			if (not is_empty_text(txt))
+			{
+				auto b = txt.data();
+				auto e = txt.data() + txt.size();
+
+				std::from_chars_result r = (b + 1 < e and *b == '+' and std::isdigit(b[1])) ? selected_charconv<T>::from_chars(b + 1, e, result) : selected_charconv<T>::from_chars(b, e, result);
+
+				if ((bool)r.ec or r.ptr != e)
+				{
+					result = {};
+					if (cif::VERBOSE)
+						std::cerr << "Not a valid number " << std::quoted(txt) << '\n';
+				}
+			}
+
+			return result;
+		}
+	};
+
+	template <typename T>
+	struct stream_value_as<T, std::enable_if_t<std::is_same_v<T, bool>>>
+	{
+		static bool convert(std::string_view txt)
+		{
+			return iequals(txt, "y");
+		}
+	};
+
+	template <typename T>
+	struct stream_value_as<T, std::enable_if_t<std::is_same_v<T, std::string>>>
+	{
+		static std::string convert(std::string_view txt)
+		{
+			if (is_empty_text(txt))
+				return {};
+			return { txt.data(), txt.size() };
+		}
+	};
+
+	template <typename T>
+	struct stream_value_as<std::optional<T>>
+	{
+		static std::optional<T> convert(std::string_view txt)
+		{
+			std::optional<T> result;
+			if (not is_empty_text(txt))
+				result = stream_value_as<T>::convert(txt);
+			return result;
+		}
+	};
+
+} // namespace detail
+/** @endcond */
+
+/**
+ * @brief A parser that passes the rows of selected categories to
+ * callbacks, with the values already converted into the requested types
+ *
+ * No cif::file is created, only the values of the items requested are
+ * converted and the data of all other categories is skipped. Memory
+ * use is therefore constant, regardless of the size of the data.
+ *
+ * @code{.cpp}
+ * cif::stream_parser p(is);
+ * p.visit<float, float, float, int>("atom_site", { "Cartn_x", "Cartn_y", "Cartn_z", "label_seq_id" },
+ * 	[](float x, float y, float z, int seq_id) { ... });
+ * p.parse_file();
+ * @endcode
+ *
+ * Supported types are the arithmetic types, bool, std::string and
+ * std::optional of these. Missing, null and unknown values are passed
+ * as a default constructed value.
+ */
+class stream_parser : public sac_parser
+{
+  public:
+	/// \brief constructor, parse the data in @a is
+	stream_parser(std::istream &is)
+		: sac_parser(is)
+	{
+	}
+
+	/// \brief constructor, parse the text in @a data
+	///
+	/// The memory pointed to by @a data should remain valid during parsing.
+	stream_parser(std::string_view data)
+		: sac_parser(data)
+	{
+	}
+
+	/**
+	 * @brief Call @a callback for each row in category @a category with
+	 * the values of the items in @a items converted into the types @a Ts
+	 *
+	 * A category can have only one callback, a second call to visit for
+	 * the same category replaces the previous one.
+	 *
+	 * @tparam Ts The types of the values passed to @a callback
+	 * @param category The name of the category
+	 * @param items The names of the items, one for each type in @a Ts
+	 * @param callback The function called for each row
+	 */
+	template <typename... Ts, typename Callback>
+	void visit(std::string_view category, const std::vector<std::string> &items, Callback &&callback)
+	{
+		static_assert(sizeof...(Ts) > 0, "Specify at least one type to visit");
+
+		if (items.size() != sizeof...(Ts))
+			throw std::runtime_error("The number of items should be equal to the number of types");
+
+		m_visitors[std::string{ category }] = std::make_unique<visitor<Ts...>>(items, std::forward<Callback>(callback));
+	}
+
+	/// \brief Call @a callback with the name of each datablock found
+	void on_datablock(std::function<void(std::string_view)> callback)
+	{
+		m_datablock_callback = std::move(callback);
+	}
+
+	/// \brief Parse the data, calling the callbacks for the rows found
+	void parse_file();
+
+  protected:
+	/** @cond */
+	void produce_datablock(std::string_view name) override;
+
+	void produce_category(std::string_view name) override;
+
+	void produce_row() override;
+
+	void produce_item(std::string_view category, std::string_view item, std::string_view value) override;
+
+	bool accept_category(std::string_view name) override;
+
+	bool accept_item(std::string_view category, std::string_view item) override;
+
+	void parse_loop_body(std::string_view category, const std::vector<std::string> &item_names) override;
+
+	struct visitor_base
+	{
+		// A setter converts the value and stores it in the visitor
+		using setter_type = void (*)(visitor_base &, std::string_view);
+
+		visitor_base(const std::vector<std::string> &items)
+			: m_items(items)
+		{
+		}
+
+		virtual ~visitor_base() = default;
+
+		// Return the setter for item @a item, or nullptr if it was not requested
+		setter_type get_setter(std::string_view item) const
+		{
+			for (std::size_t i = 0; i < m_items.size(); ++i)
+			{
+				if (iequals(m_items[i], item))
+					return m_setters[i];
+			}
+			return nullptr;
+		}
+
+		// Pass the current values to the callback and reset them
+		virtual void emit() = 0;
+
+		std::vector<std::string> m_items;
+		std::vector<setter_type> m_setters;
+	};
+
+	template <typename... Ts>
+	struct visitor : public visitor_base
+	{
+		template <typename Callback>
+		visitor(const std::vector<std::string> &items, Callback &&callback)
+			: visitor_base(items)
+			, m_callback(std::forward<Callback>(callback))
+		{
+			init_setters(std::index_sequence_for<Ts...>{});
+		}
+
+		template <std::size_t... Is>
+		void init_setters(std::index_sequence<Is...>)
+		{
+			m_setters = { &set<Is>... };
+		}
+
+		template <std::size_t I>
+		static void set(visitor_base &v, std::string_view value)
+		{
+			using value_type = std::tuple_element_t<I, std::tuple<Ts...>>;
+			std::get<I>(static_cast<visitor &>(v).m_values) = detail::stream_value_as<value_type>::convert(value);
+		}
+
+		void emit() override
+		{
+			std::apply(m_callback, m_values);
+			m_values = std::tuple<Ts...>{};
+		}
+
+		std::function<void(Ts...)> m_callback;
+		std::tuple<Ts...> m_values;
+	};
+
+	// Emit the pending row for a category not in a loop_, if any
+	void flush();
+
+	std::map<std::string, std::unique_ptr<visitor_base>, iless> m_visitors;
+	std::function<void(std::string_view)> m_datablock_callback;
+
+	visitor_base *m_visitor = nullptr;
+	bool m_pending = false;
 
 	/** @endcond */
 };
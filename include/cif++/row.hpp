@@ -176,6 +176,12 @@ class row : public std::vector<item_value>
   private:
 	friend class category;
 	friend class category_index;
+	friend class category_tree_index;
+	friend class category_hash_index;
+	friend class secondary_index;
+	friend class parser;
+	friend class binary_io;
+	friend class bcif_io;
 
 	template <typename, typename...>
 	friend class iterator_impl;
@@ -207,6 +213,9 @@ class row_handle
 	friend struct item_handle;
 	friend class category;
 	friend class category_index;
+	friend class category_tree_index;
+	friend class category_hash_index;
+	friend class condition;
 	friend class row_initializer;
 	template <typename, typename...> friend class iterator_impl;
 
@@ -269,6 +278,18 @@ class row_handle
 		return empty() ? item_handle::s_null_item : item_handle(get_item_ix(item_name), const_cast<row_handle &>(*this));
 	}
 
+	/// \brief return a cif::item_handle to the item with precomputed key @a key
+	item_handle operator[](const item_key &key)
+	{
+		return empty() ? item_handle::s_null_item : item_handle(add_item(key), *this);
+	}
+
+	/// \brief return a const cif::item_handle to the item with precomputed key @a key
+	const item_handle operator[](const item_key &key) const
+	{
+		return empty() ? item_handle::s_null_item : item_handle(get_item_ix(key), const_cast<row_handle &>(*this));
+	}
+
 	/// \brief Return an object that can be used in combination with cif::tie
 	/// to assign the values for the items @a items
 	template <typename... C>
@@ -298,6 +319,13 @@ class row_handle
 		return operator[](get_item_ix(item)).template as<T>();
 	}
 
+	/// \brief Get the value of the item with precomputed key @a key cast to type @a T
+	template <typename T>
+	T get(const item_key &key) const
+	{
+		return operator[](get_item_ix(key)).template as<T>();
+	}
+
 	/// \brief assign each of the items named in @a values to their respective value
 	void assign(const std::vector<item> &values)
 	{
@@ -342,9 +370,11 @@ class row_handle
 
   private:
 	uint16_t get_item_ix(std::string_view name) const;
+	uint16_t get_item_ix(const item_key &key) const;
 	std::string_view get_item_name(uint16_t ix) const;
 
 	uint16_t add_item(std::string_view name);
+	uint16_t add_item(const item_key &key);
 
 	row *get_row()
 	{
@@ -28,9 +28,11 @@
 
 #include "cif++/exports.hpp"
 
+#include <array>
 #include <charconv>
 #include <cmath>
 #include <cstdint>
+#include <functional>
 #include <limits>
 #include <set>
 #include <sstream>
@@ -315,6 +317,80 @@ inline char tolower(int ch)
 	return static_cast<char>(kCharToLowerMap[static_cast<uint8_t>(ch)]);
 }
 
+/// \brief return a hash value for @a s ignoring character case, strings
+/// that are equal according to iequals have the same hash value
+inline std::size_t ihash(std::string_view s)
+{
+	// FNV-1a on the lower case characters
+	uint64_t h = 14695981039346656037ULL;
+	for (char ch : s)
+	{
+		h ^= kCharToLowerMap[static_cast<uint8_t>(ch)];
+		h *= 1099511628211ULL;
+	}
+	return static_cast<std::size_t>(h);
+}
+
+/// \brief return a hash value for the number @a v
+///
+/// Numbers are equal when they differ no more than epsilon, see
+/// item_handle::compare. Since that relation is not transitive, equal
+/// numbers can have different hash values. A number equal to @a v has
+/// the hash value of either v - epsilon or v + epsilon, these are
+/// returned by number_hashes.
+inline std::size_t number_hash(double v)
+{
+	// Numbers hash on their value rounded to a multiple of 2^-40, that
+	// way numbers that are equal nearly always have the same hash. From
+	// 2^22 up, numbers are only equal to themselves, the distance to the
+	// next number exceeds epsilon.
+	if (std::abs(v) < 0x1p22)
+		v = std::round(v * 0x1p40) + 0.0; // -0 equals 0
+
+	return std::hash<double>{}(v);
+}
+
+/// \brief return the hash values a number equal to @a v can have, see
+/// number_hash. Both are the same, unless @a v is very close to halfway
+/// two multiples of 2^-40.
+inline std::array<std::size_t, 2> number_hashes(double v)
+{
+	constexpr double kEpsilon = std::numeric_limits<double>::epsilon();
+	return { number_hash(v - kEpsilon), number_hash(v + kEpsilon) };
+}
+
+/**
+ * \brief A precomputed key for looking up an item by name
+ *
+ * Looking up an item by name requires hashing that name. When the
+ * same name is used over and over again, e.g. in a loop over all
+ * atoms, it pays to do that only once:
+ *
+ * \code{.cpp}
+ * static const auto kCartnX = cif::item_key("Cartn_x");
+ *
+ * for (auto r : db["atom_site"])
+ * 	x += r[kCartnX].as<float>();
+ * \endcode
+ */
+class item_key
+{
+  public:
+	/// \brief Construct a key for the item named @a name
+	explicit item_key(std::string_view name)
+		: m_name(name)
+		, m_hash(ihash(name))
+	{
+	}
+
+	const std::string &name() const { return m_name; } ///< The item name
+	std::size_t hash() const { return m_hash; }         ///< The case insensitive hash of name()
+
+  private:
+	std::string m_name;
+	std::size_t m_hash;
+};
+
 // --------------------------------------------------------------------
 
 /** \brief return a tuple consisting of the category and item name for @a item_name
@@ -321,6 +321,18 @@ class progress_bar
 
 std::unique_ptr<std::istream> load_resource(std::filesystem::path name);
 
+/**
+ * @brief Return the location on disk of the resource named @a name
+ * 
+ * The same search order as in load_resource is used. Resources that
+ * are only available as compiled in resources have no location.
+ * 
+ * @param name The named resource to locate
+ * @return std::filesystem::path The path to the file or empty if not found
+ */
+
+std::filesystem::path locate_resource(std::filesystem::path name);
+
 /**
  * @brief Add a file specified by @a dataFile as the data for resource @a name
  * 
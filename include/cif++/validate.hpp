@@ -270,6 +270,16 @@ struct type_validator
 	/// values are equal. Less than zero means @a a sorts before @a b
 	/// and a value larger than zero likewise means the opposite
 	int compare(std::string_view a, std::string_view b) const;
+
+	/// @brief Return a hash value for @a v based on the primitive type
+	/// of this type. Values for which compare returns zero have the
+	/// same hash value, except for numbers that differ by no more than
+	/// epsilon, see hashes.
+	std::size_t hash(std::string_view v) const;
+
+	/// @brief Return the hash values a value for which compare with @a v
+	/// returns zero can have. These are the same, unless @a v is a number.
+	std::array<std::size_t, 2> hashes(std::string_view v) const;
 };
 
 /** @brief Item alias, items can be renamed over time
@@ -0,0 +1,1328 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2022 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "cif++/file.hpp"
+#include "cif++/gzio.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <functional>
+#include <unordered_map>
+
+// --------------------------------------------------------------------
+// BinaryCIF support
+//
+// BinaryCIF is a MessagePack encoded representation of mmCIF data, see
+// https://github.com/molstar/BinaryCIF for the specification. The data
+// is stored by column, each column is encoded using a chain of encodings
+// that is reversed when decoding.
+//
+// The MessagePack codec is contained in this file, only the subset
+// needed for BinaryCIF is implemented, extension types are skipped.
+
+namespace cif
+{
+
+namespace
+{
+
+[[noreturn]] void bcif_error(const std::string &msg)
+{
+	throw std::runtime_error("Invalid BinaryCIF data: " + msg);
+}
+
+// --------------------------------------------------------------------
+// MessagePack decoding, into a simple tree of values. Strings and binary
+// data are not copied, they refer to the data being decoded.
+
+struct msgpack_value
+{
+	enum class value_kind : uint8_t
+	{
+		nil,
+		boolean,
+		integer,
+		real,
+		string,
+		binary,
+		array,
+		map
+	};
+
+	value_kind m_kind = value_kind::nil;
+	bool m_bool = false;
+	int64_t m_int = 0;
+	double m_real = 0;
+	std::string_view m_text;
+	std::vector<msgpack_value> m_items;
+	std::vector<std::string_view> m_keys;
+
+	bool is_nil() const { return m_kind == value_kind::nil; }
+
+	const msgpack_value *find(std::string_view key) const
+	{
+		if (m_kind == value_kind::map)
+		{
+			for (std::size_t i = 0; i < m_keys.size(); ++i)
+			{
+				if (m_keys[i] == key)
+					return &m_items[i];
+			}
+		}
+
+		return nullptr;
+	}
+
+	const msgpack_value &operator[](std::string_view key) const
+	{
+		auto v = find(key);
+		if (v == nullptr)
+			bcif_error("missing field " + std::string{ key });
+		return *v;
+	}
+
+	int64_t as_int() const
+	{
+		if (m_kind == value_kind::integer)
+			return m_int;
+		if (m_kind == value_kind::real)
+			return static_cast<int64_t>(m_real);
+		if (m_kind == value_kind::boolean)
+			return m_bool;
+		bcif_error("expected a number");
+	}
+
+	double as_real() const
+	{
+		if (m_kind == value_kind::real)
+			return m_real;
+		if (m_kind == value_kind::integer)
+			return static_cast<double>(m_int);
+		bcif_error("expected a number");
+	}
+
+	bool as_bool() const
+	{
+		if (m_kind == value_kind::boolean)
+			return m_bool;
+		return as_int() != 0;
+	}
+
+	std::string_view as_string() const
+	{
+		if (m_kind != value_kind::string and m_kind != value_kind::binary)
+			bcif_error("expected a string");
+		return m_text;
+	}
+
+	const std::vector<msgpack_value> &as_array() const
+	{
+		if (m_kind != value_kind::array)
+			bcif_error("expected an array");
+		return m_items;
+	}
+};
+
+class msgpack_decoder
+{
+  public:
+	msgpack_decoder(std::string_view data)
+		: m_ptr(data.data())
+		, m_end(data.data() + data.length())
+	{
+	}
+
+	msgpack_value decode()
+	{
+		msgpack_value result;
+		decode(result, 0);
+		return result;
+	}
+
+  private:
+	static constexpr int kMaxDepth = 64;
+
+	uint8_t byte()
+	{
+		if (m_ptr == m_end)
+			bcif_error("unexpected end of data");
+		return static_cast<uint8_t>(*m_ptr++);
+	}
+
+	uint64_t big_endian(int n)
+	{
+		if (m_end - m_ptr < n)
+			bcif_error("unexpected end of data");
+
+		uint64_t result = 0;
+		for (int i = 0; i < n; ++i)
+			result = result << 8 | static_cast<uint8_t>(*m_ptr++);
+		return result;
+	}
+
+	std::string_view bytes(uint64_t n)
+	{
+		if (n > static_cast<uint64_t>(m_end - m_ptr))
+			bcif_error("unexpected end of data");
+
+		std::string_view result(m_ptr, n);
+		m_ptr += n;
+		return result;
+	}
+
+	void decode(msgpack_value &v, int depth)
+	{
+		using value_kind = msgpack_value::value_kind;
+
+		if (depth > kMaxDepth)
+			bcif_error("nesting too deep");
+
+		uint8_t b = byte();
+
+		if (b <= 0x7f)
+		{
+			v.m_kind = value_kind::integer;
+			v.m_int = b;
+		}
+		else if (b >= 0xe0)
+		{
+			v.m_kind = value_kind::integer;
+			v.m_int = static_cast<int8_t>(b);
+		}
+		else if ((b & 0xf0) == 0x80)
+			decode_map(v, b & 0x0f, depth);
+		else if ((b & 0xf0) == 0x90)
+			decode_array(v, b & 0x0f, depth);
+		else if ((b & 0xe0) == 0xa0)
+		{
+			v.m_kind = value_kind::string;
+			v.m_text = bytes(b & 0x1f);
+		}
+		else
+		{
+			switch (b)
+			{
+				case 0xc0: v.m_kind = value_kind::nil; break;
+				case 0xc2: v.m_kind = value_kind::boolean; v.m_bool = false; break;
+				case 0xc3: v.m_kind = value_kind::boolean; v.m_bool = true; break;
+
+				case 0xc4: v.m_kind = value_kind::binary; v.m_text = bytes(big_endian(1)); break;
+				case 0xc5: v.m_kind = value_kind::binary; v.m_text = bytes(big_endian(2)); break;
+				case 0xc6: v.m_kind = value_kind::binary; v.m_text = bytes(big_endian(4)); break;
+
+				// extension types are not used by BinaryCIF, skip them
+				case 0xc7: bytes(big_endian(1) + 1); break;
+				case 0xc8: bytes(big_endian(2) + 1); break;
+				case 0xc9: bytes(big_endian(4) + 1); break;
+				case 0xd4: bytes(2); break;
+				case 0xd5: bytes(3); break;
+				case 0xd6: bytes(5); break;
+				case 0xd7: bytes(9); break;
+				case 0xd8: bytes(17); break;
+
+				case 0xca:
+				{
+					uint32_t i = static_cast<uint32_t>(big_endian(4));
+					float f;
+					std::memcpy(&f, &i, sizeof(f));
+					v.m_kind = value_kind::real;
+					v.m_real = f;
+					break;
+				}
+
+				case 0xcb:
+				{
+					uint64_t i = big_endian(8);
+					double d;
+					std::memcpy(&d, &i, sizeof(d));
+					v.m_kind = value_kind::real;
+					v.m_real = d;
+					break;
+				}
+
+				case 0xcc: v.m_kind = value_kind::integer; v.m_int = big_endian(1); break;
+				case 0xcd: v.m_kind = value_kind::integer; v.m_int = big_endian(2); break;
+				case 0xce: v.m_kind = value_kind::integer; v.m_int = big_endian(4); break;
+				case 0xcf: v.m_kind = value_kind::integer; v.m_int = static_cast<int64_t>(big_endian(8)); break;
+
+				case 0xd0: v.m_kind = value_kind::integer; v.m_int = static_cast<int8_t>(big_endian(1)); break;
+				case 0xd1: v.m_kind = value_kind::integer; v.m_int = static_cast<int16_t>(big_endian(2)); break;
+				case 0xd2: v.m_kind = value_kind::integer; v.m_int = static_cast<int32_t>(big_endian(4)); break;
+				case 0xd3: v.m_kind = value_kind::integer; v.m_int = static_cast<int64_t>(big_endian(8)); break;
+
+				case 0xd9: v.m_kind = value_kind::string; v.m_text = bytes(big_endian(1)); break;
+				case 0xda: v.m_kind = value_kind::string; v.m_text = bytes(big_endian(2)); break;
+				case 0xdb: v.m_kind = value_kind::string; v.m_text = bytes(big_endian(4)); break;
+
+				case 0xdc: decode_array(v, big_endian(2), depth); break;
+				case 0xdd: decode_array(v, big_endian(4), depth); break;
+				case 0xde: decode_map(v, big_endian(2), depth); break;
+				case 0xdf: decode_map(v, big_endian(4), depth); break;
+
+				default:
+					bcif_error("invalid MessagePack data");
+			}
+		}
+	}
+
+	void decode_array(msgpack_value &v, uint64_t n, int depth)
+	{
+		// every element takes at least one byte
+		if (n > static_cast<uint64_t>(m_end - m_ptr))
+			bcif_error("unexpected end of data");
+
+		v.m_kind = msgpack_value::value_kind::array;
+		v.m_items.resize(n);
+		for (auto &item : v.m_items)
+			decode(item, depth + 1);
+	}
+
+	void decode_map(msgpack_value &v, uint64_t n, int depth)
+	{
+		if (n > static_cast<uint64_t>(m_end - m_ptr))
+			bcif_error("unexpected end of data");
+
+		v.m_kind = msgpack_value::value_kind::map;
+		v.m_keys.resize(n);
+		v.m_items.resize(n);
+
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			msgpack_value key;
+			decode(key, depth + 1);
+			v.m_keys[i] = key.as_string();
+			decode(v.m_items[i], depth + 1);
+		}
+	}
+
+	const char *m_ptr, *m_end;
+};
+
+// --------------------------------------------------------------------
+// MessagePack encoding
+
+class msgpack_encoder
+{
+  public:
+	void write_nil()
+	{
+		m_data.push_back(static_cast<char>(0xc0));
+	}
+
+	void write_bool(bool b)
+	{
+		m_data.push_back(static_cast<char>(b ? 0xc3 : 0xc2));
+	}
+
+	void write_int(int64_t v)
+	{
+		if (v >= 0 and v <= 0x7f)
+			m_data.push_back(static_cast<char>(v));
+		else if (v < 0 and v >= -32)
+			m_data.push_back(static_cast<char>(v));
+		else if (v >= 0)
+		{
+			if (v <= 0xff)
+				write_big_endian(0xcc, v, 1);
+			else if (v <= 0xffff)
+				write_big_endian(0xcd, v, 2);
+			else if (v <= 0xffffffffLL)
+				write_big_endian(0xce, v, 4);
+			else
+				write_big_endian(0xcf, v, 8);
+		}
+		else
+		{
+			if (v >= -0x80)
+				write_big_endian(0xd0, v, 1);
+			else if (v >= -0x8000)
+				write_big_endian(0xd1, v, 2);
+			else if (v >= -0x80000000LL)
+				write_big_endian(0xd2, v, 4);
+			else
+				write_big_endian(0xd3, v, 8);
+		}
+	}
+
+	void write_real(double d)
+	{
+		uint64_t i;
+		std::memcpy(&i, &d, sizeof(i));
+		write_big_endian(0xcb, i, 8);
+	}
+
+	void write_string(std::string_view s)
+	{
+		if (s.length() < 32)
+			m_data.push_back(static_cast<char>(0xa0 | s.length()));
+		else if (s.length() <= 0xff)
+			write_big_endian(0xd9, s.length(), 1);
+		else if (s.length() <= 0xffff)
+			write_big_endian(0xda, s.length(), 2);
+		else
+			write_big_endian(0xdb, s.length(), 4);
+
+		m_data.append(s);
+	}
+
+	void write_binary(std::string_view s)
+	{
+		if (s.length() <= 0xff)
+			write_big_endian(0xc4, s.length(), 1);
+		else if (s.length() <= 0xffff)
+			write_big_endian(0xc5, s.length(), 2);
+		else
+			write_big_endian(0xc6, s.length(), 4);
+
+		m_data.append(s);
+	}
+
+	void write_array(std::size_t n)
+	{
+		if (n < 16)
+			m_data.push_back(static_cast<char>(0x90 | n));
+		else if (n <= 0xffff)
+			write_big_endian(0xdc, n, 2);
+		else
+			write_big_endian(0xdd, n, 4);
+	}
+
+	void write_map(std::size_t n)
+	{
+		if (n < 16)
+			m_data.push_back(static_cast<char>(0x80 | n));
+		else if (n <= 0xffff)
+			write_big_endian(0xde, n, 2);
+		else
+			write_big_endian(0xdf, n, 4);
+	}
+
+	const std::string &data() const { return m_data; }
+
+  private:
+	void write_big_endian(uint8_t marker, uint64_t v, int n)
+	{
+		m_data.push_back(static_cast<char>(marker));
+		for (int i = n - 1; i >= 0; --i)
+			m_data.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+	}
+
+	std::string m_data;
+};
+
+// --------------------------------------------------------------------
+// The BinaryCIF encodings
+
+enum bcif_data_type : int
+{
+	kInt8 = 1,
+	kInt16 = 2,
+	kInt32 = 3,
+	kUint8 = 4,
+	kUint16 = 5,
+	kUint32 = 6,
+	kFloat32 = 32,
+	kFloat64 = 33
+};
+
+/// \brief The result of decoding a column, either integers, reals or strings
+struct bcif_column
+{
+	enum class column_kind
+	{
+		integer,
+		real,
+		string
+	} m_kind = column_kind::integer;
+
+	std::vector<int64_t> m_ints;
+	std::vector<double> m_reals;
+
+	// For string columns, an index into m_strings per row, negative for no value
+	std::vector<std::string_view> m_strings;
+
+	// Fixed point values are kept as integers, with the number of decimals
+	int m_decimals = -1;
+
+	std::size_t size() const
+	{
+		return m_kind == column_kind::real ? m_reals.size() : m_ints.size();
+	}
+};
+
+/// \brief Format @a v divided by 10 to the power @a decimals
+std::string format_fixed(int64_t v, int decimals)
+{
+	bool negative = v < 0;
+	uint64_t u = negative ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+
+	std::string digits = std::to_string(u);
+	if (digits.length() <= static_cast<std::size_t>(decimals))
+		digits.insert(0, decimals + 1 - digits.length(), '0');
+
+	if (decimals > 0)
+		digits.insert(digits.length() - decimals, 1, '.');
+
+	if (negative)
+		digits.insert(digits.begin(), '-');
+
+	return digits;
+}
+
+std::string format_int(int64_t v)
+{
+	char b[32];
+	auto r = std::to_chars(b, b + sizeof(b), v);
+	return { b, r.ptr };
+}
+
+std::string format_real(double v)
+{
+	char b[64];
+	auto r = std::to_chars(b, b + sizeof(b), v);
+	return { b, r.ptr };
+}
+
+void decode(const msgpack_value &encoded, bcif_column &result);
+
+void decode_byte_array(std::string_view data, int type, bcif_column &col)
+{
+	auto read = [data](std::size_t offset, int n)
+	{
+		uint64_t v = 0;
+		for (int i = n - 1; i >= 0; --i)
+			v = v << 8 | static_cast<uint8_t>(data[offset + i]);
+		return v;
+	};
+
+	int size = 0;
+	switch (type)
+	{
+		case kInt8: case kUint8: size = 1; break;
+		case kInt16: case kUint16: size = 2; break;
+		case kInt32: case kUint32: case kFloat32: size = 4; break;
+		case kFloat64: size = 8; break;
+		default: bcif_error("unsupported ByteArray type " + std::to_string(type));
+	}
+
+	if (data.length() % size != 0)
+		bcif_error("invalid ByteArray length");
+
+	std::size_t n = data.length() / size;
+
+	if (type == kFloat32 or type == kFloat64)
+	{
+		col.m_kind = bcif_column::column_kind::real;
+		col.m_reals.resize(n);
+
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			auto v = read(i * size, size);
+			if (type == kFloat32)
+			{
+				uint32_t u = static_cast<uint32_t>(v);
+				float f;
+				std::memcpy(&f, &u, sizeof(f));
+				col.m_reals[i] = f;
+			}
+			else
+				std::memcpy(&col.m_reals[i], &v, sizeof(double));
+		}
+	}
+	else
+	{
+		col.m_kind = bcif_column::column_kind::integer;
+		col.m_ints.resize(n);
+
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			auto v = read(i * size, size);
+			switch (type)
+			{
+				case kInt8: col.m_ints[i] = static_cast<int8_t>(v); break;
+				case kInt16: col.m_ints[i] = static_cast<int16_t>(v); break;
+				case kInt32: col.m_ints[i] = static_cast<int32_t>(v); break;
+				default: col.m_ints[i] = static_cast<int64_t>(v); break;
+			}
+		}
+	}
+}
+
+void expect_integers(const bcif_column &col, const char *encoding)
+{
+	if (col.m_kind != bcif_column::column_kind::integer)
+		bcif_error(std::string("the input for ") + encoding + " should be integers");
+}
+
+/// \brief Decode the data in @a data using the encodings in @a encodings, in reverse order
+void decode(std::string_view data, const std::vector<msgpack_value> &encodings, bcif_column &col)
+{
+	bool first = true;
+
+	for (auto ei = encodings.rbegin(); ei != encodings.rend(); ++ei, first = false)
+	{
+		auto &e = *ei;
+		auto kind = e["kind"].as_string();
+
+		if (kind == "ByteArray")
+		{
+			if (not first)
+				bcif_error("ByteArray should be the first encoding applied");
+			decode_byte_array(data, static_cast<int>(e["type"].as_int()), col);
+		}
+		else if (kind == "StringArray")
+		{
+			if (encodings.size() != 1)
+				bcif_error("StringArray should be the only encoding");
+
+			bcif_column offsets;
+			decode(e["offsets"].as_string(), e["offsetEncoding"].as_array(), offsets);
+			expect_integers(offsets, "StringArray offsets");
+
+			auto text = e["stringData"].as_string();
+
+			col.m_strings.clear();
+			for (std::size_t i = 0; i + 1 < offsets.m_ints.size(); ++i)
+			{
+				auto b = offsets.m_ints[i], l = offsets.m_ints[i + 1];
+				if (b < 0 or l < b or static_cast<std::size_t>(l) > text.length())
+					bcif_error("invalid StringArray offsets");
+				col.m_strings.emplace_back(text.substr(b, l - b));
+			}
+
+			bcif_column indices;
+			decode(data, e["dataEncoding"].as_array(), indices);
+			expect_integers(indices, "StringArray data");
+
+			for (auto i : indices.m_ints)
+			{
+				if (i >= static_cast<int64_t>(col.m_strings.size()))
+					bcif_error("invalid StringArray index");
+			}
+
+			col.m_ints = std::move(indices.m_ints);
+			col.m_kind = bcif_column::column_kind::string;
+		}
+		else if (first)
+			bcif_error(std::string{ kind } + " cannot be applied to binary data");
+		else if (kind == "FixedPoint")
+		{
+			expect_integers(col, "FixedPoint");
+
+			double factor = e["factor"].as_real();
+			if (factor == 0)
+				bcif_error("invalid FixedPoint factor");
+
+			// Powers of ten are kept as integers, to be able to reproduce the text exactly
+			int decimals = static_cast<int>(std::lround(std::log10(factor)));
+			if (decimals >= 0 and decimals <= 15 and std::pow(10.0, decimals) == factor)
+				col.m_decimals = decimals;
+			else
+			{
+				col.m_reals.resize(col.m_ints.size());
+				for (std::size_t i = 0; i < col.m_ints.size(); ++i)
+					col.m_reals[i] = col.m_ints[i] / factor;
+				col.m_ints.clear();
+				col.m_kind = bcif_column::column_kind::real;
+			}
+		}
+		else if (kind == "IntervalQuantization")
+		{
+			expect_integers(col, "IntervalQuantization");
+
+			double min = e["min"].as_real(), max = e["max"].as_real();
+			int64_t steps = e["numSteps"].as_int();
+			double delta = steps > 1 ? (max - min) / (steps - 1) : 0;
+
+			col.m_reals.resize(col.m_ints.size());
+			for (std::size_t i = 0; i < col.m_ints.size(); ++i)
+				col.m_reals[i] = min + delta * col.m_ints[i];
+			col.m_ints.clear();
+			col.m_kind = bcif_column::column_kind::real;
+		}
+		else if (kind == "RunLength")
+		{
+			expect_integers(col, "RunLength");
+
+			auto size = e["srcSize"].as_int();
+			if (col.m_ints.size() % 2 != 0 or size < 0)
+				bcif_error("invalid RunLength data");
+
+			std::vector<int64_t> out;
+			out.reserve(size);
+
+			for (std::size_t i = 0; i < col.m_ints.size(); i += 2)
+			{
+				auto count = col.m_ints[i + 1];
+				if (count < 0 or static_cast<int64_t>(out.size()) + count > size)
+					bcif_error("invalid RunLength data");
+				out.insert(out.end(), count, col.m_ints[i]);
+			}
+
+			col.m_ints = std::move(out);
+		}
+		else if (kind == "Delta")
+		{
+			expect_integers(col, "Delta");
+
+			int64_t v = e["origin"].as_int();
+			for (auto &i : col.m_ints)
+				i = v = v + i;
+		}
+		else if (kind == "IntegerPacking")
+		{
+			expect_integers(col, "IntegerPacking");
+
+			auto byte_count = e["byteCount"].as_int();
+			bool is_unsigned = e["isUnsigned"].as_bool();
+
+			int64_t upper, lower;
+			if (byte_count == 1)
+			{
+				upper = is_unsigned ? 0xff : 0x7f;
+				lower = is_unsigned ? 0 : -0x80;
+			}
+			else if (byte_count == 2)
+			{
+				upper = is_unsigned ? 0xffff : 0x7fff;
+				lower = is_unsigned ? 0 : -0x8000;
+			}
+			else
+				bcif_error("invalid IntegerPacking byteCount");
+
+			std::vector<int64_t> out;
+			out.reserve(std::max<int64_t>(0, e["srcSize"].as_int()));
+
+			auto &in = col.m_ints;
+			for (std::size_t i = 0; i < in.size();)
+			{
+				int64_t v = 0;
+
+				while (i < in.size() and (in[i] == upper or (not is_unsigned and in[i] == lower)))
+					v += in[i++];
+
+				if (i < in.size())
+					v += in[i++];
+
+				out.push_back(v);
+			}
+
+			col.m_ints = std::move(out);
+		}
+		else
+			bcif_error("unsupported encoding " + std::string{ kind });
+	}
+}
+
+void decode(const msgpack_value &encoded, bcif_column &col)
+{
+	decode(encoded["data"].as_string(), encoded["encoding"].as_array(), col);
+}
+
+// --------------------------------------------------------------------
+// Encoding
+
+struct encoded_ints
+{
+	std::vector<std::function<void(msgpack_encoder &)>> m_encodings;
+	std::string m_data;
+};
+
+std::vector<int64_t> pack_integers(const std::vector<int64_t> &values, int byte_count, bool is_unsigned)
+{
+	int64_t upper = byte_count == 1 ? (is_unsigned ? 0xff : 0x7f) : (is_unsigned ? 0xffff : 0x7fff);
+	int64_t lower = byte_count == 1 ? -0x80 : -0x8000;
+
+	std::vector<int64_t> result;
+	result.reserve(values.size());
+
+	for (auto v : values)
+	{
+		if (v >= 0)
+		{
+			while (v >= upper)
+			{
+				result.push_back(upper);
+				v -= upper;
+			}
+		}
+		else
+		{
+			while (v <= lower)
+			{
+				result.push_back(lower);
+				v -= lower;
+			}
+		}
+
+		result.push_back(v);
+	}
+
+	return result;
+}
+
+std::string byte_array(const std::vector<int64_t> &values, int size)
+{
+	std::string result(values.size() * size, 0);
+	for (std::size_t i = 0; i < values.size(); ++i)
+	{
+		auto v = static_cast<uint64_t>(values[i]);
+		for (int b = 0; b < size; ++b)
+			result[i * size + b] = static_cast<char>((v >> (8 * b)) & 0xff);
+	}
+	return result;
+}
+
+/// \brief Encode 32 bit integers, trying delta and run-length encoding
+/// and packing the result into bytes.
+encoded_ints encode_integers(const std::vector<int64_t> &values)
+{
+	encoded_ints result;
+
+	int64_t n = values.size();
+
+	auto run_length = [](const std::vector<int64_t> &v)
+	{
+		std::vector<int64_t> r;
+		for (std::size_t i = 0; i < v.size();)
+		{
+			std::size_t j = i + 1;
+			while (j < v.size() and v[j] == v[i])
+				++j;
+			r.push_back(v[i]);
+			r.push_back(j - i);
+			i = j;
+		}
+		return r;
+	};
+
+	std::vector<int64_t> delta(values.size());
+	for (std::size_t i = 1; i < values.size(); ++i)
+		delta[i] = values[i] - values[i - 1];
+
+	auto rl = run_length(values);
+	auto delta_rl = run_length(delta);
+
+	// Pick the shortest, packing is done afterwards
+	std::vector<int64_t> best = values;
+	bool use_delta = false, use_rl = false;
+
+	auto consider = [&](std::vector<int64_t> &v, bool d, bool r)
+	{
+		// values outside the 32 bit range might result from taking differences
+		for (auto i : v)
+		{
+			if (i < std::numeric_limits<int32_t>::min() or i > std::numeric_limits<int32_t>::max())
+				return;
+		}
+
+		if (v.size() < best.size())
+		{
+			best = std::move(v);
+			use_delta = d;
+			use_rl = r;
+		}
+	};
+
+	consider(rl, false, true);
+	consider(delta_rl, true, true);
+
+	if (use_delta)
+	{
+		int64_t origin = values.empty() ? 0 : values.front();
+		result.m_encodings.emplace_back([origin](msgpack_encoder &e)
+			{
+			e.write_map(3);
+			e.write_string("kind");
+			e.write_string("Delta");
+			e.write_string("origin");
+			e.write_int(origin);
+			e.write_string("srcType");
+			e.write_int(kInt32); });
+	}
+
+	if (use_rl)
+	{
+		result.m_encodings.emplace_back([n](msgpack_encoder &e)
+			{
+			e.write_map(3);
+			e.write_string("kind");
+			e.write_string("RunLength");
+			e.write_string("srcType");
+			e.write_int(kInt32);
+			e.write_string("srcSize");
+			e.write_int(n); });
+	}
+
+	bool is_unsigned = std::all_of(best.begin(), best.end(), [](int64_t v)
+		{ return v >= 0; });
+
+	auto packed_1 = pack_integers(best, 1, is_unsigned);
+	auto packed_2 = pack_integers(best, 2, is_unsigned);
+
+	int byte_count = 4;
+	std::vector<int64_t> *packed = &best;
+
+	if (packed_1.size() <= 2 * packed_2.size() and packed_1.size() < 4 * best.size())
+	{
+		byte_count = 1;
+		packed = &packed_1;
+	}
+	else if (2 * packed_2.size() < 4 * best.size())
+	{
+		byte_count = 2;
+		packed = &packed_2;
+	}
+
+	if (byte_count < 4)
+	{
+		int64_t size = best.size();
+		result.m_encodings.emplace_back([byte_count, is_unsigned, size](msgpack_encoder &e)
+			{
+			e.write_map(4);
+			e.write_string("kind");
+			e.write_string("IntegerPacking");
+			e.write_string("byteCount");
+			e.write_int(byte_count);
+			e.write_string("isUnsigned");
+			e.write_bool(is_unsigned);
+			e.write_string("srcSize");
+			e.write_int(size); });
+	}
+
+	int type = byte_count == 1 ? (is_unsigned ? kUint8 : kInt8) : byte_count == 2 ? (is_unsigned ? kUint16 : kInt16) : kInt32;
+
+	result.m_encodings.emplace_back([type](msgpack_encoder &e)
+		{
+		e.write_map(2);
+		e.write_string("kind");
+		e.write_string("ByteArray");
+		e.write_string("type");
+		e.write_int(type); });
+
+	result.m_data = byte_array(*packed, byte_count);
+
+	return result;
+}
+
+void write_encodings(msgpack_encoder &e, const encoded_ints &ints)
+{
+	e.write_array(ints.m_encodings.size());
+	for (auto &f : ints.m_encodings)
+		f(e);
+}
+
+void write_encoded_data(msgpack_encoder &e, const encoded_ints &ints)
+{
+	e.write_map(2);
+	e.write_string("encoding");
+	write_encodings(e, ints);
+	e.write_string("data");
+	e.write_binary(ints.m_data);
+}
+
+/// \brief Parse @a text as an int32 value, leading zeros are accepted
+bool parse_int32(std::string_view text, int64_t &v)
+{
+	auto r = std::from_chars(text.data(), text.data() + text.length(), v);
+	return r.ec == std::errc{} and r.ptr == text.data() + text.length() and
+	       v >= std::numeric_limits<int32_t>::min() and v <= std::numeric_limits<int32_t>::max();
+}
+
+/// \brief Parse @a text as integer, returns false if the result would not format as @a text
+bool parse_integer(std::string_view text, int64_t &v)
+{
+	return parse_int32(text, v) and format_int(v) == text;
+}
+
+/// \brief Parse @a text as fixed point number with @a decimals decimals,
+/// returns false if the result would not format as @a text
+bool parse_fixed(std::string_view text, int decimals, int64_t &v)
+{
+	auto dot = text.find('.');
+	if (dot == std::string_view::npos or text.length() - dot - 1 != static_cast<std::size_t>(decimals))
+		return false;
+
+	// The integer part and the fraction concatenated, e.g. "-0.125" becomes "-0125".
+	// The leading zeros this leaves are fine for from_chars, the round trip
+	// through format_fixed checks the rest.
+	std::string digits{ text.substr(0, dot) };
+	digits += text.substr(dot + 1);
+
+	return parse_int32(digits, v) and format_fixed(v, decimals) == text;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+class bcif_io
+{
+  public:
+	static void read(const msgpack_value &data, datablock &db);
+	static void write(msgpack_encoder &out, const datablock &db);
+
+  private:
+	static void read(const msgpack_value &data, category &cat);
+	static void write(msgpack_encoder &out, const category &cat);
+};
+
+void bcif_io::read(const msgpack_value &data, datablock &db)
+{
+	db.set_name(data["header"].as_string());
+
+	for (auto &c : data["categories"].as_array())
+	{
+		auto name = c["name"].as_string();
+		if (name.starts_with('_'))
+			name.remove_prefix(1);
+
+		auto &cat = db.emplace_back(name);
+		read(c, cat);
+	}
+}
+
+void bcif_io::read(const msgpack_value &data, category &cat)
+{
+	auto row_count = data["rowCount"].as_int();
+	auto &columns = data["columns"].as_array();
+
+	if (row_count < 0 or columns.size() > std::numeric_limits<uint16_t>::max())
+		bcif_error("invalid category " + cat.m_name);
+
+	for (auto &col : columns)
+	{
+		std::string_view name = col["name"].as_string();
+		cat.m_items.emplace_back(name, ihash(name), nullptr);
+	}
+	cat.rebuild_item_table();
+
+	std::vector<row *> rows;
+	rows.reserve(row_count);
+
+	row *head = nullptr, *tail = nullptr;
+
+	try
+	{
+		for (int64_t i = 0; i < row_count; ++i)
+		{
+			auto r = cat.create_row();
+			r->resize(columns.size());
+
+			if (tail == nullptr)
+				head = r;
+			else
+				tail->m_next = r;
+			tail = r;
+
+			rows.push_back(r);
+		}
+
+		bcif_column values, mask;
+
+		for (uint16_t ix = 0; ix < columns.size(); ++ix)
+		{
+			values = {};
+			mask = {};
+
+			decode(columns[ix]["data"], values);
+			if (values.size() != static_cast<std::size_t>(row_count))
+				bcif_error("the number of values in " + cat.m_name + '.' + cat.m_items[ix].m_name + " does not match the row count");
+
+			if (auto m = columns[ix].find("mask"); m != nullptr and not m->is_nil())
+			{
+				decode(*m, mask);
+				expect_integers(mask, "mask");
+				if (mask.size() != values.size())
+					bcif_error("invalid mask for " + cat.m_name + '.' + cat.m_items[ix].m_name);
+			}
+
+			for (std::size_t i = 0; i < values.size(); ++i)
+			{
+				auto &v = (*rows[i])[ix];
+
+				// 1 means inapplicable, 2 unknown
+				if (not mask.m_ints.empty() and mask.m_ints[i] != 0)
+				{
+					if (mask.m_ints[i] == 1)
+						v = item_value(".", cat.m_strings);
+					continue;
+				}
+
+				switch (values.m_kind)
+				{
+					case bcif_column::column_kind::integer:
+						v = item_value(values.m_decimals >= 0 ? format_fixed(values.m_ints[i], values.m_decimals) : format_int(values.m_ints[i]), cat.m_strings);
+						break;
+
+					case bcif_column::column_kind::real:
+						v = item_value(format_real(values.m_reals[i]), cat.m_strings);
+						break;
+
+					case bcif_column::column_kind::string:
+						if (values.m_ints[i] >= 0)
+							v = item_value(values.m_strings[values.m_ints[i]], cat.m_strings);
+						break;
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		for (auto r : rows)
+			cat.delete_row(r);
+		throw;
+	}
+
+	cat.append_rows(head, tail);
+}
+
+void bcif_io::write(msgpack_encoder &out, const datablock &db)
+{
+	out.write_map(2);
+	out.write_string("header");
+	out.write_string(db.name());
+	out.write_string("categories");
+	out.write_array(db.size());
+
+	for (auto &cat : db)
+		write(out, cat);
+}
+
+void bcif_io::write(msgpack_encoder &out, const category &cat)
+{
+	cat.acquire_rows();
+
+	std::vector<const row *> rows;
+	for (auto r = cat.m_head; r != nullptr; r = r->m_next)
+		rows.push_back(r);
+
+	out.write_map(3);
+	out.write_string("name");
+	out.write_string('_' + cat.m_name);
+	out.write_string("columns");
+	out.write_array(cat.m_items.size());
+
+	std::vector<int64_t> mask(rows.size()), ints(rows.size());
+
+	for (uint16_t ix = 0; ix < cat.m_items.size(); ++ix)
+	{
+		bool masked = false;
+		for (std::size_t i = 0; i < rows.size(); ++i)
+		{
+			auto v = rows[i]->get(ix);
+			mask[i] = (v == nullptr or not *v) ? 2 : v->text() == "." ? 1 : 0;
+			masked = masked or mask[i] != 0;
+		}
+
+		out.write_map(3);
+		out.write_string("name");
+		out.write_string(cat.m_items[ix].m_name);
+		out.write_string("data");
+
+		// Integers first
+		bool is_int = true;
+		for (std::size_t i = 0; is_int and i < rows.size(); ++i)
+		{
+			ints[i] = 0;
+			if (mask[i] == 0)
+				is_int = parse_integer(rows[i]->get(ix)->text(), ints[i]);
+		}
+
+		// Then fixed point numbers with the same number of decimals
+		int decimals = -1;
+		if (not is_int)
+		{
+			for (std::size_t i = 0; decimals < 0 and i < rows.size(); ++i)
+			{
+				if (mask[i] != 0)
+					continue;
+
+				auto text = rows[i]->get(ix)->text();
+				auto dot = text.find('.');
+				if (dot != std::string_view::npos and text.length() - dot - 1 <= 9)
+					decimals = text.length() - dot - 1;
+				break;
+			}
+
+			for (std::size_t i = 0; decimals > 0 and i < rows.size(); ++i)
+			{
+				ints[i] = 0;
+				if (mask[i] == 0 and not parse_fixed(rows[i]->get(ix)->text(), decimals, ints[i]))
+					decimals = -1;
+			}
+		}
+
+		if (is_int or decimals > 0)
+		{
+			auto encoded = encode_integers(ints);
+
+			if (decimals > 0)
+			{
+				int64_t factor = 1;
+				for (int i = 0; i < decimals; ++i)
+					factor *= 10;
+
+				encoded.m_encodings.insert(encoded.m_encodings.begin(), [factor](msgpack_encoder &e)
+					{
+					e.write_map(3);
+					e.write_string("kind");
+					e.write_string("FixedPoint");
+					e.write_string("factor");
+					e.write_int(factor);
+					e.write_string("srcType");
+					e.write_int(kFloat64); });
+			}
+
+			write_encoded_data(out, encoded);
+		}
+		else
+		{
+			// A string array, the strings are stored once
+			std::unordered_map<std::string_view, int64_t> index;
+			std::string string_data;
+			std::vector<int64_t> offsets{ 0 };
+
+			for (std::size_t i = 0; i < rows.size(); ++i)
+			{
+				ints[i] = -1;
+				if (mask[i] != 0)
+					continue;
+
+				auto text = rows[i]->get(ix)->text();
+				auto ii = index.emplace(text, offsets.size() - 1);
+				if (ii.second)
+				{
+					string_data += text;
+					offsets.push_back(string_data.length());
+				}
+
+				ints[i] = ii.first->second;
+			}
+
+			auto data = encode_integers(ints);
+			auto offset_data = encode_integers(offsets);
+
+			out.write_map(2);
+			out.write_string("encoding");
+			out.write_array(1);
+
+			out.write_map(5);
+			out.write_string("kind");
+			out.write_string("StringArray");
+			out.write_string("dataEncoding");
+			write_encodings(out, data);
+			out.write_string("stringData");
+			out.write_string(string_data);
+			out.write_string("offsetEncoding");
+			write_encodings(out, offset_data);
+			out.write_string("offsets");
+			out.write_binary(offset_data.m_data);
+
+			out.write_string("data");
+			out.write_binary(data.m_data);
+		}
+
+		out.write_string("mask");
+		if (masked)
+			write_encoded_data(out, encode_integers(mask));
+		else
+			out.write_nil();
+	}
+
+	out.write_string("rowCount");
+	out.write_int(rows.size());
+}
+
+// --------------------------------------------------------------------
+
+void file::load_bcif(const std::filesystem::path &p)
+{
+	gzio::ifstream in(p);
+	if (not in.is_open())
+		throw std::runtime_error("Could not open file '" + p.string() + '\'');
+
+	try
+	{
+		load_bcif(in);
+	}
+	catch (const std::exception &)
+	{
+		throw_with_nested(std::runtime_error("Error reading file '" + p.string() + '\''));
+	}
+}
+
+void file::load_bcif(std::istream &is)
+{
+	std::string data{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+	load_bcif_data(data);
+}
+
+void file::load_bcif_data(std::string_view data)
+{
+	auto bcif = msgpack_decoder(data).decode();
+
+	auto saved = m_validator;
+	set_validator(nullptr);
+
+	for (auto &db : bcif["dataBlocks"].as_array())
+		bcif_io::read(db, emplace_back());
+
+	if (saved)
+		set_validator(saved);
+	else
+		load_dictionary();
+}
+
+void file::save_bcif(const std::filesystem::path &p) const
+{
+	gzio::ofstream out(p);
+	if (not out.is_open())
+		throw std::runtime_error("Could not open file '" + p.string() + "' for writing");
+
+	save_bcif(out);
+}
+
+void file::save_bcif(std::ostream &os) const
+{
+	msgpack_encoder out;
+
+	out.write_map(3);
+	out.write_string("version");
+	out.write_string("0.3.0");
+	out.write_string("encoder");
+	out.write_string("libcifpp " + get_version_nr());
+	out.write_string("dataBlocks");
+	out.write_array(size());
+
+	for (auto &db : *this)
+		bcif_io::write(out, db);
+
+	os.write(out.data().data(), out.data().size());
+}
+
+} // namespace cif
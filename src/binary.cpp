@@ -0,0 +1,666 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2022 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "cif++/file.hpp"
+#include "cif++/gzio.hpp"
+
+#include <numeric>
+#include <unordered_map>
+
+// --------------------------------------------------------------------
+// The native binary format.
+//
+// All integers are unsigned LEB128 varints, except for sizes and offsets
+// that are stored as 64 bit little endian values. Strings are stored as
+// a varint length followed by the characters.
+//
+// file      := magic "CIF++BIN", version (u8), datablock count, datablock*
+// datablock := size (u64), name, category count,
+//              directory: (name, offset (u64), size (u64))*, category*
+// category  := size (u64), name, item count, item name*, row count, column*
+// column    := encoding (u8), data
+//
+// The offsets in the directory of a datablock are relative to the start
+// of the first category, the sizes include the size field itself. The
+// directory allows the reader to skip categories that are not needed.
+//
+// There are two column encodings. Plain columns contain a length for each
+// row followed by the concatenated text of all values. Dictionary columns
+// contain a list of distinct strings followed by an index for each row.
+// Lengths and indices are stored incremented by one, zero means the value
+// is absent, i.e. unknown ('?').
+
+namespace cif
+{
+
+namespace
+{
+
+const char kBinaryMagic[8] = { 'C', 'I', 'F', '+', '+', 'B', 'I', 'N' };
+const uint8_t kBinaryVersion = 1;
+
+enum class column_encoding : uint8_t
+{
+	plain = 0,
+	dictionary = 1
+};
+
+// --------------------------------------------------------------------
+
+// The writer writes to a std::ostream, or only counts the bytes when
+// there is none. The sizes stored in front of blocks are determined by
+// writing the block to a counting writer first, that way the output
+// does not have to be kept in memory.
+
+class binary_writer
+{
+  public:
+	binary_writer() = default;
+
+	binary_writer(std::ostream &os)
+		: m_os(&os)
+	{
+	}
+
+	binary_writer(const binary_writer &) = delete;
+	binary_writer &operator=(const binary_writer &) = delete;
+
+	void write_u8(uint8_t v)
+	{
+		char b = static_cast<char>(v);
+		put(&b, 1);
+	}
+
+	void write_u64(uint64_t v)
+	{
+		char b[8];
+		for (int i = 0; i < 8; ++i, v >>= 8)
+			b[i] = static_cast<char>(v & 0xff);
+		put(b, sizeof(b));
+	}
+
+	void write_varint(uint64_t v)
+	{
+		char b[10];
+		std::size_t n = 0;
+
+		while (v >= 0x80)
+		{
+			b[n++] = static_cast<char>((v & 0x7f) | 0x80);
+			v >>= 7;
+		}
+		b[n++] = static_cast<char>(v);
+
+		put(b, n);
+	}
+
+	void write_bytes(std::string_view s)
+	{
+		put(s.data(), s.length());
+	}
+
+	void write_string(std::string_view s)
+	{
+		write_varint(s.length());
+		write_bytes(s);
+	}
+
+	// The number of bytes written so far
+	std::size_t size() const { return m_size; }
+
+	// Write the buffered data to the stream
+	void flush()
+	{
+		if (m_os != nullptr and not m_buffer.empty())
+		{
+			m_os->write(m_buffer.data(), m_buffer.size());
+			m_buffer.clear();
+		}
+	}
+
+  private:
+	static constexpr std::size_t kBufferSize = 64 * 1024;
+
+	void put(const char *b, std::size_t n)
+	{
+		m_size += n;
+
+		if (m_os != nullptr)
+		{
+			m_buffer.append(b, n);
+			if (m_buffer.size() >= kBufferSize)
+				flush();
+		}
+	}
+
+	std::ostream *m_os = nullptr;
+	std::size_t m_size = 0;
+	std::string m_buffer;
+};
+
+// --------------------------------------------------------------------
+
+class binary_reader
+{
+  public:
+	binary_reader(std::string_view data)
+		: m_ptr(data.data())
+		, m_end(data.data() + data.length())
+	{
+	}
+
+	uint8_t read_u8()
+	{
+		if (m_ptr == m_end)
+			error();
+		return static_cast<uint8_t>(*m_ptr++);
+	}
+
+	uint64_t read_u64()
+	{
+		uint64_t result = 0;
+		auto b = read_bytes(8);
+		for (int i = 7; i >= 0; --i)
+			result = result << 8 | static_cast<uint8_t>(b[i]);
+		return result;
+	}
+
+	uint64_t read_varint()
+	{
+		uint64_t result = 0;
+
+		for (int shift = 0;; shift += 7)
+		{
+			if (m_ptr == m_end or shift > 63)
+				error();
+
+			uint8_t b = static_cast<uint8_t>(*m_ptr++);
+			result |= static_cast<uint64_t>(b & 0x7f) << shift;
+
+			if ((b & 0x80) == 0)
+				break;
+		}
+
+		return result;
+	}
+
+	std::string_view read_bytes(uint64_t n)
+	{
+		if (n > static_cast<uint64_t>(m_end - m_ptr))
+			error();
+
+		std::string_view result(m_ptr, n);
+		m_ptr += n;
+		return result;
+	}
+
+	std::string_view read_string()
+	{
+		return read_bytes(read_varint());
+	}
+
+	// Return a reader for the next sized block, the size includes the size field
+	binary_reader read_block()
+	{
+		auto start = m_ptr;
+		auto size = read_u64();
+
+		if (size < 8 or size - 8 > static_cast<uint64_t>(m_end - m_ptr))
+			error();
+
+		m_ptr = start + size;
+
+		return binary_reader({ start + 8, size - 8 });
+	}
+
+	// Return a reader for the @a size bytes starting @a offset bytes from the current position
+	binary_reader at(uint64_t offset, uint64_t size) const
+	{
+		if (offset > remaining() or size > remaining() - offset)
+			error();
+
+		return binary_reader({ m_ptr + offset, size });
+	}
+
+	std::size_t remaining() const { return m_end - m_ptr; }
+
+	[[noreturn]] static void error()
+	{
+		throw std::runtime_error("Invalid or truncated binary cif data");
+	}
+
+  private:
+	const char *m_ptr, *m_end;
+};
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+class binary_io
+{
+  public:
+	static void write(binary_writer &out, const category &cat);
+	static void read(binary_reader &in, category &cat);
+
+	static void write(binary_writer &out, const datablock &db);
+	// Read the datablock, skipping the categories not accepted by @a options
+	static void read(binary_reader &in, datablock &db, const load_options &options = {});
+
+  private:
+	// Write the category @a cat, except for the size in front of it
+	static void write_data(binary_writer &out, const category &cat);
+};
+
+void binary_io::write(binary_writer &out, const category &cat)
+{
+	binary_writer counter;
+	write_data(counter, cat);
+
+	out.write_u64(sizeof(uint64_t) + counter.size());
+	write_data(out, cat);
+}
+
+void binary_io::write_data(binary_writer &out, const category &cat)
+{
+	out.write_string(cat.m_name);
+
+	out.write_varint(cat.m_items.size());
+	for (auto &item : cat.m_items)
+		out.write_string(item.m_name);
+
+	cat.acquire_rows();
+
+	std::vector<const row *> rows;
+	for (auto r = cat.m_head; r != nullptr; r = r->m_next)
+		rows.push_back(r);
+
+	out.write_varint(rows.size());
+
+	std::unordered_map<std::string_view, uint64_t> dictionary;
+	std::vector<std::string_view> strings;
+
+	for (uint16_t ix = 0; ix < cat.m_items.size(); ++ix)
+	{
+		// Use a dictionary if there are few distinct values
+		const std::size_t kMaxDictionarySize = rows.size() / 2;
+
+		dictionary.clear();
+		strings.clear();
+
+		bool use_dictionary = rows.size() >= 8;
+
+		for (auto r : rows)
+		{
+			if (not use_dictionary)
+				break;
+
+			auto v = r->get(ix);
+			if (v == nullptr or not *v)
+				continue;
+
+			if (dictionary.emplace(v->text(), strings.size()).second)
+			{
+				strings.push_back(v->text());
+				use_dictionary = strings.size() <= kMaxDictionarySize;
+			}
+		}
+
+		if (use_dictionary)
+		{
+			out.write_u8(static_cast<uint8_t>(column_encoding::dictionary));
+
+			out.write_varint(strings.size());
+			for (auto s : strings)
+				out.write_string(s);
+
+			for (auto r : rows)
+			{
+				auto v = r->get(ix);
+				out.write_varint(v == nullptr or not *v ? 0 : dictionary[v->text()] + 1);
+			}
+		}
+		else
+		{
+			out.write_u8(static_cast<uint8_t>(column_encoding::plain));
+
+			for (auto r : rows)
+			{
+				auto v = r->get(ix);
+				out.write_varint(v == nullptr or not *v ? 0 : v->length() + 1);
+			}
+
+			for (auto r : rows)
+			{
+				auto v = r->get(ix);
+				if (v != nullptr and *v)
+					out.write_bytes(v->text());
+			}
+		}
+	}
+}
+
+void binary_io::read(binary_reader &in, category &cat)
+{
+	auto block = in.read_block();
+
+	cat.clear();
+	cat.m_items.clear();
+
+	// Without a validator there are no links either
+	cat.m_validator = nullptr;
+	cat.m_cat_validator = nullptr;
+	cat.m_parent_links.clear();
+	cat.m_child_links.clear();
+
+	cat.m_name = block.read_string();
+	cat.m_name_hash = ihash(cat.m_name);
+
+	auto item_count = block.read_varint();
+	if (item_count > std::numeric_limits<uint16_t>::max())
+		block.error();
+
+	for (uint64_t i = 0; i < item_count; ++i)
+	{
+		auto name = block.read_string();
+		cat.m_items.emplace_back(name, ihash(name), nullptr);
+	}
+	cat.rebuild_item_table();
+
+	auto row_count = block.read_varint();
+
+	// Each value takes at least one byte, reject impossible counts early
+	if (row_count > 0 and (item_count == 0 or row_count > block.remaining()))
+		block.error();
+
+	std::vector<row *> rows;
+	rows.reserve(row_count);
+
+	row *head = nullptr, *tail = nullptr;
+
+	try
+	{
+		for (uint64_t i = 0; i < row_count; ++i)
+		{
+			auto r = cat.create_row();
+			r->resize(item_count);
+
+			if (tail == nullptr)
+				head = r;
+			else
+				tail->m_next = r;
+			tail = r;
+
+			rows.push_back(r);
+		}
+
+		std::vector<std::string_view> strings;
+		std::vector<uint64_t> lengths(row_count);
+
+		for (uint16_t ix = 0; ix < item_count; ++ix)
+		{
+			switch (static_cast<column_encoding>(block.read_u8()))
+			{
+				case column_encoding::plain:
+				{
+					for (auto &l : lengths)
+						l = block.read_varint();
+
+					for (std::size_t i = 0; i < row_count; ++i)
+					{
+						if (lengths[i] > 0)
+							(*rows[i])[ix] = item_value(block.read_bytes(lengths[i] - 1), cat.m_strings);
+					}
+					break;
+				}
+
+				case column_encoding::dictionary:
+				{
+					strings.resize(block.read_varint());
+					for (auto &s : strings)
+						s = block.read_string();
+
+					for (auto r : rows)
+					{
+						auto v = block.read_varint();
+						if (v > strings.size())
+							block.error();
+						if (v > 0)
+							(*r)[ix] = item_value(strings[v - 1], cat.m_strings);
+					}
+					break;
+				}
+
+				default:
+					block.error();
+			}
+		}
+	}
+	catch (...)
+	{
+		for (auto r : rows)
+			cat.delete_row(r);
+		throw;
+	}
+
+	cat.append_rows(head, tail);
+}
+
+void binary_io::write(binary_writer &out, const datablock &db)
+{
+	// The sizes of the categories are needed for the directory
+	std::vector<std::size_t> sizes;
+	for (auto &cat : db)
+	{
+		binary_writer counter;
+		write_data(counter, cat);
+		sizes.push_back(sizeof(uint64_t) + counter.size());
+	}
+
+	auto write_header = [&db, &sizes](binary_writer &w)
+	{
+		w.write_string(db.name());
+		w.write_varint(db.size());
+
+		std::size_t offset = 0;
+		auto si = sizes.begin();
+		for (auto &cat : db)
+		{
+			w.write_string(cat.name());
+			w.write_u64(offset);
+			w.write_u64(*si);
+			offset += *si++;
+		}
+	};
+
+	binary_writer counter;
+	write_header(counter);
+
+	out.write_u64(std::accumulate(sizes.begin(), sizes.end(), sizeof(uint64_t) + counter.size()));
+	write_header(out);
+
+	auto si = sizes.begin();
+	for (auto &cat : db)
+	{
+		out.write_u64(*si++);
+		write_data(out, cat);
+	}
+}
+
+void binary_io::read(binary_reader &in, datablock &db, const load_options &options)
+{
+	auto block = in.read_block();
+
+	db.clear();
+	db.set_name(block.read_string());
+
+	struct entry
+	{
+		std::string_view name;
+		uint64_t offset, size;
+	};
+
+	std::vector<entry> directory;
+
+	auto count = block.read_varint();
+	for (uint64_t i = 0; i < count; ++i)
+		directory.push_back({ block.read_string(), block.read_u64(), block.read_u64() });
+
+	// The categories follow the directory, only the selected ones are read
+	for (auto &[name, offset, size] : directory)
+	{
+		if (not options.accept_category(name))
+			continue;
+
+		auto data = block.at(offset, size);
+
+		auto &cat = db.emplace_back(std::string_view{});
+		read(data, cat);
+
+		if (cat.name() != name)
+			binary_reader::error();
+	}
+}
+
+// --------------------------------------------------------------------
+
+void category::save_binary(std::ostream &os) const
+{
+	binary_writer out(os);
+	binary_io::write(out, *this);
+	out.flush();
+}
+
+void category::load_binary(std::istream &is)
+{
+	char size[8];
+	if (not is.read(size, sizeof(size)))
+		binary_reader::error();
+
+	std::string data(size, size + sizeof(size));
+	data.resize(binary_reader(data).read_u64());
+
+	if (data.size() < sizeof(size) or not is.read(data.data() + sizeof(size), data.size() - sizeof(size)))
+		binary_reader::error();
+
+	binary_reader in(data);
+	binary_io::read(in, *this);
+}
+
+// --------------------------------------------------------------------
+
+void datablock::save_binary(std::ostream &os) const
+{
+	binary_writer out(os);
+	binary_io::write(out, *this);
+	out.flush();
+}
+
+void datablock::load_binary(std::istream &is)
+{
+	char size[8];
+	if (not is.read(size, sizeof(size)))
+		binary_reader::error();
+
+	std::string data(size, size + sizeof(size));
+	data.resize(binary_reader(data).read_u64());
+
+	if (data.size() < sizeof(size) or not is.read(data.data() + sizeof(size), data.size() - sizeof(size)))
+		binary_reader::error();
+
+	binary_reader in(data);
+	binary_io::read(in, *this);
+
+	if (m_validator != nullptr)
+		set_validator(m_validator);
+}
+
+// --------------------------------------------------------------------
+
+void file::save_binary(const std::filesystem::path &p) const
+{
+	gzio::ofstream out(p);
+	if (not out.is_open())
+		throw std::runtime_error("Could not open file '" + p.string() + "' for writing");
+
+	save_binary(out);
+}
+
+void file::save_binary(std::ostream &os) const
+{
+	binary_writer out(os);
+
+	out.write_bytes({ kBinaryMagic, sizeof(kBinaryMagic) });
+	out.write_u8(kBinaryVersion);
+	out.write_varint(size());
+
+	for (auto &db : *this)
+		binary_io::write(out, db);
+
+	out.flush();
+}
+
+void file::load_binary(std::istream &is)
+{
+	load_binary(is, load_options{});
+}
+
+void file::load_binary(std::istream &is, const load_options &options)
+{
+	std::string data{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+	load_binary_data(data, options);
+}
+
+void file::load_binary_data(std::string_view data, const load_options &options)
+{
+	binary_reader in(data);
+
+	if (in.read_bytes(sizeof(kBinaryMagic)) != std::string_view{ kBinaryMagic, sizeof(kBinaryMagic) })
+		throw std::runtime_error("Not a binary cif file");
+
+	if (in.read_u8() != kBinaryVersion)
+		throw std::runtime_error("Unsupported version of binary cif file");
+
+	auto saved = m_validator;
+	set_validator(nullptr);
+
+	auto n = size();
+
+	auto count = in.read_varint();
+	for (uint64_t i = 0; i < count; ++i)
+		binary_io::read(in, emplace_back(), options);
+
+	if (saved)
+		set_validator(saved);
+	else
+		load_dictionary();
+
+	// The items not selected still need to be removed
+	select(std::next(begin(), n), options);
+}
+
+} // namespace cif
@@ -29,8 +29,12 @@
 #include "cif++/parser.hpp"
 #include "cif++/utilities.hpp"
 
+#include <atomic>
 #include <numeric>
 #include <stack>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 // TODO: Find out what the rules are exactly for linked items, the current implementation
 // is inconsistent. It all depends whether a link is satified if a item taking part in the
@@ -62,9 +66,7 @@ class row_comparator
 			if (tv == nullptr)
 				throw std::runtime_error("Incomplete dictionary, no type Validator for Item " + k);
 
-			using namespace std::placeholders;
-
-			m_comparator.emplace_back(ix, std::bind(&type_validator::compare, tv, _1, _2));
+			m_comparator.emplace_back(ix, tv);
 		}
 	}
 
@@ -77,12 +79,12 @@ class row_comparator
 		row_handle rhb(cat, *b);
 
 		int d = 0;
-		for (const auto &[k, f] : m_comparator)
+		for (const auto &[k, tv] : m_comparator)
 		{
 			std::string_view ka = rha[k].text();
 			std::string_view kb = rhb[k].text();
 
-			d = f(ka, kb);
+			d = tv->compare(ka, kb);
 
 			if (d != 0)
 				break;
@@ -100,14 +102,14 @@ class row_comparator
 		int d = 0;
 		auto ai = a.begin();
 
-		for (const auto &[k, f] : m_comparator)
+		for (const auto &[k, tv] : m_comparator)
 		{
 			assert(ai != a.end());
 
 			std::string_view ka = ai->value();
 			std::string_view kb = rhb[k].text();
 
-			d = f(ka, kb);
+			d = tv->compare(ka, kb);
 
 			if (d != 0)
 				break;
@@ -118,36 +120,225 @@ class row_comparator
 		return d;
 	}
 
+	// Hash values for the key of a row, rows that compare equal
+	// have the same hash value, except for numbers, see for_each_hash
+
+	std::size_t hash(const category &cat, const row *a) const
+	{
+		assert(a);
+
+		row_handle rha(cat, *a);
+
+		std::size_t h = 0;
+		for (const auto &[k, tv] : m_comparator)
+			h = combine_hash(h, tv->hash(rha[k].text()));
+
+		return h;
+	}
+
+	std::size_t hash(const row_initializer &a) const
+	{
+		std::size_t h = 0;
+		auto ai = a.begin();
+
+		for (const auto &[k, tv] : m_comparator)
+		{
+			assert(ai != a.end());
+
+			h = combine_hash(h, tv->hash(ai->value()));
+
+			++ai;
+		}
+
+		return h;
+	}
+
+	// Call @a f with each hash value a row with a key equal to that of
+	// row @a a can have. Usually there is only one, but numbers that
+	// differ by no more than epsilon may hash differently.
+
+	template <typename F>
+	void for_each_hash(const category &cat, const row *a, F &&f) const
+	{
+		assert(a);
+
+		row_handle rha(cat, *a);
+		for_each_key_hash([&](std::size_t i)
+			{ return rha[std::get<0>(m_comparator[i])].text(); }, f);
+	}
+
+	template <typename F>
+	void for_each_hash(const row_initializer &a, F &&f) const
+	{
+		for_each_key_hash([&](std::size_t i)
+			{ return std::next(a.begin(), i)->value(); }, f);
+	}
+
   private:
-	using compareFunc = std::function<int(std::string_view, std::string_view)>;
-	using key_comparator = std::tuple<uint16_t, compareFunc>;
+	static std::size_t combine_hash(std::size_t h, std::size_t v)
+	{
+		return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+	}
+
+	template <typename V, typename F>
+	void for_each_key_hash(V &&value, F &&f) const
+	{
+		std::size_t h = 0;
+		bool single = true;
+
+		for (std::size_t i = 0; i < m_comparator.size(); ++i)
+		{
+			auto kh = std::get<1>(m_comparator[i])->hashes(value(i));
+			h = combine_hash(h, kh[0]);
+			single = single and kh[0] == kh[1];
+		}
+
+		if (f(h) or single)
+			return;
+
+		// Rare, try all other combinations of the hash values
+		std::vector<std::size_t> hashes{ 0 };
+		for (std::size_t i = 0; i < m_comparator.size(); ++i)
+		{
+			auto kh = std::get<1>(m_comparator[i])->hashes(value(i));
+
+			std::vector<std::size_t> next;
+			for (auto hi : hashes)
+			{
+				next.push_back(combine_hash(hi, kh[0]));
+				if (kh[1] != kh[0])
+					next.push_back(combine_hash(hi, kh[1]));
+			}
+
+			std::swap(hashes, next);
+		}
+
+		for (auto hi : hashes)
+		{
+			if (hi != h and f(hi))
+				break;
+		}
+	}
+
+	using key_comparator = std::tuple<uint16_t, const type_validator *>;
 
 	std::vector<key_comparator> m_comparator;
 };
 
+// --------------------------------------------------------------------
+//
+//	base class for an index on the keys of a category
+
+class category_index
+{
+  public:
+	category_index(category &cat)
+		: m_row_comparator(cat)
+	{
+	}
+
+	virtual ~category_index() = default;
+
+	virtual row *find(const category &cat, row *k) const = 0;
+	virtual row *find_by_value(const category &cat, row_initializer k) const = 0;
+
+	virtual void insert(category &cat, row *r) = 0;
+	virtual void erase(category &cat, row *r) = 0;
+
+	// insert all rows in @a rows at once, the rows are sorted by key
+	// and none of the keys is in the index yet
+	virtual void insert_sorted(category &cat, const std::vector<row *> &rows) = 0;
+
+	// reorder the row's and returns new head and tail
+	virtual std::tuple<row *, row *> reorder(const category &cat) = 0;
+
+	virtual std::size_t size() const = 0;
+
+	// sort @a rows by key
+	void sort(const category &cat, std::vector<row *> &rows) const
+	{
+		std::sort(rows.begin(), rows.end(), [this, &cat](const row *a, const row *b)
+			{ return m_row_comparator(cat, a, b) < 0; });
+	}
+
+	bool same_key(const category &cat, const row *a, const row *b) const
+	{
+		return m_row_comparator(cat, a, b) == 0;
+	}
+
+	// return the values of the key items of row @a r, for use in messages
+	std::string describe_key(const category &cat, const row *r) const;
+
+  protected:
+	// return the values in k for the key items, in the order of the key items
+	row_initializer order_by_key(const category &cat, const row_initializer &k) const;
+
+	[[noreturn]] void throw_duplicate_key(category &cat, row *r) const;
+
+	row_comparator m_row_comparator;
+};
+
+row_initializer category_index::order_by_key(const category &cat, const row_initializer &k) const
+{
+	row_initializer result;
+	for (auto &f : cat.key_item_indices())
+	{
+		auto fld = cat.get_item_name(f);
+
+		auto ki = find_if(k.begin(), k.end(), [&fld](auto &i)
+			{ return i.name() == fld; });
+		if (ki == k.end())
+			result.emplace_back(fld, "");
+		else
+			result.emplace_back(*ki);
+	}
+
+	return result;
+}
+
+std::string category_index::describe_key(const category &cat, const row *r) const
+{
+	row_handle rh(cat, *r);
+
+	std::ostringstream os;
+	for (auto col : cat.key_items())
+	{
+		if (rh[col])
+			os << col << ": " << std::quoted(rh[col].text()) << "; ";
+	}
+
+	return os.str();
+}
+
+void category_index::throw_duplicate_key(category &cat, row *r) const
+{
+	throw duplicate_key_error("Duplicate Key violation, cat: " + cat.name() + " values: " + describe_key(cat, r));
+}
+
 // --------------------------------------------------------------------
 //
 //	class to keep an index on the keys of a category. This is a red/black
 //	tree implementation.
 
-class category_index
+class category_tree_index : public category_index
 {
   public:
-	category_index(category &cat);
+	category_tree_index(category &cat);
 
-	~category_index()
+	~category_tree_index()
 	{
 		delete m_root;
 	}
 
-	row *find(const category &cat, row *k) const;
-	row *find_by_value(const category &cat, row_initializer k) const;
+	row *find(const category &cat, row *k) const override;
+	row *find_by_value(const category &cat, row_initializer k) const override;
 
-	void insert(category &cat, row *r);
-	void erase(category &cat, row *r);
+	void insert(category &cat, row *r) override;
+	void erase(category &cat, row *r) override;
 
-	// reorder the row's and returns new head and tail
-	std::tuple<row *, row *> reorder()
+	void insert_sorted(category &cat, const std::vector<row *> &rows) override;
+
+	std::tuple<row *, row *> reorder(const category &cat) override
 	{
 		std::tuple<row *, row *> result = std::make_tuple(nullptr, nullptr);
 
@@ -164,7 +355,7 @@ class category_index
 		return result;
 	}
 
-	std::size_t size() const;
+	std::size_t size() const override;
 	//	bool isValid() const;
 
   private:
@@ -193,6 +384,19 @@ class category_index
 	entry *insert(category &cat, entry *h, row *v);
 	entry *erase(category &cat, entry *h, row *k);
 
+	// build a tree with black height @a height from the @a n sorted rows in @a rows
+	static entry *build(row *const *rows, std::size_t n, std::size_t height);
+
+	static void collect(const entry *e, std::vector<row *> &rows)
+	{
+		if (e != nullptr)
+		{
+			collect(e->m_left, rows);
+			rows.push_back(e->m_row);
+			collect(e->m_right, rows);
+		}
+	}
+
 	//	void validate(entry* h, bool isParentRed, uint32_t blackDepth, uint32_t& minBlack, uint32_t& maxBlack) const;
 
 	entry *rotateLeft(entry *h)
@@ -322,19 +526,18 @@ class category_index
 		return result;
 	}
 
-	row_comparator m_row_comparator;
 	entry *m_root;
 };
 
-category_index::category_index(category &cat)
-	: m_row_comparator(cat)
+category_tree_index::category_tree_index(category &cat)
+	: category_index(cat)
 	, m_root(nullptr)
 {
 	for (auto r : cat)
 		insert(cat, r.get_row());
 }
 
-row *category_index::find(const category &cat, row *k) const
+row *category_tree_index::find(const category &cat, row *k) const
 {
 	const entry *r = m_root;
 	while (r != nullptr)
@@ -351,22 +554,10 @@ row *category_index::find(const category &cat, row *k) const
 	return r ? r->m_row : nullptr;
 }
 
-row *category_index::find_by_value(const category &cat, row_initializer k) const
+row *category_tree_index::find_by_value(const category &cat, row_initializer k) const
 {
 	// sort the values in k first
-
-	row_initializer k2;
-	for (auto &f : cat.key_item_indices())
-	{
-		auto fld = cat.get_item_name(f);
-
-		auto ki = find_if(k.begin(), k.end(), [&fld](auto &i)
-			{ return i.name() == fld; });
-		if (ki == k.end())
-			k2.emplace_back(fld, "");
-		else
-			k2.emplace_back(*ki);
-	}
+	row_initializer k2 = order_by_key(cat, k);
 
 	const entry *r = m_root;
 	while (r != nullptr)
@@ -383,13 +574,13 @@ row *category_index::find_by_value(const category &cat, row_initializer k) const
 	return r ? r->m_row : nullptr;
 }
 
-void category_index::insert(category &cat, row *k)
+void category_tree_index::insert(category &cat, row *k)
 {
 	m_root = insert(cat, m_root, k);
 	m_root->m_red = false;
 }
 
-category_index::entry *category_index::insert(category &cat, entry *h, row *v)
+category_tree_index::entry *category_tree_index::insert(category &cat, entry *h, row *v)
 {
 	if (h == nullptr)
 		return new entry(v);
@@ -400,18 +591,7 @@ category_index::entry *category_index::insert(category &cat, entry *h, row *v)
 	else if (d > 0)
 		h->m_right = insert(cat, h->m_right, v);
 	else
-	{
-		row_handle rh(cat, *v);
-
-		std::ostringstream os;
-		for (auto col : cat.key_items())
-		{
-			if (rh[col])
-				os << col << ": " << std::quoted(rh[col].text()) << "; ";
-		}
-
-		throw duplicate_key_error("Duplicate Key violation, cat: " + cat.name() + " values: " + os.str());
-	}
+		throw_duplicate_key(cat, v);
 
 	if (is_red(h->m_right) and not is_red(h->m_left))
 		h = rotateLeft(h);
@@ -425,7 +605,7 @@ category_index::entry *category_index::insert(category &cat, entry *h, row *v)
 	return h;
 }
 
-void category_index::erase(category &cat, row *k)
+void category_tree_index::erase(category &cat, row *k)
 {
 	assert(find(cat, k) == k);
 
@@ -434,7 +614,7 @@ void category_index::erase(category &cat, row *k)
 		m_root->m_red = false;
 }
 
-category_index::entry *category_index::erase(category &cat, entry *h, row *k)
+category_tree_index::entry *category_tree_index::erase(category &cat, entry *h, row *k)
 {
 	if (m_row_comparator(cat, k, h->m_row) < 0)
 	{
@@ -475,7 +655,84 @@ category_index::entry *category_index::erase(category &cat, entry *h, row *k)
 	return fix_up(h);
 }
 
-std::size_t category_index::size() const
+void category_tree_index::insert_sorted(category &cat, const std::vector<row *> &rows)
+{
+	// For a few rows, inserting them one by one is cheaper than a rebuild
+	if (rows.size() * 4 < cat.size())
+	{
+		for (auto r : rows)
+			insert(cat, r);
+		return;
+	}
+
+	std::vector<row *> existing;
+	existing.reserve(cat.size());
+	collect(m_root, existing);
+
+	std::vector<row *> all;
+	all.reserve(existing.size() + rows.size());
+	std::merge(existing.begin(), existing.end(), rows.begin(), rows.end(), std::back_inserter(all),
+		[this, &cat](const row *a, const row *b)
+		{ return m_row_comparator(cat, a, b) < 0; });
+
+	// The black height of the new tree, floor(log2(n + 1))
+	std::size_t height = 0;
+	while ((std::size_t(2) << height) <= all.size() + 1)
+		++height;
+
+	delete m_root;
+	m_root = build(all.data(), all.size(), height);
+	if (m_root != nullptr)
+		m_root->m_red = false;
+}
+
+// The tree is built as a 2-3 tree in which all leaves have the same depth,
+// a 3-node is stored as a black entry with a red left child. A 2-3 tree of
+// height h holds between 2^h - 1 and 3^h - 1 rows.
+category_tree_index::entry *category_tree_index::build(row *const *rows, std::size_t n, std::size_t height)
+{
+	assert(n + 1 >= (std::size_t(1) << height));
+
+	if (n == 0)
+		return nullptr;
+
+	std::size_t max_child = 1;
+	for (std::size_t i = 1; i < height and max_child < std::numeric_limits<std::size_t>::max() / 3; ++i)
+		max_child *= 3;
+	--max_child;
+
+	entry *result;
+
+	if (n - 1 <= 2 * max_child)
+	{
+		std::size_t nl = (n - 1) / 2;
+
+		result = new entry(rows[nl]);
+		result->m_left = build(rows, nl, height - 1);
+		result->m_right = build(rows + nl + 1, n - 1 - nl, height - 1);
+	}
+	else
+	{
+		std::size_t nc = (n - 2) / 3, rest = (n - 2) % 3;
+		std::size_t n0 = nc + (rest > 0 ? 1 : 0);
+		std::size_t n1 = nc + (rest > 1 ? 1 : 0);
+
+		// the left entry of a 3-node is red, as new entries are
+		auto left = new entry(rows[n0]);
+		left->m_left = build(rows, n0, height - 1);
+		left->m_right = build(rows + n0 + 1, n1, height - 1);
+
+		result = new entry(rows[n0 + 1 + n1]);
+		result->m_left = left;
+		result->m_right = build(rows + n0 + n1 + 2, nc, height - 1);
+	}
+
+	result->m_red = false;
+
+	return result;
+}
+
+std::size_t category_tree_index::size() const
 {
 	std::stack<entry *> s;
 	s.push(m_root);
@@ -500,695 +757,2199 @@ std::size_t category_index::size() const
 }
 
 // --------------------------------------------------------------------
+//
+//	An index on the keys of a category using a hash table with open
+//	addressing. The hash value of the key of each row is stored in the
+//	table. Faster than the tree, but the rows are not kept in order.
 
-category::category(std::string_view name)
-	: m_name(name)
-{
-}
-
-category::category(const category &rhs)
-	: m_name(rhs.m_name)
-	, m_items(rhs.m_items)
-	, m_cascade(rhs.m_cascade)
+class category_hash_index : public category_index
 {
-	for (auto r = rhs.m_head; r != nullptr; r = r->m_next)
-		insert_impl(end(), clone_row(*r));
+  public:
+	category_hash_index(category &cat);
 
-	m_validator = rhs.m_validator;
-	m_cat_validator = rhs.m_cat_validator;
+	row *find(const category &cat, row *k) const override;
+	row *find_by_value(const category &cat, row_initializer k) const override;
 
-	if (m_cat_validator != nullptr and m_index == nullptr)
-		m_index = new category_index(*this);
-}
+	void insert(category &cat, row *r) override;
+	void erase(category &cat, row *r) override;
 
-void swap(category &a, category &b) noexcept
-{
-	std::swap(a.m_name, b.m_name);
-	std::swap(a.m_items, b.m_items);
-	std::swap(a.m_validator, b.m_validator);
-	std::swap(a.m_cat_validator, b.m_cat_validator);
-	std::swap(a.m_parent_links, b.m_parent_links);
-	std::swap(a.m_child_links, b.m_child_links);
-	std::swap(a.m_cascade, b.m_cascade);
-	std::swap(a.m_index, b.m_index);
-	std::swap(a.m_head, b.m_head);
-	std::swap(a.m_tail, b.m_tail);
-}
+	void insert_sorted(category &cat, const std::vector<row *> &rows) override
+	{
+		while ((m_size + rows.size()) * 2 > m_table.size())
+			grow();
 
-category::~category()
-{
-	clear();
-}
+		for (auto r : rows)
+			insert(cat, r);
+	}
 
-// --------------------------------------------------------------------
+	std::tuple<row *, row *> reorder(const category &cat) override;
 
-void category::remove_item(std::string_view item_name)
-{
-	for (std::size_t ix = 0; ix < m_items.size(); ++ix)
+	std::size_t size() const override
 	{
-		if (not iequals(item_name, m_items[ix].m_name))
-			continue;
+		return m_size;
+	}
 
-		for (row *r = m_head; r != nullptr; r = r->m_next)
-		{
-			if (r->size() > ix)
-				r->erase(r->begin() + ix);
-		}
+  private:
+	struct entry
+	{
+		std::size_t m_hash;
+		row *m_row;
+	};
 
-		m_items.erase(m_items.begin() + ix);
+	void grow();
 
-		break;
-	}
-}
+	// the number of slots is a power of two, empty slots have a null m_row
+	std::vector<entry> m_table;
+	std::size_t m_size = 0;
+};
 
-void category::rename_item(std::string_view from_name, std::string_view to_name)
+category_hash_index::category_hash_index(category &cat)
+	: category_index(cat)
 {
-	for (std::size_t ix = 0; ix < m_items.size(); ++ix)
-	{
-		if (not iequals(from_name, m_items[ix].m_name))
-			continue;
+	std::size_t n = 16;
+	while (n < cat.size() * 2)
+		n *= 2;
 
-		m_items[ix].m_name = to_name;
-		m_items[ix].m_validator = m_cat_validator ? m_cat_validator->get_validator_for_item(to_name) : nullptr;
+	m_table.resize(n, entry{ 0, nullptr });
 
-		break;
-	}
+	for (auto r : cat)
+		insert(cat, r.get_row());
 }
 
-iset category::get_items() const
+row *category_hash_index::find(const category &cat, row *k) const
 {
-	iset result;
+	row *result = nullptr;
 
-	for (auto &col : m_items)
-		result.insert(col.m_name);
+	const std::size_t mask = m_table.size() - 1;
+	m_row_comparator.for_each_hash(cat, k, [&](std::size_t h)
+		{
+		for (std::size_t i = h & mask; result == nullptr and m_table[i].m_row != nullptr; i = (i + 1) & mask)
+		{
+			if (m_table[i].m_hash == h and m_row_comparator(cat, k, m_table[i].m_row) == 0)
+				result = m_table[i].m_row;
+		}
+		return result != nullptr; });
 
 	return result;
 }
 
-iset category::key_items() const
+row *category_hash_index::find_by_value(const category &cat, row_initializer k) const
 {
-	if (m_validator == nullptr)
-		throw std::runtime_error("No Validator specified");
+	row_initializer k2 = order_by_key(cat, k);
 
-	if (m_cat_validator == nullptr)
-		throw validation_exception(validation_error::undefined_category);
+	row *result = nullptr;
 
-	iset result;
-	for (auto &iv : m_cat_validator->m_item_validators)
-		result.insert(iv.m_item_name);
+	const std::size_t mask = m_table.size() - 1;
+	m_row_comparator.for_each_hash(k2, [&](std::size_t h)
+		{
+		for (std::size_t i = h & mask; result == nullptr and m_table[i].m_row != nullptr; i = (i + 1) & mask)
+		{
+			if (m_table[i].m_hash == h and m_row_comparator(cat, k2, m_table[i].m_row) == 0)
+				result = m_table[i].m_row;
+		}
+		return result != nullptr; });
 
 	return result;
 }
 
-std::set<uint16_t> category::key_item_indices() const
+void category_hash_index::insert(category &cat, row *r)
 {
-	if (m_validator == nullptr)
-		throw std::runtime_error("No Validator specified");
+	if ((m_size + 1) * 2 > m_table.size())
+		grow();
 
-	if (m_cat_validator == nullptr)
-		throw validation_exception(validation_error::undefined_category);
+	if (find(cat, r) != nullptr)
+		throw_duplicate_key(cat, r);
 
-	std::set<uint16_t> result;
-	for (auto &k : m_cat_validator->m_keys)
-		result.insert(get_item_ix(k));
+	auto h = m_row_comparator.hash(cat, r);
 
-	return result;
-}
+	const std::size_t mask = m_table.size() - 1;
+	std::size_t i = h & mask;
+	while (m_table[i].m_row != nullptr)
+		i = (i + 1) & mask;
 
-// --------------------------------------------------------------------
+	m_table[i] = { h, r };
+	++m_size;
+}
 
-void category::set_validator(const validator *v, datablock &db)
+void category_hash_index::erase(category &cat, row *r)
 {
-	m_validator = v;
+	auto h = m_row_comparator.hash(cat, r);
 
-	if (m_index != nullptr)
+	const std::size_t mask = m_table.size() - 1;
+	std::size_t i = h & mask;
+	while (m_table[i].m_row != nullptr and m_table[i].m_row != r)
+		i = (i + 1) & mask;
+
+	assert(m_table[i].m_row == r);
+	if (m_table[i].m_row != r)
+		return;
+
+	// Move the entries following the erased one back when that brings
+	// them closer to their home slot, no tombstones needed this way.
+	for (std::size_t j = (i + 1) & mask; m_table[j].m_row != nullptr; j = (j + 1) & mask)
 	{
-		delete m_index;
-		m_index = nullptr;
+		std::size_t home = m_table[j].m_hash & mask;
+
+		bool stays = i <= j ? (i < home and home <= j) : (i < home or home <= j);
+		if (stays)
+			continue;
+
+		m_table[i] = m_table[j];
+		i = j;
 	}
 
-	if (m_validator != nullptr)
+	m_table[i] = { 0, nullptr };
+	--m_size;
+}
+
+void category_hash_index::grow()
+{
+	std::vector<entry> table(m_table.size() * 2, entry{ 0, nullptr });
+
+	const std::size_t mask = table.size() - 1;
+	for (auto &e : m_table)
 	{
-		m_cat_validator = m_validator->get_validator_for_category(m_name);
+		if (e.m_row == nullptr)
+			continue;
 
-		if (m_cat_validator != nullptr)
-		{
-			std::set<std::string> missing;
+		std::size_t i = e.m_hash & mask;
+		while (table[i].m_row != nullptr)
+			i = (i + 1) & mask;
+		table[i] = e;
+	}
 
-			if (not empty())
-			{
-				std::vector<uint16_t> kix;
-				for (auto k : m_cat_validator->m_keys)
-				{
-					kix.push_back(get_item_ix(k));
-					if (kix.back() >= m_items.size())
-						missing.insert(k);
-				}
-			}
+	std::swap(m_table, table);
+}
 
-			if (missing.empty())
-				m_index = new category_index(*this);
-			else
-			{
-				std::ostringstream msg;
-				msg << "Cannot construct index since the key item" << (missing.size() > 1 ? "s" : "") << " "
-					<< cif::join(missing, ", ") << " in " << m_name << " " << (missing.size() == 1 ? "is" : "are") << " missing\n";
-				throw missing_key_error(msg.str(), *missing.begin());
-			}
-		}
+std::tuple<row *, row *> category_hash_index::reorder(const category &cat)
+{
+	std::vector<row *> rows;
+	rows.reserve(m_size);
+
+	for (auto &e : m_table)
+	{
+		if (e.m_row != nullptr)
+			rows.push_back(e.m_row);
 	}
-	else
-		m_cat_validator = nullptr;
 
-	for (auto &&[item, cv] : m_items)
-		cv = m_cat_validator ? m_cat_validator->get_validator_for_item(item) : nullptr;
+	if (rows.empty())
+		return { nullptr, nullptr };
 
-	update_links(db);
+	std::sort(rows.begin(), rows.end(), [this, &cat](row *a, row *b)
+		{ return m_row_comparator(cat, a, b) < 0; });
+
+	for (std::size_t i = 0; i + 1 < rows.size(); ++i)
+		rows[i]->m_next = rows[i + 1];
+	rows.back()->m_next = nullptr;
+
+	return { rows.front(), rows.back() };
 }
 
-void category::update_links(const datablock &db)
+// --------------------------------------------------------------------
+//
+//	A secondary index on one or more items of a category. The rows are
+//	stored in buckets using the combined hash of the values of these
+//	items. The rows in a bucket are kept in the order of the category,
+//	if that order is lost the bucket is sorted again on its next use.
+//
+//	Values that are numbers hash on their value, other values hash
+//	ignoring character case. That way all rows matching a condition
+//	testing for equality with either a number or a text are found in
+//	the same bucket, or in one of two buckets for numbers, see
+//	number_hashes.
+//
+//	The index is built when it is first used and rebuilt after the
+//	category was sorted.
+
+class secondary_index
 {
-	m_child_links.clear();
-	m_parent_links.clear();
+  public:
+	secondary_index(std::vector<uint16_t> items)
+		: m_items(std::move(items))
+	{
+	}
 
-	if (m_validator != nullptr)
+	std::vector<uint16_t> &items() { return m_items; }
+
+	static std::size_t hash_value(std::string_view text)
 	{
-		for (auto link : m_validator->get_links_for_parent(m_name))
+		double v;
+		return as_number(text, v) ? number_hash(v) : ihash(text);
+	}
+
+	// The hash values of the buckets that may contain values equal to @a text
+	static std::array<std::size_t, 2> hash_values(std::string_view text)
+	{
+		double v;
+		if (as_number(text, v))
+			return number_hashes(v);
+
+		auto h = ihash(text);
+		return { h, h };
+	}
+
+	static std::array<std::size_t, 2> hash_values(double v)
+	{
+		return number_hashes(v);
+	}
+
+	static std::size_t combine(std::size_t h, std::size_t v)
+	{
+		return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+	}
+
+	// Return the rows in the buckets with hash @a hashes, @a head is the first row in the category
+	std::vector<row *> find(const row *head, const std::vector<std::size_t> &hashes) const;
+
+	// Return the number of rows in the buckets with hash @a hashes
+	std::size_t count(const row *head, const std::vector<std::size_t> &hashes) const
+	{
+		std::size_t result = 0;
+		for (auto h : hashes)
+			result += count(head, h);
+		return result;
+	}
+
+	void insert(row *r, bool at_end)
+	{
+		if (not m_valid)
+			return;
+
+		auto &b = m_buckets[hash(r)];
+		b.m_rows.push_back(r);
+		if (not at_end)
+			b.m_sorted = false;
+	}
+
+	void erase(row *r)
+	{
+		if (not m_valid)
+			return;
+
+		auto bi = m_buckets.find(hash(r));
+		if (bi == m_buckets.end())
+			return;
+
+		auto &rows = bi->second.m_rows;
+		rows.erase(std::remove(rows.begin(), rows.end(), r), rows.end());
+
+		if (rows.empty())
+			m_buckets.erase(bi);
+	}
+
+	void invalidate()
+	{
+		m_buckets.clear();
+		m_valid = false;
+	}
+
+	// Return the rows with hash @a h, @a head is the first row in the category
+	std::vector<row *> find(const row *head, std::size_t h) const;
+
+	// Return the number of rows with hash @a h
+	std::size_t count(const row *head, std::size_t h) const
+	{
+		std::lock_guard lock(m_mutex);
+
+		build(head);
+
+		auto bi = m_buckets.find(h);
+		return bi != m_buckets.end() ? bi->second.m_rows.size() : 0;
+	}
+
+	// Statistics, the number of distinct values in the index, if it was built
+	std::optional<std::size_t> distinct_count() const
+	{
+		std::lock_guard lock(m_mutex);
+
+		return m_valid ? std::make_optional(m_buckets.size()) : std::nullopt;
+	}
+
+  private:
+	struct bucket
+	{
+		std::vector<row *> m_rows;
+		bool m_sorted = true;
+	};
+
+	// Same rules as used in item_handle::compare for numbers
+	static bool as_number(std::string_view text, double &v)
+	{
+		auto b = text.data();
+		auto e = text.data() + text.length();
+
+		auto r = (b + 1 < e and *b == '+' and std::isdigit(b[1]))
+		             ? selected_charconv<double>::from_chars(b + 1, e, v)
+		             : selected_charconv<double>::from_chars(b, e, v);
+
+		return not (bool)r.ec and r.ptr == e;
+	}
+
+	std::size_t hash(const row *r) const
+	{
+		std::size_t h = 0;
+
+		for (auto ix : m_items)
 		{
-			auto childCat = const_cast<category *>(db.get(link->m_child_category));
-			if (childCat == nullptr)
-				continue;
-			m_child_links.emplace_back(childCat, link);
+			auto v = r->get(ix);
+			h = combine(h, hash_value(v != nullptr ? v->text() : std::string_view{}));
 		}
 
-		for (auto link : m_validator->get_links_for_child(m_name))
+		return h;
+	}
+
+	void build(const row *head) const
+	{
+		if (not m_valid)
 		{
-			auto parentCat = const_cast<category *>(db.get(link->m_parent_category));
-			if (parentCat == nullptr)
-				continue;
-			m_parent_links.emplace_back(parentCat, link);
+			for (auto r = head; r != nullptr; r = r->m_next)
+				m_buckets[hash(r)].m_rows.push_back(const_cast<row *>(r));
+			m_valid = true;
 		}
 	}
-}
 
-bool category::is_valid() const
+	std::vector<uint16_t> m_items;
+
+	// The buckets are built and sorted by lookups, which may be done
+	// by several threads and by the copies sharing this index
+	mutable std::mutex m_mutex;
+	mutable std::unordered_map<std::size_t, bucket> m_buckets;
+	mutable bool m_valid = false;
+};
+
+std::vector<row *> secondary_index::find(const row *head, std::size_t h) const
 {
-	bool result = true;
+	std::lock_guard lock(m_mutex);
 
-	if (m_validator == nullptr)
-		throw std::runtime_error("no Validator specified");
+	build(head);
 
-	if (empty())
+	auto bi = m_buckets.find(h);
+	if (bi == m_buckets.end())
+		return {};
+
+	auto &b = bi->second;
+
+	if (not b.m_sorted)
 	{
-		if (VERBOSE > 2)
-			std::cerr << "Skipping validation of empty category " << m_name << '\n';
-		return true;
+		std::unordered_set<const row *> rows(b.m_rows.begin(), b.m_rows.end());
+
+		b.m_rows.clear();
+		for (auto r = head; r != nullptr and b.m_rows.size() < rows.size(); r = r->m_next)
+		{
+			if (rows.contains(r))
+				b.m_rows.push_back(const_cast<row *>(r));
+		}
+
+		b.m_sorted = true;
 	}
 
-	if (m_cat_validator == nullptr)
+	return b.m_rows;
+}
+
+std::vector<row *> secondary_index::find(const row *head, const std::vector<std::size_t> &hashes) const
+{
+	if (hashes.size() == 1)
+		return find(head, hashes.front());
+
+	// Merge the buckets, keeping the order of the category
+	std::unordered_set<const row *> rows;
+	for (auto h : hashes)
 	{
-		m_validator->report_error(validation_error::undefined_category, m_name, {}, false);
-		return false;
+		for (auto r : find(head, h))
+			rows.insert(r);
 	}
 
-	auto mandatory = m_cat_validator->m_mandatory_items;
+	std::vector<row *> result;
+	result.reserve(rows.size());
+	for (auto r = head; r != nullptr and result.size() < rows.size(); r = r->m_next)
+	{
+		if (rows.contains(r))
+			result.push_back(const_cast<row *>(r));
+	}
 
-	for (auto &col : m_items)
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+category::category(std::string_view name)
+	: m_name(name)
+	, m_name_hash(ihash(name))
+{
+}
+
+// --------------------------------------------------------------------
+// The rows of a category are shared with its copies. The original
+// keeps its rows, its storage pools and its indices. The copies only
+// refer to a shared_rows object and have no rows until they acquire
+// them, which they do before the rows are accessed.
+//
+// A copy acquires the rows by cloning them, or by taking them over if
+// it is the last category using them. When the original is about to
+// be modified, it first stores a clone of its rows in the shared_rows
+// for the copies. And when the original stops using the rows, the
+// shared_rows takes over its storage instead.
+
+struct category::shared_rows
+{
+	shared_rows(const row *head, const std::vector<secondary_index *> &indices)
+		: m_head(head)
 	{
-		auto iv = m_cat_validator->get_validator_for_item(col.m_name);
-		if (iv == nullptr)
+		for (auto si : indices)
+			m_secondary_indices.push_back(new secondary_index(si->items()));
+	}
+
+	~shared_rows()
+	{
+		if (m_owns_rows)
 		{
-			m_validator->report_error(validation_error::unknown_item, col.m_name, m_name, false);
-			result = false;
+			row_allocator_type ra;
+			for (auto r = const_cast<row *>(m_head); r != nullptr;)
+			{
+				auto t = r;
+				r = r->m_next;
+				row_allocator_traits::destroy(ra, t);
+			}
 		}
 
-		// col.m_validator = iv;
-		if (col.m_validator != iv)
-			m_validator->report_error(validation_error::incorrect_item_validator, true);
-
-		mandatory.erase(col.m_name);
+		for (auto si : m_secondary_indices)
+			delete si;
 	}
 
-	if (not mandatory.empty())
+	// The number of categories using these rows
+	std::atomic<std::size_t> m_refs = 2;
+
+	// Protects the rows while they are cloned and replaced
+	std::mutex m_mutex;
+
+	// The rows, stored in m_rows and m_strings when m_owns_rows is true,
+	// otherwise they belong to the original
+	const row *m_head;
+	bool m_owns_rows = false;
+
+	// The items of the secondary indices, without the actual indices
+	std::vector<secondary_index *> m_secondary_indices;
+
+	row_pool m_rows;
+	string_pool m_strings;
+};
+
+category::shared_rows *category::share_rows() const
+{
+	auto s = m_shared.load();
+
+	if (s == nullptr)
 	{
-		m_validator->report_error(validation_error::missing_mandatory_items, m_name, join(mandatory, ", "), false);
-		result = false;
+		auto n = new shared_rows(m_head, m_secondary_indices);
+		if (m_shared.compare_exchange_strong(s, n))
+			return n;
+
+		// Another copy was made at the same time
+		delete n;
 	}
 
-	if (m_cat_validator->m_keys.empty() == false and m_index == nullptr)
+	++s->m_refs;
+	return s;
+}
+
+category::category(const category &rhs)
+	: m_name(rhs.m_name)
+	, m_name_hash(rhs.m_name_hash)
+	, m_items(rhs.m_items)
+	, m_item_table(rhs.m_item_table)
+	, m_validator(rhs.m_validator)
+	, m_cat_validator(rhs.m_cat_validator)
+	, m_cascade(rhs.m_cascade)
+	, m_index_type(rhs.m_index_type)
+{
+	// A copy of a copy uses the same shared rows, if they were not acquired yet
+	std::unique_lock lock(rhs.m_source_mutex);
+
+	if (auto s = rhs.m_source.load(); s != nullptr)
 	{
-		std::set<std::string> missing;
+		++s->m_refs;
+		m_source = s;
+		m_row_count = rhs.m_row_count;
+		return;
+	}
 
-		for (auto k : m_cat_validator->m_keys)
-		{
-			if (get_item_ix(k) >= m_items.size())
-				missing.insert(k);
-		}
+	lock.unlock();
 
-		m_validator->report_error(validation_error::missing_key_items, m_name, join(missing, ", "), false);
-		result = false;
+	if (rhs.m_head != nullptr)
+	{
+		m_source = rhs.share_rows();
+		m_row_count = rhs.m_row_count;
 	}
+	else
+		clone_rows(nullptr, rhs.m_secondary_indices);
+}
 
-	// #if not defined(NDEBUG)
-	// 	// check index?
-	// 	if (m_index)
-	// 	{
-	// 		if (m_index->size() != size())
-	// 			m_validator->report_error("size of index is not equal to size of category " + m_name, true);
+void category::acquire_shared_rows() const
+{
+	std::unique_lock lock(m_source_mutex);
 
-	// 		// m_index->validate();
-	// 		for (auto r : *this)
-	// 		{
-	// 			auto p = r.get_row();
-	// 			if (m_index->find(*this, p) != p)
-	// 				m_validator->report_error("Key not found in index for category " + m_name, true);
-	// 		}
-	// 	}
-	// #endif
+	auto s = m_source.load();
+	if (s == nullptr) // another thread was first
+		return;
 
-	// validate all values
-	mandatory = m_cat_validator->m_mandatory_items;
+	// The rows are assembled in another category first, the other
+	// threads reading this one wait for m_source to become null.
+	category tmp;
+	tmp.m_items = m_items;
+	tmp.m_item_table = m_item_table;
+	tmp.m_validator = m_validator;
+	tmp.m_cat_validator = m_cat_validator;
+	tmp.m_index_type = m_index_type;
+
+	bool last;
 
-	for (auto ri = m_head; ri != nullptr; ri = ri->m_next)
 	{
-		for (uint16_t cix = 0; cix < m_items.size(); ++cix)
+		std::unique_lock slock(s->m_mutex);
+
+		last = --s->m_refs == 0;
+
+		if (last)
 		{
-			bool seen = false;
-			auto iv = m_items[cix].m_validator;
+			assert(s->m_owns_rows);
 
-			if (iv == nullptr)
+			tmp.m_rows.splice(s->m_rows);
+			tmp.m_strings.splice(s->m_strings);
+			tmp.m_head = const_cast<row *>(std::exchange(s->m_head, nullptr));
+			s->m_owns_rows = false;
+
+			for (auto r = tmp.m_head; r != nullptr; r = r->m_next)
 			{
-				// no need to report, should have been reported already above
-				result = false;
-				continue;
+				tmp.m_tail = r;
+				++tmp.m_row_count;
 			}
 
-			auto vi = ri->get(cix);
-			if (vi != nullptr)
-			{
-				seen = true;
-				std::error_code ec;
+			if (tmp.m_cat_validator != nullptr)
+				tmp.create_key_index();
 
-				iv->validate_value(vi->text(), ec);
+			std::swap(tmp.m_secondary_indices, s->m_secondary_indices);
+		}
+		else
+			tmp.clone_rows(s->m_head, s->m_secondary_indices);
+	}
+
+	if (last)
+		delete s;
+
+	auto &self = const_cast<category &>(*this);
+
+	assert(tmp.m_row_count == m_row_count);
+
+	std::swap(self.m_head, tmp.m_head);
+	std::swap(self.m_tail, tmp.m_tail);
+	std::swap(self.m_index, tmp.m_index);
+	std::swap(self.m_secondary_indices, tmp.m_secondary_indices);
+	self.m_rows.swap(tmp.m_rows);
+	self.m_strings.swap(tmp.m_strings);
+
+	m_source = nullptr;
+}
+
+void category::detach_shared_rows()
+{
+	auto s = m_shared.exchange(nullptr);
+
+	category tmp;
+	bool last;
+
+	{
+		std::unique_lock slock(s->m_mutex);
+
+		last = --s->m_refs == 0;
+
+		// The copies need the rows as they are now
+		if (not last)
+		{
+			tmp.clone_rows(m_head, {});
+
+			s->m_rows.splice(tmp.m_rows);
+			s->m_strings.splice(tmp.m_strings);
+			s->m_head = std::exchange(tmp.m_head, nullptr);
+			s->m_owns_rows = true;
+
+			tmp.m_tail = nullptr;
+			tmp.m_row_count = 0;
+		}
+	}
+
+	if (last)
+		delete s;
+}
+
+void category::release_shared_rows()
+{
+	if (auto s = m_source.exchange(nullptr); s != nullptr)
+	{
+		// A copy that never acquired its rows, keep the secondary index definitions
+		{
+			std::unique_lock slock(s->m_mutex);
+
+			for (auto si : s->m_secondary_indices)
+				m_secondary_indices.push_back(new secondary_index(si->items()));
+		}
+
+		if (--s->m_refs == 0)
+			delete s;
+
+		m_row_count = 0;
+	}
+
+	if (auto s = m_shared.exchange(nullptr); s != nullptr)
+	{
+		bool last;
+
+		// The original, the copies take over its storage
+		{
+			std::unique_lock slock(s->m_mutex);
+
+			last = --s->m_refs == 0;
+
+			if (not last)
+			{
+				s->m_rows.splice(m_rows);
+				s->m_strings.splice(m_strings);
+				s->m_owns_rows = true;
+
+				m_head = m_tail = nullptr;
+				m_row_count = 0;
+				m_directory.clear();
+				m_directory_valid = false;
+
+				delete m_index;
+				m_index = nullptr;
+
+				secondary_index_invalidate();
+			}
+		}
+
+		if (last)
+			delete s;
+	}
+}
+
+void category::clone_rows(const row *head, const std::vector<secondary_index *> &indices)
+{
+	assert(m_shared == nullptr and m_source == nullptr and m_head == nullptr);
+
+	for (auto r = head; r != nullptr; r = r->m_next)
+	{
+		auto n = clone_row(*r);
+
+		if (m_head == nullptr)
+			m_head = n;
+		else
+			m_tail->m_next = n;
+		m_tail = n;
+
+		++m_row_count;
+	}
+
+	if (m_cat_validator != nullptr)
+		create_key_index();
+
+	for (auto si : indices)
+		m_secondary_indices.push_back(new secondary_index(si->items()));
+}
+
+// --------------------------------------------------------------------
+
+void swap(category &a, category &b) noexcept
+{
+	// The journal refers to the rows by address, changes recorded
+	// for the contents swapped out can no longer be undone
+	if (a.m_journal != nullptr)
+		a.m_journal->forget(&a);
+	if (b.m_journal != nullptr)
+		b.m_journal->forget(&b);
+
+	b.m_shared = a.m_shared.exchange(b.m_shared);
+	b.m_source = a.m_source.exchange(b.m_source);
+	std::swap(a.m_name, b.m_name);
+	std::swap(a.m_name_hash, b.m_name_hash);
+	std::swap(a.m_items, b.m_items);
+	std::swap(a.m_item_table, b.m_item_table);
+	std::swap(a.m_validator, b.m_validator);
+	std::swap(a.m_cat_validator, b.m_cat_validator);
+	std::swap(a.m_parent_links, b.m_parent_links);
+	std::swap(a.m_child_links, b.m_child_links);
+	std::swap(a.m_cascade, b.m_cascade);
+	std::swap(a.m_index, b.m_index);
+	std::swap(a.m_index_type, b.m_index_type);
+	std::swap(a.m_secondary_indices, b.m_secondary_indices);
+	std::swap(a.m_head, b.m_head);
+	std::swap(a.m_tail, b.m_tail);
+	std::swap(a.m_row_count, b.m_row_count);
+	std::swap(a.m_directory, b.m_directory);
+	a.m_directory_valid = b.m_directory_valid.exchange(a.m_directory_valid);
+	a.m_rows.swap(b.m_rows);
+	a.m_strings.swap(b.m_strings);
+}
+
+category::~category()
+{
+	if (m_journal != nullptr)
+		std::exchange(m_journal, nullptr)->forget(this);
+
+	clear();
+
+	for (auto si : m_secondary_indices)
+		delete si;
+}
+
+// --------------------------------------------------------------------
+
+void category::remove_item(std::string_view item_name)
+{
+	detach_rows();
+
+	for (std::size_t ix = 0; ix < m_items.size(); ++ix)
+	{
+		if (not iequals(item_name, m_items[ix].m_name))
+			continue;
+
+		for (row *r = m_head; r != nullptr; r = r->m_next)
+		{
+			if (r->size() > ix)
+				r->erase(r->begin() + ix);
+		}
+
+		m_items.erase(m_items.begin() + ix);
+		rebuild_item_table();
+
+		// drop the secondary indices on this item, renumber the others
+		for (auto si = m_secondary_indices.begin(); si != m_secondary_indices.end();)
+		{
+			auto &items = (*si)->items();
+
+			if (std::find(items.begin(), items.end(), ix) != items.end())
+			{
+				delete *si;
+				si = m_secondary_indices.erase(si);
+				continue;
+			}
+
+			for (auto &item : items)
+			{
+				if (item > ix)
+					--item;
+			}
+
+			(*si)->invalidate();
+			++si;
+		}
+
+		break;
+	}
+}
+
+void category::rename_item(std::string_view from_name, std::string_view to_name)
+{
+	for (std::size_t ix = 0; ix < m_items.size(); ++ix)
+	{
+		if (not iequals(from_name, m_items[ix].m_name))
+			continue;
+
+		m_items[ix].m_name = to_name;
+		m_items[ix].m_hash = ihash(to_name);
+		m_items[ix].m_validator = m_cat_validator ? m_cat_validator->get_validator_for_item(to_name) : nullptr;
+		rebuild_item_table();
+
+		break;
+	}
+}
+
+uint16_t category::add_item(std::string_view item_name, std::size_t hash)
+{
+	uint16_t result = find_item_ix(item_name, hash);
+
+	if (result == m_items.size())
+	{
+		const item_validator *item_validator = nullptr;
+
+		if (m_cat_validator != nullptr)
+		{
+			item_validator = m_cat_validator->get_validator_for_item(item_name);
+			if (item_validator == nullptr)
+				m_validator->report_error(validation_error::item_not_allowed_in_category, m_name, item_name, false);
+		}
+
+		m_items.emplace_back(item_name, hash, item_validator);
+
+		// keep the load factor of the table below one half
+		if (m_items.size() * 2 > m_item_table.size())
+			rebuild_item_table();
+		else
+		{
+			const std::size_t mask = m_item_table.size() - 1;
+			std::size_t i = hash & mask;
+			while (m_item_table[i] != 0)
+				i = (i + 1) & mask;
+			m_item_table[i] = static_cast<uint16_t>(m_items.size());
+		}
+	}
+
+	return result;
+}
+
+void category::rebuild_item_table()
+{
+	std::size_t size = 16;
+	while (size < m_items.size() * 2)
+		size *= 2;
+
+	m_item_table.assign(size, 0);
+
+	const std::size_t mask = size - 1;
+	for (std::size_t ix = 0; ix < m_items.size(); ++ix)
+	{
+		std::size_t i = m_items[ix].m_hash & mask;
+		while (m_item_table[i] != 0)
+			i = (i + 1) & mask;
+		m_item_table[i] = static_cast<uint16_t>(ix + 1);
+	}
+}
+
+iset category::get_items() const
+{
+	iset result;
+
+	for (auto &col : m_items)
+		result.insert(col.m_name);
+
+	return result;
+}
+
+iset category::key_items() const
+{
+	if (m_validator == nullptr)
+		throw std::runtime_error("No Validator specified");
+
+	if (m_cat_validator == nullptr)
+		throw validation_exception(validation_error::undefined_category);
+
+	iset result;
+	for (auto &iv : m_cat_validator->m_item_validators)
+		result.insert(iv.m_item_name);
+
+	return result;
+}
+
+std::set<uint16_t> category::key_item_indices() const
+{
+	if (m_validator == nullptr)
+		throw std::runtime_error("No Validator specified");
+
+	if (m_cat_validator == nullptr)
+		throw validation_exception(validation_error::undefined_category);
+
+	std::set<uint16_t> result;
+	for (auto &k : m_cat_validator->m_keys)
+		result.insert(get_item_ix(k));
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+void category::set_index_type(index_type type)
+{
+	if (m_index_type != type)
+	{
+		detach_rows();
+
+		m_index_type = type;
+
+		if (m_index != nullptr)
+		{
+			delete m_index;
+			m_index = nullptr;
+
+			create_key_index();
+		}
+	}
+}
+
+void category::create_key_index()
+{
+	assert(m_index == nullptr);
+
+	if (m_index_type == index_type::hash)
+		m_index = new category_hash_index(*this);
+	else
+		m_index = new category_tree_index(*this);
+}
+
+void category::create_index(const std::vector<std::string> &items)
+{
+	detach_rows();
+
+	std::vector<uint16_t> ix;
+	for (auto &item : items)
+		ix.push_back(add_item(item));
+
+	for (auto si : m_secondary_indices)
+	{
+		if (si->items() == ix)
+			return;
+	}
+
+	m_secondary_indices.push_back(new secondary_index(std::move(ix)));
+}
+
+std::optional<std::vector<row *>> category::find_in_secondary_index(const std::vector<detail::item_equality> &equalities, std::string &plan) const
+{
+	acquire_rows();
+
+	auto find_equality = [&equalities](uint16_t ix)
+	{
+		return std::find_if(equalities.begin(), equalities.end(), [ix](const detail::item_equality &eq)
+			{ return eq.m_item_ix == ix; });
+	};
+
+	// Of all the indices on items that are all tested for, use the one
+	// that returns the fewest rows
+	secondary_index *best = nullptr;
+	std::vector<std::size_t> best_hashes;
+	std::size_t best_count = 0;
+
+	for (auto si : m_secondary_indices)
+	{
+		auto &items = si->items();
+
+		if (not std::all_of(items.begin(), items.end(), [&](uint16_t ix)
+				{ return find_equality(ix) != equalities.end(); }))
+			continue;
+
+		// Numbers equal to the value may be found in two buckets
+		std::vector<std::size_t> hashes{ 0 };
+		for (auto ix : items)
+		{
+			auto vh = std::visit([](auto v)
+				{ return secondary_index::hash_values(v); }, find_equality(ix)->m_value);
+
+			std::vector<std::size_t> next;
+			for (auto h : hashes)
+			{
+				next.push_back(secondary_index::combine(h, vh[0]));
+				if (vh[1] != vh[0])
+					next.push_back(secondary_index::combine(h, vh[1]));
+			}
+
+			std::swap(hashes, next);
+		}
+
+		auto n = si->count(m_head, hashes);
+		if (best == nullptr or n < best_count)
+		{
+			best = si;
+			best_hashes = std::move(hashes);
+			best_count = n;
+		}
+	}
+
+	if (best == nullptr)
+		return {};
+
+	plan = "secondary index on";
+	for (bool first = true; auto ix : best->items())
+		plan += (std::exchange(first, false) ? " " : ", ") + m_items[ix].m_name;
+	plan += ", " + std::to_string(best_count) + " candidate rows";
+
+	return best->find(m_head, best_hashes);
+}
+
+double category::equality_selectivity(uint16_t item_ix) const
+{
+	if (m_row_count == 0)
+		return 1;
+
+	acquire_rows();
+
+	double result = 0.1;
+
+	if (m_cat_validator != nullptr and m_cat_validator->m_keys.size() == 1 and
+		get_item_ix(m_cat_validator->m_keys.front()) == item_ix)
+		result = 0;
+	else
+	{
+		for (auto si : m_secondary_indices)
+		{
+			auto n = si->distinct_count();
+			if (si->items().size() == 1 and si->items().front() == item_ix and n.has_value() and *n > 0)
+				result = 1.0 / *n;
+		}
+	}
+
+	return std::max(result, 1.0 / m_row_count);
+}
+
+void category::secondary_index_insert(row *r, bool at_end)
+{
+	for (auto si : m_secondary_indices)
+		si->insert(r, at_end);
+}
+
+void category::secondary_index_erase(row *r)
+{
+	for (auto si : m_secondary_indices)
+		si->erase(r);
+}
+
+void category::secondary_index_invalidate()
+{
+	for (auto si : m_secondary_indices)
+		si->invalidate();
+}
+
+void category::set_validator(const validator *v, datablock &db)
+{
+	detach_rows();
+
+	m_validator = v;
+
+	if (m_index != nullptr)
+	{
+		delete m_index;
+		m_index = nullptr;
+	}
+
+	if (m_validator != nullptr)
+	{
+		m_cat_validator = m_validator->get_validator_for_category(m_name);
+
+		if (m_cat_validator != nullptr)
+		{
+			std::set<std::string> missing;
+
+			if (not empty())
+			{
+				std::vector<uint16_t> kix;
+				for (auto k : m_cat_validator->m_keys)
+				{
+					kix.push_back(get_item_ix(k));
+					if (kix.back() >= m_items.size())
+						missing.insert(k);
+				}
+			}
+
+			if (missing.empty())
+				create_key_index();
+			else
+			{
+				std::ostringstream msg;
+				msg << "Cannot construct index since the key item" << (missing.size() > 1 ? "s" : "") << " "
+					<< cif::join(missing, ", ") << " in " << m_name << " " << (missing.size() == 1 ? "is" : "are") << " missing\n";
+				throw missing_key_error(msg.str(), *missing.begin());
+			}
+		}
+	}
+	else
+		m_cat_validator = nullptr;
+
+	for (auto &item : m_items)
+		item.m_validator = m_cat_validator ? m_cat_validator->get_validator_for_item(item.m_name) : nullptr;
+
+	update_links(db);
+}
+
+void category::update_links(const datablock &db)
+{
+	m_child_links.clear();
+	m_parent_links.clear();
+
+	if (m_validator != nullptr)
+	{
+		for (auto link : m_validator->get_links_for_parent(m_name))
+		{
+			auto childCat = const_cast<category *>(db.get(link->m_child_category));
+			if (childCat == nullptr)
+				continue;
+			m_child_links.emplace_back(childCat, link);
+		}
+
+		for (auto link : m_validator->get_links_for_child(m_name))
+		{
+			auto parentCat = const_cast<category *>(db.get(link->m_parent_category));
+			if (parentCat == nullptr)
+				continue;
+			m_parent_links.emplace_back(parentCat, link);
+		}
+	}
+}
+
+bool category::is_valid() const
+{
+	bool result = true;
+
+	if (m_validator == nullptr)
+		throw std::runtime_error("no Validator specified");
+
+	acquire_rows();
+
+	if (empty())
+	{
+		if (VERBOSE > 2)
+			std::cerr << "Skipping validation of empty category " << m_name << '\n';
+		return true;
+	}
+
+	if (m_cat_validator == nullptr)
+	{
+		m_validator->report_error(validation_error::undefined_category, m_name, {}, false);
+		return false;
+	}
+
+	auto mandatory = m_cat_validator->m_mandatory_items;
+
+	for (auto &col : m_items)
+	{
+		auto iv = m_cat_validator->get_validator_for_item(col.m_name);
+		if (iv == nullptr)
+		{
+			m_validator->report_error(validation_error::unknown_item, col.m_name, m_name, false);
+			result = false;
+		}
+
+		// col.m_validator = iv;
+		if (col.m_validator != iv)
+			m_validator->report_error(validation_error::incorrect_item_validator, true);
+
+		mandatory.erase(col.m_name);
+	}
+
+	if (not mandatory.empty())
+	{
+		m_validator->report_error(validation_error::missing_mandatory_items, m_name, join(mandatory, ", "), false);
+		result = false;
+	}
+
+	if (m_cat_validator->m_keys.empty() == false and m_index == nullptr)
+	{
+		std::set<std::string> missing;
+
+		for (auto k : m_cat_validator->m_keys)
+		{
+			if (get_item_ix(k) >= m_items.size())
+				missing.insert(k);
+		}
+
+		m_validator->report_error(validation_error::missing_key_items, m_name, join(missing, ", "), false);
+		result = false;
+	}
+
+	// #if not defined(NDEBUG)
+	// 	// check index?
+	// 	if (m_index)
+	// 	{
+	// 		if (m_index->size() != size())
+	// 			m_validator->report_error("size of index is not equal to size of category " + m_name, true);
+
+	// 		// m_index->validate();
+	// 		for (auto r : *this)
+	// 		{
+	// 			auto p = r.get_row();
+	// 			if (m_index->find(*this, p) != p)
+	// 				m_validator->report_error("Key not found in index for category " + m_name, true);
+	// 		}
+	// 	}
+	// #endif
+
+	// validate all values
+	mandatory = m_cat_validator->m_mandatory_items;
+
+	for (auto ri = m_head; ri != nullptr; ri = ri->m_next)
+	{
+		for (uint16_t cix = 0; cix < m_items.size(); ++cix)
+		{
+			bool seen = false;
+			auto iv = m_items[cix].m_validator;
+
+			if (iv == nullptr)
+			{
+				// no need to report, should have been reported already above
+				result = false;
+				continue;
+			}
+
+			auto vi = ri->get(cix);
+			if (vi != nullptr)
+			{
+				seen = true;
+				std::error_code ec;
+
+				iv->validate_value(vi->text(), ec);
+
+				if ((bool)ec)
+				{
+					m_validator->report_error(ec, m_name, m_items[cix].m_name, false);
+					continue;
+				}
+			}
+
+			if (seen or ri != m_head)
+				continue;
+
+			if (iv != nullptr and iv->m_mandatory)
+			{
+				m_validator->report_error(validation_error::missing_mandatory_items, m_name, m_items[cix].m_name, false);
+				result = false;
+			}
+		}
+	}
+
+	return result;
+}
+
+bool category::validate_links() const
+{
+	if (not m_validator)
+		return false;
+
+	bool result = true;
+
+	for (auto &link : m_parent_links)
+	{
+		auto parent = link.linked;
+
+		if (parent == nullptr)
+			continue;
+
+		// this particular case should be skipped, that's because it is wrong:
+		// there are atoms that are not part of a polymer, and thus will have no
+		// parent in that category.
+		if (name() == "atom_site" and (parent->name() == "pdbx_poly_seq_scheme" or parent->name() == "entity_poly_seq"))
+			continue;
+
+		std::size_t missing = 0;
+		category first_missing_rows(name());
+
+		for (auto r : *this)
+		{
+			auto cond = get_parents_condition(r, *parent);
+			if (not cond)
+				continue;
+			if (not parent->contains(std::move(cond)))
+			{
+				++missing;
+				if (VERBOSE and first_missing_rows.size() < 5)
+					first_missing_rows.emplace(r);
+			}
+		}
+
+		if (missing)
+		{
+			result = false;
+
+			std::cerr << "Links for " << link.v->m_link_group_label << " are incomplete\n"
+					  << "  There are " << missing << " items in " << m_name << " that don't have matching parent items in " << parent->m_name << '\n';
+
+			if (VERBOSE)
+			{
+				std::cerr << "showing first " << first_missing_rows.size() << " rows\n"
+						  << '\n';
+
+				first_missing_rows.write(std::cerr, link.v->m_child_keys, false);
+
+				std::cerr << '\n';
+			}
+		}
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+row_handle category::operator[](const key_type &key)
+{
+	detach_rows();
+
+	return std::as_const(*this)[key];
+}
+
+const row_handle category::operator[](const key_type &key) const
+{
+	acquire_rows();
+
+	row_handle result{};
+
+	if (not empty())
+	{
+		if (m_index == nullptr)
+			throw std::logic_error("Category " + m_name + " does not have an index");
+
+		auto row = m_index->find_by_value(*this, key);
+		if (row != nullptr)
+			result = { *this, *row };
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+condition category::get_parents_condition(row_handle rh, const category &parentCat) const
+{
+	if (m_validator == nullptr or m_cat_validator == nullptr)
+		throw std::runtime_error("No validator known for category " + m_name);
+
+	condition result;
+
+	auto links = m_validator->get_links_for_child(m_name);
+	links.erase(remove_if(links.begin(), links.end(), [n = parentCat.m_name](auto &l)
+					{ return l->m_parent_category != n; }),
+		links.end());
+
+	if (not links.empty())
+	{
+		for (auto &link : links)
+		{
+			condition cond;
+
+			for (std::size_t ix = 0; ix < link->m_child_keys.size(); ++ix)
+			{
+				auto childValue = rh[link->m_child_keys[ix]];
+
+				if (childValue.empty())
+					continue;
+
+				cond = std::move(cond) and key(link->m_parent_keys[ix]) == childValue.text();
+			}
+
+			result = std::move(result) or std::move(cond);
+		}
+	}
+	else if (cif::VERBOSE > 0)
+		std::cerr << "warning: no child to parent links were found for child " << parentCat.name() << " and parent " << name() << '\n';
+
+	return result;
+}
+
+condition category::get_children_condition(row_handle rh, const category &childCat) const
+{
+	if (m_validator == nullptr or m_cat_validator == nullptr)
+		throw std::runtime_error("No validator known for category " + m_name);
+
+	condition result;
+
+	iset mandatoryChildItems;
+	auto childCatValidator = m_validator->get_validator_for_category(childCat.name());
+	if (childCatValidator != nullptr)
+		mandatoryChildItems = childCatValidator->m_mandatory_items;
+
+	auto links = m_validator->get_links_for_parent(m_name);
+	links.erase(remove_if(links.begin(), links.end(), [n = childCat.m_name](auto &l)
+					{ return l->m_child_category != n; }),
+		links.end());
+
+	if (not links.empty())
+	{
+		for (auto &link : links)
+		{
+			condition cond;
+
+			for (std::size_t ix = 0; ix < link->m_parent_keys.size(); ++ix)
+			{
+				auto childKey = link->m_child_keys[ix];
+				auto parentKey = link->m_parent_keys[ix];
+
+				auto parentValue = rh[parentKey];
+
+				if (parentValue.empty())
+					cond = std::move(cond) and key(childKey) == null;
+				else if (link->m_parent_keys.size() > 1 and not mandatoryChildItems.contains(childKey))
+					cond = std::move(cond) and (key(childKey) == parentValue.text() or key(childKey) == null);
+				else
+					cond = std::move(cond) and key(childKey) == parentValue.text();
+			}
+
+			result = std::move(result) or std::move(cond);
+		}
+	}
+	else if (cif::VERBOSE > 0)
+		std::cerr << "warning: no parent to child links were found for parent " << name() << " and child " << childCat.name() << '\n';
+
+	return result;
+}
+
+bool category::has_children(row_handle r) const
+{
+	bool result = false;
+
+	for (auto &&[childCat, link] : m_child_links)
+	{
+		if (not childCat->contains(get_children_condition(r, *childCat)))
+			continue;
+
+		result = true;
+		break;
+	}
+
+	return result;
+}
+
+bool category::has_parents(row_handle r) const
+{
+	bool result = false;
+
+	for (auto &&[parentCat, link] : m_parent_links)
+	{
+		if (not parentCat->contains(get_parents_condition(r, *parentCat)))
+			continue;
+
+		result = true;
+		break;
+	}
+
+	return result;
+}
+
+std::vector<row_handle> category::get_children(row_handle r, const category &childCat) const
+{
+	if (m_validator == nullptr or m_cat_validator == nullptr)
+		throw std::runtime_error("No validator known for category " + m_name);
+
+	std::vector<row_handle> result;
+
+	for (auto child : childCat.find(get_children_condition(r, childCat)))
+	{
+		if (std::find(result.begin(), result.end(), child) == result.end())
+			result.push_back(child);
+	}
+
+	return result;
+}
+
+std::vector<row_handle> category::get_parents(row_handle r, const category &parentCat) const
+{
+	assert(m_validator != nullptr);
+	assert(m_cat_validator != nullptr);
+
+	std::vector<row_handle> result;
+
+	for (auto parent : parentCat.find(get_parents_condition(r, parentCat)))
+	{
+		if (std::find(result.begin(), result.end(), parent) == result.end())
+			result.push_back(parent);
+	}
+
+	return result;
+}
+
+std::vector<row_handle> category::get_linked(row_handle r, const category &cat) const
+{
+	std::vector<row_handle> result = get_children(r, cat);
+	if (result.empty())
+		result = get_parents(r, cat);
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+category::iterator category::erase(iterator pos)
+{
+	detach_rows();
+
+	row *r = (*pos).get_row();
+	row_handle rh(*this, *r);
+	iterator result(*this, r->m_next);
+
+	if (m_head == nullptr)
+		throw std::runtime_error("erase");
+
+	if (m_index != nullptr)
+		m_index->erase(*this, r);
+
+	secondary_index_erase(r);
+
+	row *prev = nullptr;
+
+	if (r == m_head)
+	{
+		m_head = m_head->m_next;
+		r->m_next = nullptr;
+	}
+	else
+	{
+		for (auto pi = m_head; pi != nullptr; pi = pi->m_next)
+		{
+			if (pi->m_next == r)
+			{
+				pi->m_next = r->m_next;
+				r->m_next = nullptr;
+				prev = pi;
+				break;
+			}
+		}
+	}
+
+	// reset the tail before the cascade below, it may erase prev as well
+	if (r == m_tail)
+		m_tail = prev;
+
+	--m_row_count;
+	m_directory_valid = false;
+
+	bool keep = m_journal != nullptr and m_journal->record_erase(this, r, prev);
+
+	// links are created based on the _pdbx_item_linked_group_list entries
+	// in mmcif_pdbx.dic dictionary.
+	//
+	// For each link group in _pdbx_item_linked_group_list
+	// a set of keys from one category is mapped to another.
+	// If all values in a child are the same as the specified parent ones
+	// the child is removed as well, recursively of course.
+
+	if (m_validator != nullptr)
+	{
+		for (auto &&[childCat, link] : m_child_links)
+			childCat->erase_orphans(get_children_condition(rh, *childCat), *this);
+	}
+
+	if (not keep)
+		delete_row(r);
+
+	return result;
+}
+
+template <typename T>
+class save_value
+{
+  public:
+	save_value(T &v, const T nv = {})
+		: m_v(v)
+		, m_sv(std::exchange(m_v, nv))
+	{
+	}
+
+	~save_value()
+	{
+		m_v = m_sv;
+	}
+
+  private:
+	T &m_v;
+	const T m_sv;
+};
+
+template <typename Pred>
+std::size_t category::erase_if(Pred &&pred, std::function<void(row_handle)> &&visit)
+{
+	detach_rows();
+
+	std::size_t result = 0;
+
+	std::map<category *, condition> potential_orphans;
+
+	auto ri = begin();
+	while (ri != end())
+	{
+		if (pred(*ri))
+		{
+			if (visit)
+				visit(*ri);
 
-				if ((bool)ec)
-				{
-					m_validator->report_error(ec, m_name, m_items[cix].m_name, false);
+			for (auto &&[childCat, link] : m_child_links)
+			{
+				auto ccond = get_children_condition(*ri, *childCat);
+				if (not ccond)
 					continue;
-				}
+				potential_orphans[childCat] = std::move(potential_orphans[childCat]) or std::move(ccond);
 			}
 
-			if (seen or ri != m_head)
-				continue;
+			save_value sv(m_validator);
 
-			if (iv != nullptr and iv->m_mandatory)
-			{
-				m_validator->report_error(validation_error::missing_mandatory_items, m_name, m_items[cix].m_name, false);
-				result = false;
-			}
+			ri = erase(ri);
+			++result;
 		}
+		else
+			++ri;
 	}
 
+	for (auto &&[childCat, condition] : potential_orphans)
+		childCat->erase_orphans(std::move(condition), *this);
+
 	return result;
 }
 
-bool category::validate_links() const
+std::size_t category::erase(condition &&cond)
 {
-	if (not m_validator)
-		return false;
+	return erase(std::move(cond), {});
+}
 
-	bool result = true;
+std::size_t category::erase(condition &&cond, std::function<void(row_handle)> &&visit)
+{
+	// the prepared condition may refer to rows of this category
+	detach_rows();
 
-	for (auto &link : m_parent_links)
-	{
-		auto parent = link.linked;
+	cond.prepare(*this);
 
-		if (parent == nullptr)
-			continue;
+	return erase_if([&cond](row_handle r)
+		{ return cond(r); }, std::move(visit));
+}
 
-		// this particular case should be skipped, that's because it is wrong:
-		// there are atoms that are not part of a polymer, and thus will have no
-		// parent in that category.
-		if (name() == "atom_site" and (parent->name() == "pdbx_poly_seq_scheme" or parent->name() == "entity_poly_seq"))
-			continue;
+// --------------------------------------------------------------------
 
-		std::size_t missing = 0;
-		category first_missing_rows(name());
+namespace
+{
+	// The number of rows in the ranges handed to the threads
+	constexpr std::size_t kParallelChunkSize = 16 * condition::kBatchSize;
+
+	// Call @a f for each range of at most kParallelChunkSize rows in @a rows
+	// using @a n_threads threads. @a f is called with the index of the range,
+	// the rows and the number of rows.
+	template <typename F>
+	void for_each_chunk_parallel(row *const *rows, std::size_t count, std::size_t n_threads, F &&f)
+	{
+		std::size_t n_chunks = (count + kParallelChunkSize - 1) / kParallelChunkSize;
 
-		for (auto r : *this)
+		if (n_threads == 0)
+			n_threads = std::thread::hardware_concurrency();
+
+		std::vector<std::exception_ptr> errors(n_chunks);
+		std::atomic<std::size_t> next = 0;
+
+		auto worker = [&]()
 		{
-			auto cond = get_parents_condition(r, *parent);
-			if (not cond)
-				continue;
-			if (not parent->contains(std::move(cond)))
+			for (std::size_t i = next++; i < n_chunks; i = next++)
 			{
-				++missing;
-				if (VERBOSE and first_missing_rows.size() < 5)
-					first_missing_rows.emplace(r);
+				try
+				{
+					auto b = i * kParallelChunkSize;
+					f(i, rows + b, std::min(kParallelChunkSize, count - b));
+				}
+				catch (...)
+				{
+					errors[i] = std::current_exception();
+				}
 			}
+		};
+
+		if (n_threads <= 1 or n_chunks <= 1)
+			worker();
+		else
+		{
+			std::vector<std::thread> threads;
+			for (std::size_t i = 0; i < std::min(n_threads, n_chunks); ++i)
+				threads.emplace_back(worker);
+
+			for (auto &t : threads)
+				t.join();
 		}
 
-		if (missing)
+		for (auto &e : errors)
 		{
-			result = false;
+			if (e)
+				std::rethrow_exception(e);
+		}
+	}
+} // namespace
 
-			std::cerr << "Links for " << link.v->m_link_group_label << " are incomplete\n"
-					  << "  There are " << missing << " items in " << m_name << " that don't have matching parent items in " << parent->m_name << '\n';
+void category::bulk_insert_rows(std::vector<row *> &&rows, std::size_t n_threads)
+{
+	detach_rows();
 
-			if (VERBOSE)
+	if (rows.empty())
+		return;
+
+	std::vector<std::string> errors;
+
+	if (m_cat_validator != nullptr)
+	{
+		if (m_index == nullptr)
+			create_key_index();
+
+		// Validate the values and look up the keys in the existing index
+		std::vector<std::vector<std::string>> chunk_errors((rows.size() + kParallelChunkSize - 1) / kParallelChunkSize);
+
+		for_each_chunk_parallel(rows.data(), rows.size(), n_threads, [&](std::size_t ix, row *const *chunk, std::size_t n)
 			{
-				std::cerr << "showing first " << first_missing_rows.size() << " rows\n"
-						  << '\n';
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					auto r = chunk[i];
+					auto nr = std::to_string(ix * kParallelChunkSize + i);
 
-				first_missing_rows.write(std::cerr, link.v->m_child_keys, false);
+					for (uint16_t cix = 0; cix < static_cast<uint16_t>(m_items.size()); ++cix)
+					{
+						auto iv = m_items[cix].m_validator;
+						if (iv == nullptr)
+							continue;
+
+						auto v = r->get(cix);
+						if (v != nullptr)
+						{
+							std::error_code ec;
+							if (not iv->validate_value(v->text(), ec))
+								chunk_errors[ix].emplace_back("row " + nr + ": " + ec.message() + ", item " + m_items[cix].m_name + " value " + std::string{ v->text() });
+						}
+						else if (iv->m_mandatory)
+							chunk_errors[ix].emplace_back("row " + nr + ": missing mandatory item " + m_items[cix].m_name);
+					}
 
-				std::cerr << '\n';
-			}
-		}
-	}
+					if (m_index->find(*this, r) != nullptr)
+						chunk_errors[ix].emplace_back("row " + nr + ": duplicate key " + m_index->describe_key(*this, r));
+				} });
 
-	return result;
-}
+		for (auto &ce : chunk_errors)
+			errors.insert(errors.end(), ce.begin(), ce.end());
 
-// --------------------------------------------------------------------
+		// Duplicate keys within the new rows
+		std::vector<row *> sorted(rows);
+		m_index->sort(*this, sorted);
 
-row_handle category::operator[](const key_type &key)
-{
-	row_handle result{};
+		for (std::size_t i = 1; i < sorted.size(); ++i)
+		{
+			if (m_index->same_key(*this, sorted[i - 1], sorted[i]))
+				errors.emplace_back("duplicate key in new rows " + m_index->describe_key(*this, sorted[i]));
+		}
 
-	if (not empty())
+		if (errors.empty())
+			m_index->insert_sorted(*this, sorted);
+	}
+
+	if (not errors.empty())
 	{
-		if (m_index == nullptr)
-			throw std::logic_error("Category " + m_name + " does not have an index");
+		for (auto r : rows)
+			delete_row(r);
 
-		auto row = m_index->find_by_value(*this, key);
-		if (row != nullptr)
-			result = { *this, *row };
+		throw bulk_insert_error(m_name, std::move(errors));
 	}
 
-	return result;
-}
+	for (std::size_t i = 0; i + 1 < rows.size(); ++i)
+		rows[i]->m_next = rows[i + 1];
 
-// --------------------------------------------------------------------
+	append_rows(rows.front(), rows.back());
+}
 
-condition category::get_parents_condition(row_handle rh, const category &parentCat) const
+std::vector<row *> category::find_rows_parallel(condition &cond, std::size_t n_threads) const
 {
-	if (m_validator == nullptr or m_cat_validator == nullptr)
-		throw std::runtime_error("No validator known for category " + m_name);
-
-	condition result;
+	if (not cond)
+		return {};
 
-	auto links = m_validator->get_links_for_child(m_name);
-	links.erase(remove_if(links.begin(), links.end(), [n = parentCat.m_name](auto &l)
-					{ return l->m_parent_category != n; }),
-		links.end());
+	cond.prepare(*this);
 
-	if (not links.empty())
+	const std::vector<row *> *rows = cond.candidates();
+	if (rows == nullptr)
 	{
-		for (auto &link : links)
-		{
-			condition cond;
+		build_directory();
+		rows = &m_directory;
+	}
 
-			for (std::size_t ix = 0; ix < link->m_child_keys.size(); ++ix)
-			{
-				auto childValue = rh[link->m_child_keys[ix]];
+	std::vector<std::vector<row *>> found((rows->size() + kParallelChunkSize - 1) / kParallelChunkSize);
 
-				if (childValue.empty())
-					continue;
+	for_each_chunk_parallel(rows->data(), rows->size(), n_threads, [&](std::size_t ix, row *const *chunk, std::size_t n)
+		{
+			auto &f = found[ix];
+			f.assign(chunk, chunk + n);
+			f.resize(cond.filter(f.data(), n)); });
 
-				cond = std::move(cond) and key(link->m_parent_keys[ix]) == childValue.text();
-			}
+	std::vector<row *> result;
 
-			result = std::move(result) or std::move(cond);
-		}
+	if (found.size() == 1)
+		std::swap(result, found.front());
+	else
+	{
+		std::size_t n = 0;
+		for (auto &f : found)
+			n += f.size();
+
+		result.reserve(n);
+		for (auto &f : found)
+			result.insert(result.end(), f.begin(), f.end());
 	}
-	else if (cif::VERBOSE > 0)
-		std::cerr << "warning: no child to parent links were found for child " << parentCat.name() << " and parent " << name() << '\n';
 
 	return result;
 }
 
-condition category::get_children_condition(row_handle rh, const category &childCat) const
+std::vector<row_handle> category::find_parallel(condition &&cond, std::size_t n_threads)
 {
-	if (m_validator == nullptr or m_cat_validator == nullptr)
-		throw std::runtime_error("No validator known for category " + m_name);
+	std::vector<row_handle> result;
 
-	condition result;
+	for (auto r : find_rows_parallel(cond, n_threads))
+		result.emplace_back(*this, *r);
 
-	iset mandatoryChildItems;
-	auto childCatValidator = m_validator->get_validator_for_category(childCat.name());
-	if (childCatValidator != nullptr)
-		mandatoryChildItems = childCatValidator->m_mandatory_items;
+	return result;
+}
 
-	auto links = m_validator->get_links_for_parent(m_name);
-	links.erase(remove_if(links.begin(), links.end(), [n = childCat.m_name](auto &l)
-					{ return l->m_child_category != n; }),
-		links.end());
+std::size_t category::count_parallel(condition &&cond, std::size_t n_threads) const
+{
+	if (not cond)
+		return 0;
 
-	if (not links.empty())
+	cond.prepare(*this);
+
+	const std::vector<row *> *rows = cond.candidates();
+	if (rows == nullptr)
 	{
-		for (auto &link : links)
+		build_directory();
+		rows = &m_directory;
+	}
+
+	std::atomic<std::size_t> result = 0;
+
+	for_each_chunk_parallel(rows->data(), rows->size(), n_threads, [&](std::size_t, row *const *chunk, std::size_t n)
 		{
-			condition cond;
+			std::vector<row *> f(chunk, chunk + n);
+			result += cond.filter(f.data(), n); });
 
-			for (std::size_t ix = 0; ix < link->m_parent_keys.size(); ++ix)
-			{
-				auto childKey = link->m_child_keys[ix];
-				auto parentKey = link->m_parent_keys[ix];
+	return result;
+}
 
-				auto parentValue = rh[parentKey];
+bool category::contains_parallel(condition &&cond, std::size_t n_threads) const
+{
+	if (not cond)
+		return false;
 
-				if (parentValue.empty())
-					cond = std::move(cond) and key(childKey) == null;
-				else if (link->m_parent_keys.size() > 1 and not mandatoryChildItems.contains(childKey))
-					cond = std::move(cond) and (key(childKey) == parentValue.text() or key(childKey) == null);
-				else
-					cond = std::move(cond) and key(childKey) == parentValue.text();
-			}
+	cond.prepare(*this);
 
-			result = std::move(result) or std::move(cond);
-		}
+	const std::vector<row *> *rows = cond.candidates();
+	if (rows == nullptr)
+	{
+		build_directory();
+		rows = &m_directory;
 	}
-	else if (cif::VERBOSE > 0)
-		std::cerr << "warning: no parent to child links were found for parent " << name() << " and child " << childCat.name() << '\n';
+
+	std::atomic<bool> result = false;
+
+	for_each_chunk_parallel(rows->data(), rows->size(), n_threads, [&](std::size_t, row *const *chunk, std::size_t n)
+		{
+			if (result)
+				return;
+
+			std::vector<row *> f(chunk, chunk + n);
+			if (cond.filter(f.data(), n) > 0)
+				result = true; });
 
 	return result;
 }
 
-bool category::has_children(row_handle r) const
+std::size_t category::erase_parallel(condition &&cond, std::size_t n_threads)
 {
-	bool result = false;
+	detach_rows();
 
-	for (auto &&[childCat, link] : m_child_links)
-	{
-		if (not childCat->contains(get_children_condition(r, *childCat)))
-			continue;
+	auto rows = find_rows_parallel(cond, n_threads);
+	if (rows.empty())
+		return 0;
 
-		result = true;
-		break;
-	}
+	// Erasing a row may cascade to other rows in this category, those
+	// are then skipped since only the rows still in the list are tested
+	std::unordered_set<const row *> matched(rows.begin(), rows.end());
 
-	return result;
+	return erase_if([&matched](row_handle r)
+		{ return matched.contains(r.get_row()); }, {});
 }
 
-bool category::has_parents(row_handle r) const
+void category::clear()
 {
-	bool result = false;
+	// The journal refers to the rows of this category
+	if (m_journal != nullptr)
+		detach_rows();
 
-	for (auto &&[parentCat, link] : m_parent_links)
+	if (m_shared != nullptr or m_source != nullptr)
+		release_shared_rows();
+
+	// The journal keeps the rows, they are erased one by one from the front
+	if (m_journal != nullptr and m_head != nullptr)
 	{
-		if (not parentCat->contains(get_parents_condition(r, *parentCat)))
-			continue;
+		while (m_head != nullptr)
+		{
+			auto r = std::exchange(m_head, m_head->m_next);
+			r->m_next = nullptr;
+			if (not m_journal->record_erase(this, r, nullptr))
+				delete_row(r);
+		}
 
-		result = true;
-		break;
+		m_tail = nullptr;
+		m_row_count = 0;
+		m_directory.clear();
+		m_directory_valid = false;
+
+		delete m_index;
+		m_index = nullptr;
+
+		secondary_index_invalidate();
+		return;
 	}
 
-	return result;
+	// The storage for the rows is released all at once below
+	row_allocator_type ra(get_allocator());
+
+	auto i = m_head;
+	while (i != nullptr)
+	{
+		auto t = i;
+		i = i->m_next;
+		row_allocator_traits::destroy(ra, t);
+	}
+
+	m_head = m_tail = nullptr;
+	m_row_count = 0;
+	m_directory.clear();
+	m_directory_valid = false;
+
+	m_rows.release();
+	m_strings.release();
+
+	delete m_index;
+	m_index = nullptr;
+
+	secondary_index_invalidate();
 }
 
-std::vector<row_handle> category::get_children(row_handle r, const category &childCat) const
+// --------------------------------------------------------------------
+
+void category::undo_insert(row *r, row *prev)
 {
-	if (m_validator == nullptr or m_cat_validator == nullptr)
-		throw std::runtime_error("No validator known for category " + m_name);
+	detach_rows();
 
-	std::vector<row_handle> result;
+	assert(prev == nullptr ? m_head == r : prev->m_next == r);
 
-	for (auto child : childCat.find(get_children_condition(r, childCat)))
-	{
-		if (std::find(result.begin(), result.end(), child) == result.end())
-			result.push_back(child);
-	}
+	if (m_index != nullptr and m_index->find(*this, r) == r)
+		m_index->erase(*this, r);
+
+	secondary_index_erase(r);
+
+	if (prev == nullptr)
+		m_head = r->m_next;
+	else
+		prev->m_next = r->m_next;
+
+	if (m_tail == r)
+		m_tail = prev;
 
-	return result;
+	r->m_next = nullptr;
+
+	--m_row_count;
+	m_directory_valid = false;
+
+	delete_row(r);
 }
 
-std::vector<row_handle> category::get_parents(row_handle r, const category &parentCat) const
+void category::undo_erase(row *r, row *prev)
 {
-	assert(m_validator != nullptr);
-	assert(m_cat_validator != nullptr);
+	detach_rows();
 
-	std::vector<row_handle> result;
+	assert(r->m_next == nullptr);
 
-	for (auto parent : parentCat.find(get_parents_condition(r, parentCat)))
+	if (prev == nullptr)
 	{
-		if (std::find(result.begin(), result.end(), parent) == result.end())
-			result.push_back(parent);
+		r->m_next = m_head;
+		m_head = r;
+	}
+	else
+	{
+		r->m_next = prev->m_next;
+		prev->m_next = r;
 	}
 
-	return result;
+	if (r->m_next == nullptr)
+		m_tail = r;
+
+	++m_row_count;
+	m_directory_valid = false;
+
+	// clear() removes the index
+	if (m_index != nullptr)
+		m_index->insert(*this, r);
+	else if (m_cat_validator != nullptr)
+		create_key_index();
+
+	secondary_index_insert(r, r == m_tail);
 }
 
-std::vector<row_handle> category::get_linked(row_handle r, const category &cat) const
+void category::undo_reorder(const std::vector<row *> &order)
 {
-	std::vector<row_handle> result = get_children(r, cat);
-	if (result.empty())
-		result = get_parents(r, cat);
-	return result;
+	detach_rows();
+
+	assert(order.size() == m_row_count);
+
+	m_head = order.front();
+	m_tail = order.back();
+
+	for (std::size_t i = 1; i < order.size(); ++i)
+		order[i - 1]->m_next = order[i];
+	m_tail->m_next = nullptr;
+
+	m_directory_valid = false;
+	secondary_index_invalidate();
 }
 
 // --------------------------------------------------------------------
 
-category::iterator category::erase(iterator pos)
+namespace detail
 {
-	row_handle rh = *pos;
-	row *r = rh.get_row();
-	iterator result = ++pos;
-
-	if (m_head == nullptr)
-		throw std::runtime_error("erase");
+	void journal::begin(datablock &db)
+	{
+		m_marks.push_back(m_changes.size());
 
-	if (m_index != nullptr)
-		m_index->erase(*this, r);
+		if (m_marks.size() == 1)
+		{
+			for (auto &cat : db)
+				cat.m_journal = this;
+		}
+	}
 
-	if (r == m_head)
+	void journal::commit(datablock &db)
 	{
-		m_head = m_head->m_next;
-		r->m_next = nullptr;
+		assert(active());
+
+		m_marks.pop_back();
+
+		// The changes of a nested transaction are part of the enclosing one
+		if (active())
+			return;
+
+		for (auto &c : m_changes)
+		{
+			if (c.m_kind == change_kind::erase and c.m_category != nullptr)
+				c.m_category->delete_row(c.m_row);
+		}
+
+		m_changes.clear();
+		detach(db);
 	}
-	else
+
+	void journal::rollback(datablock &db)
 	{
-		for (auto pi = m_head; pi != nullptr; pi = pi->m_next)
+		assert(active());
+
+		auto mark = m_marks.back();
+		m_marks.pop_back();
+
+		m_undoing = true;
+
+		try
 		{
-			if (pi->m_next == r)
+			while (m_changes.size() > mark)
 			{
-				pi->m_next = r->m_next;
-				r->m_next = nullptr;
-				break;
+				auto c = std::move(m_changes.back());
+				m_changes.pop_back();
+
+				auto cat = c.m_category;
+				if (cat == nullptr)
+					continue;
+
+				switch (c.m_kind)
+				{
+					case change_kind::create:
+						db.remove_if([cat](category &dbc)
+							{ return &dbc == cat; });
+						for (auto &dbc : db)
+							dbc.update_links(db);
+						break;
+
+					case change_kind::insert:
+						cat->undo_insert(c.m_row, c.m_other);
+						break;
+
+					case change_kind::erase:
+						cat->undo_erase(c.m_row, c.m_other);
+						break;
+
+					case change_kind::update:
+						cat->update_value(c.m_row, c.m_item_ix, c.m_value, false, false);
+						break;
+
+					case change_kind::swap:
+					{
+						row_handle a(*cat, *c.m_row), b(*cat, *c.m_other);
+						cat->swap_item(c.m_item_ix, a, b);
+						break;
+					}
+
+					case change_kind::reorder:
+						cat->undo_reorder(c.m_order);
+						break;
+				}
 			}
 		}
-	}
+		catch (...)
+		{
+			m_undoing = false;
+			throw;
+		}
 
-	// links are created based on the _pdbx_item_linked_group_list entries
-	// in mmcif_pdbx.dic dictionary.
-	//
-	// For each link group in _pdbx_item_linked_group_list
-	// a set of keys from one category is mapped to another.
-	// If all values in a child are the same as the specified parent ones
-	// the child is removed as well, recursively of course.
+		m_undoing = false;
 
-	if (m_validator != nullptr)
-	{
-		for (auto &&[childCat, link] : m_child_links)
-			childCat->erase_orphans(get_children_condition(rh, *childCat), *this);
+		if (not active())
+			detach(db);
 	}
 
-	delete_row(r);
-
-	// reset mTail, if needed
-	if (r == m_tail)
+	void journal::detach(datablock &db)
 	{
-		m_tail = m_head;
-		if (m_tail != nullptr)
-			while (m_tail->m_next != nullptr)
-				m_tail = m_tail->m_next;
+		for (auto &cat : db)
+		{
+			if (cat.m_journal == this)
+				cat.m_journal = nullptr;
+		}
 	}
 
-	return result;
-}
-
-template <typename T>
-class save_value
-{
-  public:
-	save_value(T &v, const T nv = {})
-		: m_v(v)
-		, m_sv(std::exchange(m_v, nv))
+	void journal::record_create(category &cat)
 	{
+		cat.m_journal = this;
+
+		if (not m_undoing)
+			m_changes.push_back({ change_kind::create, &cat });
 	}
 
-	~save_value()
+	void journal::record_insert(category *cat, row *r, row *prev)
 	{
-		m_v = m_sv;
+		if (not m_undoing)
+			m_changes.push_back({ change_kind::insert, cat, r, prev });
 	}
 
-  private:
-	T &m_v;
-	const T m_sv;
-};
+	bool journal::record_erase(category *cat, row *r, row *prev)
+	{
+		if (m_undoing)
+			return false;
 
-std::size_t category::erase(condition &&cond)
-{
-	return erase(std::move(cond), {});
-}
+		m_changes.push_back({ change_kind::erase, cat, r, prev });
+		return true;
+	}
 
-std::size_t category::erase(condition &&cond, std::function<void(row_handle)> &&visit)
-{
-	std::size_t result = 0;
+	void journal::record_update(category *cat, row *r, uint16_t item_ix, std::string_view old_value)
+	{
+		if (not m_undoing)
+			m_changes.push_back({ change_kind::update, cat, r, nullptr, item_ix, std::string{ old_value } });
+	}
 
-	cond.prepare(*this);
+	void journal::record_swap(category *cat, uint16_t item_ix, row *a, row *b)
+	{
+		if (not m_undoing)
+			m_changes.push_back({ change_kind::swap, cat, a, b, item_ix });
+	}
 
-	std::map<category *, condition> potential_orphans;
+	void journal::record_reorder(category *cat, std::vector<row *> &&order)
+	{
+		if (not m_undoing)
+			m_changes.push_back({ change_kind::reorder, cat, nullptr, nullptr, 0, {}, std::move(order) });
+	}
 
-	auto ri = begin();
-	while (ri != end())
+	void journal::forget(category *cat)
 	{
-		if (cond(*ri))
+		for (auto &c : m_changes)
 		{
-			if (visit)
-				visit(*ri);
-
-			for (auto &&[childCat, link] : m_child_links)
-			{
-				auto ccond = get_children_condition(*ri, *childCat);
-				if (not ccond)
-					continue;
-				potential_orphans[childCat] = std::move(potential_orphans[childCat]) or std::move(ccond);
-			}
+			if (c.m_category != cat)
+				continue;
 
-			save_value sv(m_validator);
+			if (c.m_kind == change_kind::erase)
+				cat->delete_row(c.m_row);
 
-			ri = erase(ri);
-			++result;
+			c.m_category = nullptr;
 		}
-		else
-			++ri;
-	}
-
-	for (auto &&[childCat, condition] : potential_orphans)
-		childCat->erase_orphans(std::move(condition), *this);
-
-	return result;
-}
-
-void category::clear()
-{
-	auto i = m_head;
-	while (i != nullptr)
-	{
-		auto t = i;
-		i = i->m_next;
-		delete_row(t);
 	}
+} // namespace detail
 
-	m_head = m_tail = nullptr;
-
-	delete m_index;
-	m_index = nullptr;
-}
+// --------------------------------------------------------------------
 
 void category::erase_orphans(condition &&cond, category &parent)
 {
+	detach_rows();
+
 	std::vector<row *> remove;
 
 	cond.prepare(*this);
@@ -1233,7 +2994,7 @@ std::string category::get_unique_id(std::function<std::string(int)> generator)
 		id_name = m_cat_validator->m_keys.front();
 
 		if (m_index == nullptr and m_cat_validator != nullptr)
-			m_index = new category_index(*this);
+			create_key_index();
 
 		for (;;)
 		{
@@ -1294,6 +3055,8 @@ void category::update_value(const std::vector<row_handle> &rows, std::string_vie
 	if (rows.empty())
 		return;
 
+	detach_rows();
+
 	auto colIx = get_item_ix(item_name);
 	if (colIx >= m_items.size())
 		throw validation_exception(validation_error::unknown_item, m_name, item_name);
@@ -1419,9 +3182,11 @@ void category::update_value(const std::vector<row_handle> &rows, std::string_vie
 
 void category::update_value(row *row, uint16_t item, std::string_view value, bool updateLinked, bool validate)
 {
+	detach_rows();
+
 	// make sure we have an index, if possible
 	if ((updateLinked or validate) and m_index == nullptr and m_cat_validator != nullptr)
-		m_index = new category_index(*this);
+		create_key_index();
 
 	auto &col = m_items[item];
 
@@ -1440,6 +3205,9 @@ void category::update_value(row *row, uint16_t item, std::string_view value, boo
 	if (col.m_validator and validate)
 		col.m_validator->operator()(value);
 
+	if (m_journal != nullptr)
+		m_journal->record_update(this, row, item, oldStrValue);
+
 	// If the item is part of the Key for this category, remove it from the index
 	// before updating
 
@@ -1451,16 +3219,37 @@ void category::update_value(row *row, uint16_t item, std::string_view value, boo
 			m_index->erase(*this, row);
 	}
 
-	// first remove old value with cix
+	std::vector<secondary_index *> reindex;
+	for (auto si : m_secondary_indices)
+	{
+		auto &items = si->items();
+		if (std::find(items.begin(), items.end(), item) == items.end())
+			continue;
+
+		si->erase(row);
+		reindex.push_back(si);
+	}
+
+	// Updated values own their text, text in the string pool could not be
+	// reclaimed when the value is updated again. The new value is created
+	// before the old one is removed, @a value may refer to its text.
+	item_value new_value(value);
+
 	if (ival != nullptr)
 		row->remove(item);
 
 	if (not value.empty())
-		row->append(item, { value });
+	{
+		row->append(item, std::move(new_value));
+		value = row->get(item)->text();
+	}
 
 	if (reinsert and m_index != nullptr)
 		m_index->insert(*this, row);
 
+	for (auto si : reindex)
+		si->insert(row, false);
+
 	// see if we need to update any child categories that depend on this value
 	auto iv = col.m_validator;
 	if (updateLinked and iv != nullptr /*and m_cascade*/)
@@ -1556,7 +3345,7 @@ row *category::clone_row(const row &r)
 			if (not i)
 				continue;
 
-			result->append(ix, { i.text() });
+			result->append(ix, { i.text(), m_strings });
 		}
 	}
 	catch (...)
@@ -1574,8 +3363,94 @@ void category::delete_row(row *r)
 	{
 		row_allocator_type ra(get_allocator());
 		row_allocator_traits::destroy(ra, r);
-		row_allocator_traits::deallocate(ra, r, 1);
+
+		m_rows.deallocate(r);
+	}
+}
+
+// --------------------------------------------------------------------
+
+row *category::row_pool::allocate(std::size_t n)
+{
+	if (n == 1 and not m_free.empty())
+	{
+		auto result = m_free.back();
+		m_free.pop_back();
+		return result;
+	}
+
+	if (m_blocks.empty() or m_blocks.back().size - m_used < n)
+	{
+		// Blocks grow in size, small categories waste little memory this way
+		std::size_t size = m_blocks.empty() ? 1 : std::min(2 * m_blocks.back().size, kMaxBlockSize);
+		if (size < n)
+			size = n;
+
+		row_allocator_type ra;
+		m_blocks.push_back({ row_allocator_traits::allocate(ra, size), size });
+		m_used = 0;
+	}
+
+	auto result = m_blocks.back().data + m_used;
+	m_used += n;
+	return result;
+}
+
+void category::row_pool::release()
+{
+	row_allocator_type ra;
+	for (auto &b : m_blocks)
+		row_allocator_traits::deallocate(ra, b.data, b.size);
+
+	m_blocks.clear();
+	m_free.clear();
+	m_used = 0;
+}
+
+void category::row_pool::splice(row_pool &rhs)
+{
+	if (m_blocks.empty())
+	{
+		swap(rhs);
+		return;
+	}
+
+	// New rows are still taken from the last block of this pool
+	m_blocks.insert(m_blocks.end() - 1, rhs.m_blocks.begin(), rhs.m_blocks.end());
+	m_free.insert(m_free.end(), rhs.m_free.begin(), rhs.m_free.end());
+
+	rhs.m_blocks.clear();
+	rhs.m_free.clear();
+	rhs.m_used = 0;
+}
+
+void category::append_rows(row *head, row *tail)
+{
+	if (head == nullptr)
+		return;
+
+	detach_rows();
+
+	row *prev = m_tail;
+
+	if (m_head == nullptr)
+		m_head = head;
+	else
+		m_tail->m_next = head;
+
+	m_tail = tail;
+	m_tail->m_next = nullptr;
+
+	for (auto r = head; r != nullptr; r = r->m_next)
+	{
+		++m_row_count;
+		secondary_index_insert(r, true);
+
+		if (m_journal != nullptr)
+			m_journal->record_insert(this, r, prev);
+		prev = r;
 	}
+	m_directory_valid = false;
 }
 
 row_handle category::create_copy(row_handle r)
@@ -1614,8 +3489,10 @@ row_handle category::create_copy(row_handle r)
 // proxy methods for every insertion
 category::iterator category::insert_impl(const_iterator pos, row *n)
 {
+	detach_rows();
+
 	if (m_index == nullptr and m_cat_validator != nullptr)
-		m_index = new category_index(*this);
+		create_key_index();
 
 	assert(n != nullptr);
 	assert(n->m_next == nullptr);
@@ -1623,6 +3500,8 @@ category::iterator category::insert_impl(const_iterator pos, row *n)
 	if (n == nullptr)
 		throw std::runtime_error("Invalid pointer passed to insert");
 
+	row *prev = nullptr;
+
 	// #ifndef NDEBUG
 	// 	if (m_validator)
 	// 		is_valid();
@@ -1635,7 +3514,8 @@ category::iterator category::insert_impl(const_iterator pos, row *n)
 		{
 			for (uint16_t ix = 0; ix < static_cast<uint16_t>(m_items.size()); ++ix)
 			{
-				const auto &[item, iv] = m_items[ix];
+				const auto &item = m_items[ix].m_name;
+				const auto iv = m_items[ix].m_validator;
 
 				if (iv == nullptr)
 					continue;
@@ -1660,6 +3540,8 @@ category::iterator category::insert_impl(const_iterator pos, row *n)
 		// insert at end, most often this is the case
 		if (pos.m_current.m_row == nullptr)
 		{
+			prev = m_tail;
+
 			if (m_head == nullptr)
 				m_tail = m_head = n;
 			else
@@ -1670,12 +3552,25 @@ category::iterator category::insert_impl(const_iterator pos, row *n)
 			assert(m_head != nullptr);
 
 			if (pos.m_current.m_row == m_head)
-				m_head = n->m_next = m_head;
+			{
+				n->m_next = m_head;
+				m_head = n;
+			}
 			else
-				n = n->m_next = m_head->m_next;
+			{
+				prev = m_head;
+				while (prev->m_next != pos.m_current.m_row)
+					prev = prev->m_next;
+
+				n->m_next = prev->m_next;
+				prev->m_next = n;
+			}
 		}
 
-		return iterator(*this, n);
+		++m_row_count;
+		m_directory_valid = false;
+
+		secondary_index_insert(n, pos.m_current.m_row == nullptr);
 	}
 	catch (const std::exception &e)
 	{
@@ -1683,6 +3578,11 @@ category::iterator category::insert_impl(const_iterator pos, row *n)
 		throw;
 	}
 
+	if (m_journal != nullptr)
+		m_journal->record_insert(this, n, prev);
+
+	return iterator(*this, n);
+
 	// #ifndef NDEBUG
 	// 	if (m_validator)
 	// 		is_valid();
@@ -1694,6 +3594,8 @@ void category::swap_item(uint16_t item_ix, row_handle &a, row_handle &b)
 	assert(this == a.m_category);
 	assert(this == b.m_category);
 
+	detach_rows();
+
 	auto &ra = *a.m_row;
 	auto &rb = *b.m_row;
 
@@ -1703,11 +3605,18 @@ void category::swap_item(uint16_t item_ix, row_handle &a, row_handle &b)
 	while (rb.size() <= item_ix)
 		rb.emplace_back("");
 
+	if (m_journal != nullptr)
+		m_journal->record_swap(this, item_ix, &ra, &rb);
+
 	std::swap(ra.at(item_ix), rb.at(item_ix));
+
+	secondary_index_invalidate();
 }
 
 void category::sort(std::function<int(row_handle, row_handle)> f)
 {
+	detach_rows();
+
 	if (m_head == nullptr)
 		return;
 
@@ -1715,6 +3624,14 @@ void category::sort(std::function<int(row_handle, row_handle)> f)
 	for (auto itemRow = m_head; itemRow != nullptr; itemRow = itemRow->m_next)
 		rows.emplace_back(*this, *itemRow);
 
+	if (m_journal != nullptr)
+	{
+		std::vector<row *> order;
+		for (auto &rh : rows)
+			order.push_back(rh.get_row());
+		m_journal->record_reorder(this, std::move(order));
+	}
+
 	std::stable_sort(rows.begin(), rows.end(),
 		[&f](row_handle ia, row_handle ib)
 		{
@@ -1729,14 +3646,53 @@ void category::sort(std::function<int(row_handle, row_handle)> f)
 		r = r->m_next = rows[i].get_row();
 	r->m_next = nullptr;
 
+	m_directory_valid = false;
+	secondary_index_invalidate();
+
 	assert(r == m_tail);
 	assert(size() == rows.size());
 }
 
 void category::reorder_by_index()
 {
+	detach_rows();
+
 	if (m_index)
-		std::tie(m_head, m_tail) = m_index->reorder();
+	{
+		if (m_journal != nullptr and m_head != nullptr)
+		{
+			std::vector<row *> order;
+			for (auto r = m_head; r != nullptr; r = r->m_next)
+				order.push_back(r);
+			m_journal->record_reorder(this, std::move(order));
+		}
+
+		std::tie(m_head, m_tail) = m_index->reorder(*this);
+		m_directory_valid = false;
+		secondary_index_invalidate();
+	}
+}
+
+void category::build_directory() const
+{
+	acquire_rows();
+
+	if (m_directory_valid)
+		return;
+
+	std::lock_guard lock(m_directory_mutex);
+
+	if (m_directory_valid)
+		return;
+
+	m_directory.clear();
+	m_directory.reserve(m_row_count);
+
+	for (auto r = m_head; r != nullptr; r = r->m_next)
+		m_directory.push_back(r);
+
+	assert(m_directory.size() == m_row_count);
+	m_directory_valid = true;
 }
 
 namespace detail
@@ -1882,6 +3838,8 @@ void category::write(std::ostream &os, const std::vector<uint16_t> &order, bool
 	if (empty())
 		return;
 
+	acquire_rows();
+
 	// If the first Row has a next, we need a loop_
 	bool needLoop = (m_head->m_next != nullptr);
 
@@ -2056,6 +4014,16 @@ bool category::operator==(const category &rhs) const
 	if (this == &rhs)
 		return true;
 
+	// copies sharing the same rows and items are equal as well
+	auto shared = m_shared != nullptr ? m_shared.load() : m_source.load();
+	if (shared != nullptr and (shared == rhs.m_shared or shared == rhs.m_source) and
+		std::equal(m_items.begin(), m_items.end(), rhs.m_items.begin(), rhs.m_items.end(),
+			[](const item_entry &a, const item_entry &b)
+			{ return a.m_name == b.m_name; }))
+	{
+		return true;
+	}
+
 	auto &a = *this;
 	auto &b = rhs;
 
@@ -31,6 +31,7 @@
 #include <map>
 #include <mutex>
 #include <numeric>
+#include <random>
 #include <shared_mutex>
 
 namespace fs = std::filesystem;
@@ -362,6 +363,179 @@ const std::map<std::string, char> compound_factory::kBaseMap{
 	{ "DT", 'T' }
 };
 
+// --------------------------------------------------------------------
+// The index of the datablocks in a large CCD file is stored in a cache
+// file. That way the file needs to be scanned only once for each version
+// of the file, instead of once in every process.
+
+namespace
+{
+
+/// \brief Files smaller than this are indexed quickly enough
+const std::uintmax_t kMinCachedIndexFileSize = 1024 * 1024;
+
+const char kCCDIndexSignature[] = "libcifpp-ccd-index 1";
+
+/// \brief Identify the version of @a file using its size and modification time
+std::string ccd_index_key(const fs::path &file)
+{
+	std::error_code ec;
+
+	auto size = fs::file_size(file, ec);
+	if (ec or size < kMinCachedIndexFileSize)
+		return {};
+
+	auto mtime = fs::last_write_time(file, ec);
+	if (ec)
+		return {};
+
+	return std::string(kCCDIndexSignature) + ' ' + std::to_string(size) + ' ' + std::to_string(mtime.time_since_epoch().count());
+}
+
+/// \brief The locations for the cached index of @a file, in order of preference.
+/// The first is next to the file, the second in the user's cache directory.
+std::vector<fs::path> ccd_index_locations(const fs::path &file)
+{
+	std::vector<fs::path> result{ fs::path(file).concat(".idx") };
+
+	fs::path cache_dir;
+
+	if (auto xdg = getenv("XDG_CACHE_HOME"); xdg != nullptr and *xdg != 0)
+		cache_dir = xdg;
+	else if (auto home = getenv("HOME"); home != nullptr and *home != 0)
+		cache_dir = fs::path(home) / ".cache";
+#if defined(_WIN32)
+	else if (auto local = getenv("LOCALAPPDATA"); local != nullptr and *local != 0)
+		cache_dir = local;
+#endif
+
+	if (not cache_dir.empty())
+	{
+		// Different files with the same name should not share an index
+		std::error_code ec;
+		auto id = std::hash<std::string>{}(fs::absolute(file, ec).string());
+
+		std::ostringstream name;
+		name << file.filename().string() << '-' << std::hex << id << ".idx";
+
+		result.emplace_back(cache_dir / "libcifpp" / name.str());
+	}
+
+	return result;
+}
+
+/// \brief Read a cached index for @a file, returns false if there is none
+/// or if it does not match the current version of @a file
+bool read_ccd_index(const fs::path &file, cif::parser::datablock_index &index)
+{
+	auto key = ccd_index_key(file);
+	if (key.empty())
+		return false;
+
+	for (auto &p : ccd_index_locations(file))
+	{
+		std::ifstream in(p);
+		if (not in.is_open())
+			continue;
+
+		std::string line;
+		if (not std::getline(in, line) or line != key)
+			continue;
+
+		cif::parser::datablock_index result;
+
+		std::string name;
+		std::size_t offset;
+
+		while (in >> name >> offset)
+			result.emplace_hint(result.end(), name, offset);
+
+		if (not in.eof())
+			continue;
+
+		if (cif::VERBOSE > 1)
+			std::cout << "Using component index " << p << '\n';
+
+		std::swap(index, result);
+		return true;
+	}
+
+	return false;
+}
+
+/// \brief Store @a index for @a file in the first cache location that is writable.
+/// The file is written under a temporary name and then renamed so that
+/// other processes never see a partially written index.
+void write_ccd_index(const fs::path &file, const cif::parser::datablock_index &index)
+{
+	auto key = ccd_index_key(file);
+	if (key.empty())
+		return;
+
+	std::random_device rd;
+
+	for (auto &p : ccd_index_locations(file))
+	{
+		std::error_code ec;
+
+		if (p.has_parent_path())
+		{
+			fs::create_directories(p.parent_path(), ec);
+			if (ec)
+				continue;
+		}
+
+		auto tmp = fs::path(p).concat(".tmp-" + std::to_string(rd()));
+
+		std::ofstream out(tmp);
+		if (not out.is_open())
+			continue;
+
+		out << key << '\n';
+		for (auto &[name, offset] : index)
+			out << name << ' ' << offset << '\n';
+
+		out.close();
+
+		if (out)
+			fs::rename(tmp, p, ec);
+
+		if (not out or ec)
+		{
+			fs::remove(tmp, ec);
+			continue;
+		}
+
+		if (cif::VERBOSE > 1)
+			std::cout << "Stored component index in " << p << '\n';
+
+		break;
+	}
+}
+
+// --------------------------------------------------------------------
+
+/// \brief An istream for BGZF compressed files that supports seeking,
+/// the stream is in a failed state if the file is not BGZF.
+class bgzf_ifstream : public std::istream
+{
+  public:
+	bgzf_ifstream(const fs::path &file)
+		: std::istream(nullptr)
+	{
+		if (m_file.open(file, std::ios::in | std::ios::binary) != nullptr and m_buffer.init(&m_file) != nullptr)
+			this->rdbuf(&m_buffer);
+		else
+			this->setstate(std::ios_base::failbit);
+	}
+
+  private:
+	std::filebuf m_file;
+	gzio::basic_ibgzf_streambuf<char, std::char_traits<char>> m_buffer;
+};
+
+} // namespace
+
 // --------------------------------------------------------------------
 // a factory class to generate compounds
 
@@ -438,6 +612,11 @@ class compound_factory_impl : public std::enable_shared_from_this<compound_facto
 
 	virtual compound *create(const std::string &id);
 
+	/// \brief Open the CCD file, @a file is set to its location if known. If the
+	/// file is compressed using regular gzip, @a seekable is set to false and
+	/// the index cannot be used.
+	std::unique_ptr<std::istream> open_ccd(fs::path &file, bool &seekable);
+
 	std::shared_timed_mutex mMutex;
 
 	fs::path m_file;
@@ -463,27 +642,68 @@ compound_factory_impl::compound_factory_impl(const fs::path &file, std::shared_p
 	m_file = file;
 }
 
-compound *compound_factory_impl::create(const std::string &id)
+std::unique_ptr<std::istream> compound_factory_impl::open_ccd(fs::path &file, bool &seekable)
 {
-	compound *result = nullptr;
+	std::unique_ptr<std::istream> result;
 
-	std::unique_ptr<std::istream> ccd;
+	seekable = true;
+	file = m_file;
 
 	if (m_file.empty())
 	{
-		ccd = cif::load_resource("components.cif");
-		if (not ccd)
+		file = cif::locate_resource("components.cif");
+
+		// perhaps a compiled in resource
+		if (file.empty())
+			result = cif::load_resource("components.cif");
+
+		if (not result and file.empty())
+			file = cif::locate_resource("components.cif.gz");
+	}
+
+	if (not result and not file.empty())
+	{
+		if (file.extension() == ".gz")
 		{
-			std::cerr << "Could not locate the CCD components.cif file, please make sure the software is installed properly and/or use the update-libcifpp-data to fetch the data.\n";
-			return nullptr;
+			// BGZF files allow random access, regular gzip files must be read sequentially
+			result.reset(new bgzf_ifstream(file));
+			if (not *result)
+			{
+				result.reset(new gzio::ifstream(file));
+				seekable = false;
+			}
 		}
+		else
+			result.reset(new std::ifstream(file));
+
+		if (not *result)
+			result.reset();
+	}
+
+	return result;
+}
+
+compound *compound_factory_impl::create(const std::string &id)
+{
+	compound *result = nullptr;
+
+	fs::path ccd_file;
+	bool seekable;
+
+	std::unique_ptr<std::istream> ccd = open_ccd(ccd_file, seekable);
+	if (not ccd)
+	{
+		if (m_file.empty())
+			std::cerr << "Could not locate the CCD components.cif file, please make sure the software is installed properly and/or use the update-libcifpp-data to fetch the data.\n";
+		return nullptr;
 	}
-	else
-		ccd.reset(new std::ifstream(m_file));
 
 	cif::file file;
 
-	if (m_index.empty())
+	if (seekable and m_index.empty() and not ccd_file.empty())
+		read_ccd_index(ccd_file, m_index);
+
+	if (seekable and m_index.empty())
 	{
 		if (cif::VERBOSE > 1)
 		{
@@ -498,15 +718,13 @@ compound *compound_factory_impl::create(const std::string &id)
 		if (cif::VERBOSE > 1)
 			std::cout << " done\n";
 
+		if (not ccd_file.empty())
+			write_ccd_index(ccd_file, m_index);
+
 		// reload the resource, perhaps this should be improved...
-		if (m_file.empty())
-		{
-			ccd = cif::load_resource("components.cif");
-			if (not ccd)
-				throw std::runtime_error("Could not locate the CCD components.cif file, please make sure the software is installed properly and/or use the update-libcifpp-data to fetch the data.");
-		}
-		else
-			ccd.reset(new std::ifstream(m_file));
+		ccd = open_ccd(ccd_file, seekable);
+		if (not ccd)
+			throw std::runtime_error("Could not locate the CCD components.cif file, please make sure the software is installed properly and/or use the update-libcifpp-data to fetch the data.");
 	}
 
 	if (cif::VERBOSE > 1)
@@ -516,7 +734,10 @@ compound *compound_factory_impl::create(const std::string &id)
 	}
 
 	cif::parser parser(*ccd, file);
-	parser.parse_single_datablock(id, m_index);
+	if (seekable)
+		parser.parse_single_datablock(id, m_index);
+	else
+		parser.parse_single_datablock(id);
 
 	if (cif::VERBOSE > 1)
 		std::cout << " done\n";
@@ -710,7 +931,7 @@ compound_factory::compound_factory()
 	: m_impl(nullptr)
 {
 	auto ccd = cif::load_resource("components.cif");
-	if (ccd)
+	if (ccd or not cif::locate_resource("components.cif.gz").empty())
 		m_impl = std::make_shared<compound_factory_impl>();
 	else if (cif::VERBOSE > 0)
 		std::cerr << "CCD components.cif resource was not found\n";
@@ -27,6 +27,8 @@
 #include "cif++/category.hpp"
 #include "cif++/condition.hpp"
 
+#include <sstream>
+
 namespace cif
 {
 
@@ -58,13 +60,305 @@ bool is_item_type_uchar(const category &cat, std::string_view col)
 	return result;
 }
 
+double get_equality_selectivity(const category &cat, uint16_t ix)
+{
+	return cat.equality_selectivity(ix);
+}
+
 namespace detail
 {
 
+	// --------------------------------------------------------------------
+	// condition_program
+
+	namespace
+	{
+		std::string_view text_of(const row *r, uint16_t ix)
+		{
+			auto iv = r->get(ix);
+			return iv != nullptr ? iv->text() : std::string_view{};
+		}
+
+		bool is_empty(std::string_view txt)
+		{
+			return txt.empty() or (txt.length() == 1 and (txt.front() == '.' or txt.front() == '?'));
+		}
+
+		bool holds(comparison_op op, int cmp)
+		{
+			switch (op)
+			{
+				case comparison_op::equal: return cmp == 0;
+				case comparison_op::less: return cmp < 0;
+				case comparison_op::less_equal: return cmp <= 0;
+				case comparison_op::greater: return cmp > 0;
+				case comparison_op::greater_equal: return cmp >= 0;
+			}
+
+			return false;
+		}
+
+		// Same rules as item_handle::compare, empty values and values that
+		// are not a number compare as larger than @a value
+		template <typename V>
+		int compare_number(std::string_view txt, V value, int64_t min = 0, int64_t max = 0)
+		{
+			if (is_empty(txt))
+				return 1;
+
+			auto b = txt.data();
+			auto e = txt.data() + txt.length();
+
+			V v = {};
+			auto r = (b + 1 < e and *b == '+' and std::isdigit(b[1]))
+			             ? selected_charconv<V>::from_chars(b + 1, e, v)
+			             : selected_charconv<V>::from_chars(b, e, v);
+
+			if ((bool)r.ec or r.ptr != e)
+				return 1;
+
+			if constexpr (std::is_integral_v<V>)
+			{
+				if (v < min or v > max)
+					return 1;
+				return v < value ? -1 : v > value ? 1
+				                                  : 0;
+			}
+			else
+			{
+				if (std::abs(v - value) <= std::numeric_limits<V>::epsilon())
+					return 0;
+				return v < value ? -1 : v > value ? 1
+				                                  : 0;
+			}
+		}
+
+		// Keep the indices in @a sel of the rows in @a rows that pass @a test
+		template <typename F>
+		std::size_t select(const row *const *rows, uint16_t *sel, std::size_t count, F &&test)
+		{
+			std::size_t n = 0;
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				auto s = sel[i];
+				sel[n] = s;
+				n += test(rows[s]) ? 1 : 0;
+			}
+			return n;
+		}
+	} // namespace
+
+	void condition_program::add(const comparison &cmp, uint16_t item_ix, bool icase)
+	{
+		instruction i{ .m_op = opcode::compare_text, .m_cmp = cmp.m_op, .m_icase = icase, .m_item_ix = item_ix };
+
+		switch (cmp.m_value.index())
+		{
+			case 0:
+				i.m_text = std::get<std::string>(cmp.m_value);
+				break;
+			case 1:
+				i.m_op = opcode::compare_integer;
+				i.m_integer = std::get<int64_t>(cmp.m_value);
+				i.m_min = cmp.m_min;
+				i.m_max = cmp.m_max;
+				break;
+			case 2:
+				i.m_op = opcode::compare_float;
+				i.m_number = std::get<float>(cmp.m_value);
+				break;
+			case 3:
+				i.m_op = opcode::compare_double;
+				i.m_number = std::get<double>(cmp.m_value);
+				break;
+		}
+
+		add(std::move(i));
+	}
+
+	bool condition_program::test(std::size_t pc, const row *r) const
+	{
+		auto &i = m_code[pc];
+
+		switch (i.m_op)
+		{
+			case opcode::always:
+				return true;
+
+			case opcode::is_empty:
+				return is_empty(text_of(r, i.m_item_ix));
+
+			case opcode::is_not_empty:
+				return not is_empty(text_of(r, i.m_item_ix));
+
+			case opcode::equals_row:
+				return i.m_row == row_handle(*m_category, *r);
+
+			case opcode::equals_short:
+			{
+				auto iv = r->get(i.m_item_ix);
+				return iv != nullptr and iv->m_length == i.m_length and
+				       (iv->m_storage | i.m_mask) == (i.m_word | i.m_mask);
+			}
+
+			case opcode::compare_text:
+			{
+				auto txt = text_of(r, i.m_item_ix);
+				return holds(i.m_cmp, i.m_icase ? icompare(txt, i.m_text) : txt.compare(i.m_text));
+			}
+
+			case opcode::compare_integer:
+				return holds(i.m_cmp, compare_number(text_of(r, i.m_item_ix), i.m_integer, i.m_min, i.m_max));
+
+			case opcode::compare_float:
+				return holds(i.m_cmp, compare_number(text_of(r, i.m_item_ix), static_cast<float>(i.m_number)));
+
+			case opcode::compare_double:
+				return holds(i.m_cmp, compare_number(text_of(r, i.m_item_ix), i.m_number));
+
+			case opcode::call:
+				return i.m_impl->test(row_handle(*m_category, *r));
+
+			case opcode::and_op:
+				for (auto o = pc + 1; o < i.m_end; o = next(o))
+				{
+					if (not test(o, r))
+						return false;
+				}
+				return true;
+
+			case opcode::or_op:
+				for (auto o = pc + 1; o < i.m_end; o = next(o))
+				{
+					if (test(o, r))
+						return true;
+				}
+				return false;
+
+			case opcode::not_op:
+				return not test(pc + 1, r);
+		}
+
+		return false;
+	}
+
+	std::size_t condition_program::filter(row **rows, std::size_t count) const
+	{
+		std::size_t result = 0;
+
+		uint16_t sel[kBatchSize];
+
+		for (std::size_t b = 0; b < count; b += kBatchSize)
+		{
+			auto batch = rows + b;
+			auto n = std::min(count - b, kBatchSize);
+
+			for (std::size_t i = 0; i < n; ++i)
+				sel[i] = static_cast<uint16_t>(i);
+
+			n = filter(0, batch, sel, n);
+
+			for (std::size_t i = 0; i < n; ++i)
+				rows[result++] = batch[sel[i]];
+		}
+
+		return result;
+	}
+
+	std::size_t condition_program::filter(std::size_t pc, const row *const *rows, uint16_t *sel, std::size_t count) const
+	{
+		auto &i = m_code[pc];
+
+		switch (i.m_op)
+		{
+			case opcode::always:
+				return count;
+
+			case opcode::is_empty:
+				return select(rows, sel, count, [ix = i.m_item_ix](const row *r)
+					{ return is_empty(text_of(r, ix)); });
+
+			case opcode::is_not_empty:
+				return select(rows, sel, count, [ix = i.m_item_ix](const row *r)
+					{ return not is_empty(text_of(r, ix)); });
+
+			case opcode::equals_short:
+				return select(rows, sel, count, [&i](const row *r)
+					{
+						auto iv = r->get(i.m_item_ix);
+						return iv != nullptr and iv->m_length == i.m_length and
+						       (iv->m_storage | i.m_mask) == (i.m_word | i.m_mask); });
+
+			case opcode::compare_integer:
+				return select(rows, sel, count, [&i](const row *r)
+					{ return holds(i.m_cmp, compare_number(text_of(r, i.m_item_ix), i.m_integer, i.m_min, i.m_max)); });
+
+			case opcode::compare_double:
+				return select(rows, sel, count, [&i](const row *r)
+					{ return holds(i.m_cmp, compare_number(text_of(r, i.m_item_ix), i.m_number)); });
+
+			case opcode::and_op:
+				for (auto o = pc + 1; o < i.m_end and count > 0; o = next(o))
+					count = filter(o, rows, sel, count);
+				return count;
+
+			case opcode::or_op:
+			{
+				// test the operands on the rows that did not match yet
+				bool hit[kBatchSize] = {};
+				uint16_t rest[kBatchSize], tmp[kBatchSize];
+
+				std::copy(sel, sel + count, rest);
+				std::size_t n = count;
+
+				for (auto o = pc + 1; o < i.m_end and n > 0; o = next(o))
+				{
+					std::copy(rest, rest + n, tmp);
+					auto m = filter(o, rows, tmp, n);
+
+					for (std::size_t k = 0; k < m; ++k)
+						hit[tmp[k]] = true;
+
+					n = std::remove_if(rest, rest + n, [&hit](uint16_t s)
+							{ return hit[s]; }) -
+					    rest;
+				}
+
+				return std::remove_if(sel, sel + count, [&hit](uint16_t s)
+						   { return not hit[s]; }) -
+				       sel;
+			}
+
+			case opcode::not_op:
+			{
+				bool hit[kBatchSize] = {};
+				uint16_t tmp[kBatchSize];
+
+				std::copy(sel, sel + count, tmp);
+				auto m = filter(pc + 1, rows, tmp, count);
+
+				for (std::size_t k = 0; k < m; ++k)
+					hit[tmp[k]] = true;
+
+				return std::remove_if(sel, sel + count, [&hit](uint16_t s)
+						   { return hit[s]; }) -
+				       sel;
+			}
+
+			default:
+				return select(rows, sel, count, [this, pc](const row *r)
+					{ return test(pc, r); });
+		}
+	}
+
+	// --------------------------------------------------------------------
+
 	condition_impl *key_equals_condition_impl::prepare(const category &c)
 	{
 		m_item_ix = c.get_item_ix(m_item_name);
 		m_icase = is_item_type_uchar(c, m_item_name);
+		m_short_value.init(m_value, m_icase);
+		m_selectivity = c.equality_selectivity(m_item_ix);
 
 		if (c.get_cat_validator() != nullptr and
 			c.key_item_indices().contains(m_item_ix) and
@@ -79,6 +373,7 @@ namespace detail
 	condition_impl *key_equals_number_condition_impl::prepare(const category &c)
 	{
 		m_item_ix = c.get_item_ix(m_item_name);
+		m_selectivity = c.equality_selectivity(m_item_ix);
 
 		if (c.get_cat_validator() != nullptr and
 			c.key_item_indices().contains(m_item_ix) and
@@ -162,6 +457,16 @@ namespace detail
 				and_conditions.push_back(static_cast<and_condition_impl *>(sub));
 		}
 
+		// Test the sub conditions that are cheap and accept many rows first
+		auto rank = [](const condition_impl *c)
+		{
+			double accept = c->selectivity();
+			return accept > 0 ? c->cost() / accept : std::numeric_limits<double>::max();
+		};
+
+		std::stable_sort(m_sub.begin(), m_sub.end(), [rank](const condition_impl *a, const condition_impl *b)
+			{ return rank(a) < rank(b); });
+
 		if (and_conditions.size() == m_sub.size())
 			return and_condition_impl::combine_equal(and_conditions, this);
 
@@ -172,10 +477,82 @@ namespace detail
 
 void condition::prepare(const category &c)
 {
+	c.acquire_rows();
+
+	m_candidates.reset();
+	m_plan.clear();
+	m_program.reset(c);
+
 	if (m_impl)
+	{
 		m_impl = m_impl->prepare(c);
-	
+
+		// Choose the access path: the primary index if the condition
+		// contains a test for the complete key, a secondary index if
+		// there is one that can be used or else a scan of all rows.
+
+		auto key_hit = m_impl->single();
+
+		if (not key_hit.has_value() and typeid(*m_impl) == typeid(detail::and_condition_impl))
+		{
+			for (auto sub : static_cast<detail::and_condition_impl *>(m_impl)->m_sub)
+			{
+				if ((key_hit = sub->single()).has_value())
+					break;
+			}
+		}
+
+		if (key_hit.has_value())
+		{
+			m_candidates.emplace();
+			if (not key_hit->empty())
+				m_candidates->push_back(const_cast<row *>(key_hit->get_row()));
+
+			m_plan = "primary index, " + std::to_string(m_candidates->size()) + " candidate rows";
+		}
+		else
+		{
+			std::vector<detail::item_equality> equalities;
+			m_impl->get_equalities(equalities);
+
+			if (not equalities.empty())
+				m_candidates = c.find_in_secondary_index(equalities, m_plan);
+
+			if (not m_candidates.has_value())
+				m_plan = "scan of " + std::to_string(c.size()) + " rows";
+		}
+
+		m_impl->compile(m_program);
+	}
+
 	m_prepared = true;
 }
 
+std::size_t condition::filter(row **rows, std::size_t count) const
+{
+	assert(m_prepared);
+
+	if (m_impl == nullptr)
+		return 0;
+
+	return m_program.filter(rows, count);
+}
+
+std::string condition::explain() const
+{
+	if (m_impl == nullptr)
+		return "no condition";
+
+	if (not m_prepared)
+		return "not prepared";
+
+	std::ostringstream os;
+
+	os << m_plan << ", test ";
+	m_impl->str(os);
+	os << ", estimated selectivity " << m_impl->selectivity();
+
+	return os.str();
+}
+
 } // namespace cif
@@ -32,12 +32,20 @@ namespace cif
 datablock::datablock(const datablock &db)
 	: std::list<category>(db)
 	, m_name(db.m_name)
+	, m_name_hash(db.m_name_hash)
 	, m_validator(db.m_validator)
 {
 	for (auto &cat : *this)
 		cat.update_links(*this);
 }
 
+datablock::~datablock()
+{
+	// Release the rows kept by the journal
+	while (in_transaction())
+		m_journal->commit(*this);
+}
+
 void datablock::set_validator(const validator *v)
 {
 	m_validator = v;
@@ -122,14 +130,17 @@ bool datablock::validate_links() const
 
 category &datablock::operator[](std::string_view name)
 {
-	auto i = std::find_if(begin(), end(), [name](const category &c)
-		{ return iequals(c.name(), name); });
+	auto i = std::find_if(begin(), end(), [name, hash = ihash(name)](const category &c)
+		{ return c.name_hash() == hash and iequals(c.name(), name); });
 
 	if (i != end())
 		return *i;
 
 	auto &cat = emplace_back(name);
 
+	if (in_transaction())
+		m_journal->record_create(cat);
+
 	if (m_validator)
 		cat.set_validator(m_validator, *this);
 
@@ -139,15 +150,15 @@ category &datablock::operator[](std::string_view name)
 const category &datablock::operator[](std::string_view name) const
 {
 	static const category s_empty;
-	auto i = std::find_if(begin(), end(), [name](const category &c)
-		{ return iequals(c.name(), name); });
+	auto i = std::find_if(begin(), end(), [name, hash = ihash(name)](const category &c)
+		{ return c.name_hash() == hash and iequals(c.name(), name); });
 	return i == end() ? s_empty : *i;
 }
 
 category *datablock::get(std::string_view name)
 {
-	auto i = std::find_if(begin(), end(), [name](const category &c)
-		{ return iequals(c.name(), name); });
+	auto i = std::find_if(begin(), end(), [name, hash = ihash(name)](const category &c)
+		{ return c.name_hash() == hash and iequals(c.name(), name); });
 	return i == end() ? nullptr : &*i;
 }
 
@@ -159,11 +170,12 @@ const category *datablock::get(std::string_view name) const
 std::tuple<datablock::iterator, bool> datablock::emplace(std::string_view name)
 {
 	bool is_new = true;
+	const auto hash = ihash(name);
 
 	auto i = begin();
 	while (i != end())
 	{
-		if (iequals(name, i->name()))
+		if (i->name_hash() == hash and iequals(name, i->name()))
 		{
 			is_new = false;
 			break;
@@ -175,6 +187,10 @@ std::tuple<datablock::iterator, bool> datablock::emplace(std::string_view name)
 	if (is_new)
 	{
 		i = insert(end(), {name});
+
+		if (in_transaction())
+			m_journal->record_create(*i);
+
 		i->set_validator(m_validator, *this);
 	}
 
@@ -443,4 +459,30 @@ bool datablock::operator==(const datablock &rhs) const
 	return true;
 }
 
+// --------------------------------------------------------------------
+
+void datablock::begin_transaction()
+{
+	if (not m_journal)
+		m_journal.reset(new detail::journal);
+
+	m_journal->begin(*this);
+}
+
+void datablock::commit()
+{
+	if (not in_transaction())
+		throw std::logic_error("No transaction to commit in datablock " + m_name);
+
+	m_journal->commit(*this);
+}
+
+void datablock::rollback()
+{
+	if (not in_transaction())
+		throw std::logic_error("No transaction to roll back in datablock " + m_name);
+
+	m_journal->rollback(*this);
+}
+
 } // namespace cif
\ No newline at end of file
@@ -27,9 +27,111 @@
 #include "cif++/file.hpp"
 #include "cif++/gzio.hpp"
 
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#if _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace cif
 {
 
+// --------------------------------------------------------------------
+// BinaryCIF data is a MessagePack map, text never starts with these bytes
+
+static bool is_bcif_start(int ch)
+{
+	return (ch >= 0x80 and ch <= 0x8f) or ch == 0xde or ch == 0xdf;
+}
+
+// --------------------------------------------------------------------
+// A read only view on the contents of a file. On POSIX systems the
+// file is mapped into memory, elsewhere the data is simply read.
+
+class mapped_file
+{
+  public:
+	mapped_file(const std::filesystem::path &p);
+	~mapped_file();
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	std::string_view data() const { return { m_data, m_size }; }
+
+  private:
+	const char *m_data = nullptr;
+	std::size_t m_size = 0;
+#if _WIN32
+	std::string m_buffer;
+#endif
+};
+
+#if _WIN32
+
+mapped_file::mapped_file(const std::filesystem::path &p)
+{
+	std::ifstream in(p, std::ios::binary);
+	if (not in.is_open())
+		throw std::runtime_error("Could not open file '" + p.string() + '\'');
+
+	m_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	m_data = m_buffer.data();
+	m_size = m_buffer.size();
+}
+
+mapped_file::~mapped_file()
+{
+}
+
+#else
+
+mapped_file::mapped_file(const std::filesystem::path &p)
+{
+	int fd = ::open(p.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Could not open file '" + p.string() + '\'');
+
+	struct stat st;
+	if (::fstat(fd, &st) < 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Could not stat file '" + p.string() + '\'');
+	}
+
+	m_size = st.st_size;
+
+	if (m_size > 0)
+	{
+		void *ptr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			::close(fd);
+			throw std::runtime_error("Could not map file '" + p.string() + '\'');
+		}
+
+		::madvise(ptr, m_size, MADV_SEQUENTIAL);
+		m_data = static_cast<const char *>(ptr);
+	}
+
+	::close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+	if (m_data != nullptr)
+		::munmap(const_cast<char *>(m_data), m_size);
+}
+
+#endif
+
 // --------------------------------------------------------------------
 // TODO: This is wrong. A validator should be assigned to datablocks,
 // not to a file. Since audit_conform is a category specifying the
@@ -112,25 +214,18 @@ void file::load_dictionary()
 {
 	if (not empty())
 	{
-		auto *audit_conform = front().get("audit_conform");
-		if (audit_conform and not audit_conform->empty())
-		{
-			std::string name = audit_conform->front().get<std::string>("dict_name");
+		std::string name = get_dictionary_name(front());
 
-			if (name == "mmcif_pdbx_v50")
-				name = "mmcif_pdbx.dic"; // we had a bug here in libcifpp...
-
-			if (not name.empty())
+		if (not name.empty())
+		{
+			try
 			{
-				try
-				{
-					load_dictionary(name);
-				}
-				catch (const std::exception &ex)
-				{
-					if (VERBOSE)
-						std::cerr << "Failed to load dictionary " << std::quoted(name) << ": " << ex.what() << '\n';
-				}
+				load_dictionary(name);
+			}
+			catch (const std::exception &ex)
+			{
+				if (VERBOSE)
+					std::cerr << "Failed to load dictionary " << std::quoted(name) << ": " << ex.what() << '\n';
 			}
 		}
 	}
@@ -144,16 +239,32 @@ void file::load_dictionary(std::string_view name)
 	set_validator(&validator_factory::instance()[name]);
 }
 
+std::string file::get_dictionary_name(const datablock &db)
+{
+	std::string result;
+
+	auto *audit_conform = db.get("audit_conform");
+	if (audit_conform and not audit_conform->empty())
+	{
+		result = audit_conform->front().get<std::string>("dict_name");
+
+		if (result == "mmcif_pdbx_v50")
+			result = "mmcif_pdbx.dic"; // we had a bug here in libcifpp...
+	}
+
+	return result;
+}
+
 bool file::contains(std::string_view name) const
 {
-	return std::find_if(begin(), end(), [name](const datablock &db)
-			   { return iequals(db.name(), name); }) != end();
+	return std::find_if(begin(), end(), [name, hash = ihash(name)](const datablock &db)
+			   { return db.name_hash() == hash and iequals(db.name(), name); }) != end();
 }
 
 datablock &file::operator[](std::string_view name)
 {
-	auto i = std::find_if(begin(), end(), [name](const datablock &c)
-		{ return iequals(c.name(), name); });
+	auto i = std::find_if(begin(), end(), [name, hash = ihash(name)](const datablock &c)
+		{ return c.name_hash() == hash and iequals(c.name(), name); });
 
 	if (i != end())
 		return *i;
@@ -165,19 +276,20 @@ datablock &file::operator[](std::string_view name)
 const datablock &file::operator[](std::string_view name) const
 {
 	static const datablock s_empty;
-	auto i = std::find_if(begin(), end(), [name](const datablock &c)
-		{ return iequals(c.name(), name); });
+	auto i = std::find_if(begin(), end(), [name, hash = ihash(name)](const datablock &c)
+		{ return c.name_hash() == hash and iequals(c.name(), name); });
 	return i == end() ? s_empty : *i;
 }
 
 std::tuple<file::iterator, bool> file::emplace(std::string_view name)
 {
 	bool is_new = true;
+	const auto hash = ihash(name);
 
 	auto i = begin();
 	while (i != end())
 	{
-		if (iequals(name, i->name()))
+		if (i->name_hash() == hash and iequals(name, i->name()))
 		{
 			is_new = false;
 			break;
@@ -198,13 +310,173 @@ std::tuple<file::iterator, bool> file::emplace(std::string_view name)
 
 void file::load(const std::filesystem::path &p)
 {
+	load(p, load_options{});
+}
+
+void file::load(const std::filesystem::path &p, const load_options &options)
+{
+	// Uncompressed files are parsed directly from memory
+	if (p.extension() != ".gz" and std::filesystem::is_regular_file(p))
+	{
+		try
+		{
+			mapped_file data(p);
+			load_text(data.data(), options);
+		}
+		catch (const std::exception &)
+		{
+			throw_with_nested(std::runtime_error("Error reading file '" + p.string() + '\''));
+		}
+
+		return;
+	}
+
 	gzio::ifstream in(p);
 	if (not in.is_open())
 		throw std::runtime_error("Could not open file '" + p.string() + '\'');
 
 	try
 	{
-		load(in);
+		load(in, options);
+	}
+	catch (const std::exception &)
+	{
+		throw_with_nested(std::runtime_error("Error reading file '" + p.string() + '\''));
+	}
+}
+
+// A parser for a part of a file, keeping track of the datablocks it produced
+
+class slice_parser : public parser
+{
+  public:
+	slice_parser(std::string_view data, file &file)
+		: parser(data, file)
+	{
+	}
+
+	void produce_datablock(std::string_view name) override
+	{
+		m_names.emplace_back(name);
+		parser::produce_datablock(name);
+	}
+
+	std::vector<std::string> m_names;
+};
+
+void file::load_parallel(const std::filesystem::path &p, std::size_t n_threads)
+{
+	std::unique_ptr<mapped_file> mapping;
+	std::string buffer;
+	std::string_view text;
+
+	if (p.extension() == ".gz")
+	{
+		gzio::ifstream in(p);
+		if (not in.is_open())
+			throw std::runtime_error("Could not open file '" + p.string() + '\'');
+
+		char block[65536];
+		while (in.read(block, sizeof(block)) or in.gcount() > 0)
+			buffer.append(block, in.gcount());
+
+		text = buffer;
+	}
+	else
+	{
+		mapping.reset(new mapped_file(p));
+		text = mapping->data();
+	}
+
+	if (n_threads == 0)
+		n_threads = std::thread::hardware_concurrency();
+
+	try
+	{
+		parser::datablock_index index;
+		{
+			file dummy;
+			parser index_parser(text, dummy);
+			index = index_parser.index_datablocks();
+		}
+
+		if (n_threads <= 1 or index.size() <= 1)
+		{
+			load_text(text);
+			return;
+		}
+
+		// The start of each datablock, in the order in which they appear. The
+		// index contains the offset following 'data_', the name and a space.
+		// The first part also contains anything preceding the first datablock.
+		std::vector<std::size_t> starts;
+		for (auto &[name, offset] : index)
+			starts.push_back(offset - name.length() - 6);
+		std::sort(starts.begin(), starts.end());
+		starts.front() = 0;
+		starts.push_back(text.length());
+
+		std::vector<file> results(index.size());
+		std::vector<std::vector<std::string>> names(index.size());
+		std::vector<std::exception_ptr> errors(index.size());
+		std::atomic<std::size_t> next = 0;
+
+		auto worker = [&]()
+		{
+			for (std::size_t i = next++; i < results.size(); i = next++)
+			{
+				try
+				{
+					// Each parser only sees its own part of the text
+					slice_parser block_parser(text.substr(starts[i], starts[i + 1] - starts[i]), results[i]);
+
+					// datablocks are already parsed in parallel, do not split loops as well
+					block_parser.set_max_threads(1);
+					block_parser.parse_file();
+
+					names[i] = std::move(block_parser.m_names);
+				}
+				catch (...)
+				{
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (std::size_t i = 0; i < std::min(n_threads, results.size()); ++i)
+			threads.emplace_back(worker);
+
+		for (auto &t : threads)
+			t.join();
+
+		for (auto &e : errors)
+		{
+			if (e)
+				std::rethrow_exception(e);
+		}
+
+		// The index has only one entry for datablocks with the same name
+		std::set<std::string, iless> seen;
+		for (auto &part : names)
+		{
+			for (auto &name : part)
+			{
+				if (not seen.insert(name).second)
+					throw std::runtime_error("Duplicate datablock data_" + name);
+			}
+		}
+
+		auto saved = m_validator;
+		set_validator(nullptr);
+
+		for (auto &f : results)
+			splice(end(), f);
+
+		if (saved != nullptr)
+			set_validator(saved);
+		else
+			load_dictionary();
 	}
 	catch (const std::exception &)
 	{
@@ -214,20 +486,140 @@ void file::load(const std::filesystem::path &p)
 
 void file::load(std::istream &is)
 {
+	load(is, load_options{});
+}
+
+void file::load(std::istream &is, const load_options &options)
+{
+	auto n = size();
+
+	if (is_bcif_start(is.peek()))
+	{
+		load_bcif(is);
+		select(std::next(begin(), n), options);
+		return;
+	}
+
 	auto saved = m_validator;
 	set_validator(nullptr);
 
 	parser p(is, *this);
+	p.set_load_options(options, saved);
 	p.parse_file();
 
 	if (saved != nullptr)
 		set_validator(saved);
 	else
+	{
 		load_dictionary();
+
+		// remove the items that were loaded since the keys were not known yet
+		select(std::next(begin(), n), options);
+	}
+}
+
+void file::load_text(std::string_view data, const load_options &options)
+{
+	auto n = size();
+
+	if (not data.empty() and is_bcif_start(static_cast<unsigned char>(data.front())))
+	{
+		load_bcif_data(data);
+		select(std::next(begin(), n), options);
+		return;
+	}
+
+	auto saved = m_validator;
+	set_validator(nullptr);
+
+	parser p(data, *this);
+	p.set_load_options(options, saved);
+	p.parse_file();
+
+	if (saved != nullptr)
+		set_validator(saved);
+	else
+	{
+		load_dictionary();
+
+		// remove the items that were loaded since the keys were not known yet
+		select(std::next(begin(), n), options);
+	}
+}
+
+void file::select(iterator db, const load_options &options)
+{
+	if (options.empty())
+		return;
+
+	for (; db != end(); ++db)
+	{
+		for (auto cat = db->begin(); cat != db->end();)
+		{
+			if (not options.accept_category(cat->name()))
+			{
+				cat = db->erase(cat);
+				continue;
+			}
+
+			auto cv = cat->get_cat_validator();
+
+			for (auto item : cat->get_items())
+			{
+				// key items are always kept
+				if (cv != nullptr and std::find_if(cv->m_keys.begin(), cv->m_keys.end(), [&item](const std::string &key)
+										  { return iequals(key, item); }) != cv->m_keys.end())
+					continue;
+
+				if (not options.accept_item(cat->name(), item))
+					cat->remove_item(item);
+			}
+
+			if (cat->get_items().empty())
+				cat = db->erase(cat);
+			else
+				++cat;
+		}
+	}
+}
+
+void file::load_binary(const std::filesystem::path &p)
+{
+	load_binary(p, load_options{});
+}
+
+void file::load_binary(const std::filesystem::path &p, const load_options &options)
+{
+	try
+	{
+		if (p.extension() != ".gz" and std::filesystem::is_regular_file(p))
+		{
+			mapped_file data(p);
+			load_binary_data(data.data(), options);
+		}
+		else
+		{
+			gzio::ifstream in(p);
+			if (not in.is_open())
+				throw std::runtime_error("Could not open file '" + p.string() + '\'');
+
+			load_binary(in, options);
+		}
+	}
+	catch (const std::exception &)
+	{
+		throw_with_nested(std::runtime_error("Error reading file '" + p.string() + '\''));
+	}
 }
 
 void file::save(const std::filesystem::path &p) const
 {
+	if (p.extension() == ".bcif" or (p.extension() == ".gz" and p.stem().extension() == ".bcif"))
+	{
+		save_bcif(p);
+		return;
+	}
+
 	gzio::ofstream outFile(p);
 	save(outFile);
 }
@@ -31,6 +31,47 @@
 namespace cif
 {
 
+// --------------------------------------------------------------------
+
+char *string_pool::allocate(std::size_t n)
+{
+	if (static_cast<std::size_t>(m_end - m_ptr) < n)
+	{
+		// Large strings get a block of their own, the current block is kept
+		if (n > kBlockSize / 4)
+		{
+			m_blocks.push_back(new char[n]);
+			return m_blocks.back();
+		}
+
+		m_blocks.push_back(new char[kBlockSize]);
+		m_ptr = m_blocks.back();
+		m_end = m_ptr + kBlockSize;
+	}
+
+	auto result = m_ptr;
+	m_ptr += n;
+	return result;
+}
+
+void string_pool::splice(string_pool &rhs)
+{
+	m_blocks.insert(m_blocks.end(), rhs.m_blocks.begin(), rhs.m_blocks.end());
+	rhs.m_blocks.clear();
+	rhs.m_ptr = rhs.m_end = nullptr;
+}
+
+void string_pool::release()
+{
+	for (auto b : m_blocks)
+		delete[] b;
+
+	m_blocks.clear();
+	m_ptr = m_end = nullptr;
+}
+
+// --------------------------------------------------------------------
+
 const item_handle item_handle::s_null_item;
 row_handle s_null_row_handle;
 
@@ -52,6 +93,18 @@ std::string_view item_handle::text() const
 	return {};
 }
 
+bool item_handle::equals_short(const item_value &value, uint64_t fold_mask) const
+{
+	assert(value.m_length > 0 and value.m_length < item_value::kBufferSize);
+
+	if (m_row_handle.empty())
+		return false;
+
+	auto iv = m_row_handle.m_row->get(m_item_ix);
+	return iv != nullptr and iv->m_length == value.m_length and
+	       (iv->m_storage | fold_mask) == (value.m_storage | fold_mask);
+}
+
 void item_handle::assign_value(std::string_view value)
 {
 	assert(not m_row_handle.empty());
@@ -29,10 +29,15 @@
 #include "cif++/parser.hpp"
 #include "cif++/file.hpp"
 
+#include <bit>
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <stack>
+#include <thread>
 
 namespace cif
 {
@@ -177,8 +182,112 @@ class reserved_words_automaton
 
 // --------------------------------------------------------------------
 
+namespace
+{
+
+// A streambuf reading from a block of memory, used when the
+// data contains carriage returns that need to be translated.
+class span_buffer : public std::streambuf
+{
+  public:
+	span_buffer(std::string_view data)
+	{
+		char *b = const_cast<char *>(data.data());
+		setg(b, b, b + data.length());
+	}
+
+  protected:
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+	{
+		switch (dir)
+		{
+			case std::ios_base::beg: break;
+			case std::ios_base::cur: off += gptr() - eback(); break;
+			case std::ios_base::end: off += egptr() - eback(); break;
+			default: return pos_type(off_type(-1));
+		}
+
+		return seekpos(off, which);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode) override
+	{
+		if (pos < 0 or pos > egptr() - eback())
+			return pos_type(off_type(-1));
+
+		setg(eback(), eback() + pos, egptr());
+		return pos;
+	}
+};
+
+// --------------------------------------------------------------------
+// When parsing from memory, runs of characters that do not change the
+// state of the tokeniser can be skipped eight bytes at a time. The
+// functions below do this using plain 64 bit integer arithmetic, which
+// is portable and does not depend on any particular instruction set.
+
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+constexpr uint64_t kLowBits = 0x7f7f7f7f7f7f7f7fULL;
+
+constexpr uint64_t repeat_byte(uint8_t b)
+{
+	return 0x0101010101010101ULL * b;
+}
+
+// Return the high bit of each byte in @a w that is outside the range [lo, hi]
+constexpr uint64_t outside_range(uint64_t w, uint8_t lo, uint8_t hi)
+{
+	uint64_t low7 = w & kLowBits;
+	uint64_t ge_lo = (low7 + repeat_byte(0x80 - lo)) & kHighBits;
+	uint64_t gt_hi = (low7 + repeat_byte(0x7f - hi)) & kHighBits;
+	return (w & kHighBits) | (ge_lo ^ kHighBits) | gt_hi;
+}
+
+// Return the high bit of each byte in @a w that is equal to @a ch
+constexpr uint64_t equal_to(uint64_t w, uint8_t ch)
+{
+	uint64_t x = w ^ repeat_byte(ch);
+	return ~(((x & kLowBits) + kLowBits) | x | kLowBits);
+}
+
+// Return a pointer to the first character in [b, e) that is outside
+// the range [lo, hi] or is equal to @a stop.
+template <uint8_t lo, uint8_t hi>
+const char *skip_range(const char *b, const char *e, int stop = -1)
+{
+	if constexpr (std::endian::native == std::endian::little)
+	{
+		while (e - b >= 8)
+		{
+			uint64_t w;
+			std::memcpy(&w, b, sizeof(w));
+
+			uint64_t m = outside_range(w, lo, hi);
+			if (stop >= 0)
+				m |= equal_to(w, static_cast<uint8_t>(stop));
+
+			if (m != 0)
+				return b + std::countr_zero(m) / 8;
+
+			b += 8;
+		}
+	}
+
+	while (b < e)
+	{
+		auto ch = static_cast<uint8_t>(*b);
+		if (ch < lo or ch > hi or ch == stop)
+			break;
+		++b;
+	}
+
+	return b;
+}
+
+} // namespace
+
 sac_parser::sac_parser(std::istream &is, bool init)
-	: m_source(*is.rdbuf())
+	: m_source(is.rdbuf())
 {
 	m_token_buffer.reserve(8192);
 
@@ -192,6 +301,32 @@ sac_parser::sac_parser(std::istream &is, bool init)
 		m_lookahead = get_next_token();
 }
 
+sac_parser::sac_parser(std::string_view data, bool init)
+{
+	if (data.data() == nullptr)
+		data = std::string_view("", 0);
+
+	// Carriage return/linefeed translation changes the token text,
+	// so in that case we read through a regular streambuf instead.
+	if (std::memchr(data.data(), '\r', data.length()) != nullptr)
+	{
+		m_data_buffer.reset(new span_buffer(data));
+		m_source = m_data_buffer.get();
+		m_token_buffer.reserve(8192);
+	}
+	else
+	{
+		m_data_begin = m_data_ptr = m_token_start = data.data();
+		m_data_end = data.data() + data.length();
+	}
+
+	m_line_nr = 1;
+	m_bol = true;
+
+	if (init)
+		m_lookahead = get_next_token();
+}
+
 bool sac_parser::is_unquoted_string(std::string_view text)
 {
 	bool result = text.empty() or is_ordinary(text.front());
@@ -222,7 +357,21 @@ bool sac_parser::is_unquoted_string(std::string_view text)
 // translation.
 int sac_parser::get_next_char()
 {
-	int result = m_source.sbumpc();
+	if (m_data_begin != nullptr)
+	{
+		if (m_data_ptr == m_data_end)
+		{
+			m_data_eof = true;
+			return std::char_traits<char>::eof();
+		}
+
+		int result = static_cast<unsigned char>(*m_data_ptr++);
+		if (result == '\n')
+			++m_line_nr;
+		return result;
+	}
+
+	int result = m_source->sbumpc();
 
 	if (result == std::char_traits<char>::eof())
 		m_token_buffer.push_back(0);
@@ -230,8 +379,8 @@ int sac_parser::get_next_char()
 	{
 		if (result == '\r')
 		{
-			if (m_source.sgetc() == '\n')
-				m_source.sbumpc();
+			if (m_source->sgetc() == '\n')
+				m_source->sbumpc();
 
 			++m_line_nr;
 			result = '\n';
@@ -247,6 +396,19 @@ int sac_parser::get_next_char()
 
 void sac_parser::retract()
 {
+	if (m_data_begin != nullptr)
+	{
+		if (m_data_eof)
+			m_data_eof = false;
+		else
+		{
+			assert(m_data_ptr > m_token_start);
+			if (*--m_data_ptr == '\n')
+				--m_line_nr;
+		}
+		return;
+	}
+
 	assert(not m_token_buffer.empty());
 
 	char ch = m_token_buffer.back();
@@ -258,13 +420,58 @@ void sac_parser::retract()
 		// since we always putback at most a single character,
 		// the test below should never fail.
 
-		if (m_source.sputbackc(ch) == std::char_traits<char>::eof())
+		if (m_source->sputbackc(ch) == std::char_traits<char>::eof())
 			throw std::runtime_error("putback failure");
 	}
 
 	m_token_buffer.pop_back();
 }
 
+void sac_parser::clear_token()
+{
+	if (m_data_begin != nullptr)
+		m_token_start = m_data_ptr;
+	else
+		m_token_buffer.clear();
+}
+
+const char *sac_parser::token_data() const
+{
+	return m_data_begin != nullptr ? m_token_start : m_token_buffer.data();
+}
+
+std::size_t sac_parser::token_size() const
+{
+	return m_data_begin != nullptr ? m_data_ptr - m_token_start : m_token_buffer.size();
+}
+
+int sac_parser::bump_raw()
+{
+	if (m_data_begin != nullptr)
+		return m_data_ptr < m_data_end ? static_cast<unsigned char>(*m_data_ptr++) : std::char_traits<char>::eof();
+	else
+		return m_source->sbumpc();
+}
+
+std::size_t sac_parser::tell_raw()
+{
+	if (m_data_begin != nullptr)
+		return m_data_ptr - m_data_begin;
+	else
+		return m_source->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+}
+
+void sac_parser::seek_raw(std::size_t pos)
+{
+	if (m_data_begin != nullptr)
+	{
+		m_data_ptr = m_data_begin + std::min<std::size_t>(pos, m_data_end - m_data_begin);
+		m_data_eof = false;
+	}
+	else
+		m_source->pubseekpos(pos, std::ios_base::in);
+}
+
 sac_parser::CIFToken sac_parser::get_next_token()
 {
 	const auto kEOF = std::char_traits<char>::eof();
@@ -274,8 +481,14 @@ sac_parser::CIFToken sac_parser::get_next_token()
 	State state = State::Start;
 	m_bol = false;
 
-	m_token_buffer.clear();
-	m_token_value = {};
+	if (m_data_begin != nullptr)
+		result = get_next_simple_token();
+
+	if (result == CIFToken::UNKNOWN)
+	{
+		clear_token();
+		m_token_value = {};
+	}
 
 	reserved_words_automaton dag;
 
@@ -321,10 +534,14 @@ sac_parser::CIFToken sac_parser::get_next_token()
 				{
 					state = State::Start;
 					retract();
-					m_token_buffer.clear();
+					clear_token();
 				}
 				else
+				{
 					m_bol = (ch == '\n');
+					if (m_data_begin != nullptr)
+						m_data_ptr = skip_range<' ', ' '>(m_data_ptr, m_data_end);
+				}
 				break;
 			
 			case State::Comment:
@@ -332,12 +549,14 @@ sac_parser::CIFToken sac_parser::get_next_token()
 				{
 					state = State::Start;
 					m_bol = true;
-					m_token_buffer.clear();
+					clear_token();
 				}
 				else if (ch == kEOF)
 					result = CIFToken::END_OF_FILE;
 				else if (not is_any_print(ch))
 					error("invalid character in comment");
+				else if (m_data_begin != nullptr)
+					m_data_ptr = skip_range<0x20, 0x7e>(m_data_ptr, m_data_end);
 				break;
 			
 			case State::QuestionMark:
@@ -357,6 +576,8 @@ sac_parser::CIFToken sac_parser::get_next_token()
 					error("unterminated textfield");
 				else if (not is_any_print(ch) and cif::VERBOSE > 2)
 					warning("invalid character in text field '" + std::string({static_cast<char>(ch)}) + "' (" + std::to_string((int)ch) + ")");
+				else if (m_data_begin != nullptr)
+					m_data_ptr = skip_range<0x20, 0x7e>(m_data_ptr, m_data_end);
 				break;
 
 			case State::TextItemNL:
@@ -364,8 +585,8 @@ sac_parser::CIFToken sac_parser::get_next_token()
 					state = State::TextItem;
 				else if (ch == ';')
 				{
-					assert(m_token_buffer.size() >= 2);
-					m_token_value = std::string_view(m_token_buffer.data() + 1, m_token_buffer.size() - 3);
+					assert(token_size() >= 2);
+					m_token_value = std::string_view(token_data() + 1, token_size() - 3);
 					result = CIFToken::VALUE;
 				}
 				else if (ch == kEOF)
@@ -381,6 +602,8 @@ sac_parser::CIFToken sac_parser::get_next_token()
 					state = State::QuotedStringQuote;
 				else if (not is_any_print(ch) and cif::VERBOSE > 2)
 					warning("invalid character in quoted string: '" + std::string({static_cast<char>(ch)}) + "' (" + std::to_string((int)ch) + ")");
+				else if (m_data_begin != nullptr)
+					m_data_ptr = skip_range<0x20, 0x7e>(m_data_ptr, m_data_end, quoteChar);
 				break;
 
 			case State::QuotedStringQuote:
@@ -388,10 +611,10 @@ sac_parser::CIFToken sac_parser::get_next_token()
 				{
 					retract();
 					result = CIFToken::VALUE;
-					if (m_token_buffer.size() < 2)
+					if (token_size() < 2)
 						error("Invalid quoted string token");
 
-					m_token_value = std::string_view(m_token_buffer.data() + 1, m_token_buffer.size() - 2);
+					m_token_value = std::string_view(token_data() + 1, token_size() - 2);
 				}
 				else if (ch == quoteChar)
 					;
@@ -408,8 +631,10 @@ sac_parser::CIFToken sac_parser::get_next_token()
 				{
 					retract();
 					result = CIFToken::ITEM_NAME;
-					m_token_value = std::string_view(m_token_buffer.data(), m_token_buffer.size());
+					m_token_value = std::string_view(token_data(), token_size());
 				}
+				else if (m_data_begin != nullptr)
+					m_data_ptr = skip_range<0x21, 0x7e>(m_data_ptr, m_data_end);
 				break;
 
 			case State::Reserved:
@@ -423,7 +648,7 @@ sac_parser::CIFToken sac_parser::get_next_token()
 						{
 							retract();
 							result = CIFToken::VALUE;
-							m_token_value = std::string_view(m_token_buffer.data(), m_token_buffer.size());
+							m_token_value = std::string_view(token_data(), token_size());
 						}
 						else
 							state = State::Value;
@@ -431,7 +656,7 @@ sac_parser::CIFToken sac_parser::get_next_token()
 
 					case reserved_words_automaton::data:
 						retract();
-						m_token_value = std::string_view(m_token_buffer.data() + 5, m_token_buffer.size() - 5);
+						m_token_value = std::string_view(token_data() + 5, token_size() - 5);
 						result = CIFToken::DATA;
 						break;
 
@@ -452,7 +677,7 @@ sac_parser::CIFToken sac_parser::get_next_token()
 
 					case reserved_words_automaton::save_plus:
 						retract();
-						m_token_value = std::string_view(m_token_buffer.data() + 5, m_token_buffer.size() - 5);
+						m_token_value = std::string_view(token_data() + 5, token_size() - 5);
 						result = CIFToken::SAVE_NAME;
 						break;
 
@@ -468,9 +693,11 @@ sac_parser::CIFToken sac_parser::get_next_token()
 				{
 					retract();
 					result = CIFToken::VALUE;
-					m_token_value = std::string_view(m_token_buffer.data(), m_token_buffer.size());
+					m_token_value = std::string_view(token_data(), token_size());
 					break;
 				}
+				else if (m_data_begin != nullptr)
+					m_data_ptr = skip_range<0x21, 0x7e>(m_data_ptr, m_data_end);
 				break;
 
 			default:
@@ -491,6 +718,70 @@ sac_parser::CIFToken sac_parser::get_next_token()
 	return result;
 }
 
+// When parsing from memory, white space is skipped and the most common
+// kind of token, an unquoted value, is returned without using the state
+// machine in get_next_token. Returns UNKNOWN if the token is something
+// else, in which case the state machine takes over at m_data_ptr.
+sac_parser::CIFToken sac_parser::get_next_simple_token()
+{
+	auto p = m_data_ptr;
+
+	for (;;)
+	{
+		if (auto q = skip_range<' ', ' '>(p, m_data_end); q != p)
+		{
+			m_bol = false;
+			p = q;
+		}
+
+		if (p == m_data_end)
+			break;
+
+		if (*p == '\n')
+		{
+			++m_line_nr;
+			m_bol = true;
+		}
+		else if (*p == '\t')
+			m_bol = false;
+		else
+			break;
+
+		++p;
+	}
+
+	m_data_ptr = p;
+
+	if (p == m_data_end or not is_non_blank(*p))
+		return CIFToken::UNKNOWN;
+
+	switch (*p)
+	{
+		// These may start something other than an unquoted value
+		case '#':
+		case '_':
+		case '\'':
+		case '"':
+		case '?':
+		case ';':
+		case 'd':
+		case 'D':
+		case 'g':
+		case 'G':
+		case 'l':
+		case 'L':
+		case 's':
+		case 'S':
+			return CIFToken::UNKNOWN;
+
+		default:
+			m_token_start = p;
+			m_data_ptr = skip_range<0x21, 0x7e>(p + 1, m_data_end);
+			m_token_value = std::string_view(m_token_start, m_data_ptr - m_token_start);
+			return CIFToken::VALUE;
+	}
+}
+
 void sac_parser::match(CIFToken token)
 {
 	if (m_lookahead != token)
@@ -518,8 +809,13 @@ bool sac_parser::parse_single_datablock(const std::string &datablock)
 	std::string::size_type si = 0;
 	bool found = false;
 
-	for (auto ch = m_source.sbumpc(); not found and ch != std::streambuf::traits_type::eof(); ch = m_source.sbumpc())
+	// Stop reading right after the name, the next character is part of the datablock
+	while (not found)
 	{
+		auto ch = bump_raw();
+		if (ch == std::streambuf::traits_type::eof())
+			break;
+
 		switch (state)
 		{
 			case start:
@@ -609,9 +905,9 @@ sac_parser::datablock_index sac_parser::index_datablocks()
 	std::string datablock;
 
 	// Seek to beginning of file
-	m_source.pubseekpos(0);
+	seek_raw(0);
 
-	for (auto ch = m_source.sbumpc(); ch != std::streambuf::traits_type::eof(); ch = m_source.sbumpc())
+	for (auto ch = bump_raw(); ch != std::streambuf::traits_type::eof(); ch = bump_raw())
 	{
 		switch (state)
 		{
@@ -674,7 +970,7 @@ sac_parser::datablock_index sac_parser::index_datablocks()
 				else if (is_space(ch))
 				{
 					if (not datablock.empty())
-						index[datablock] = m_source.pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+						index[datablock] = tell_raw();
 
 					state = start;
 				}
@@ -696,7 +992,7 @@ bool sac_parser::parse_single_datablock(const std::string &datablock, const data
 	auto i = index.find(datablock);
 	if (i != index.end())
 	{
-		m_source.pubseekpos(i->second, std::ios_base::in);
+		seek_raw(i->second);
 
 		produce_datablock(datablock);
 		m_lookahead = get_next_token();
@@ -746,6 +1042,7 @@ void sac_parser::parse_datablock()
 {
 	static const std::string kUnitializedCategory("<invalid>");
 	std::string cat = kUnitializedCategory;	// intial value acts as a guard for empty category names
+	bool accept_cat = false, produced = false;
 
 	while (m_lookahead == CIFToken::LOOP or m_lookahead == CIFToken::ITEM_NAME or m_lookahead == CIFToken::SAVE_NAME)
 	{
@@ -758,6 +1055,7 @@ void sac_parser::parse_datablock()
 				match(CIFToken::LOOP);
 
 				std::vector<std::string> item_names;
+				bool accept = false;
 
 				while (m_lookahead == CIFToken::ITEM_NAME)
 				{
@@ -765,28 +1063,29 @@ void sac_parser::parse_datablock()
 					std::tie(catName, itemName) = split_item_name(m_token_value);
 
 					if (cat == kUnitializedCategory)
-					{
-						produce_category(catName);
 						cat = catName;
-					}
 					else if (not iequals(cat, catName))
 						error("inconsistent categories in loop_");
 
-					item_names.push_back(itemName);
+					// items that are not accepted get an empty name
+					if (accept_item(cat, itemName))
+					{
+						item_names.push_back(itemName);
+						accept = true;
+					}
+					else
+						item_names.emplace_back();
 
 					match(CIFToken::ITEM_NAME);
 				}
 
-				while (m_lookahead == CIFToken::VALUE)
+				if (accept and accept_category(cat))
 				{
-					produce_row();
-
-					for (auto item_name : item_names)
-					{
-						produce_item(cat, item_name, m_token_value);
-						match(CIFToken::VALUE);
-					}
+					produce_category(cat);
+					parse_loop_body(cat, item_names);
 				}
+				else
+					skip_loop_body();
 
 				cat.clear();
 				break;
@@ -799,14 +1098,25 @@ void sac_parser::parse_datablock()
 
 				if (not iequals(cat, catName))
 				{
-					produce_category(catName);
 					cat = catName;
-					produce_row();
+					accept_cat = accept_category(cat);
+					produced = false;
 				}
 
 				match(CIFToken::ITEM_NAME);
 
-				produce_item(cat, itemName, m_token_value);
+				if (accept_cat and accept_item(cat, itemName))
+				{
+					// The category is only created when it contains an accepted item
+					if (not produced)
+					{
+						produce_category(cat);
+						produce_row();
+						produced = true;
+					}
+
+					produce_item(cat, itemName, m_token_value);
+				}
 
 				match(CIFToken::VALUE);
 				break;
@@ -823,6 +1133,27 @@ void sac_parser::parse_datablock()
 	}
 }
 
+void sac_parser::parse_loop_body(std::string_view category, const std::vector<std::string> &item_names)
+{
+	while (m_lookahead == CIFToken::VALUE)
+	{
+		produce_row();
+
+		for (auto &item_name : item_names)
+		{
+			if (not item_name.empty())
+				produce_item(category, item_name, m_token_value);
+			match(CIFToken::VALUE);
+		}
+	}
+}
+
+void sac_parser::skip_loop_body()
+{
+	while (m_lookahead == CIFToken::VALUE)
+		match(CIFToken::VALUE);
+}
+
 void sac_parser::parse_save_frame()
 {
 	error("A regular CIF file should not contain a save frame");
@@ -830,6 +1161,404 @@ void sac_parser::parse_save_frame()
 
 // --------------------------------------------------------------------
 
+namespace
+{
+
+// A tokeniser for a range of characters inside the body of a loop_
+
+class loop_chunk_tokeniser : public sac_parser
+{
+  public:
+	using sac_parser::CIFToken;
+
+	loop_chunk_tokeniser(const char *b, const char *e)
+		: sac_parser(std::string_view{}, false)
+	{
+		// The data has already been checked for carriage returns
+		m_data_begin = m_data_ptr = m_token_start = b;
+		m_data_end = e;
+	}
+
+	CIFToken next() { return get_next_token(); }
+	std::string_view value() const { return m_token_value; }
+	uint32_t line_count() const { return m_line_nr - 1; }
+
+  protected:
+	void produce_datablock(std::string_view) override {}
+	void produce_category(std::string_view) override {}
+	void produce_row() override {}
+	void produce_item(std::string_view, std::string_view, std::string_view) override {}
+};
+
+// Run @a task for each number in the range [0, count) using at most @a n_threads threads
+template <typename Task>
+void run_tasks(std::size_t count, std::size_t n_threads, Task &&task)
+{
+	std::atomic<std::size_t> next = 0;
+
+	auto worker = [&]()
+	{
+		for (std::size_t i = next++; i < count; i = next++)
+			task(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (std::size_t i = 0; i < std::min(n_threads, count); ++i)
+		threads.emplace_back(worker);
+
+	for (auto &t : threads)
+		t.join();
+}
+
+// Return true if the text at @a p starts with a reserved word
+// that ends a loop_, e.g. data_ or loop_
+bool starts_with_reserved_word(const char *p, const char *e)
+{
+	for (std::string_view word : { "data_", "loop_", "save_", "global_", "stop_" })
+	{
+		if (static_cast<std::size_t>(e - p) >= word.length() and iequals(std::string_view(p, word.length()), word))
+			return true;
+	}
+
+	return false;
+}
+
+} // namespace
+
+void parser::parse_loop_body(std::string_view /*category*/, const std::vector<std::string> &item_names)
+{
+	if (m_category == nullptr)
+		error("inconsistent categories in loop_");
+
+	if (parse_loop_body_parallel(item_names))
+		return;
+
+	// The item indices are resolved once, rows are created directly
+	// and added to the category when the whole loop has been read.
+
+	auto item_ix = get_item_indices(item_names);
+
+	std::size_t row_size = 0;
+	for (auto ix : item_ix)
+	{
+		if (ix != kSkipItem and ix >= row_size)
+			row_size = ix + 1;
+	}
+
+	auto &cat = *m_category;
+	row *head = nullptr, *tail = nullptr;
+
+	try
+	{
+		while (m_lookahead == CIFToken::VALUE)
+		{
+			row *r = cat.create_row();
+			r->resize(row_size);
+
+			if (tail == nullptr)
+				head = r;
+			else
+				tail->m_next = r;
+			tail = r;
+
+			for (auto ix : item_ix)
+			{
+				if (ix != kSkipItem and not m_token_value.empty())
+					r->append(ix, { m_token_value, cat.m_strings });
+				match(CIFToken::VALUE);
+			}
+		}
+	}
+	catch (...)
+	{
+		while (head != nullptr)
+		{
+			auto next = head->m_next;
+			cat.delete_row(head);
+			head = next;
+		}
+		throw;
+	}
+
+	append_rows(head, tail);
+}
+
+std::vector<uint16_t> parser::get_item_indices(const std::vector<std::string> &item_names)
+{
+	std::vector<uint16_t> result;
+	result.reserve(item_names.size());
+
+	for (auto &item_name : item_names)
+		result.push_back(item_name.empty() ? kSkipItem : m_category->add_item(item_name));
+
+	return result;
+}
+
+void parser::append_rows(row *head, row *tail)
+{
+	auto &cat = *m_category;
+
+	// Without validator and index the rows can simply be appended,
+	// otherwise each row is validated and indexed now.
+	if (cat.m_cat_validator == nullptr and cat.m_index == nullptr)
+	{
+		cat.append_rows(head, tail);
+		return;
+	}
+
+	while (head != nullptr)
+	{
+		auto r = head;
+		head = head->m_next;
+		r->m_next = nullptr;
+
+		try
+		{
+			cat.insert_impl(cat.cend(), r);
+		}
+		catch (...)
+		{
+			while (head != nullptr)
+			{
+				auto next = head->m_next;
+				cat.delete_row(head);
+				head = next;
+			}
+			throw;
+		}
+	}
+}
+
+// Large loops are split into chunks at line boundaries. These chunks
+// are first tokenised in parallel to count the number of values in
+// each of them. Then, knowing where each row starts, the rows are
+// created in parallel and finally appended to the category in order.
+// If anything looks unusual, false is returned and the loop is
+// parsed sequentially instead, reporting errors as usual.
+
+bool parser::parse_loop_body_parallel(const std::vector<std::string> &item_names)
+{
+	const std::size_t kChunkSize = 256 * 1024;
+	const std::size_t kMinLoopSize = 4 * kChunkSize;
+
+	std::size_t n_threads = m_max_threads != 0 ? m_max_threads : std::thread::hardware_concurrency();
+
+	if (n_threads <= 1 or m_data_begin == nullptr or m_lookahead != CIFToken::VALUE or
+		m_category == nullptr or m_category->get_cat_validator() != nullptr or item_names.empty())
+	{
+		return false;
+	}
+
+	const char *start = m_data_ptr, *end = m_data_end;
+
+	// Locate the probable end of the loop, that is the first line that
+	// is not part of a text field and starts with an item name or a
+	// reserved word. At the same time collect the chunk boundaries.
+
+	struct chunk
+	{
+		const char *begin, *end;
+		std::size_t value_count = 0, first_value_nr = 0;
+		uint32_t line_count = 0;
+		bool valid = false;
+		row *head = nullptr, *tail = nullptr;
+		row *rows = nullptr;
+		std::size_t row_count = 0;
+		string_pool strings;
+	};
+
+	std::vector<chunk> chunks;
+
+	bool in_text_field = false;
+	const char *chunk_start = start;
+
+	for (const char *p = start;;)
+	{
+		auto nl = static_cast<const char *>(std::memchr(p, '\n', m_data_end - p));
+		if (nl == nullptr)
+			break;
+
+		p = nl + 1;
+
+		if (p < m_data_end and *p == ';')
+		{
+			in_text_field = not in_text_field;
+			continue;
+		}
+
+		if (in_text_field)
+			continue;
+
+		auto q = p;
+		while (q < m_data_end and (*q == ' ' or *q == '\t'))
+			++q;
+
+		if (q < m_data_end and (*q == '_' or starts_with_reserved_word(q, m_data_end)))
+		{
+			end = nl;
+			break;
+		}
+
+		if (static_cast<std::size_t>(nl - chunk_start) >= kChunkSize)
+		{
+			chunks.push_back({ chunk_start, nl });
+			chunk_start = nl;
+		}
+	}
+
+	if (static_cast<std::size_t>(end - start) < kMinLoopSize or in_text_field)
+		return false;
+
+	chunks.push_back({ chunk_start, end });
+
+	// The loop must really end here
+	if (loop_chunk_tokeniser(end, m_data_end).next() == CIFToken::VALUE)
+		return false;
+
+	// First pass, count the values in each chunk
+
+	run_tasks(chunks.size(), n_threads, [&chunks](std::size_t i)
+		{
+			auto &c = chunks[i];
+
+			try
+			{
+				loop_chunk_tokeniser t(c.begin, c.end);
+
+				CIFToken token;
+				while ((token = t.next()) == CIFToken::VALUE)
+					++c.value_count;
+
+				c.valid = token == CIFToken::END_OF_FILE;
+				c.line_count = t.line_count();
+			}
+			catch (const parse_error &)
+			{
+				c.valid = false;
+			} });
+
+	// The first value in the loop is in the lookahead
+	std::size_t value_count = 1;
+	for (auto &c : chunks)
+	{
+		if (not c.valid)
+			return false;
+		c.first_value_nr = value_count;
+		value_count += c.value_count;
+	}
+
+	const std::size_t N = item_names.size();
+	if (value_count % N != 0)
+		return false;
+
+	auto item_ix = get_item_indices(item_names);
+
+	// Reserve the storage for the rows starting in each chunk up front,
+	// the category's storage is not thread safe. The first value, in
+	// the lookahead, is value number zero and belongs to the first chunk.
+	for (std::size_t i = 0; i < chunks.size(); ++i)
+	{
+		auto &c = chunks[i];
+		std::size_t b = i == 0 ? 0 : c.first_value_nr;
+		std::size_t e = c.first_value_nr + c.value_count;
+
+		std::size_t n = (e + N - 1) / N - (b + N - 1) / N;
+		if (n > 0)
+			c.rows = m_category->get_row(n);
+	}
+
+	// Second pass, create the rows starting in each chunk
+
+	std::vector<std::exception_ptr> errors(chunks.size());
+	std::string_view first_value = m_token_value;
+	auto &cat = *m_category;
+
+	run_tasks(chunks.size(), n_threads, [&](std::size_t i)
+		{
+			auto &c = chunks[i];
+
+			try
+			{
+				// skip the values belonging to a row started in a previous chunk
+				std::size_t col = c.first_value_nr % N;
+				std::size_t skip = col == 0 ? 0 : N - col;
+				row *r = nullptr;
+
+				col = 0;
+
+				auto add_value = [&](std::string_view value)
+				{
+					if (col == 0)
+					{
+						r = cat.construct_row(c.rows + c.row_count++);
+						r->reserve(N);
+
+						if (c.tail == nullptr)
+							c.head = r;
+						else
+							c.tail->m_next = r;
+						c.tail = r;
+					}
+
+					if (item_ix[col] != kSkipItem)
+					{
+						if (value.empty())
+							r->remove(item_ix[col]);
+						else
+							r->append(item_ix[col], { value, c.strings });
+					}
+
+					col = (col + 1) % N;
+				};
+
+				if (i == 0)
+				{
+					skip = 0;
+					add_value(first_value);
+				}
+
+				loop_chunk_tokeniser t(c.begin, c.end);
+				while (t.next() == CIFToken::VALUE)
+				{
+					if (skip > 0)
+						--skip;
+					else
+						add_value(t.value());
+				}
+
+				// finish the last row using the values in the next chunk(s)
+				if (col != 0)
+				{
+					loop_chunk_tokeniser t(c.end, chunks.back().end);
+					while (col != 0 and t.next() == CIFToken::VALUE)
+						add_value(t.value());
+				}
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			} });
+
+	for (auto &c : chunks)
+	{
+		append_rows(c.head, c.tail);
+		cat.m_strings.splice(c.strings);
+		m_line_nr += c.line_count;
+	}
+
+	for (auto &e : errors)
+	{
+		if (e)
+			std::rethrow_exception(e);
+	}
+
+	m_data_ptr = end;
+	m_lookahead = get_next_token();
+	return true;
+}
+
+// --------------------------------------------------------------------
+
 void parser::produce_datablock(std::string_view name)
 {
 	if (VERBOSE >= 4)
@@ -861,6 +1590,55 @@ void parser::produce_row()
 	// m_row.lineNr(m_line_nr);
 }
 
+bool parser::accept_category(std::string_view name)
+{
+	return m_options.accept_category(name);
+}
+
+bool parser::accept_item(std::string_view category, std::string_view item)
+{
+	if (m_options.accept_item(category, item))
+		return true;
+
+	// Key items are always loaded, the key index needs them. If the
+	// keys are not known, the item is loaded and removed afterwards.
+	auto v = get_validator();
+	if (v == nullptr)
+		return true;
+
+	auto cv = v->get_validator_for_category(category);
+	return cv != nullptr and std::find_if(cv->m_keys.begin(), cv->m_keys.end(), [item](const std::string &key)
+								 { return iequals(key, item); }) != cv->m_keys.end();
+}
+
+const validator *parser::get_validator()
+{
+	if (m_validator != nullptr)
+		return m_validator;
+
+	if (m_datablock != nullptr and m_datablock != m_db_validator_for)
+	{
+		auto name = file::get_dictionary_name(*m_datablock);
+
+		// audit_conform may not have been parsed yet
+		if (not name.empty())
+		{
+			try
+			{
+				m_db_validator = &validator_factory::instance()[name];
+			}
+			catch (const std::exception &)
+			{
+				m_db_validator = nullptr;
+			}
+
+			m_db_validator_for = m_datablock;
+		}
+	}
+
+	return m_datablock == m_db_validator_for ? m_db_validator : nullptr;
+}
+
 void parser::produce_item(std::string_view category, std::string_view item, std::string_view value)
 {
 	if (VERBOSE >= 4)
@@ -872,4 +1650,87 @@ void parser::produce_item(std::string_view category, std::string_view item, std:
 	m_row[item] = m_token_value;
 }
 
+// --------------------------------------------------------------------
+
+void stream_parser::parse_file()
+{
+	sac_parser::parse_file();
+	flush();
+}
+
+void stream_parser::flush()
+{
+	if (m_pending and m_visitor != nullptr)
+		m_visitor->emit();
+	m_pending = false;
+}
+
+void stream_parser::produce_datablock(std::string_view name)
+{
+	flush();
+	m_visitor = nullptr;
+
+	if (m_datablock_callback)
+		m_datablock_callback(name);
+}
+
+void stream_parser::produce_category(std::string_view name)
+{
+	flush();
+
+	auto i = m_visitors.find(std::string{ name });
+	m_visitor = i == m_visitors.end() ? nullptr : i->second.get();
+}
+
+void stream_parser::produce_row()
+{
+	m_pending = true;
+}
+
+void stream_parser::produce_item(std::string_view /*category*/, std::string_view item, std::string_view value)
+{
+	if (m_visitor == nullptr)
+		return;
+
+	if (auto setter = m_visitor->get_setter(item); setter != nullptr)
+		setter(*m_visitor, value);
+}
+
+bool stream_parser::accept_category(std::string_view name)
+{
+	return m_visitors.count(std::string{ name }) != 0;
+}
+
+bool stream_parser::accept_item(std::string_view category, std::string_view item)
+{
+	auto i = m_visitors.find(std::string{ category });
+	return i != m_visitors.end() and i->second->get_setter(item) != nullptr;
+}
+
+void stream_parser::parse_loop_body(std::string_view /*category*/, const std::vector<std::string> &item_names)
+{
+	if (m_visitor == nullptr)
+	{
+		skip_loop_body();
+		return;
+	}
+
+	// Resolve the setters for the columns once
+	std::vector<visitor_base::setter_type> setters;
+	for (auto &item_name : item_names)
+		setters.push_back(item_name.empty() ? nullptr : m_visitor->get_setter(item_name));
+
+	while (m_lookahead == CIFToken::VALUE)
+	{
+		for (auto setter : setters)
+		{
+			if (setter != nullptr)
+				setter(*m_visitor, m_token_value);
+			match(CIFToken::VALUE);
+		}
+
+		m_visitor->emit();
+	}
+}
+
 } // namespace cif
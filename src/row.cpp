@@ -45,6 +45,14 @@ uint16_t row_handle::get_item_ix(std::string_view name) const
 	return m_category->get_item_ix(name);
 }
 
+uint16_t row_handle::get_item_ix(const item_key &key) const
+{
+	if (not m_category)
+		throw std::runtime_error("uninitialized row");
+
+	return m_category->get_item_ix(key);
+}
+
 std::string_view row_handle::get_item_name(uint16_t ix) const
 {
 	if (not m_category)
@@ -61,6 +69,14 @@ uint16_t row_handle::add_item(std::string_view name)
 	return m_category->add_item(name);
 }
 
+uint16_t row_handle::add_item(const item_key &key)
+{
+	if (not m_category)
+		throw std::runtime_error("uninitialized row");
+
+	return m_category->add_item(key);
+}
+
 void row_handle::swap(uint16_t item, row_handle &b)
 {
 	if (not m_category)
@@ -42,6 +42,7 @@
 #include <mutex>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -844,6 +845,7 @@ class resource_pool
 	}
 
 	std::unique_ptr<std::istream> load(fs::path name);
+	fs::path locate(fs::path name);
 
 	const auto data_directories() { return mDirs; }
 	const auto file_resources() { return mLocalResources; }
@@ -851,6 +853,9 @@ class resource_pool
   private:
 	resource_pool();
 
+	/// \brief The existing files for resource @a name, in order of preference
+	std::vector<fs::path> candidates(fs::path name);
+
 	std::unique_ptr<std::ifstream> open(fs::path &p)
 	{
 		std::unique_ptr<std::ifstream> result;
@@ -907,26 +912,44 @@ resource_pool::resource_pool()
 #endif
 }
 
-std::unique_ptr<std::istream> resource_pool::load(fs::path name)
+std::vector<fs::path> resource_pool::candidates(fs::path name)
 {
-	std::unique_ptr<std::istream> result;
+	std::vector<fs::path> result;
 	std::error_code ec;
 
-	fs::path p = name;
+	if (fs::exists(name, ec) and not ec)
+		result.push_back(name);
 
-	if (mLocalResources.count(name.string()))
-		result = open(mLocalResources[name.string()]);
+	// A file registered with add_file_resource is used only if it exists,
+	// otherwise the data directories are searched as usual
+	if (auto i = mLocalResources.find(name.string()); i != mLocalResources.end() and fs::exists(i->second, ec) and not ec)
+		result.push_back(i->second);
 
-	if (fs::exists(p, ec) and not ec)
-		result = open(p);
-
-	for (auto di = mDirs.begin(); not result and di != mDirs.end(); ++di)
+	for (auto &dir : mDirs)
 	{
-		auto p2 = *di / p;
+		auto p2 = dir / name;
 		if (fs::exists(p2, ec) and not ec)
-			result = open(p2);
+			result.push_back(p2);
 	}
 
+	return result;
+}
+
+fs::path resource_pool::locate(fs::path name)
+{
+	auto c = candidates(name);
+	return c.empty() ? fs::path{} : c.front();
+}
+
+std::unique_ptr<std::istream> resource_pool::load(fs::path name)
+{
+	std::unique_ptr<std::istream> result;
+
+	// Fall back to the next candidate if a file cannot be opened
+	auto files = candidates(name);
+	for (auto fi = files.begin(); not result and fi != files.end(); ++fi)
+		result = open(*fi);
+
 	// if (not result and gResourceData)
 	if (not result and (gResourceIndex[0].m_child > 0 or gResourceIndex[0].m_size > 0))
 	{
@@ -955,6 +978,11 @@ std::unique_ptr<std::istream> load_resource(std::filesystem::path name)
 	return resource_pool::instance().load(name);
 }
 
+std::filesystem::path locate_resource(std::filesystem::path name)
+{
+	return resource_pool::instance().locate(name);
+}
+
 void list_file_resources(std::ostream &os)
 {
 	auto &file_resources = resource_pool::instance().file_resources();
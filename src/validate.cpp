@@ -211,6 +211,58 @@ int type_validator::compare(std::string_view a, std::string_view b) const
 	return result;
 }
 
+std::size_t type_validator::hash(std::string_view v) const
+{
+	if (v.empty())
+		return 0;
+
+	if (m_primitive_type == DDL_PrimitiveType::Numb)
+	{
+		double d;
+		auto r = selected_charconv<double>::from_chars(v.data(), v.data() + v.length(), d);
+		if (not (bool)r.ec)
+			return number_hash(d);
+	}
+
+	// FNV-1a on the characters, folding case and collapsing spaces
+	// the same way compare does
+
+	uint64_t h = 14695981039346656037ULL;
+
+	for (auto i = v.begin(); i != v.end(); ++i)
+	{
+		char ch = *i;
+
+		if (m_primitive_type == DDL_PrimitiveType::UChar)
+			ch = tolower(ch);
+
+		h ^= static_cast<uint8_t>(ch);
+		h *= 1099511628211ULL;
+
+		if (ch == ' ')
+		{
+			while (i + 1 != v.end() and i[1] == ' ')
+				++i;
+		}
+	}
+
+	return static_cast<std::size_t>(h);
+}
+
+std::array<std::size_t, 2> type_validator::hashes(std::string_view v) const
+{
+	if (m_primitive_type == DDL_PrimitiveType::Numb and not v.empty())
+	{
+		double d;
+		auto r = selected_charconv<double>::from_chars(v.data(), v.data() + v.length(), d);
+		if (not (bool)r.ec)
+			return number_hashes(d);
+	}
+
+	auto h = hash(v);
+	return { h, h };
+}
+
 // --------------------------------------------------------------------
 
 void item_validator::operator()(std::string_view value) const
@@ -30,7 +30,10 @@
 
 #include "cif++/dictionary_parser.hpp"
 
+#include <numeric>
+#include <random>
 #include <stdexcept>
+#include <thread>
 
 // --------------------------------------------------------------------
 
@@ -3563,4 +3566,3173 @@ TEST_CASE("pdb2cif_formula_weight")
 TEST_CASE("update_values_with_provider")
 {
 
-}
\ No newline at end of file
+}
+// --------------------------------------------------------------------
+
+TEST_CASE("parse_from_memory_1")
+{
+	using namespace cif::literals;
+
+	const std::string text = R"(data_TEST
+#
+_test.id 1
+_test.name 'quoted value'
+#
+loop_
+_loop.id
+_loop.text
+1
+;A text field
+spanning lines
+;
+2 "double quoted"
+3 unquoted
+4 ?
+5 .
+#
+data_SECOND
+_other.value 42
+)";
+
+	std::istringstream is(text);
+	cif::file f1(is);
+
+	cif::file f2(text.data(), text.length());
+
+	std::ostringstream s1, s2;
+	s1 << f1;
+	s2 << f2;
+
+	CHECK(s1.str() == s2.str());
+	REQUIRE(f2.size() == 2);
+
+	auto &loop = f2.front()["loop"];
+	REQUIRE(loop.size() == 5);
+	CHECK(loop.front()["text"].as<std::string>() == "A text field\nspanning lines");
+	CHECK(loop.find1<std::string>("id"_key == 2, "text") == "double quoted");
+	CHECK(loop.find1("id"_key == 4)["text"].empty());
+
+	// Carriage returns should be translated as usual
+	std::string crlf = text;
+	cif::replace_all(crlf, "\n", "\r\n");
+	cif::file f3(crlf.data(), crlf.length());
+
+	std::ostringstream s3;
+	s3 << f3;
+	CHECK(s1.str() == s3.str());
+
+	// Loading an uncompressed file from disk uses the same code
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-parse-from-memory.cif";
+	{
+		std::ofstream out(tmp);
+		out << text;
+	}
+
+	cif::file f6(tmp);
+	std::filesystem::remove(tmp);
+
+	std::ostringstream s6;
+	s6 << f6;
+	CHECK(s1.str() == s6.str());
+
+	// Locating datablocks works on memory as well
+	cif::file f4;
+	cif::parser p(std::string_view{ text }, f4);
+	auto index = p.index_datablocks();
+	REQUIRE(index.size() == 2);
+	REQUIRE(p.parse_single_datablock("SECOND", index));
+	REQUIRE(f4.size() == 1);
+	CHECK(f4.front()["other"].front()["value"].as<int>() == 42);
+
+	// And parse errors still report the correct line number
+	const std::string bad = "data_BAD\n_test.id 1\n_test.name 'unterminated\n";
+	cif::file f5;
+	cif::parser p2(std::string_view{ bad }, f5);
+	try
+	{
+		p2.parse_file();
+		FAIL("expected a parse error");
+	}
+	catch (const cif::parse_error &ex)
+	{
+		CHECK(std::string(ex.what()) == "parse error at line 4: unterminated quoted string");
+	}
+}
+
+TEST_CASE("parse_from_memory_2")
+{
+	// Values that look like, but are not, something special
+	const std::string text =
+		"data_TEST\n"
+		"loop_\n"
+		"_test.id\n"
+		"_test.value\n"
+		"1 data\n"
+		"2\tloop\n"
+		"3 ;not-a-text-field\n"
+		"4\n"
+		";a text field\n"
+		";\n"
+		"5   ?x\n"
+		"  6 'it's quoted'\n"
+		"7 stop\n"
+		"8 \"a # b\" # comment\n"
+		"9 global\n";
+
+	std::istringstream is(text);
+	cif::file f1(is);
+	cif::file f2(text.data(), text.length());
+
+	std::ostringstream s1, s2;
+	s1 << f1;
+	s2 << f2;
+	CHECK(s1.str() == s2.str());
+
+	auto &test = f2.front()["test"];
+	REQUIRE(test.size() == 9);
+
+	const char *values[] = {
+		"data", "loop", ";not-a-text-field", "a text field", "?x", "it's quoted", "stop", "a # b", "global"
+	};
+
+	for (auto v = values; auto r : test)
+		CHECK(r["value"].as<std::string>() == *v++);
+}
+
+TEST_CASE("load_parallel_1")
+{
+	std::ostringstream text;
+	text << "# data preceding the first datablock\n";
+	for (int i = 0; i < 50; ++i)
+	{
+		text << "data_Block_" << i << "\n"
+			 << "_entry.id Block_" << i << "\n"
+			 << "loop_\n"
+			 << "_test.id\n"
+			 << "_test.value\n";
+		for (int j = 0; j < i; ++j)
+			text << j << " 'value " << i << '.' << j << "'\n";
+	}
+
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-load-parallel.cif";
+	{
+		std::ofstream out(tmp);
+		out << text.str();
+	}
+
+	cif::file f1(tmp);
+
+	cif::file f2;
+	f2.load_parallel(tmp, 4);
+
+	REQUIRE(f2.size() == 50);
+
+	std::ostringstream s1, s2;
+	s1 << f1;
+	s2 << f2;
+	CHECK(s1.str() == s2.str());
+
+	CHECK(f2.front().name() == "Block_0");
+	CHECK(f2.back().name() == "Block_49");
+	CHECK(f2["block_10"]["test"].size() == 10);
+
+	// Line endings with carriage returns
+	auto crlf = text.str();
+	cif::replace_all(crlf, "\n", "\r\n");
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out << crlf;
+	}
+
+	cif::file f3;
+	f3.load_parallel(tmp, 4);
+
+	std::ostringstream s3;
+	s3 << f3;
+	CHECK(s1.str() == s3.str());
+
+	// Datablocks with the same name are reported
+	{
+		std::ofstream out(tmp);
+		out << "data_A\n_a.id 1\ndata_B\n_b.id 2\ndata_a\n_a.id 3\n";
+	}
+
+	cif::file f4;
+	CHECK_THROWS_AS(f4.load_parallel(tmp, 4), std::runtime_error);
+
+	std::filesystem::remove(tmp);
+}
+
+TEST_CASE("parse_large_loop_1")
+{
+	std::ostringstream os;
+	os << "data_TEST\n"
+	   << "_first.id 1\n"
+	   << "loop_\n"
+	   << "_test.id\n"
+	   << "_test.name\n"
+	   << "_test.value\n";
+
+	for (int i = 0; i < 50000; ++i)
+	{
+		switch (i % 5)
+		{
+			case 0: os << i << " 'quoted name' ?\n"; break;
+			case 1: os << i << "\n;text\n_field\n;\n" << i * 1.5 << "\n"; break;
+			case 2: os << i << " \"data_not_really\" loop_x\n"; break;
+			case 3: os << i << " . " << i << " " << i + 1 << "\n"; break;
+			case 4: os << "# a comment\n'x y' " << i << '\n'; break;
+		}
+	}
+
+	os << "_last.id 1\n"
+	   << "_last.name\n";
+
+	const std::string text = os.str();
+
+	cif::file f1, f2;
+
+	cif::parser p1(std::string_view{ text }, f1);
+	p1.set_max_threads(1);
+
+	cif::parser p2(std::string_view{ text }, f2);
+	p2.set_max_threads(4);
+
+	std::string e1, e2;
+	try { p1.parse_file(); } catch (const cif::parse_error &ex) { e1 = ex.what(); }
+	try { p2.parse_file(); } catch (const cif::parse_error &ex) { e2 = ex.what(); }
+
+	// The error at the end should be reported at the same line
+	CHECK(not e1.empty());
+	CHECK(e1 == e2);
+
+	std::ostringstream s1, s2;
+	s1 << f1;
+	s2 << f2;
+
+	CHECK(s1.str() == s2.str());
+
+	auto &test = f2.front()["test"];
+	CHECK(test.size() == 50000);
+	CHECK(test.front()["name"].as<std::string>() == "quoted name");
+	CHECK(f2.front()["last"].size() == 1);
+}
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// Write a BGZF member containing the data in @a text to @a os
+void write_bgzf_member(std::ostream &os, std::string_view text)
+{
+	std::vector<unsigned char> buffer(compressBound(static_cast<uLong>(text.size())) + 64);
+
+	z_stream zs{};
+	REQUIRE(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+
+	zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(text.data()));
+	zs.avail_in = static_cast<uInt>(text.size());
+	zs.next_out = buffer.data();
+	zs.avail_out = static_cast<uInt>(buffer.size());
+	REQUIRE(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+
+	std::size_t clen = zs.total_out;
+	deflateEnd(&zs);
+
+	std::size_t bsize = 18 + clen + 8 - 1;
+	uLong crc = crc32(0, reinterpret_cast<const Bytef *>(text.data()), static_cast<uInt>(text.size()));
+
+	const unsigned char header[18] = {
+		0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+		static_cast<unsigned char>(bsize), static_cast<unsigned char>(bsize >> 8)
+	};
+
+	const unsigned char trailer[8] = {
+		static_cast<unsigned char>(crc), static_cast<unsigned char>(crc >> 8),
+		static_cast<unsigned char>(crc >> 16), static_cast<unsigned char>(crc >> 24),
+		static_cast<unsigned char>(text.size()), static_cast<unsigned char>(text.size() >> 8),
+		static_cast<unsigned char>(text.size() >> 16), static_cast<unsigned char>(text.size() >> 24)
+	};
+
+	os.write(reinterpret_cast<const char *>(header), sizeof(header));
+	os.write(reinterpret_cast<const char *>(buffer.data()), clen);
+	os.write(reinterpret_cast<const char *>(trailer), sizeof(trailer));
+}
+
+} // namespace
+
+TEST_CASE("gzio_mt_1")
+{
+	std::string text;
+	for (int i = 0; i < 200000; ++i)
+		text += "line " + std::to_string(i) + " of the test data\n";
+
+	// A regular gzip file, inflated by a single background thread
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-gzio-mt-1.gz";
+
+	{
+		cif::gzio::ofstream out(tmp);
+		out << text;
+	}
+
+	{
+		std::ifstream file(tmp, std::ios::binary);
+		cif::gzio::basic_igzip_mt_streambuf<char, std::char_traits<char>> buf(4);
+		REQUIRE(buf.init(file.rdbuf()) != nullptr);
+
+		std::istream in(&buf);
+		std::string s{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+		CHECK(s == text);
+	}
+
+	// And through ifstream, which reads ahead on a background thread
+	{
+		cif::gzio::ifstream in(tmp);
+		if (std::thread::hardware_concurrency() > 1)
+			CHECK(dynamic_cast<cif::gzio::basic_igzip_mt_streambuf<char, std::char_traits<char>> *>(in.rdbuf()) != nullptr);
+
+		std::string s{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+		CHECK(s == text);
+	}
+
+	// A BGZF file, consisting of members of at most 64 KiB, inflated in parallel
+	auto tmp2 = std::filesystem::temp_directory_path() / "cifpp-gzio-mt-2.gz";
+
+	{
+		std::ofstream out(tmp2, std::ios::binary);
+		for (std::size_t o = 0; o < text.size(); o += 60000)
+			write_bgzf_member(out, std::string_view{ text }.substr(o, 60000));
+		write_bgzf_member(out, {});
+	}
+
+	{
+		std::ifstream file(tmp2, std::ios::binary);
+		cif::gzio::basic_igzip_mt_streambuf<char, std::char_traits<char>> buf(4);
+		REQUIRE(buf.init(file.rdbuf()) != nullptr);
+
+		std::istream in(&buf);
+		std::string s{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+		CHECK(s == text);
+	}
+
+	// The single threaded version reads BGZF as well, of course
+	{
+		std::ifstream file(tmp2, std::ios::binary);
+		cif::gzio::basic_igzip_streambuf<char, std::char_traits<char>> buf;
+		REQUIRE(buf.init(file.rdbuf()) != nullptr);
+
+		std::istream in(&buf);
+		std::string s{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+		CHECK(s == text);
+	}
+
+	std::filesystem::remove(tmp);
+	std::filesystem::remove(tmp2);
+}
+
+TEST_CASE("gzio_mt_2")
+{
+	using mt_streambuf = cif::gzio::basic_igzip_mt_streambuf<char, std::char_traits<char>>;
+
+	std::string text;
+	for (int i = 0; i < 50000; ++i)
+		text += "line " + std::to_string(i) + " of the test data\n";
+
+	std::ostringstream bgzf;
+	for (std::size_t o = 0; o < text.size(); o += 60000)
+		write_bgzf_member(bgzf, std::string_view{ text }.substr(o, 60000));
+
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-gzio-mt-3.gz";
+	{
+		cif::gzio::ofstream out(tmp);
+		out << text;
+	}
+
+	std::string gzip;
+	{
+		std::ifstream file(tmp, std::ios::binary);
+		gzip.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	std::filesystem::remove(tmp);
+
+	auto inflate = [](const std::string &data, bool &bad)
+	{
+		std::stringbuf sb(data);
+		mt_streambuf buf(4);
+		REQUIRE(buf.init(&sb) != nullptr);
+
+		// istream::get turns exceptions thrown by the streambuf into a badbit
+		std::istream in(&buf);
+		std::string result;
+		for (char ch; in.get(ch);)
+			result += ch;
+		bad = in.bad();
+		return result;
+	};
+
+	bool bad;
+
+	// BGZF followed by a regular gzip file
+	CHECK((inflate(bgzf.str() + gzip, bad) == text + text));
+	CHECK_FALSE(bad);
+
+	// And the other way around
+	CHECK((inflate(gzip + bgzf.str(), bad) == text + text));
+	CHECK_FALSE(bad);
+
+	// Truncated BGZF, the complete members are still delivered
+	auto truncated = bgzf.str();
+	truncated.resize(truncated.size() - 100);
+	auto s = inflate(truncated, bad);
+	CHECK(bad);
+	CHECK(s.length() >= 60000);
+	CHECK(text.starts_with(s));
+
+	// Truncated regular gzip
+	truncated = gzip;
+	truncated.resize(truncated.size() / 2);
+	s = inflate(truncated, bad);
+	CHECK(bad);
+	CHECK(text.starts_with(s));
+
+	// Garbage after BGZF data
+	s = inflate(bgzf.str() + "not gzip", bad);
+	CHECK(s.length() == text.length());
+	CHECK((s == text));
+	CHECK(bad);
+
+	// Data that is not compressed is rejected
+	{
+		std::stringbuf sb("data_test\n_test.name 1\n");
+		mt_streambuf buf(4);
+		CHECK(buf.init(&sb) == nullptr);
+	}
+}
+
+TEST_CASE("gzio_mt_3")
+{
+	using mt_streambuf = cif::gzio::basic_igzip_mt_streambuf<char, std::char_traits<char>>;
+
+	// Incompressible data fills complete jobs, the end-of-file marker is
+	// then a job of its own that inflates to nothing
+	std::mt19937 rng(1);
+	std::string data(5 * 0xff00, 0);
+	for (auto &ch : data)
+		ch = static_cast<char>(rng());
+
+	std::istringstream in(data);
+	std::ostringstream bgzf;
+	REQUIRE(cif::gzio::convert_to_bgzf(in, bgzf));
+
+	std::stringbuf sb(bgzf.str());
+	mt_streambuf buf(4);
+	REQUIRE(buf.init(&sb) != nullptr);
+
+	std::istream is(&buf);
+	std::string s{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+	CHECK_FALSE(is.bad());
+	CHECK((s == data));
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("ccd_index_cache_1")
+{
+	auto dir = std::filesystem::temp_directory_path() / "cifpp-ccd-index";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	auto ccd = dir / "components.cif";
+
+	{
+		std::ofstream out(ccd);
+
+		// Enough data to make the index worth caching
+		for (int i = 0; i < 20000; ++i)
+			out << "data_P" << i << "\n_chem_comp.id P" << i << "\n_chem_comp.name 'padding compound'\n";
+
+		// Use a copy of REA with an id not used by other tests
+		std::ifstream rea(gTestDir / "REA.cif");
+		std::string text{ std::istreambuf_iterator<char>(rea), std::istreambuf_iterator<char>() };
+		cif::replace_all(text, "REA", "XRA");
+		out << text;
+	}
+
+	cif::compound_factory::instance().push_dictionary(ccd);
+	auto c = cif::compound_factory::instance().create("XRA");
+
+	REQUIRE(c != nullptr);
+	CHECK(c->name() == "RETINOIC ACID");
+
+	cif::compound_factory::instance().pop_dictionary();
+
+	// The index should have been stored next to the file
+	std::ifstream idx(dir / "components.cif.idx");
+	REQUIRE(idx.is_open());
+
+	std::string line;
+	std::getline(idx, line);
+	CHECK(line.starts_with("libcifpp-ccd-index 1 "));
+
+	std::size_t n = 0;
+	bool found = false;
+	while (std::getline(idx, line))
+	{
+		++n;
+		found = found or line.starts_with("XRA ");
+	}
+
+	CHECK(n == 20001);
+	CHECK(found);
+
+	idx.close();
+	auto stored = std::filesystem::last_write_time(dir / "components.cif.idx");
+
+	// And a new factory should use it instead of indexing the file again
+	std::ostringstream log;
+	auto saved_buf = std::cout.rdbuf(log.rdbuf());
+	auto saved_verbose = std::exchange(cif::VERBOSE, 2);
+
+	cif::compound_factory::instance().push_dictionary(ccd);
+	c = cif::compound_factory::instance().create("XRA");
+
+	cif::VERBOSE = saved_verbose;
+	std::cout.rdbuf(saved_buf);
+
+	REQUIRE(c != nullptr);
+	CHECK(c->formula_weight() == 300.435f);
+
+	CHECK(log.str().find("Using component index") != std::string::npos);
+	CHECK(log.str().find("Creating component index") == std::string::npos);
+	CHECK(std::filesystem::last_write_time(dir / "components.cif.idx") == stored);
+
+	cif::compound_factory::instance().pop_dictionary();
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("locate_resource_1")
+{
+	auto dir = std::filesystem::temp_directory_path() / "cifpp-locate-resource";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	std::filesystem::create_directories(dir / "removed");
+	std::ofstream(dir / "cifpp-locate-test.cif") << "data_test\n";
+	std::ofstream(dir / "removed" / "cifpp-locate-test.cif") << "data_test\n";
+
+	cif::add_file_resource("cifpp-locate-test.cif", dir / "removed" / "cifpp-locate-test.cif");
+	cif::add_data_directory(dir);
+	CHECK(cif::locate_resource("cifpp-locate-test.cif") == dir / "removed" / "cifpp-locate-test.cif");
+
+	// A registered file that no longer exists does not hide the one in a data directory
+	std::filesystem::remove_all(dir / "removed");
+
+	CHECK(cif::locate_resource("cifpp-locate-test.cif") == dir / "cifpp-locate-test.cif");
+	CHECK(cif::load_resource("cifpp-locate-test.cif") != nullptr);
+
+	std::filesystem::remove_all(dir);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("bgzf_1")
+{
+	std::string text;
+	for (int i = 0; i < 100000; ++i)
+		text += "line " + std::to_string(i) + " of the test data\n";
+
+	auto dir = std::filesystem::temp_directory_path() / "cifpp-bgzf";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	// Convert a regular gzip file into BGZF
+	{
+		cif::gzio::ofstream out(dir / "text.gz");
+		out << text;
+	}
+
+	{
+		cif::gzio::ifstream in(dir / "text.gz");
+		std::ofstream out(dir / "text-bgzf.gz", std::ios::binary);
+		CHECK(cif::gzio::convert_to_bgzf(in, out));
+	}
+
+	// Any gzip reader should be able to read it
+	{
+		cif::gzio::ifstream in(dir / "text-bgzf.gz");
+		std::string s{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+		CHECK(s == text);
+	}
+
+	// A regular gzip file is not accepted by the seekable reader
+	{
+		std::filebuf file;
+		file.open(dir / "text.gz", std::ios::in | std::ios::binary);
+		cif::gzio::basic_ibgzf_streambuf<char, std::char_traits<char>> buf;
+		CHECK(buf.init(&file) == nullptr);
+	}
+
+	{
+		std::filebuf file;
+		file.open(dir / "text-bgzf.gz", std::ios::in | std::ios::binary);
+		cif::gzio::basic_ibgzf_streambuf<char, std::char_traits<char>> buf;
+		REQUIRE(buf.init(&file) != nullptr);
+		CHECK(buf.size() == text.size());
+
+		std::istream in(&buf);
+		std::string s{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+		CHECK(s == text);
+
+		// random access
+		for (std::size_t pos : { std::size_t(1000000), std::size_t(10), std::size_t(0xff00 - 3), text.size() - 5, std::size_t(2000000) })
+		{
+			in.clear();
+			in.seekg(pos);
+			REQUIRE(in.tellg() == std::streampos(pos));
+
+			char b[5];
+			in.read(b, sizeof(b));
+			CHECK(std::string_view(b, in.gcount()) == std::string_view(text).substr(pos, 5));
+		}
+
+		in.clear();
+		in.seekg(0, std::ios::end);
+		CHECK(in.tellg() == std::streampos(text.size()));
+	}
+
+	// The CCD can be a BGZF file
+	{
+		std::ostringstream os;
+		for (int i = 0; i < 1000; ++i)
+			os << "data_Q" << i << "\n_chem_comp.id Q" << i << "\n_chem_comp.name 'padding compound'\n";
+
+		std::ifstream rea(gTestDir / "REA.cif");
+		std::string rea_text{ std::istreambuf_iterator<char>(rea), std::istreambuf_iterator<char>() };
+		cif::replace_all(rea_text, "REA", "XRB");
+		os << rea_text;
+
+		std::istringstream in(os.str());
+		std::ofstream out(dir / "components.cif.gz", std::ios::binary);
+		CHECK(cif::gzio::convert_to_bgzf(in, out));
+	}
+
+	cif::compound_factory::instance().push_dictionary(dir / "components.cif.gz");
+	auto c = cif::compound_factory::instance().create("XRB");
+
+	REQUIRE(c != nullptr);
+	CHECK(c->name() == "RETINOIC ACID");
+
+	cif::compound_factory::instance().pop_dictionary();
+
+	// A regular gzip file is read sequentially
+	{
+		cif::gzio::ifstream in(dir / "components.cif.gz");
+		cif::gzio::ofstream out(dir / "components-2.cif.gz");
+		out << in.rdbuf();
+	}
+
+	cif::compound_factory::instance().push_dictionary(dir / "components-2.cif.gz");
+	c = cif::compound_factory::instance().create("Q999");
+
+	REQUIRE(c != nullptr);
+	CHECK(c->id() == "Q999");
+
+	cif::compound_factory::instance().pop_dictionary();
+
+	std::filesystem::remove_all(dir);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("binary_1")
+{
+	using namespace cif::literals;
+
+	std::ostringstream os;
+	os << R"(data_first
+_single.id 1
+_single.dot .
+_single.unknown ?
+_single.text
+;multi
+line text
+;
+loop_
+_loop.id
+_loop.type
+_loop.value
+_loop.name
+)";
+
+	for (int i = 0; i < 100; ++i)
+		os << i << ' ' << (i % 3 == 0 ? "." : i % 3 == 1 ? "?" : "A") << ' ' << i * 0.5 << " 'a name with spaces " << i << "'\n";
+
+	os << R"(
+data_second
+_z.b 2
+_z.a 1
+)";
+
+	auto text = os.str();
+	cif::file f(text.data(), text.length());
+
+	std::stringstream bin;
+	f.save_binary(bin);
+
+	cif::file f2;
+	f2.load_binary(bin);
+
+	std::ostringstream s1, s2;
+	s1 << f;
+	s2 << f2;
+	CHECK(s1.str() == s2.str());
+
+	REQUIRE(f2.size() == 2);
+	CHECK(f2.front().name() == "first");
+	CHECK(f2.back().name() == "second");
+
+	auto &single = f2.front()["single"];
+	CHECK(single.front()["dot"].text() == ".");
+	CHECK(single.front()["unknown"].empty());
+	CHECK(single.front()["text"].text() == "multi\nline text");
+
+	auto &loop = f2.front()["loop"];
+	CHECK(loop.size() == 100);
+	CHECK(loop.find1("id"_key == 3)["type"].text() == ".");
+	CHECK(loop.find1("id"_key == 4)["type"].empty());
+	CHECK(loop.find1<std::string>("id"_key == 5, "name") == "a name with spaces 5");
+
+	// Item order must be kept
+	CHECK(f2.back()["z"].get_item_order() == std::vector<std::string>{ "_z.b", "_z.a" });
+
+	// Categories and datablocks can be stored separately
+	std::stringstream cbin;
+	f.front()["loop"].save_binary(cbin);
+
+	cif::category cat("other");
+	cat.load_binary(cbin);
+	CHECK(cat.name() == "loop");
+	CHECK(cat == f.front()["loop"]);
+
+	std::stringstream dbin;
+	f.back().save_binary(dbin);
+
+	cif::datablock db("x");
+	db.load_binary(dbin);
+	CHECK(db.name() == "second");
+	CHECK(db == f.back());
+
+	// And via a file on disk
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-binary.bin";
+	f.save_binary(tmp);
+
+	cif::file f3;
+	f3.load_binary(tmp);
+
+	std::ostringstream s3;
+	s3 << f3;
+	CHECK(s1.str() == s3.str());
+
+	std::filesystem::remove(tmp);
+
+	// Truncated data should be reported
+	auto data = bin.str();
+	std::istringstream truncated(data.substr(0, data.length() - 10));
+
+	cif::file f4;
+	CHECK_THROWS_AS(f4.load_binary(truncated), std::runtime_error);
+
+	// Categories that are not selected are skipped using the directory,
+	// damage the size of category single to show it is not read at all.
+	// The first occurrence of the name is in the directory.
+	auto pos = data.find("\x06single", data.find("\x06single") + 1);
+	REQUIRE(pos != std::string::npos);
+	data.replace(pos - 8, 8, 8, '\xff');
+
+	cif::load_options options;
+	options.skip_categories = { "single" };
+	options.items["loop"] = { "id", "name" };
+
+	std::istringstream damaged(data);
+	cif::file f5;
+	f5.load_binary(damaged, options);
+
+	REQUIRE(f5.size() == 2);
+	CHECK(f5.front().get("single") == nullptr);
+	CHECK(f5.front()["loop"].size() == 100);
+	CHECK(f5.front()["loop"].get_item_order() == std::vector<std::string>{ "_loop.id", "_loop.name" });
+	CHECK(f5.back()["z"] == f.back()["z"]);
+
+	// while reading everything fails
+	std::istringstream damaged_all(data);
+	cif::file f6;
+	CHECK_THROWS_AS(f6.load_binary(damaged_all), std::runtime_error);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("binary_links")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               int       numb
+               '[+-]?[0-9]+'
+
+save_cat_1
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save_cat_2
+    _category.id              cat_2
+    _category.mandatory_code  no
+    _category_key.name        '_cat_2.id'
+    save_
+
+save__cat_2.id
+    _item.name                '_cat_2.id'
+    _item.category_id         cat_2
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_2.parent_id
+    _item.name                '_cat_2.parent_id'
+    _item.category_id         cat_2
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+loop_
+_pdbx_item_linked_group_list.child_category_id
+_pdbx_item_linked_group_list.link_group_id
+_pdbx_item_linked_group_list.child_name
+_pdbx_item_linked_group_list.parent_name
+_pdbx_item_linked_group_list.parent_category_id
+cat_2 1 '_cat_2.parent_id' '_cat_1.id' cat_1
+    )";
+
+	std::istringstream is_dict(dict);
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	const char data[] = R"(
+data_test
+loop_
+_cat_1.id
+1
+2
+
+loop_
+_cat_2.id
+_cat_2.parent_id
+1 1
+2 1
+    )";
+
+	cif::file f;
+	f.set_validator(&validator);
+
+	std::istringstream is_data(data);
+	f.load(is_data);
+
+	auto &db = f.front();
+	auto &cat1 = db["cat_1"];
+	REQUIRE(cat1.has_children(cat1.front()));
+
+	// Loading a category drops the validator and with it the links
+	std::stringstream cbin;
+	cat1.save_binary(cbin);
+	cat1.load_binary(cbin);
+
+	CHECK(cat1.get_validator() == nullptr);
+	CHECK_FALSE(cat1.has_children(cat1.front()));
+
+	// which are rebuilt when a validator is attached again
+	db.set_validator(&validator);
+	CHECK(cat1.has_children(cat1.front()));
+
+	// A datablock with a validator rebuilds the links after loading
+	std::stringstream dbin;
+	db.save_binary(dbin);
+
+	cif::datablock db2("x");
+	db2.set_validator(&validator);
+	db2.load_binary(dbin);
+
+	auto &cat2 = db2["cat_2"];
+	CHECK(db2["cat_1"].get_children(db2["cat_1"].front(), cat2).size() == 2);
+	CHECK(cat2.has_parents(cat2.front()));
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("bcif_1")
+{
+	using namespace cif::literals;
+
+	std::ostringstream os;
+	os << R"(data_TEST
+_single.id 1
+_single.dot .
+_single.unknown ?
+_single.text
+;multi
+line text
+;
+loop_
+_loop.id
+_loop.seq
+_loop.type
+_loop.x
+_loop.b
+_loop.big
+_loop.name
+)";
+
+	for (int i = 0; i < 500; ++i)
+	{
+		os << i + 1 << ' '
+		   << (i / 10) * 3 - 20 << ' '
+		   << (i % 3 == 0 ? "." : i % 3 == 1 ? "?" : "ATOM") << ' '
+		   << cif::format("%.3f", std::sin(i) * 100).str() << ' '
+		   << cif::format("%.2f", i * 0.25).str() << ' '
+		   << i * 100003 - 40000000 << ' '
+		   << "'name " << i % 7 << "'\n";
+	}
+
+	os << R"(
+data_second
+_z.b 0.10
+_z.a 007
+)";
+
+	auto text = os.str();
+	cif::file f(text.data(), text.length());
+
+	std::stringstream bcif;
+	f.save_bcif(bcif);
+
+	// BinaryCIF is detected automatically
+	cif::file f2(bcif);
+
+	std::ostringstream s1, s2;
+	s1 << f;
+	s2 << f2;
+	CHECK(s1.str() == s2.str());
+
+	auto &loop = f2.front()["loop"];
+	CHECK(loop.size() == 500);
+	CHECK(loop.find1("id"_key == 1)["type"].text() == ".");
+	CHECK(loop.find1("id"_key == 2)["type"].empty());
+	CHECK(f2.front()["single"].front()["unknown"].empty());
+	CHECK(f2.back()["z"].front()["a"].text() == "007");
+	CHECK(f2.back()["z"].front()["b"].text() == "0.10");
+
+	// Smaller than the text
+	CHECK(bcif.str().length() < text.length());
+
+	// Via a file, using the extension
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-test.bcif.gz";
+	f.save(tmp);
+
+	cif::file f3(tmp);
+	std::ostringstream s3;
+	s3 << f3;
+	CHECK(s1.str() == s3.str());
+
+	std::filesystem::remove(tmp);
+
+	// Damaged data is reported
+	auto data = bcif.str();
+	std::istringstream truncated(data.substr(0, data.length() / 2));
+	cif::file f4;
+	CHECK_THROWS_AS(f4.load_bcif(truncated), std::runtime_error);
+}
+
+TEST_CASE("bcif_2")
+{
+	// Hand crafted BinaryCIF using encodings that are not produced by save_bcif
+	auto str = [](std::string &s, std::string_view t) { s += static_cast<char>(0xa0 | t.length()); s += t; };
+	auto bin = [](std::string &s, std::string_view t) { s += static_cast<char>(0xc4); s += static_cast<char>(t.length()); s += t; };
+
+	std::string d;
+	d += static_cast<char>(0x81);
+	str(d, "dataBlocks");
+	d += static_cast<char>(0x91);
+	d += static_cast<char>(0x82);
+	str(d, "header");
+	str(d, "X");
+	str(d, "categories");
+	d += static_cast<char>(0x91);
+	d += static_cast<char>(0x83);
+	str(d, "name");
+	str(d, "_c");
+	str(d, "rowCount");
+	d += static_cast<char>(4);
+	str(d, "columns");
+	d += static_cast<char>(0x92);
+
+	// column a: float32 values
+	d += static_cast<char>(0x82);
+	str(d, "name");
+	str(d, "a");
+	str(d, "data");
+	d += static_cast<char>(0x82);
+	str(d, "encoding");
+	d += static_cast<char>(0x91);
+	d += static_cast<char>(0x82);
+	str(d, "kind");
+	str(d, "ByteArray");
+	str(d, "type");
+	d += static_cast<char>(32);
+	str(d, "data");
+	{
+		float v[4] = { 1.5f, -2.25f, 0, 100 };
+		bin(d, std::string_view(reinterpret_cast<const char *>(v), sizeof(v)));
+	}
+
+	// column b: interval quantization of int8 values
+	d += static_cast<char>(0x82);
+	str(d, "name");
+	str(d, "b");
+	str(d, "data");
+	d += static_cast<char>(0x82);
+	str(d, "encoding");
+	d += static_cast<char>(0x92);
+	d += static_cast<char>(0x85);
+	str(d, "kind");
+	str(d, "IntervalQuantization");
+	str(d, "min");
+	d += static_cast<char>(0);
+	str(d, "max");
+	d += static_cast<char>(10);
+	str(d, "numSteps");
+	d += static_cast<char>(11);
+	str(d, "srcType");
+	d += static_cast<char>(33);
+	d += static_cast<char>(0x82);
+	str(d, "kind");
+	str(d, "ByteArray");
+	str(d, "type");
+	d += static_cast<char>(1);
+	str(d, "data");
+	bin(d, std::string_view("\x00\x01\x05\x0a", 4));
+
+	cif::file f;
+	std::istringstream is(d);
+	f.load_bcif(is);
+
+	auto &c = f.front()["c"];
+	REQUIRE(c.size() == 4);
+
+	std::vector<float> a, b;
+	for (const auto &[av, bv] : c.rows<float, float>("a", "b"))
+	{
+		a.push_back(av);
+		b.push_back(bv);
+	}
+
+	CHECK(a == std::vector<float>{ 1.5f, -2.25f, 0, 100 });
+	CHECK(b == std::vector<float>{ 0, 1, 5, 10 });
+}
+
+TEST_CASE("bcif_3")
+{
+	// Sub unit and negative values are stored as fixed point as well
+	auto write = [](const char *text)
+	{
+		cif::file f(text, std::strlen(text));
+		std::stringstream bcif;
+		f.save_bcif(bcif);
+
+		cif::file f2(bcif);
+		std::ostringstream s1, s2;
+		s1 << f;
+		s2 << f2;
+		CHECK(s1.str() == s2.str());
+
+		return bcif.str();
+	};
+
+	auto data = write(R"(data_TEST
+loop_
+_c.x
+1.500
+0.250
+-0.125
+-12.000
+)");
+
+	CHECK(data.find("FixedPoint") != std::string::npos);
+	CHECK(data.find("StringArray") == std::string::npos);
+
+	// Values that would not survive the round trip are kept as text
+	data = write(R"(data_TEST
+loop_
+_c.x
+1.500
+-0.000
+00.250
+)");
+
+	CHECK(data.find("StringArray") != std::string::npos);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("load_options_1")
+{
+	std::ostringstream os;
+	os << "data_TEST\n"
+	   << "_entry.id TEST\n"
+	   << "_struct.title 'a title'\n"
+	   << "_struct.pdbx_descriptor 'a descriptor'\n"
+	   << "loop_\n"
+	   << "_entity.id\n"
+	   << "_entity.type\n"
+	   << "_entity.src_method\n"
+	   << "1 polymer man\n"
+	   << "2 water nat\n"
+	   << "loop_\n"
+	   << "_atom_site.id\n"
+	   << "_atom_site.label_atom_id\n";
+
+	for (int i = 0; i < 20000; ++i)
+		os << i << " CA\n";
+
+	os << "_last.id 1\n";
+
+	auto tmp = std::filesystem::temp_directory_path() / "cifpp-load-options.cif";
+	{
+		std::ofstream out(tmp);
+		out << os.str();
+	}
+
+	cif::load_options options;
+	options.categories = { "entry", "ENTITY", "struct", "last" };
+	options.skip_categories = { "last" };
+	options.items["entity"] = { "id", "type" };
+	options.items["struct"] = { "title" };
+
+	cif::file f1(tmp, options);
+
+	std::istringstream is(os.str());
+	cif::file f2;
+	f2.load(is, options);
+
+	std::filesystem::remove(tmp);
+
+	for (auto *f : { &f1, &f2 })
+	{
+		REQUIRE(f->size() == 1);
+		auto &db = f->front();
+
+		CHECK(db.get("atom_site") == nullptr);
+		CHECK(db.get("last") == nullptr);
+
+		REQUIRE(db.get("entry") != nullptr);
+		CHECK(db["entry"].front()["id"].as<std::string>() == "TEST");
+
+		auto &entity = db["entity"];
+		CHECK(entity.size() == 2);
+		CHECK(entity.get_items() == cif::iset{ "id", "type" });
+		CHECK(entity.find1<std::string>(cif::key("id") == 2, "type") == "water");
+
+		auto &s = db["struct"];
+		CHECK(s.get_items() == cif::iset{ "title" });
+		CHECK(s.front()["title"].as<std::string>() == "a title");
+	}
+
+	// Selecting only items that do not exist leaves out the category
+	cif::load_options options2;
+	options2.items["atom_site"] = { "Cartn_x" };
+
+	std::istringstream is2(os.str());
+	cif::file f3;
+	f3.load(is2, options2);
+
+	REQUIRE(f3.size() == 1);
+	CHECK(f3.front().get("atom_site") == nullptr);
+	CHECK(f3.front().get("entity") != nullptr);
+}
+
+TEST_CASE("load_options_2")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id               test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           load_options_2.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+               int       numb
+               '[+-]?[0-9]+'
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.name
+    _item.name                '_cat_1.name'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+
+save__cat_1.desc
+    _item.name                '_cat_1.desc'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+    )";
+
+	std::istringstream is_dict(dict);
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	const std::string data = R"(data_test
+loop_
+_cat_1.id
+_cat_1.name
+_cat_1.desc
+1 aap  a
+2 noot n
+3 mies m
+)";
+
+	// The key item is loaded, even though it was not selected
+	cif::load_options options;
+	options.items["cat_1"] = { "name" };
+
+	cif::file f;
+	f.set_validator(&validator);
+
+	std::istringstream is(data);
+	REQUIRE_NOTHROW(f.load(is, options));
+
+	auto &cat1 = f.front()["cat_1"];
+	CHECK(cat1.get_items() == cif::iset{ "id", "name" });
+	CHECK(cat1[{ { "id", 2 } }]["name"].as<std::string>() == "noot");
+
+	// Without a validator the keys are not known
+	cif::file f2;
+	std::istringstream is2(data);
+	f2.load(is2, options);
+	CHECK(f2.front()["cat_1"].get_items() == cif::iset{ "name" });
+
+	// Unless the data names a dictionary in audit_conform
+	std::istringstream is_dict2(dict);
+	cif::validator_factory::instance().construct_validator("load_options_2.dic", is_dict2);
+
+	cif::file f3;
+	std::istringstream is3("data_test\n_audit_conform.dict_name load_options_2.dic\n" + data.substr(data.find('\n') + 1));
+	f3.load(is3, options);
+
+	REQUIRE(f3.get_validator() != nullptr);
+	CHECK(f3.front()["cat_1"].get_items() == cif::iset{ "id", "name" });
+	CHECK(f3.front()["cat_1"][{ { "id", 3 } }]["name"].as<std::string>() == "mies");
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("stream_parser_1")
+{
+	const char *text = R"(data_FIRST
+_entry.id FIRST
+_struct.title 'a title'
+loop_
+_atom_site.id
+_atom_site.type_symbol
+_atom_site.label_seq_id
+_atom_site.Cartn_x
+_atom_site.pdbx_PDB_model_num
+1 N 1 1.5 1
+2 C 1 +2.25 1
+3 O ? -3 1
+data_SECOND
+_entry.id SECOND
+loop_
+_atom_site.Cartn_x
+_atom_site.id
+_atom_site.label_seq_id
+10.5 4 7
+)";
+
+	std::vector<std::string> datablocks;
+	std::vector<std::string> entries;
+	std::vector<std::tuple<int, int, float, std::optional<int>>> atoms;
+
+	auto parse = [&](cif::stream_parser &p)
+	{
+		datablocks.clear();
+		entries.clear();
+		atoms.clear();
+
+		p.on_datablock([&](std::string_view name) { datablocks.emplace_back(name); });
+
+		p.visit<std::string>("entry", { "id" }, [&](const std::string &id) { entries.push_back(id); });
+
+		p.visit<int, int, float, std::optional<int>>("ATOM_SITE", { "id", "label_seq_id", "Cartn_x", "pdbx_PDB_model_num" },
+			[&](int id, int seq_id, float x, std::optional<int> model_nr)
+			{ atoms.emplace_back(id, seq_id, x, model_nr); });
+
+		p.parse_file();
+
+		CHECK(datablocks == std::vector<std::string>{ "FIRST", "SECOND" });
+		CHECK(entries == std::vector<std::string>{ "FIRST", "SECOND" });
+
+		REQUIRE(atoms.size() == 4);
+		CHECK(atoms[0] == std::make_tuple(1, 1, 1.5f, std::optional<int>{ 1 }));
+		CHECK(atoms[1] == std::make_tuple(2, 1, 2.25f, std::optional<int>{ 1 }));
+		CHECK(atoms[2] == std::make_tuple(3, 0, -3.f, std::optional<int>{ 1 }));
+		CHECK(atoms[3] == std::make_tuple(4, 7, 10.5f, std::optional<int>{}));
+	};
+
+	cif::stream_parser p1(std::string_view{ text });
+	parse(p1);
+
+	std::istringstream is(text);
+	cif::stream_parser p2(is);
+	parse(p2);
+
+	cif::stream_parser p3(std::string_view{ text });
+	CHECK_THROWS(p3.visit<int, int>("atom_site", { "id" }, [](int, int) {}));
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("parse_loop_validated_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+               int       numb
+               '[+-]?[0-9]+'
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.name
+    _item.name                '_cat_1.name'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           code
+    save_
+    )";
+
+	std::istringstream is_dict(dict);
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::file f;
+	f.set_validator(&validator);
+
+	// Rows read from a loop_ are validated and indexed
+	std::string_view data = R"(data_test
+loop_
+_cat_1.id
+_cat_1.name
+1 Aap
+2 Noot
+3 Mies
+)";
+
+	cif::parser p(data, f);
+	p.parse_file();
+
+	auto &cat1 = f.front()["cat_1"];
+	REQUIRE(cat1.size() == 3);
+	CHECK(cat1.find1<std::string>(cif::key("id") == 2, "name") == "Noot");
+	CHECK_THROWS(cat1.emplace({ { "id", 3 }, { "name", "Wim" } }));
+
+	// An invalid value is reported while reading the loop
+	std::string_view bad_data = R"(data_bad
+loop_
+_cat_1.id
+_cat_1.name
+1 Aap
+two Noot
+)";
+
+	cif::file f2;
+	f2.set_validator(&validator);
+
+	cif::parser p2(bad_data, f2);
+	CHECK_THROWS(p2.parse_file());
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("row_storage_1")
+{
+	cif::category cat("test");
+
+	for (int i = 0; i < 10000; ++i)
+		cat.emplace({ { "id", i }, { "name", "name_" + std::to_string(i) } });
+
+	CHECK(cat.size() == 10000);
+
+	// erase the odd rows, their storage is reused for new rows
+	for (auto i = cat.begin(); i != cat.end();)
+	{
+		if (i->get<int>("id") % 2 == 1)
+			i = cat.erase(i);
+		else
+			++i;
+	}
+	CHECK(cat.size() == 5000);
+
+	for (int i = 10000; i < 12500; ++i)
+		cat.emplace({ { "id", i }, { "name", "name_" + std::to_string(i) } });
+
+	REQUIRE(cat.size() == 7500);
+
+	int n = 0;
+	for (const auto &[id, name] : cat.rows<int, std::string>("id", "name"))
+	{
+		CHECK(name == "name_" + std::to_string(id));
+		CHECK((id >= 10000 or id % 2 == 0));
+		++n;
+	}
+	CHECK(n == 7500);
+
+	cif::category copy(cat);
+	cif::category moved(std::move(cat));
+
+	CHECK(copy.size() == 7500);
+	CHECK(moved.size() == 7500);
+	CHECK(copy.find1<std::string>(cif::key("id") == 12499, "name") == "name_12499");
+	CHECK(moved.find1<std::string>(cif::key("id") == 42, "name") == "name_42");
+
+	moved.clear();
+	CHECK(moved.empty());
+
+	moved.emplace({ { "id", 1 } });
+	CHECK(moved.size() == 1);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("string_pool_1")
+{
+	auto long_text = [](int i) { return "a rather long value, number " + std::to_string(i); };
+
+	cif::category cat("test");
+
+	for (int i = 0; i < 5000; ++i)
+		cat.emplace({ { "id", i }, { "text", long_text(i) }, { "short", "x" } });
+
+	// update values, the new values own their text
+	for (auto r : cat)
+	{
+		auto id = r["id"].as<int>();
+		if (id % 3 == 0)
+			r["text"] = long_text(id + 100000);
+	}
+
+	// values updated repeatedly, and updated with a part of their own text
+	auto r7 = cat.find1(cif::key("id") == 7);
+	for (int i = 0; i < 100; ++i)
+		r7["text"] = long_text(i);
+	r7["text"] = r7["text"].text().substr(2);
+	CHECK(r7["text"].as<std::string>() == long_text(99).substr(2));
+	r7["text"] = long_text(7);
+
+	cif::category copy(cat);
+
+	cat.erase(cif::key("id") < 2500);
+	CHECK(cat.size() == 2500);
+
+	for (const auto &[id, text] : cat.rows<int, std::string>("id", "text"))
+		CHECK(text == long_text(id % 3 == 0 ? id + 100000 : id));
+
+	cat.clear();
+
+	REQUIRE(copy.size() == 5000);
+	for (const auto &[id, text, s] : copy.rows<int, std::string, std::string>("id", "text", "short"))
+	{
+		CHECK(text == long_text(id % 3 == 0 ? id + 100000 : id));
+		CHECK(s == "x");
+	}
+
+	// a value with its own heap storage
+	cif::item_value v(long_text(1));
+	CHECK(v.text() == long_text(1));
+	CHECK(v.length() == long_text(1).length());
+
+	cif::string_pool pool;
+	cif::item_value pv(long_text(2), pool);
+	CHECK(pv.text() == long_text(2));
+	CHECK(pv.length() == long_text(2).length());
+	CHECK(sizeof(cif::item_value) == 16);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("short_value_condition_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+               ucode     uchar
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+
+save_test
+    _category.description     'A test category'
+    _category.id              test
+    _category.mandatory_code  no
+    _category_key.name        '_test.id'
+    save_
+
+save__test.id
+    _item.name                '_test.id'
+    _item.category_id         test
+    _item.mandatory_code      yes
+    _item_type.code           code
+    save_
+
+save__test.comp_id
+    _item.name                '_test.comp_id'
+    _item.category_id         test
+    _item.mandatory_code      no
+    _item_type.code           ucode
+    save_
+
+save__test.name
+    _item.name                '_test.name'
+    _item.category_id         test
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+    )";
+
+	const char *values[] = { "HOH", "hoh", "HoH", "H0H", "HOH1", "HO", "[OH", "{OH", "ABCDEFG", "abcdefg", "ABCDEFGH", "." };
+
+	auto fill = [&](cif::category &cat)
+	{
+		int id = 0;
+		for (auto v : values)
+		{
+			++id;
+			cat.emplace({ { "id", id }, { "comp_id", v }, { "name", v } });
+		}
+		cat.emplace({ { "id", 100 } });
+	};
+
+	// Without validator comparison is case sensitive
+	cif::category cat("test");
+	fill(cat);
+
+	CHECK(cat.count(cif::key("comp_id") == "HOH") == 1);
+	CHECK(cat.count(cif::key("comp_id") == "hoh") == 1);
+	CHECK(cat.count(cif::key("comp_id") == "[OH") == 1);
+	CHECK(cat.count(cif::key("comp_id") == "ABCDEFG") == 1);
+	CHECK(cat.count(cif::key("comp_id") == "ABCDEFGH") == 1);
+	CHECK(cat.count(cif::key("comp_id") == "HOH" or cif::key("comp_id") == cif::null) == 3);
+	CHECK(cat.count(cif::key("comp_id") == "XYZ") == 0);
+
+	// The uchar item is compared case insensitive
+	std::istringstream is_dict(dict);
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::file f;
+	f.set_validator(&validator);
+	f.emplace("TEST");
+
+	auto &vcat = f.front()["test"];
+	fill(vcat);
+
+	CHECK(vcat.count(cif::key("comp_id") == "HOH") == 3);
+	CHECK(vcat.count(cif::key("comp_id") == "hOh") == 3);
+	CHECK(vcat.count(cif::key("comp_id") == "H0H") == 1);
+	CHECK(vcat.count(cif::key("comp_id") == "[OH") == 1);
+	CHECK(vcat.count(cif::key("comp_id") == "{oh") == 1);
+	CHECK(vcat.count(cif::key("comp_id") == "abcdefg") == 2);
+	CHECK(vcat.count(cif::key("comp_id") == "abcdefgh") == 1);
+	CHECK(vcat.count(cif::key("comp_id") == "hoh" or cif::key("comp_id") == cif::null) == 5);
+
+	CHECK(vcat.count(cif::key("name") == "HOH") == 1);
+	CHECK(vcat.count(cif::key("name") == "abcdefg") == 1);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("row_directory_1")
+{
+	cif::category cat("test");
+	CHECK(cat.size() == 0);
+
+	for (int i = 0; i < 100; ++i)
+		cat.emplace({ { "id", i } });
+
+	REQUIRE(cat.size() == 100);
+	CHECK(cat[std::size_t{ 0 }]["id"].as<int>() == 0);
+	CHECK(cat[std::size_t{ 42 }]["id"].as<int>() == 42);
+	CHECK(cat[std::size_t{ 99 }]["id"].as<int>() == 99);
+	CHECK_THROWS(cat[std::size_t{ 100 }]);
+
+	// erasing rows keeps the count and directory up to date
+	cat.erase(cif::key("id") < 10);
+	CHECK(cat.size() == 90);
+	CHECK(cat[std::size_t{ 0 }]["id"].as<int>() == 10);
+
+	// erase the last row, the next row is appended at the end
+	cat.erase(cif::key("id") == 99);
+	cat.emplace({ { "id", 1000 } });
+	CHECK(cat.size() == 90);
+	CHECK(cat.back()["id"].as<int>() == 1000);
+	CHECK(cat[std::size_t{ 89 }]["id"].as<int>() == 1000);
+
+	cat.sort([](cif::row_handle a, cif::row_handle b)
+		{ return b["id"].as<int>() - a["id"].as<int>(); });
+
+	CHECK(cat.size() == 90);
+	CHECK(cat[std::size_t{ 0 }]["id"].as<int>() == 1000);
+	CHECK(cat[std::size_t{ 89 }]["id"].as<int>() == 10);
+
+	cif::category copy(cat);
+	CHECK(copy.size() == 90);
+
+	cat.clear();
+	CHECK(cat.size() == 0);
+	CHECK(cat.empty());
+
+	std::istringstream is(R"(data_TEST
+loop_
+_test.id
+1 2 3 4 5
+)");
+	cif::file f(is);
+	CHECK(f.front()["test"].size() == 5);
+	CHECK(f.front()["test"][std::size_t{ 4 }]["id"].as<int>() == 5);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("item_key_1")
+{
+	using namespace cif::literals;
+
+	CHECK(cif::ihash("Cartn_x") == cif::ihash("CARTN_X"));
+
+	cif::category cat("atom_site");
+
+	// enough items to force the item table to grow a few times
+	for (int i = 0; i < 100; ++i)
+		cat.add_item("item_" + std::to_string(i));
+
+	for (int i = 0; i < 100; ++i)
+	{
+		CHECK(cat.get_item_ix("item_" + std::to_string(i)) == i);
+		CHECK(cat.get_item_ix("ITEM_" + std::to_string(i)) == i);
+	}
+	CHECK(cat.get_item_ix("item_100") == 100);
+
+	cat.rename_item("item_10", "Cartn_x");
+	CHECK(cat.get_item_ix("item_10") == 100);
+	CHECK(cat.get_item_ix("cartn_x") == 10);
+
+	cat.remove_item("item_0");
+	CHECK(cat.get_item_ix("cartn_x") == 9);
+	CHECK(cat.get_item_ix("item_99") == 98);
+	CHECK(not cat.has_item("item_0"));
+
+	static const auto kCartnX = cif::item_key("Cartn_x");
+	static const auto kOcc = cif::item_key("occupancy");
+
+	CHECK(cat.has_item(kCartnX));
+	CHECK(not cat.has_item(kOcc));
+
+	cat.emplace({ { "Cartn_x", "1.5" }, { "item_1", "a" } });
+
+	auto r = cat.front();
+	CHECK(r[kCartnX].as<float>() == 1.5f);
+	CHECK(r.get<float>(kCartnX) == 1.5f);
+	CHECK(r[kOcc].empty());
+
+	r[kOcc] = "0.5";
+	CHECK(cat.has_item(kOcc));
+	CHECK(r["occupancy"].as<float>() == 0.5f);
+
+	cif::category copy(cat);
+	CHECK(copy.front()[kCartnX].as<float>() == 1.5f);
+
+	// lookup of categories and datablocks
+	cif::file f;
+	auto &db = f["TEST"];
+	db.emplace_back(std::move(copy));
+	db["Entity"];
+
+	CHECK(&f["test"] == &f.front());
+	CHECK(f.contains("Test"));
+	CHECK(db.get("ATOM_SITE") == &db.front());
+	CHECK(db.get("entity") == &db.back());
+	CHECK(db.get("entity_poly") == nullptr);
+
+	db.set_name("other");
+	CHECK(not f.contains("test"));
+	CHECK(f.contains("OTHER"));
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("hash_index_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+    _item_type_list.detail
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+;              code item types/single words ...
+;
+               ucode     uchar
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+;              code item types/single words, case insensitive ...
+;
+               int       numb
+               '[+-]?[0-9]+'
+;              int item types are the subset of numbers that are the negative
+               or positive integers.
+;
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+     loop_
+    _category_key.name        '_cat_1.id'
+                              '_cat_1.code'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.code
+    _item.name                '_cat_1.code'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           ucode
+    save_
+
+save__cat_1.name
+    _item.name                '_cat_1.name'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::file f;
+	f.set_validator(&validator);
+
+	std::istringstream is_data(R"(
+data_test
+loop_
+_cat_1.id
+_cat_1.code
+_cat_1.name
+2 a Noot
+1 a Aap
+3 b Mies
+    )");
+
+	f.load(is_data);
+
+	auto &cat1 = f.front()["cat_1"];
+	CHECK(cat1.get_index_type() == cif::index_type::tree);
+
+	cat1.set_index_type(cif::index_type::hash);
+	CHECK(cat1.get_index_type() == cif::index_type::hash);
+
+	// numbers compare by value, ucode ignores case
+	CHECK(cat1[{ { "id", "01" }, { "code", "A" } }]["name"].as<std::string>() == "Aap");
+	CHECK(cat1[{ { "id", 3 }, { "code", "B" } }]["name"].as<std::string>() == "Mies");
+	CHECK(cat1[{ { "id", 3 }, { "code", "a" } }].empty());
+
+	CHECK_THROWS_AS(cat1.emplace({ { "id", "02" }, { "code", "A" }, { "name", "Dup" } }), cif::duplicate_key_error);
+	CHECK(cat1.size() == 3);
+
+	// enough rows to grow the table a few times
+	for (int i = 4; i < 1000; ++i)
+		cat1.emplace({ { "id", i }, { "code", i % 2 ? "a" : "b" }, { "name", "row-" + std::to_string(i) } });
+
+	// erasing moves entries in the table, all remaining rows should still be found
+	cat1.erase(cif::key("id") > 500 and cif::key("id") < 900);
+
+	CHECK(cat1.size() == 600);
+	for (int i = 4; i < 1000; ++i)
+	{
+		auto r = cat1[{ { "id", i }, { "code", i % 2 ? "A" : "B" } }];
+		CHECK(r.empty() == (i > 500 and i < 900));
+	}
+
+	// updating a key value updates the index
+	cat1[{ { "id", 999 }, { "code", "a" } }]["id"] = 1000;
+	CHECK(cat1[{ { "id", 999 }, { "code", "a" } }].empty());
+	CHECK(cat1[{ { "id", 1000 }, { "code", "a" } }]["name"].as<std::string>() == "row-999");
+
+	// copies use the same type of index
+	cif::category copy(cat1);
+	CHECK(copy.get_index_type() == cif::index_type::hash);
+	CHECK(copy[{ { "id", 4 }, { "code", "b" } }]["name"].as<std::string>() == "row-4");
+
+	// reorder sorts the rows on key
+	cat1.reorder_by_index();
+
+	int last = 0;
+	for (int id : cat1.rows<int>("id"))
+	{
+		CHECK(id > last);
+		last = id;
+	}
+	CHECK(last == 1000);
+
+	cat1.set_index_type(cif::index_type::tree);
+	CHECK(cat1[{ { "id", 1 }, { "code", "a" } }]["name"].as<std::string>() == "Aap");
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("secondary_index_1")
+{
+	using namespace cif::literals;
+
+	cif::category atom_site("atom_site");
+
+	int id = 1;
+	for (auto asym : { "A", "B" })
+	{
+		for (int seq = 1; seq <= 50; ++seq)
+		{
+			for (auto atom : { "N", "CA", "C", "O" })
+				atom_site.emplace({ { "id", id++ }, { "label_asym_id", asym }, { "label_seq_id", seq }, { "label_atom_id", atom } });
+		}
+	}
+
+	atom_site.create_index({ "label_asym_id", "label_seq_id" });
+
+	auto atoms = [&](auto &&cond)
+	{
+		std::vector<int> result;
+		for (int i : atom_site.find<int>(std::forward<decltype(cond)>(cond), "id"))
+			result.push_back(i);
+		return result;
+	};
+
+	// results are the same as without index and in the order of the category
+	CHECK(atoms("label_asym_id"_key == "B" and "label_seq_id"_key == 2) == std::vector<int>{ 205, 206, 207, 208 });
+	CHECK(atoms("label_asym_id"_key == "b" and "label_seq_id"_key == "2") == std::vector<int>{});
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 3 and "label_atom_id"_key == "CA") == std::vector<int>{ 10 });
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 51).empty());
+
+	// numbers compare by value
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == "01").size() == 0);
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 1.0).size() == 4);
+
+	CHECK(atom_site.count("label_asym_id"_key == "A" and "label_seq_id"_key == 7) == 4);
+	CHECK(atom_site.contains("label_asym_id"_key == "B" and "label_seq_id"_key == 50));
+	CHECK(atom_site.find1<int>("label_asym_id"_key == "B" and "label_seq_id"_key == 50 and "label_atom_id"_key == "O", "id") == 400);
+
+	// the index is kept up to date
+	atom_site.emplace({ { "id", 401 }, { "label_asym_id", "A" }, { "label_seq_id", 2 }, { "label_atom_id", "CB" } });
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 2) == std::vector<int>{ 5, 6, 7, 8, 401 });
+
+	atom_site.erase("id"_key == 6);
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 2) == std::vector<int>{ 5, 7, 8, 401 });
+
+	for (auto r : atom_site.find("label_asym_id"_key == "A" and "label_seq_id"_key == 1))
+		r["label_seq_id"] = 2;
+
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 1).empty());
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 2) == std::vector<int>{ 1, 2, 3, 4, 5, 7, 8, 401 });
+
+	atom_site.sort([](cif::row_handle a, cif::row_handle b)
+		{ return b["id"].as<int>() - a["id"].as<int>(); });
+	CHECK(atoms("label_asym_id"_key == "A" and "label_seq_id"_key == 2) == std::vector<int>{ 401, 8, 7, 5, 4, 3, 2, 1 });
+
+	// starting somewhere in the middle does not use the index
+	auto pos = atom_site.begin();
+	std::advance(pos, 393);
+	CHECK(atom_site.find(pos, "label_asym_id"_key == "A" and "label_seq_id"_key == 2).size() == 7);
+
+	// copies have the same indices
+	cif::category copy(atom_site);
+	CHECK(copy.count("label_asym_id"_key == "B" and "label_seq_id"_key == 10) == 4);
+
+	atom_site.remove_item("label_seq_id");
+	CHECK(atom_site.count("label_asym_id"_key == "A") == 200);
+}
+
+TEST_CASE("numeric_hash_1")
+{
+	using namespace cif::literals;
+
+	// Numbers are equal when they differ no more than epsilon. The last two
+	// values are close to halfway two hash buckets and end up in different ones.
+	const std::vector<std::string> values{ "0.30000000000000004", "0.3", "4.546473508864641e-13", "4.548473508864641e-13" };
+
+	cif::category cat("test");
+	for (int id = 0; auto v : values)
+		cat.emplace({ { "id", ++id }, { "v", v } });
+
+	std::vector<std::size_t> scan;
+	for (auto v : { 0.3, 4.546473508864641e-13, 4.547473508864641e-13, 4.548473508864641e-13 })
+		scan.push_back(cat.count("v"_key == v));
+
+	CHECK(scan == std::vector<std::size_t>{ 2, 2, 2, 2 });
+
+	cat.create_index({ "v" });
+
+	std::vector<std::size_t> indexed;
+	for (auto v : { 0.3, 4.546473508864641e-13, 4.547473508864641e-13, 4.548473508864641e-13 })
+		indexed.push_back(cat.count("v"_key == v));
+
+	CHECK(indexed == scan);
+
+	// The same goes for the primary key in a hash index
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id               test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               float     numb
+               '-?(([0-9]+)|([0-9]*\.[0-9]+))([(][0-9]+[)])?([eE][+-]?[0-9]+)?'
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.v'
+    save_
+
+save__cat_1.v
+    _item.name                '_cat_1.v'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           float
+    save_
+    )";
+
+	std::istringstream is_dict(dict);
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	for (auto type : { cif::index_type::tree, cif::index_type::hash })
+	{
+		cif::datablock db("test");
+		db.set_validator(&validator);
+
+		auto &cat1 = db["cat_1"];
+		cat1.set_index_type(type);
+
+		cat1.emplace({ { "v", "4.546473508864641e-13" } });
+		CHECK_THROWS_AS(cat1.emplace({ { "v", "4.548473508864641e-13" } }), cif::duplicate_key_error);
+
+		CHECK_FALSE(cat1[{ { "v", "4.548473508864641e-13" } }].empty());
+		CHECK_FALSE(cat1[{ { "v", "4.547473508864641e-13" } }].empty());
+		CHECK(cat1[{ { "v", "4.549473508864641e-13" } }].empty());
+	}
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("query_plan_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+    _item_type_list.detail
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+;              code item types/single words ...
+;
+               int       numb
+               '[+-]?[0-9]+'
+;              int item types are the subset of numbers that are the negative
+               or positive integers.
+;
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.kind
+    _item.name                '_cat_1.kind'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+
+save__cat_1.value
+    _item.name                '_cat_1.value'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           int
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::datablock db("test");
+	db.set_validator(&validator);
+
+	auto &cat1 = db["cat_1"];
+
+	for (int id = 1; id <= 100; ++id)
+		cat1.emplace({ { "id", id }, { "kind", id % 4 == 0 ? "x" : "y" }, { "value", id % 10 } });
+
+	using namespace cif::literals;
+
+	// a test on the key uses the primary index, also inside an AND
+	cif::condition c1 = "id"_key == 42;
+	c1.prepare(cat1);
+	CHECK(c1.explain().starts_with("primary index, 1 candidate rows"));
+	REQUIRE(c1.candidates() != nullptr);
+	CHECK(c1.candidates()->size() == 1);
+
+	cif::condition c2 = "kind"_key == "y" and "id"_key == 43;
+	c2.prepare(cat1);
+	CHECK(c2.explain().starts_with("primary index, 1 candidate rows"));
+	CHECK(cat1.count("kind"_key == "y" and "id"_key == 43) == 1);
+	CHECK(cat1.count("kind"_key == "x" and "id"_key == 43) == 0);
+	CHECK(cat1.count("id"_key == 43 and "kind"_key == "x") == 0);
+	CHECK(cat1.find("kind"_key == "x" and "id"_key == 44).size() == 1);
+
+	cif::condition c3 = "id"_key == 142;
+	c3.prepare(cat1);
+	CHECK(c3.explain().starts_with("primary index, 0 candidate rows"));
+	CHECK(cat1.find("id"_key == 142).empty());
+
+	// without an index all rows are tested, the cheapest and most
+	// selective tests first
+	cif::condition c4 = "kind"_key == "x" and "value"_key > 4 and "value"_key == 8;
+	c4.prepare(cat1);
+	CHECK(c4.explain().starts_with("scan of 100 rows, test (kind  == x AND value == 8 AND value  > 4)"));
+	CHECK(cat1.count("kind"_key == "x" and "value"_key > 4 and "value"_key == 8) == 5);
+
+	// a secondary index provides statistics and candidates
+	cat1.create_index({ "kind" });
+	cat1.create_index({ "value" });
+
+	cif::condition c5 = "kind"_key == "x" and "value"_key == 8;
+	c5.prepare(cat1);
+	CHECK(c5.explain().starts_with("secondary index on value, 10 candidate rows"));
+	CHECK(cat1.count("kind"_key == "x" and "value"_key == 8) == 5);
+
+	CHECK(cat1.equality_selectivity(cat1.get_item_ix("id")) == 0.01);
+	CHECK(cat1.equality_selectivity(cat1.get_item_ix("kind")) == 0.5);
+	CHECK(cat1.equality_selectivity(cat1.get_item_ix("value")) == 0.1);
+
+	// OR tests the condition most likely to be true first
+	cif::condition c6 = "value"_key == 1 or "kind"_key == "y";
+	c6.prepare(cat1);
+	CHECK(c6.explain().starts_with("scan of 100 rows, test (kind  == y OR value == 1)"));
+	CHECK(cat1.count("value"_key == 1 or "kind"_key == "y") == 75);
+
+	cif::condition c7;
+	CHECK(c7.explain() == "no condition");
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("compiled_condition_1")
+{
+	using namespace cif::literals;
+
+	cif::category c("test");
+
+	// more rows than fit in a single batch
+	for (int i = 1; i <= 1000; ++i)
+	{
+		c.emplace({ { "id", i },
+			{ "name", i % 3 == 0 ? "aap" : i % 3 == 1 ? "Noot" : "a-long-name" },
+			{ "value", i % 7 == 0 ? "." : std::to_string(i % 10 - 5) },
+			{ "x", i % 11 == 0 ? "?" : std::to_string(i / 4.0) } });
+	}
+
+	auto expected = [&](auto &&pred)
+	{
+		std::size_t result = 0;
+		for (int i = 1; i <= 1000; ++i)
+		{
+			if (pred(i))
+				++result;
+		}
+		return result;
+	};
+
+	auto name = [](int i) -> std::string { return i % 3 == 0 ? "aap" : i % 3 == 1 ? "Noot" : "a-long-name"; };
+	auto has_value = [](int i) { return i % 7 != 0; };
+	auto value = [](int i) { return i % 10 - 5; };
+	auto has_x = [](int i) { return i % 11 != 0; };
+
+	auto check = [&](cif::condition &&cond, std::size_t n)
+	{
+		// the batched count must equal the number of rows found one by one
+		std::size_t found = 0;
+		for (auto r : c.find(std::move(cond)))
+			found += r ? 1 : 0;
+		CHECK(found == n);
+	};
+
+	CHECK(c.count("name"_key == "aap") == expected([&](int i) { return name(i) == "aap"; }));
+	check("name"_key == "aap", expected([&](int i) { return name(i) == "aap"; }));
+	CHECK(c.count("name"_key == "a-long-name") == expected([&](int i) { return name(i) == "a-long-name"; }));
+	CHECK(c.count("name"_key == cif::null) == 0);
+	CHECK(c.count("value"_key == cif::null) == expected([&](int i) { return not has_value(i); }));
+	CHECK(c.count("value"_key != cif::null) == expected(has_value));
+
+	// numbers, empty values compare as larger
+	CHECK(c.count("value"_key == 2) == expected([&](int i) { return has_value(i) and value(i) == 2; }));
+	CHECK(c.count("value"_key > 2) == expected([&](int i) { return not has_value(i) or value(i) > 2; }));
+	CHECK(c.count("value"_key <= -3) == expected([&](int i) { return has_value(i) and value(i) <= -3; }));
+	CHECK(c.count("value"_key >= 2.5) == expected([&](int i) { return not has_value(i) or value(i) >= 2.5; }));
+	CHECK(c.count("value"_key < 0.5f) == expected([&](int i) { return has_value(i) and value(i) < 0.5; }));
+
+	// a value that is not an integer does not compare with an int
+	CHECK(c.count("x"_key > 100) == 1000);
+	CHECK(c.count("x"_key <= 100) == 0);
+	CHECK(c.count("x"_key > 100.0) == expected([&](int i) { return not has_x(i) or i / 4.0 > 100; }));
+
+	// text comparisons
+	CHECK(c.count("name"_key < "b") == 1000);
+	CHECK(c.count("name"_key >= "a-m") == expected([&](int i) { return name(i) == "aap"; }));
+
+	// combinations
+	CHECK(c.count("name"_key == "aap" and "value"_key > 0) ==
+		  expected([&](int i) { return name(i) == "aap" and (not has_value(i) or value(i) > 0); }));
+	CHECK(c.count("name"_key == "aap" or "value"_key == 0 or "x"_key == cif::null) ==
+		  expected([&](int i) { return name(i) == "aap" or (has_value(i) and value(i) == 0) or not has_x(i); }));
+	CHECK(c.count(not("name"_key == "Noot") and ("value"_key == 1 or "value"_key == -1)) ==
+		  expected([&](int i) { return name(i) != "Noot" and has_value(i) and (value(i) == 1 or value(i) == -1); }));
+	check(not("name"_key == "Noot") and ("value"_key == 1 or "value"_key == -1),
+		  expected([&](int i) { return name(i) != "Noot" and has_value(i) and (value(i) == 1 or value(i) == -1); }));
+
+	// conditions that are called, not compiled
+	CHECK(c.count("name"_key == std::regex("a.*") and "value"_key == 3) ==
+		  expected([&](int i) { return name(i) != "Noot" and has_value(i) and value(i) == 3; }));
+	check("id"_key == 10 or "name"_key == std::regex("N.*"),
+		  expected([&](int i) { return i == 10 or name(i) == "Noot"; }));
+
+	CHECK(c.contains("value"_key == 4 and "name"_key == "Noot"));
+	CHECK_FALSE(c.contains("value"_key == 5));
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("parallel_find_1")
+{
+	using namespace cif::literals;
+
+	cif::category c("test");
+
+	for (int i = 1; i <= 20000; ++i)
+		c.emplace({ { "id", i }, { "group", i % 13 }, { "name", i % 2 ? "odd" : "even" } });
+
+	auto ids = [](auto &&rows)
+	{
+		std::vector<int> result;
+		for (auto r : rows)
+			result.push_back(r["id"].template as<int>());
+		return result;
+	};
+
+	for (std::size_t n_threads : { 0, 1, 3, 8 })
+	{
+		auto found = c.find_parallel("group"_key == 5 and "name"_key == "odd", n_threads);
+		CHECK(ids(found) == ids(c.find("group"_key == 5 and "name"_key == "odd")));
+
+		CHECK(c.count_parallel("group"_key == 5 or "name"_key == "even", n_threads) ==
+			  c.count("group"_key == 5 or "name"_key == "even"));
+
+		CHECK(c.contains_parallel("id"_key == 19999, n_threads));
+		CHECK_FALSE(c.contains_parallel("id"_key == 20001, n_threads));
+	}
+
+	CHECK(c.find_parallel(cif::condition{}).empty());
+	CHECK(c.count_parallel(cif::all()) == 20000);
+
+	// using a secondary index
+	c.create_index({ "group" });
+	CHECK(ids(c.find_parallel("group"_key == 7, 4)) == ids(c.find("group"_key == 7)));
+
+	CHECK(c.erase_parallel("group"_key == 0, 4) == 20000 / 13);
+	CHECK(c.size() == 20000 - 20000 / 13);
+	CHECK(c.count("group"_key == 0) == 0);
+	CHECK(c.count_parallel("group"_key == 1, 4) == c.count("group"_key == 1));
+
+	// Several threads using the same category, the directory and the
+	// secondary index are built by the first of them
+	c.create_index({ "name" });
+	c.emplace({ { "id", 20001 }, { "group", 1 }, { "name", "odd" } });
+
+	const auto &cc = c;
+	const auto expected = cc.count("group"_key == 1 and "name"_key == "odd");
+
+	std::vector<std::thread> threads;
+	std::atomic<std::size_t> failed = 0;
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&cc, &failed, expected]()
+			{
+				if (cc.count_parallel("group"_key == 1 and "name"_key == "odd", 2) != expected or
+					not cc.contains_parallel("name"_key == "odd" and "id"_key == 20001, 2) or
+					cc[cc.size() - 1]["id"].as<int>() != 20001)
+					++failed; });
+	}
+
+	for (auto &t : threads)
+		t.join();
+	CHECK(failed == 0);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("bulk_insert_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+    _item_type_list.detail
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+;              code item types/single words ...
+;
+               int       numb
+               '[+-]?[0-9]+'
+;              int item types are the subset of numbers that are the negative
+               or positive integers.
+;
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.name
+    _item.name                '_cat_1.name'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           code
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	using namespace cif::literals;
+
+	for (auto type : { cif::index_type::tree, cif::index_type::hash })
+	{
+		cif::datablock db("test");
+		db.set_validator(&validator);
+
+		auto &cat1 = db["cat_1"];
+		cat1.set_index_type(type);
+
+		cat1.emplace({ { "id", 0 }, { "name", "first" } });
+
+		// rows in random key order, the category keeps the insertion order
+		std::vector<int> ids(5000);
+		std::iota(ids.begin(), ids.end(), 1);
+		std::shuffle(ids.begin(), ids.end(), std::mt19937{ 42 });
+
+		std::vector<cif::row_initializer> rows;
+		for (int id : ids)
+			rows.push_back({ { "id", id }, { "name", "n" + std::to_string(id) } });
+
+		cat1.bulk_insert(rows, 4);
+
+		REQUIRE(cat1.size() == 5001);
+		CHECK(cat1[1]["id"].as<int>() == ids.front());
+		CHECK(cat1[5000]["id"].as<int>() == ids.back());
+
+		for (int id = 0; id <= 5000; ++id)
+			CHECK(cat1[{ { "id", id } }]["name"].as<std::string>() == (id == 0 ? "first" : "n" + std::to_string(id)));
+
+		// the index still works after erasing and inserting
+		for (int id = 1; id <= 5000; id += 3)
+			cat1.erase(cat1[{ { "id", id } }]);
+		for (int id = 1; id <= 5000; id += 6)
+			cat1.emplace({ { "id", id }, { "name", "again" } });
+
+		for (int id = 0; id <= 5000; ++id)
+		{
+			bool erased = id % 3 == 1 and id % 6 != 1;
+			CHECK(cat1[{ { "id", id } }].empty() == erased);
+		}
+
+		CHECK_THROWS_AS(cat1.emplace({ { "id", 2 }, { "name", "dup" } }), cif::duplicate_key_error);
+
+		// all errors are reported together and nothing is inserted
+		auto size = cat1.size();
+		try
+		{
+			cat1.bulk_insert(std::vector<cif::row_initializer>{
+				{ { "id", 6001 }, { "name", "ok" } },
+				{ { "id", "x" }, { "name", "bad-id" } },
+				{ { "id", 6002 } },
+				{ { "id", 2 }, { "name", "existing" } },
+				{ { "id", 6003 }, { "name", "twice" } },
+				{ { "id", 6003 }, { "name", "twice" } } });
+
+			FAIL("bulk_insert should have thrown");
+		}
+		catch (const cif::bulk_insert_error &ex)
+		{
+			CHECK(ex.errors().size() == 4);
+		}
+
+		CHECK(cat1.size() == size);
+		CHECK(cat1[{ { "id", 6001 } }].empty());
+
+		// a few rows in a large category
+		cat1.bulk_insert(std::vector<cif::row_initializer>{
+			{ { "id", 6002 }, { "name", "two" } },
+			{ { "id", 6001 }, { "name", "one" } } });
+
+		CHECK(cat1.size() == size + 2);
+		CHECK(cat1[{ { "id", 6001 } }]["name"].as<std::string>() == "one");
+		CHECK(cat1.back()["name"].as<std::string>() == "one");
+	}
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("copy_on_write_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+    _item_type_list.detail
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+;              code item types/single words ...
+;
+               int       numb
+               '[+-]?[0-9]+'
+;              int item types are the subset of numbers that are the negative
+               or positive integers.
+;
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.name
+    _item.name                '_cat_1.name'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+
+save_cat_2
+    _category.description     'Another simple test category'
+    _category.id              cat_2
+    _category.mandatory_code  no
+    _category_key.name        '_cat_2.id'
+    save_
+
+save__cat_2.id
+    _item.name                '_cat_2.id'
+    _item.category_id         cat_2
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_2.name
+    _item.name                '_cat_2.name'
+    _item.category_id         cat_2
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::datablock db("test");
+	db.set_validator(&validator);
+
+	auto &cat1 = db["cat_1"];
+	auto &cat2 = db["cat_2"];
+	for (int i = 1; i <= 100; ++i)
+	{
+		cat1.emplace({ { "id", i }, { "name", "a" + std::to_string(i) } });
+		cat2.emplace({ { "id", i }, { "name", "b" + std::to_string(i) } });
+	}
+
+	cat1.create_index({ "name" });
+
+	auto snapshot = db;
+	CHECK(snapshot == db);
+
+	// Modifying the original leaves the copy alone
+	auto r1 = cat1[{ { "id", 1 } }];
+	r1["name"] = "changed";
+	CHECK(cat1[{ { "id", 1 } }]["name"].as<std::string>() == "changed");
+	CHECK(std::as_const(snapshot)["cat_1"][{ { "id", 1 } }]["name"].as<std::string>() == "a1");
+	CHECK(snapshot["cat_2"] == cat2);
+	CHECK(snapshot["cat_1"] != cat1);
+
+	// Modifying the copy leaves the original alone
+	auto copy = db;
+	auto &copy2 = copy["cat_2"];
+	copy2.erase(cif::key("id") == 2);
+	copy2.emplace({ { "id", 101 }, { "name", "b101" } });
+
+	CHECK(copy2.size() == 100);
+	CHECK(cat2.size() == 100);
+	CHECK(cat2.contains(cif::key("id") == 2));
+	CHECK(not cat2.contains(cif::key("id") == 101));
+	CHECK(copy2.contains(cif::key("id") == 101));
+	CHECK_THROWS_AS(copy2.emplace({ { "id", 3 }, { "name", "dup" } }), cif::duplicate_key_error);
+
+	// The secondary index is recreated in the copies
+	cif::condition c = cif::key("name") == "a7";
+	c.prepare(copy["cat_1"]);
+	CHECK(c.explain().starts_with("secondary index on name"));
+	CHECK(copy["cat_1"].find1<int>(cif::key("name") == "a7", "id") == 7);
+
+	// Copies of copies, destroyed in any order
+	{
+		auto c1 = std::make_unique<cif::category>(cat1);
+		auto c2 = std::make_unique<cif::category>(*c1);
+		auto c3 = std::make_unique<cif::category>(*c2);
+
+		c1.reset();
+		CHECK(*c2 == *c3);
+
+		c3->front()["name"] = "c3";
+		CHECK(c2->front()["name"].as<std::string>() == "changed");
+		CHECK(c3->front()["name"].as<std::string>() == "c3");
+
+		auto c4 = std::move(*c2);
+		c2.reset();
+		CHECK(c4.size() == 100);
+		CHECK(c4[{ { "id", 50 } }]["name"].as<std::string>() == "a50");
+	}
+
+	cat1.clear();
+	CHECK(cat1.empty());
+	CHECK(snapshot["cat_1"].size() == 100);
+	CHECK(copy["cat_1"].size() == 100);
+	CHECK(snapshot["cat_1"][{ { "id", 1 } }]["name"].as<std::string>() == "a1");
+}
+
+TEST_CASE("copy_on_write_2")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+    _item_type_list.detail
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+;              code item types/single words ...
+;
+               int       numb
+               '[+-]?[0-9]+'
+;              int item types are the subset of numbers that are the negative
+               or positive integers.
+;
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_1.name
+    _item.name                '_cat_1.name'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::datablock db("test");
+	db.set_validator(&validator);
+
+	auto &cat1 = db["cat_1"];
+	for (int i = 1; i <= 100; ++i)
+		cat1.emplace({ { "id", i }, { "name", "a" + std::to_string(i) } });
+	cat1.create_index({ "name" });
+
+	// The address of a value identifies the row it is stored in
+	auto first_row = [](const cif::category &cat)
+	{
+		return static_cast<const void *>(cat.front()["id"].text().data());
+	};
+
+	// Reading the original does not clone its rows, the copy clones
+	// them when it is read for the first time
+	auto old_first = first_row(cat1);
+
+	const cif::category copy(cat1);
+	CHECK(copy.size() == 100);
+	CHECK(first_row(cat1) == old_first);
+	CHECK(first_row(copy) != old_first);
+
+	std::size_t n = 0;
+	for (auto r : copy)
+		n += r["id"].as<int>();
+	CHECK(n == 5050);
+	CHECK(copy.find1<int>(cif::key("name") == "a7", "id") == 7);
+	CHECK(copy.count_parallel(cif::key("id") > 50, 4) == 50);
+	CHECK(copy[{ { "id", 42 } }]["name"].as<std::string>() == "a42");
+	CHECK(std::as_const(cat1)[{ { "id", 43 } }]["name"].as<std::string>() == "a43");
+	CHECK(first_row(cat1) == old_first);
+
+	// Copies are made and read by several threads at the same time, as
+	// is a copy that did not clone its rows yet
+	const cif::category unread(cat1);
+
+	std::vector<std::thread> threads;
+	std::atomic<std::size_t> found = 0;
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&copy, &unread, &found]()
+			{
+				for (int i = 0; i < 10; ++i)
+				{
+					cif::category c(copy);
+					if (c.contains(cif::key("name") == "a" + std::to_string(i + 1)))
+						++found;
+					if (unread.contains(cif::key("id") == i + 1))
+						++found;
+				} });
+	}
+
+	for (auto &t : threads)
+		t.join();
+	CHECK(found == 80);
+
+	// Modifying the original keeps its rows, the copies get the old ones
+	const cif::category copy3(cat1);
+	for (auto r : cat1)
+		r["name"] = "b" + r["id"].as<std::string>();
+
+	CHECK(first_row(cat1) == old_first);
+	CHECK(copy.find1<std::string>(cif::key("id") == 7, "name") == "a7");
+	CHECK(copy3.find1<std::string>(cif::key("id") == 7, "name") == "a7");
+	CHECK(unread.find1<std::string>(cif::key("id") == 7, "name") == "a7");
+	CHECK(cat1.find1<std::string>(cif::key("id") == 7, "name") == "b7");
+	CHECK(not cat1.contains(cif::key("name") == "a7"));
+
+	// Clearing a copy keeps its secondary indices
+	cif::category copy2(cat1);
+	copy2.clear();
+	copy2.emplace({ { "id", 1 }, { "name", "c1" } });
+	cif::condition c = cif::key("name") == "c1";
+	c.prepare(copy2);
+	CHECK(c.explain().starts_with("secondary index on name"));
+	CHECK(cat1.size() == 100);
+
+	// Changes recorded by the journal are undone after the rows were cloned
+	db.begin_transaction();
+	cat1.erase(cif::key("id") == 1);
+	cat1[{ { "id", 2 } }]["name"] = "x2";
+
+	auto snapshot = db;
+
+	cat1[{ { "id", 3 } }]["name"] = "x3";
+	cat1.erase(cif::key("id") == 4);
+	CHECK(cat1.size() == 98);
+
+	db.rollback();
+
+	CHECK(cat1.size() == 100);
+	CHECK(cat1.find1<std::string>(cif::key("id") == 1, "name") == "b1");
+	CHECK(cat1.find1<std::string>(cif::key("id") == 2, "name") == "b2");
+	CHECK(cat1.find1<std::string>(cif::key("id") == 3, "name") == "b3");
+	CHECK(cat1.front()["id"].as<int>() == 1);
+
+	CHECK(snapshot["cat_1"].size() == 99);
+	CHECK(std::as_const(snapshot)["cat_1"].find1<std::string>(cif::key("id") == 2, "name") == "x2");
+	CHECK(std::as_const(snapshot)["cat_1"].find1<std::string>(cif::key("id") == 3, "name") == "b3");
+}
+
+TEST_CASE("copy_on_write_3")
+{
+	using namespace cif::literals;
+
+	cif::category cat("test");
+	for (int i = 1; i <= 4; ++i)
+		cat.emplace({ { "id", i }, { "v", "a" } });
+
+	// A row handle obtained before taking a snapshot keeps referring to the original
+	auto r = cat.front();
+	cif::category snap(cat);
+
+	r["v"] = "x";
+	r["v"] = "y";
+
+	CHECK(r["v"].as<std::string>() == "y");
+	CHECK(cat.front()["v"].as<std::string>() == "y");
+	CHECK(snap.front()["v"].as<std::string>() == "a");
+
+	// Writing to all rows found by find_parallel modifies the original only
+	cif::category snap2(cat);
+	for (auto rh : cat.find_parallel("v"_key != cif::null, 2))
+		rh["v"] = "z";
+
+	CHECK(cat.count("v"_key == "z") == 4);
+	CHECK(snap2.count("v"_key == "z") == 0);
+	CHECK(snap2.count("v"_key == "a") == 3);
+	CHECK(snap.count("v"_key == "a") == 4);
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("journal_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+
+               text      char
+               '[][ \n\t()_,.;:"&<>/\{}'`~!@#$%?+=*A-Za-z0-9|^-]*'
+
+               int       numb
+               '[+-]?[0-9]+'
+
+save_cat_1
+    _category.description     'A simple test category'
+    _category.id              cat_1
+    _category.mandatory_code  no
+    _category_key.name        '_cat_1.id'
+
+    save_
+
+save__cat_1.id
+    _item.name                '_cat_1.id'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_linked.child_name   '_cat_2.parent_id'
+    _item_linked.parent_name  '_cat_1.id'
+    _item_type.code           code
+    save_
+
+save__cat_1.name1
+    _item.name                '_cat_1.name1'
+    _item.category_id         cat_1
+    _item.mandatory_code      yes
+    _item_type.code           text
+    save_
+
+save__cat_1.name2
+    _item.name                '_cat_1.name2'
+    _item.category_id         cat_1
+    _item.mandatory_code      no
+    _item_linked.child_name   '_cat_2.name2'
+    _item_linked.parent_name  '_cat_1.name2'
+    _item_type.code           text
+    save_
+
+save_cat_2
+    _category.description     'A second simple test category'
+    _category.id              cat_2
+    _category.mandatory_code  no
+    _category_key.name        '_cat_2.id'
+    save_
+
+save__cat_2.id
+    _item.name                '_cat_2.id'
+    _item.category_id         cat_2
+    _item.mandatory_code      yes
+    _item_type.code           int
+    save_
+
+save__cat_2.parent_id
+    _item.name                '_cat_2.parent_id'
+    _item.category_id         cat_2
+    _item.mandatory_code      yes
+    _item_type.code           code
+    save_
+
+save__cat_2.name2
+    _item.name                '_cat_2.name2'
+    _item.category_id         cat_2
+    _item.mandatory_code      no
+    _item_type.code           text
+    save_
+
+save__cat_2.desc
+    _item.name                '_cat_2.desc'
+    _item.category_id         cat_2
+    _item.mandatory_code      yes
+    _item_type.code           text
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::file f;
+	f.set_validator(&validator);
+
+	// --------------------------------------------------------------------
+
+	const char data[] = R"(
+data_test
+loop_
+_cat_1.id
+_cat_1.name1
+_cat_1.name2
+1 Aap   aap
+2 Noot  noot
+3 Mies  mies
+
+loop_
+_cat_2.id
+_cat_2.parent_id
+_cat_2.name2
+_cat_2.desc
+1 1 aap   'Een dier'
+2 1 .     'Een andere aap'
+3 2 noot  'walnoot bijvoorbeeld'
+4 2 n2     hazelnoot
+    )";
+
+	struct data_membuf : public std::streambuf
+	{
+		data_membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} data_buffer(const_cast<char *>(data), sizeof(data) - 1);
+
+	std::istream is_data(&data_buffer);
+	f.load(is_data);
+
+	auto &db = f.front();
+	auto &cat1 = db["cat_1"];
+	auto &cat2 = db["cat_2"];
+
+	auto ids = [](const cif::category &cat)
+	{
+		std::vector<std::string> result;
+		for (auto id : cat.rows<std::string>("id"))
+			result.push_back(id);
+		return result;
+	};
+
+	const auto before = db;
+
+	CHECK_THROWS_AS(db.commit(), std::logic_error);
+	CHECK_THROWS_AS(db.rollback(), std::logic_error);
+
+	auto noot = cat1[{ { "id", "2" } }];
+	REQUIRE(not noot.empty());
+
+	db.begin_transaction();
+	CHECK(db.in_transaction());
+
+	// a rename in the parent is propagated to the children
+	cat1[{ { "id", "1" } }]["id"] = "10";
+	CHECK(cat2.find(cif::key("parent_id") == "10").size() == 2);
+
+	// erasing a parent erases its orphaned children
+	cat1.erase(cif::key("id") == "2");
+	CHECK(cat2.size() == 3);
+
+	cat1.emplace({ { "id", "4" }, { "name1", "Wim" } });
+	cat2.emplace({ { "id", 5 }, { "parent_id", "4" }, { "desc", "Wim's" } });
+	cat2.sort([](cif::row_handle a, cif::row_handle b)
+		{ return b["id"].compare(a["id"].as<int>()); });
+	CHECK(ids(cat2) == std::vector<std::string>{ "5", "4", "2", "1" });
+
+	db["cat_3"].emplace({ { "x", "y" } });
+
+	CHECK(db != before);
+
+	db.rollback();
+	CHECK(not db.in_transaction());
+
+	CHECK(db == before);
+	CHECK(db.get("cat_3") == nullptr);
+	CHECK(ids(cat1) == std::vector<std::string>{ "1", "2", "3" });
+	CHECK(ids(cat2) == std::vector<std::string>{ "1", "2", "3", "4" });
+	CHECK(cat2.find(cif::key("parent_id") == "1").size() == 2);
+
+	// the index is restored and the erased row is back
+	CHECK(cat1[{ { "id", "10" } }].empty());
+	CHECK(cat1[{ { "id", "2" } }] == noot);
+	CHECK(noot["name1"].as<std::string>() == "Noot");
+	CHECK_THROWS_AS(cat1.emplace({ { "id", "2" }, { "name1", "dup" } }), cif::duplicate_key_error);
+
+	// clear and nested transactions
+	db.begin_transaction();
+	cat2.erase(cif::key("id") == 4);
+
+	db.begin_transaction();
+	cat2.clear();
+	cat1.clear();
+	CHECK(cat1.empty());
+	db.rollback();
+
+	CHECK(ids(cat1) == std::vector<std::string>{ "1", "2", "3" });
+	CHECK(ids(cat2) == std::vector<std::string>{ "1", "2", "3" });
+	CHECK(db.in_transaction());
+
+	db.begin_transaction();
+	cat1[{ { "id", "3" } }]["name1"] = "Teun";
+	db.commit();
+
+	db.commit();
+	CHECK(not db.in_transaction());
+
+	CHECK(ids(cat2) == std::vector<std::string>{ "1", "2", "3" });
+	CHECK(cat1[{ { "id", "3" } }]["name1"].as<std::string>() == "Teun");
+	CHECK(before["cat_1"][{ { "id", "3" } }]["name1"].as<std::string>() == "Mies");
+
+	// a datablock destroyed in a transaction releases the erased rows
+	{
+		auto copy = db;
+		copy.begin_transaction();
+		copy["cat_2"].erase(cif::key("id") == 1);
+		CHECK(copy["cat_2"].size() == 2);
+	}
+}
+
+// --------------------------------------------------------------------
+
+TEST_CASE("erase_tail_cascade_1")
+{
+	const char dict[] = R"(
+data_test_dict.dic
+    _datablock.id	test_dict.dic
+    _datablock.description
+;
+    A test dictionary
+;
+    _dictionary.title           test_dict.dic
+    _dictionary.datablock_id    test_dict.dic
+    _dictionary.version         1.0
+
+     loop_
+    _item_type_list.code
+    _item_type_list.primitive_code
+    _item_type_list.construct
+               code      char
+               '[][_,.;:"&<>()/\{}'`~!@#$%A-Za-z0-9*|+-]*'
+
+save_node
+    _category.description     'A self linked category'
+    _category.id              node
+    _category.mandatory_code  no
+    _category_key.name        '_node.id'
+    save_
+
+save__node.id
+    _item.name                '_node.id'
+    _item.category_id         node
+    _item.mandatory_code      yes
+    _item_linked.child_name   '_node.parent_id'
+    _item_linked.parent_name  '_node.id'
+    _item_type.code           code
+    save_
+
+save__node.parent_id
+    _item.name                '_node.parent_id'
+    _item.category_id         node
+    _item.mandatory_code      no
+    _item_type.code           code
+    save_
+    )";
+
+	struct membuf : public std::streambuf
+	{
+		membuf(char *text, std::size_t length)
+		{
+			this->setg(text, text, text + length);
+		}
+	} buffer(const_cast<char *>(dict), sizeof(dict) - 1);
+
+	std::istream is_dict(&buffer);
+
+	auto validator = cif::parse_dictionary("test", is_dict);
+
+	cif::datablock db("test");
+	db.set_validator(&validator);
+
+	auto &node = db["node"];
+	node.emplace({ { "id", "3" } });
+	node.emplace({ { "id", "2" }, { "parent_id", "1" } });
+	node.emplace({ { "id", "1" } });
+
+	// erasing the last row erases its child, the row before it
+	auto last = node.begin();
+	std::advance(last, 2);
+	node.erase(last);
+	REQUIRE(node.size() == 1);
+
+	node.emplace({ { "id", "4" } });
+	REQUIRE(node.size() == 2);
+
+	std::vector<std::string> ids;
+	for (auto id : node.rows<std::string>("id"))
+		ids.push_back(id);
+
+	CHECK(ids == std::vector<std::string>{ "3", "4" });
+	CHECK(node.back()["id"].as<std::string>() == "4");
+}